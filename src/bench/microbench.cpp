@@ -0,0 +1,711 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   @file
+
+   Microbenchmarks of the server's hot primitives: PDU (un)marshalling, the
+   transfer table, the layout of transfer state, the poller, and the file I/O
+   functions.
+
+   Uses Google Benchmark; pass @c --benchmark_format=json (or
+   @c --benchmark_out=<file> @c --benchmark_out_format=json) for
+   machine-readable results.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../impl/test_utils.hpp"
+
+#include "../responses.h"
+#include "../impl/file_io.h"
+#include "../impl/protocol_client.h"
+#include "../impl/protocol_server.h"
+#include "../impl/server_resources.h"
+#include "../impl/server_xfer_table.h"
+#include "../impl/syspoll.h"
+#include "../impl/util.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wglobal-constructors"
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#pragma GCC diagnostic ignored "-Wpadded"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+
+namespace {
+
+// ------------------- Protocol -----------------
+
+/** A file name of the specified length */
+std::string make_filename(const long len)
+{
+    std::string s(static_cast<std::size_t>(len), 'x');
+    s[0] = '/';
+    return s;
+}
+
+void BM_prot_marshal_send(benchmark::State& state)
+{
+    const std::string fname {make_filename(state.range(0))};
+    std::vector<std::uint8_t> buf(PROT_REQ_MAXSIZE);
+    auto* const req = reinterpret_cast<prot_request*>(buf.data());
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(prot_marshal_send(req, fname.c_str(), 0, 0));
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_prot_marshal_send)->Arg(16)->Arg(64)->Arg(256)
+    ->Arg(PROT_FILENAME_MAX);
+
+void BM_prot_unmarshal_request(benchmark::State& state)
+{
+    const std::string fname {make_filename(state.range(0))};
+    std::vector<std::uint8_t> buf(PROT_REQ_MAXSIZE);
+    auto* const req = reinterpret_cast<prot_request*>(buf.data());
+
+    if (!prot_marshal_send(req, fname.c_str(), 0, 0)) {
+        state.SkipWithError("Couldn't marshal request");
+        return;
+    }
+
+    const std::size_t size {PROT_REQ_BASE_SIZE + fname.size() + 1};
+    prot_request pdu;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(prot_unmarshal_request(&pdu, buf.data(), size));
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_prot_unmarshal_request)->Arg(16)->Arg(64)->Arg(256)
+    ->Arg(PROT_FILENAME_MAX);
+
+void BM_prot_marshal_send_open(benchmark::State& state)
+{
+    prot_send_open pdu;
+    std::size_t txnid {};
+
+    for (auto _ : state) {
+        prot_marshal_send_open(&pdu, txnid++);
+        benchmark::DoNotOptimize(pdu);
+    }
+}
+BENCHMARK(BM_prot_marshal_send_open);
+
+void BM_prot_unmarshal_send_open(benchmark::State& state)
+{
+    prot_send_open in;
+    prot_marshal_send_open(&in, 12345);
+
+    prot_send_open pdu;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(prot_unmarshal_send_open(&pdu, &in));
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_prot_unmarshal_send_open);
+
+void BM_prot_marshal_file_info(benchmark::State& state)
+{
+    sfd_file_info pdu;
+    std::size_t txnid {};
+
+    for (auto _ : state) {
+        prot_marshal_file_info(&pdu, 4096, 1, 2, 3, txnid++);
+        benchmark::DoNotOptimize(pdu);
+    }
+}
+BENCHMARK(BM_prot_marshal_file_info);
+
+void BM_sfd_unmarshal_file_info(benchmark::State& state)
+{
+    sfd_file_info in;
+    prot_marshal_file_info(&in, 4096, 1, 2, 3, 4);
+
+    sfd_file_info pdu;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sfd_unmarshal_file_info(&pdu, &in));
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_sfd_unmarshal_file_info);
+
+void BM_prot_marshal_xfer_stat(benchmark::State& state)
+{
+    sfd_xfer_stat pdu;
+    std::size_t n {};
+
+    for (auto _ : state) {
+        prot_marshal_xfer_stat(&pdu, n++);
+        benchmark::DoNotOptimize(pdu);
+    }
+}
+BENCHMARK(BM_prot_marshal_xfer_stat);
+
+void BM_sfd_unmarshal_xfer_stat(benchmark::State& state)
+{
+    sfd_xfer_stat in;
+    prot_marshal_xfer_stat(&in, 65536);
+
+    sfd_xfer_stat pdu;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sfd_unmarshal_xfer_stat(&pdu, &in));
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_sfd_unmarshal_xfer_stat);
+
+// ------------------- Transfer table -----------------
+
+constexpr std::size_t table_size {4096};
+
+std::size_t hash_elem(void* p)
+{
+    return *static_cast<std::size_t*>(p);
+}
+
+/**
+   A transfer table filled to the percentage given by the benchmark's first
+   argument, and the (heap-allocated) keys of its elements.
+*/
+struct filled_table {
+    explicit filled_table(const benchmark::State& state) :
+        keys(table_size) {
+
+        if (!xfer_table_construct(&tbl, hash_elem, table_size))
+            throw std::runtime_error("Couldn't construct table");
+
+        for (std::size_t i = 0; i < table_size; i++)
+            keys[i] = i;
+
+        nfilled = table_size * static_cast<std::size_t>(state.range(0)) / 100;
+
+        for (std::size_t i = 0; i < nfilled; i++)
+            xfer_table_insert(&tbl, &keys[i]);
+    }
+
+    ~filled_table() {
+        xfer_table_destruct(&tbl, nullptr);
+    }
+
+    filled_table(const filled_table&) = delete;
+    filled_table& operator=(const filled_table&) = delete;
+
+    xfer_table tbl;
+    std::vector<std::size_t> keys;
+    std::size_t nfilled;
+};
+
+void fill_levels(benchmark::internal::Benchmark* b)
+{
+    for (const int pct : {0, 25, 50, 90, 99})
+        b->Arg(pct);
+}
+
+/** Finds each present element in turn (or misses, in an empty table) */
+void BM_xfer_table_find(benchmark::State& state)
+{
+    filled_table t {state};
+    std::size_t i {};
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(xfer_table_find(&t.tbl, i));
+        if (++i >= std::max<std::size_t>(t.nfilled, 1))
+            i = 0;
+    }
+}
+BENCHMARK(BM_xfer_table_find)->Apply(fill_levels);
+
+/** Inserts an element into a free slot and erases it again */
+void BM_xfer_table_insert_erase(benchmark::State& state)
+{
+    filled_table t {state};
+    std::size_t i {t.nfilled};
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(xfer_table_insert(&t.tbl, &t.keys[i]));
+        xfer_table_erase(&t.tbl, t.keys[i]);
+        if (++i == table_size)
+            i = t.nfilled;
+    }
+}
+BENCHMARK(BM_xfer_table_insert_erase)->Apply(fill_levels);
+
+// ------------------- Transfer state layout -----------------
+
+/**
+   Counts the calling thread's (last-level) cache misses, where the system
+   permits it (Linux perf events); valid() is false otherwise.
+*/
+class cache_miss_counter final {
+public:
+    cache_miss_counter() {
+#ifdef __linux__
+        perf_event_attr attr {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fd.reset(static_cast<int>(syscall(SYS_perf_event_open,
+                                          &attr, 0, -1, -1, 0)));
+#endif
+    }
+
+    bool valid() const {
+        return (fd != -1);
+    }
+
+    void start() {
+#ifdef __linux__
+        if (valid()) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    std::uint64_t stop() {
+        std::uint64_t count {};
+#ifdef __linux__
+        if (valid()) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count))
+                count = 0;
+        }
+#endif
+        return count;
+    }
+
+private:
+    test::unique_fd fd;
+};
+
+/** The number of concurrent transfers */
+constexpr std::size_t nxfers {100000};
+
+/**
+   The layout of transfer state before it was split into hot and cold parts:
+   every field in one structure, and one heap allocation per transfer.
+*/
+struct unsplit_xfer {
+    int dest_fd;
+    int tag;
+    int stat_fd;
+    prot_cmd_req cmd;
+    std::size_t txnid;
+    resrc_xfer_file file;
+    fio_ctx* ctx;
+    std::size_t nbytes_left;
+    std::uint64_t start_us;
+    std::uint64_t ttfb_us;
+    std::uint64_t queue_us;
+    std::uint64_t window_us;
+    std::size_t window_nbytes_left;
+    std::uint32_t nwrites;
+    std::uint32_t nstalls;
+    std::uint32_t ndeferrals;
+    unsigned flags;
+    pid_t client_pid;
+    deferral defer;
+};
+
+/**
+   What processing an I/O event reads and writes of a transfer's state
+   (process_events() and transfer_file()), minus the I/O itself.
+*/
+template<typename Xfer>
+std::size_t process_event(Xfer* const x, fio_ctx* const ctx)
+{
+    if (x->tag != XFER_RESRC_TAG || x->defer == CANCEL)
+        return 0;
+
+    x->nwrites++;
+
+    return (std::min<std::size_t>(x->file.blksize, x->nbytes_left) +
+            static_cast<std::size_t>(x->file.fd + x->dest_fd + x->stat_fd) +
+            static_cast<std::size_t>(x->cmd) +
+            (ctx ? 1 : 0));
+}
+
+/** The transfers' event order: random, as with many busy clients */
+std::vector<std::uint32_t> event_order()
+{
+    std::vector<std::uint32_t> order(nxfers);
+    for (std::size_t i = 0; i < nxfers; i++)
+        order[i] = static_cast<std::uint32_t>(i);
+
+    std::shuffle(order.begin(), order.end(), std::mt19937 {42});
+
+    return order;
+}
+
+template<typename Xfer, typename GetCtx>
+void process_events(benchmark::State& state,
+                    const std::vector<Xfer*>& xfers,
+                    GetCtx get_ctx)
+{
+    const std::vector<std::uint32_t> order {event_order()};
+    cache_miss_counter misses;
+    std::size_t i {};
+    std::uint64_t nmisses {};
+
+    for (auto _ : state) {
+        // Misses are counted in batches (a whole pass over the transfers) to
+        // keep the cost of reading the counter out of the measurement
+        if (i == 0)
+            misses.start();
+
+        Xfer* const x {xfers[order[i]]};
+        benchmark::DoNotOptimize(process_event(x, get_ctx(x)));
+
+        if (++i == nxfers) {
+            nmisses += misses.stop();
+            i = 0;
+        }
+    }
+
+    if (i != 0)
+        nmisses += misses.stop();
+
+    if (misses.valid()) {
+        state.counters["cache_misses_per_event"] =
+            static_cast<double>(nmisses) /
+            static_cast<double>(state.iterations());
+    }
+}
+
+/** Per-event accesses with the old, unsplit layout (the baseline) */
+void BM_xfer_events_unsplit(benchmark::State& state)
+{
+    std::vector<std::unique_ptr<unsplit_xfer>> storage(nxfers);
+    std::vector<unsplit_xfer*> xfers(nxfers);
+
+    for (std::size_t i = 0; i < nxfers; i++) {
+        storage[i].reset(new unsplit_xfer {});
+        storage[i]->tag = XFER_RESRC_TAG;
+        storage[i]->cmd = PROT_CMD_SEND;
+        storage[i]->file.blksize = 4096;
+        storage[i]->nbytes_left = 1 << 20;
+        storage[i]->defer = NONE;
+        xfers[i] = storage[i].get();
+    }
+
+    process_events(state, xfers, [](unsplit_xfer* x) { return x->ctx; });
+}
+BENCHMARK(BM_xfer_events_unsplit);
+
+/** Per-event accesses with the split layout of struct xfer_pool */
+void BM_xfer_events_pool(benchmark::State& state)
+{
+    xfer_pool* const pool {xfer_pool_new(nxfers)};
+    if (!pool) {
+        state.SkipWithError("Couldn't create pool");
+        return;
+    }
+
+    const resrc_xfer_file file {1 << 20, -1, 4096};
+    std::vector<resrc_xfer*> xfers(nxfers);
+
+    for (std::size_t i = 0; i < nxfers; i++) {
+        xfers[i] = xfer_new(pool, PROT_CMD_SEND, &file, file.size,
+                            0, -1, -1, i + 1);
+        if (!xfers[i]) {
+            state.SkipWithError("Couldn't add transfer");
+            return;
+        }
+    }
+
+    process_events(state, xfers, [](resrc_xfer* x) { return x->fio_ctx; });
+
+    for (resrc_xfer* const x : xfers)
+        xfer_delete(x);
+
+    xfer_pool_delete(pool);
+}
+BENCHMARK(BM_xfer_events_pool);
+
+// ------------------- Poller -----------------
+
+/**
+   N pipes whose read ends are registered with a poller.
+*/
+struct polled_pipes {
+    explicit polled_pipes(const std::size_t n) :
+        poller(syspoll_new(static_cast<int>(n) + 1)),
+        pipes(n), resrcs(n) {
+
+        if (!poller)
+            throw std::runtime_error("Couldn't create poller");
+
+        for (std::size_t i = 0; i < n; i++) {
+            int fds[2];
+            if (sfd_pipe(fds, O_NONBLOCK) == -1)
+                throw std::runtime_error("Couldn't create pipe");
+
+            pipes[i].first.reset(fds[0]);
+            pipes[i].second.reset(fds[1]);
+            resrcs[i].ident = fds[0];
+        }
+    }
+
+    ~polled_pipes() {
+        syspoll_delete(poller);
+    }
+
+    polled_pipes(const polled_pipes&) = delete;
+    polled_pipes& operator=(const polled_pipes&) = delete;
+
+    /** Makes every pipe readable, generating a new (edge-triggered) event */
+    void make_ready() {
+        const std::uint8_t byte {};
+        std::uint8_t buf[16];
+
+        for (auto& p : pipes) {
+            while (read(p.first, buf, sizeof(buf)) > 0) {}
+            if (write(p.second, &byte, 1) != 1)
+                throw std::runtime_error("Couldn't write to pipe");
+        }
+    }
+
+    syspoll* const poller;
+    std::vector<std::pair<test::unique_fd, test::unique_fd>> pipes;
+    std::vector<syspoll_resrc> resrcs;
+};
+
+void BM_syspoll_register_deregister(benchmark::State& state)
+{
+    polled_pipes p {1};
+
+    for (auto _ : state) {
+        syspoll_register(p.poller, &p.resrcs[0], SYSPOLL_READ);
+        syspoll_deregister(p.poller, p.resrcs[0].ident);
+    }
+}
+BENCHMARK(BM_syspoll_register_deregister);
+
+/**
+   Retrieves N ready events. Making the descriptors ready again is excluded
+   from the measurement.
+*/
+void BM_syspoll_wait(benchmark::State& state)
+{
+    const std::size_t n {static_cast<std::size_t>(state.range(0))};
+    polled_pipes p {n};
+
+    for (auto& r : p.resrcs) {
+        if (!syspoll_register(p.poller, &r, SYSPOLL_READ)) {
+            state.SkipWithError("Couldn't register descriptor");
+            return;
+        }
+    }
+
+    std::int64_t nevents_total {};
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        p.make_ready();
+        state.ResumeTiming();
+
+        const int nevents {syspoll_wait(p.poller)};
+        for (int i = 0; i < nevents; i++)
+            benchmark::DoNotOptimize(syspoll_get(p.poller, i));
+
+        nevents_total += nevents;
+    }
+
+    state.SetItemsProcessed(nevents_total);
+}
+BENCHMARK(BM_syspoll_wait)->RangeMultiplier(4)->Range(1, 1024);
+
+// ------------------- File I/O -----------------
+
+constexpr std::size_t file_size {16 * 1024 * 1024};
+
+/**
+   A (page-cached) file from which chunks are transferred, rewinding whenever
+   less than a chunk remains.
+*/
+struct source_file {
+    source_file() {
+        std::vector<std::uint8_t> block(1024 * 1024, 0xAA);
+
+        for (std::size_t n = 0; n < file_size; n += block.size()) {
+            if (write(tmp, block.data(), block.size()) !=
+                static_cast<ssize_t>(block.size())) {
+                throw std::runtime_error("Couldn't write file");
+            }
+        }
+
+        fd = open(tmp.name().c_str(), O_RDONLY);
+        if (!fd)
+            throw std::runtime_error("Couldn't open file");
+
+        // Warm the page cache
+        while (read(fd, block.data(), block.size()) > 0) {}
+    }
+
+    void rewind_if_needed(const std::size_t chunk) {
+        const off_t off {file_offset(fd)};
+        if (static_cast<std::size_t>(off) + chunk > file_size)
+            lseek(fd, 0, SEEK_SET);
+    }
+
+    test::TmpFile tmp;
+    test::unique_fd fd;
+};
+
+void chunk_sizes(benchmark::internal::Benchmark* b)
+{
+    b->RangeMultiplier(2)->Range(4 * 1024, 1024 * 1024);
+}
+
+/**
+   Splices chunks from a file into a pipe (as for a Read File transfer). The
+   pipe is drained into /dev/null within the timed region.
+*/
+void BM_file_splice(benchmark::State& state)
+{
+    const std::size_t chunk {static_cast<std::size_t>(state.range(0))};
+
+    source_file src;
+    test::unique_fd devnull {open("/dev/null", O_WRONLY)};
+
+    int fds[2];
+    if (sfd_pipe(fds, O_NONBLOCK) == -1) {
+        state.SkipWithError("Couldn't create pipe");
+        return;
+    }
+    test::unique_fd pipe_read {fds[0]};
+    test::unique_fd pipe_write {fds[1]};
+
+#ifdef F_SETPIPE_SZ
+    fcntl(pipe_write, F_SETPIPE_SZ, static_cast<int>(chunk));
+#endif
+
+    std::int64_t nbytes {};
+    std::uint8_t buf[64 * 1024];
+
+    for (auto _ : state) {
+        src.rewind_if_needed(chunk);
+
+        const ssize_t n {file_splice(src.fd, pipe_write, nullptr, chunk)};
+        if (n <= 0) {
+            state.SkipWithError("file_splice() failed");
+            break;
+        }
+        nbytes += n;
+
+        while (read(pipe_read, buf, sizeof(buf)) > 0) {}
+    }
+
+    state.SetBytesProcessed(nbytes);
+}
+BENCHMARK(BM_file_splice)->Apply(chunk_sizes);
+
+/**
+   Sends chunks from a file to /dev/null (Linux) or a socket pair (elsewhere;
+   drained within the timed region).
+*/
+void BM_file_sendfile(benchmark::State& state)
+{
+    const std::size_t chunk {static_cast<std::size_t>(state.range(0))};
+
+    source_file src;
+
+#ifdef __linux__
+    test::unique_fd dest {open("/dev/null", O_WRONLY)};
+    test::unique_fd drain_fd;
+#else
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        state.SkipWithError("Couldn't create socket pair");
+        return;
+    }
+    test::unique_fd dest {fds[0]};
+    test::unique_fd drain_fd {fds[1]};
+    set_nonblock(drain_fd, true);
+#endif
+
+    struct fio_ctx* const ctx {fio_ctx_new(chunk)};
+    if (!fio_ctx_valid(ctx)) {
+        state.SkipWithError("Couldn't create file I/O context");
+        return;
+    }
+
+    std::int64_t nbytes {};
+    std::vector<std::uint8_t> buf(chunk);
+
+    for (auto _ : state) {
+        src.rewind_if_needed(chunk);
+
+        const ssize_t n {file_sendfile(src.fd, dest, ctx, nullptr, chunk)};
+        if (n <= 0) {
+            state.SkipWithError("file_sendfile() failed");
+            break;
+        }
+        nbytes += n;
+
+        if (drain_fd) {
+            while (read(drain_fd, buf.data(), buf.size()) > 0) {}
+        }
+    }
+
+    state.SetBytesProcessed(nbytes);
+
+    fio_ctx_delete(ctx);
+}
+BENCHMARK(BM_file_sendfile)->Apply(chunk_sizes);
+
+} // namespace
+
+#pragma GCC diagnostic pop
+
+BENCHMARK_MAIN();
@@ -0,0 +1,873 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   @file
+
+   End-to-end load generator for the server.
+
+   Creates a corpus of files, then drives a server instance with Send File, Read
+   File or Open/Send Open File requests from a number of concurrent client
+   threads, each of which writes to its own data sink (a socket pair, a pipe or
+   /dev/null). Reports throughput, time-to-first-byte and completion latency
+   percentiles, and CPU time per GB transferred.
+
+   The same workload is then replayed with in-process sendfile(2) calls (no
+   server) in order to quantify the overhead of the request/response IPC.
+*/
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sfd_config.h>
+
+#include "../impl/test_utils.hpp"
+
+#include "../sendfiled.h"
+#include "../impl/server.h"
+#include "../impl/unix_socket_server.h"
+#include "../impl/util.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+enum class op_type { send, read, open };
+
+enum class sink_type { socketpair, pipe, devnull };
+
+struct options {
+    op_type op {op_type::send};
+    sink_type sink {sink_type::socketpair};
+    int nfiles {100};
+    std::size_t min_size {4096};
+    std::size_t max_size {1024 * 1024};
+    int concurrency {8};
+    long nrequests {10000};
+    int maxfiles {1024};
+    bool in_thread {false};
+    bool baseline {true};
+    bool keep_corpus {false};
+    std::string corpus_dir {};
+    unsigned seed {1};
+};
+
+/** A file in the corpus */
+struct corpus_file {
+    std::string name;
+    std::size_t size;
+};
+
+/** Per-request measurements, in nanoseconds */
+struct sample {
+    std::int64_t ttfb;
+    std::int64_t total;
+};
+
+struct results {
+    std::vector<sample> samples {};
+    std::uint64_t nbytes {};
+    long nerrors {};
+    double wall_secs {};
+    double cpu_secs {};
+};
+
+const char* const srvname {"sfd_bench"};
+
+// ------------------- Utilities -----------------
+
+[[noreturn]]
+void die(const std::string& msg)
+{
+    std::fprintf(stderr, "sfd_bench: %s [errno %d %s]\n",
+                 msg.c_str(), errno, std::strerror(errno));
+    std::exit(EXIT_FAILURE);
+}
+
+std::int64_t ns_since(const bench_clock::time_point t0)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        bench_clock::now() - t0).count();
+}
+
+double cpu_secs_self()
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+        return 0;
+
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+        (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+   Returns the CPU time (user + system) consumed so far by another process, or
+   zero if it cannot be determined (non-Linux systems).
+*/
+double cpu_secs_proc(const pid_t pid)
+{
+    std::ifstream f {"/proc/" + std::to_string(pid) + "/stat"};
+    if (!f)
+        return 0;
+
+    std::string line;
+    std::getline(f, line);
+
+    // The command name (field 2) may contain spaces, so skip past it
+    const auto rparen = line.rfind(')');
+    if (rparen == std::string::npos)
+        return 0;
+
+    unsigned long utime {}, stime {};
+    const int n {std::sscanf(line.c_str() + rparen + 2,
+                             "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u"
+                             " %lu %lu",
+                             &utime, &stime)};
+    if (n != 2)
+        return 0;
+
+    return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+std::size_t parse_size(const char* s)
+{
+    char* end {};
+    const double v {std::strtod(s, &end)};
+
+    switch (*end) {
+    case 'k': case 'K': return (std::size_t)(v * 1024);
+    case 'm': case 'M': return (std::size_t)(v * 1024 * 1024);
+    case 'g': case 'G': return (std::size_t)(v * 1024 * 1024 * 1024);
+    default: return (std::size_t)v;
+    }
+}
+
+void print_usage()
+{
+    std::printf(
+        "Usage: sfd_bench [OPTION]...\n"
+        "\nOptions:\n"
+        "-o <send|read|open> (operation; default: send)\n"
+        "-k <socketpair|pipe|null> (data sink; default: socketpair)\n"
+        "-f <nfiles> (number of files in the corpus; default: 100)\n"
+        "-s <min>[:<max>] (file size range, log-uniformly distributed;"
+        " K/M/G suffixes; default: 4K:1M)\n"
+        "-c <concurrency> (client threads; default: 8)\n"
+        "-n <nrequests> (total requests; default: 10000)\n"
+        "-m <maxfiles> (server's concurrent transfer limit; default: 1024)\n"
+        "-D <dir> (corpus directory; default: a new temporary directory)\n"
+        "-r <seed> (random seed; default: 1)\n"
+        "[-T] (run the server in a thread of this process instead of"
+        " spawning it)\n"
+        "[-B] (skip the in-process sendfile baseline)\n"
+        "[-K] (keep the corpus)\n");
+}
+
+options parse_options(const int argc, char** argv)
+{
+    options opts;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:k:f:s:c:n:m:D:r:TBKh")) != -1) {
+        switch (opt) {
+        case 'o':
+            if (std::strcmp(optarg, "send") == 0)
+                opts.op = op_type::send;
+            else if (std::strcmp(optarg, "read") == 0)
+                opts.op = op_type::read;
+            else if (std::strcmp(optarg, "open") == 0)
+                opts.op = op_type::open;
+            else
+                die("Invalid operation");
+            break;
+
+        case 'k':
+            if (std::strcmp(optarg, "socketpair") == 0)
+                opts.sink = sink_type::socketpair;
+            else if (std::strcmp(optarg, "pipe") == 0)
+                opts.sink = sink_type::pipe;
+            else if (std::strcmp(optarg, "null") == 0)
+                opts.sink = sink_type::devnull;
+            else
+                die("Invalid sink type");
+            break;
+
+        case 'f': opts.nfiles = std::atoi(optarg); break;
+
+        case 's': {
+            opts.min_size = parse_size(optarg);
+            const char* const colon {std::strchr(optarg, ':')};
+            opts.max_size = (colon ? parse_size(colon + 1) : opts.min_size);
+        } break;
+
+        case 'c': opts.concurrency = std::atoi(optarg); break;
+        case 'n': opts.nrequests = std::atol(optarg); break;
+        case 'm': opts.maxfiles = std::atoi(optarg); break;
+        case 'D': opts.corpus_dir = optarg; break;
+        case 'r': opts.seed = (unsigned)std::atoi(optarg); break;
+        case 'T': opts.in_thread = true; break;
+        case 'B': opts.baseline = false; break;
+        case 'K': opts.keep_corpus = true; break;
+
+        default:
+            print_usage();
+            std::exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (opts.nfiles < 1 || opts.concurrency < 1 || opts.nrequests < 1 ||
+        opts.maxfiles < 1 || opts.min_size == 0 ||
+        opts.max_size < opts.min_size) {
+        print_usage();
+        std::exit(EXIT_FAILURE);
+    }
+
+    return opts;
+}
+
+// ------------------- Corpus -----------------
+
+std::vector<corpus_file> make_corpus(options& opts)
+{
+    if (opts.corpus_dir.empty()) {
+        char tmpl[] {"/tmp/sfd_bench_XXXXXX"};
+        if (!mkdtemp(tmpl))
+            die("Couldn't create corpus directory");
+        opts.corpus_dir = tmpl;
+    } else if (mkdir(opts.corpus_dir.c_str(), S_IRWXU) == -1 &&
+               errno != EEXIST) {
+        die("Couldn't create corpus directory");
+    }
+
+    std::mt19937 rng {opts.seed};
+    std::uniform_real_distribution<double> dist {
+        std::log((double)opts.min_size), std::log((double)opts.max_size)};
+
+    std::vector<std::uint8_t> block(64 * 1024);
+    std::iota(block.begin(), block.end(), 0);
+
+    std::vector<corpus_file> files;
+
+    for (int i = 0; i < opts.nfiles; i++) {
+        const corpus_file f {opts.corpus_dir + "/f" + std::to_string(i),
+                             (std::size_t)std::exp(dist(rng))};
+
+        const test::unique_fd fd {
+            open(f.name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600)};
+        if (!fd)
+            die("Couldn't create corpus file");
+
+        for (std::size_t n = 0; n < f.size; ) {
+            const std::size_t len {std::min(block.size(), f.size - n)};
+            if (write(fd, block.data(), len) != (ssize_t)len)
+                die("Couldn't write corpus file");
+            n += len;
+        }
+
+        files.push_back(f);
+    }
+
+    return files;
+}
+
+void remove_corpus(const options& opts, const std::vector<corpus_file>& files)
+{
+    for (const auto& f : files)
+        unlink(f.name.c_str());
+    rmdir(opts.corpus_dir.c_str());
+}
+
+// ------------------- Sinks -----------------
+
+/**
+   The data sink. Data is written to @a wr (by the server or by sendfile(2))
+   and drained from @a rd (not used for /dev/null).
+*/
+struct sink {
+    test::unique_fd rd;
+    test::unique_fd wr;
+};
+
+sink make_sink(const sink_type type)
+{
+    int fds[2];
+
+    switch (type) {
+    case sink_type::socketpair:
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+            die("socketpair");
+        break;
+
+    case sink_type::pipe:
+        if (pipe(fds) == -1)
+            die("pipe");
+        break;
+
+    case sink_type::devnull:
+        fds[0] = -1;
+        fds[1] = open("/dev/null", O_WRONLY);
+        if (fds[1] == -1)
+            die("open(/dev/null)");
+        break;
+    }
+
+    return sink {test::unique_fd {fds[0]}, test::unique_fd {fds[1]}};
+}
+
+/**
+   Drains whatever is available from a sink.
+
+   @return The number of bytes read, 0 on EOF, or -1 if nothing was available
+*/
+ssize_t drain(const int fd, std::vector<std::uint8_t>& buf)
+{
+    ssize_t total {};
+
+    for (;;) {
+        const ssize_t n {read(fd, buf.data(), buf.size())};
+
+        if (n > 0) {
+            total += n;
+        } else if (n == 0) {
+            return total;
+        } else {
+            if (errno == EINTR)
+                continue;
+            return (total > 0 ? total : -1);
+        }
+    }
+}
+
+// ------------------- Server -----------------
+
+/** A server instance, either spawned or running in a thread */
+class server {
+public:
+    explicit server(const options& opts) : in_thread {opts.in_thread} {
+        if (in_thread) {
+            thr = std::thread {[this, &opts] {
+                    const int listenfd {us_serve(SFD_SRV_SOCKDIR, srvname,
+                                                 getuid(), getgid())};
+                    {
+                        std::lock_guard<std::mutex> l {mtx};
+                        started = true;
+                        ok = (listenfd != -1);
+                    }
+                    cv.notify_all();
+
+                    if (listenfd == -1)
+                        return;
+
+                    srv_run(listenfd, opts.maxfiles, 1000, 1000, 0, 0);
+                    us_stop_serving(SFD_SRV_SOCKDIR, srvname, listenfd);
+                }};
+
+            std::unique_lock<std::mutex> l {mtx};
+            cv.wait(l, [this] { return started; });
+            if (!ok)
+                die("Couldn't start server thread");
+
+        } else {
+            pid = sfd_spawn(srvname, "/", SFD_SRV_SOCKDIR, opts.maxfiles, 1000);
+            if (pid == 0)
+                die("A server named 'sfd_bench' is already running");
+            if (pid == -1)
+                die("Couldn't spawn server ('" SFD_PROGNAME "' not in PATH?)");
+        }
+    }
+
+    ~server() {
+        if (in_thread) {
+            test::kill_thread(thr, SIGTERM);
+            thr.join();
+        } else {
+            sfd_shutdown(pid);
+        }
+    }
+
+    server(const server&) = delete;
+    server& operator=(const server&) = delete;
+
+    /** CPU time consumed by a spawned server (0 if running in a thread; its
+        time is included in this process's usage) */
+    double cpu_secs() const {
+        return (in_thread ? 0 : cpu_secs_proc(pid));
+    }
+
+private:
+    const bool in_thread;
+    pid_t pid {-1};
+    std::thread thr {};
+    std::mutex mtx {};
+    std::condition_variable cv {};
+    bool started {false};
+    bool ok {false};
+};
+
+// ------------------- Clients -----------------
+
+/**
+   Reads one status channel message.
+
+   @return The message size, or -1 if the channel was closed or failed
+*/
+ssize_t read_msg(const int fd, void* buf, const std::size_t size)
+{
+    for (;;) {
+        const ssize_t n {read(fd, buf, size)};
+        if (n > 0 || (n == -1 && errno != EINTR))
+            return (n > 0 ? n : -1);
+        if (n == 0)
+            return -1;
+    }
+}
+
+/**
+   Services a Send File or Send Open File transfer until the server reports
+   completion, draining the sink as data arrives.
+
+   @param t0 The time at which the request was issued
+
+   @return false on error
+*/
+bool await_send(const int stat_fd, sink& snk, const std::size_t size,
+                const bench_clock::time_point t0, sample& s,
+                std::vector<std::uint8_t>& buf)
+{
+    std::size_t nrecvd {};
+    bool complete {false};
+
+    if (!snk.rd) {
+        // /dev/null: the first status update is the earliest observable sign
+        // of data having been written
+        s.ttfb = -1;
+    }
+
+    set_nonblock(stat_fd, true);
+    if (snk.rd)
+        set_nonblock(snk.rd, true);
+
+    while (!complete || (snk.rd && nrecvd < size)) {
+        struct pollfd pfds[2] {
+            {stat_fd, POLLIN, 0},
+            {snk.rd, POLLIN, 0}
+        };
+
+        if (poll(pfds, (snk.rd ? 2 : 1), -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        if (pfds[1].revents) {
+            const ssize_t n {drain(snk.rd, buf)};
+            if (n == 0 && nrecvd < size)
+                return false;
+            if (n > 0) {
+                if (nrecvd == 0)
+                    s.ttfb = ns_since(t0);
+                nrecvd += (std::size_t)n;
+            }
+        }
+
+        if (pfds[0].revents && !complete) {
+            struct sfd_xfer_stat xstat;
+            const ssize_t n {read_msg(stat_fd, buf.data(), sizeof(xstat))};
+
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    continue;
+                return false;
+            }
+
+            if (!sfd_unmarshal_xfer_stat(&xstat, buf.data()))
+                return false;
+
+            if (s.ttfb == -1)
+                s.ttfb = ns_since(t0);
+
+            complete = sfd_xfer_complete(&xstat);
+        }
+    }
+
+    return true;
+}
+
+bool do_send(const int srv_fd, const corpus_file& f, const sink_type st,
+             sample& s, std::vector<std::uint8_t>& buf)
+{
+    sink snk {make_sink(st)};
+
+    const auto t0 = bench_clock::now();
+
+    const test::unique_fd stat_fd {
+        sfd_send(srv_fd, f.name.c_str(), snk.wr, 0, 0, false)};
+    if (!stat_fd)
+        return false;
+
+    // The server has its own copy; EOF on the sink signals that it is done
+    snk.wr.reset();
+
+    struct sfd_file_info info;
+    if (read_msg(stat_fd, buf.data(), sizeof(info)) != sizeof(info) ||
+        !sfd_unmarshal_file_info(&info, buf.data())) {
+        return false;
+    }
+
+    const bool ok {await_send(stat_fd, snk, info.size, t0, s, buf)};
+    s.total = ns_since(t0);
+
+    return ok;
+}
+
+bool do_open(const int srv_fd, const corpus_file& f, const sink_type st,
+             sample& s, std::vector<std::uint8_t>& buf)
+{
+    sink snk {make_sink(st)};
+
+    const auto t0 = bench_clock::now();
+
+    const test::unique_fd stat_fd {
+        sfd_open(srv_fd, f.name.c_str(), 0, 0, false)};
+    if (!stat_fd)
+        return false;
+
+    struct sfd_file_info info;
+    if (read_msg(stat_fd, buf.data(), sizeof(info)) != sizeof(info) ||
+        !sfd_unmarshal_file_info(&info, buf.data())) {
+        return false;
+    }
+
+    if (!sfd_send_open(srv_fd, info.txnid, snk.wr))
+        return false;
+
+    snk.wr.reset();
+
+    const bool ok {await_send(stat_fd, snk, info.size, t0, s, buf)};
+    s.total = ns_since(t0);
+
+    return ok;
+}
+
+bool do_read(const int srv_fd, const corpus_file& f, sample& s,
+             std::vector<std::uint8_t>& buf)
+{
+    const auto t0 = bench_clock::now();
+
+    const test::unique_fd data_fd {
+        sfd_read(srv_fd, f.name.c_str(), 0, 0, false)};
+    if (!data_fd)
+        return false;
+
+    struct sfd_file_info info;
+    if (read_msg(data_fd, buf.data(), sizeof(info)) != sizeof(info) ||
+        !sfd_unmarshal_file_info(&info, buf.data())) {
+        return false;
+    }
+
+    std::size_t nrecvd {};
+
+    while (nrecvd < info.size) {
+        const ssize_t n {read(data_fd, buf.data(), buf.size())};
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            return false;
+        }
+        if (nrecvd == 0)
+            s.ttfb = ns_since(t0);
+        nrecvd += (std::size_t)n;
+    }
+
+    s.total = ns_since(t0);
+
+    return true;
+}
+
+/**
+   The in-process baseline: opens the file and sendfile(2)s it to the sink
+   directly, without any server involvement.
+*/
+bool do_baseline(const corpus_file& f, const sink_type st, sample& s,
+                 std::vector<std::uint8_t>& buf)
+{
+    sink snk {make_sink(st)};
+
+    const auto t0 = bench_clock::now();
+
+    const test::unique_fd fd {open(f.name.c_str(), O_RDONLY)};
+    if (!fd)
+        return false;
+
+    struct stat st_buf;
+    if (fstat(fd, &st_buf) == -1)
+        return false;
+
+    const std::size_t size {(std::size_t)st_buf.st_size};
+
+    if (snk.rd) {
+        set_nonblock(snk.wr, true);
+        set_nonblock(snk.rd, true);
+    }
+
+    std::size_t nsent {};
+    std::size_t nrecvd {};
+    s.ttfb = -1;
+
+    while (nsent < size || (snk.rd && nrecvd < size)) {
+        if (nsent < size) {
+#ifdef __linux__
+            const ssize_t n {sendfile(snk.wr, fd, nullptr, size - nsent)};
+#else
+            off_t nbytes {};
+            const ssize_t n {(::sendfile(fd, snk.wr, (off_t)nsent, size - nsent,
+                                         nullptr, &nbytes, 0) == -1 &&
+                              nbytes == 0) ? -1 : (ssize_t)nbytes};
+#endif
+            if (n > 0) {
+                nsent += (std::size_t)n;
+                if (!snk.rd && s.ttfb == -1)
+                    s.ttfb = ns_since(t0);
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK &&
+                       errno != EINTR) {
+                return false;
+            }
+        }
+
+        if (snk.rd) {
+            const ssize_t n {drain(snk.rd, buf)};
+            if (n > 0) {
+                if (nrecvd == 0)
+                    s.ttfb = ns_since(t0);
+                nrecvd += (std::size_t)n;
+            }
+        }
+    }
+
+    s.total = ns_since(t0);
+
+    return true;
+}
+
+/**
+   Runs the workload across @a opts.concurrency threads.
+
+   @param srv The server, or NULL for the in-process baseline
+*/
+results run(const options& opts, const std::vector<corpus_file>& files,
+            const server* srv)
+{
+    std::atomic<long> next_req {0};
+    std::vector<results> thread_results(
+        static_cast<std::size_t>(opts.concurrency));
+    std::vector<std::thread> threads;
+
+    const double cpu0 {cpu_secs_self() + (srv ? srv->cpu_secs() : 0)};
+    const auto t0 = bench_clock::now();
+
+    for (int i = 0; i < opts.concurrency; i++) {
+        threads.emplace_back([&, i] {
+                results& r {thread_results[(std::size_t)i]};
+                std::mt19937 rng {opts.seed + (unsigned)i};
+                std::uniform_int_distribution<std::size_t> pick {
+                    0, files.size() - 1};
+                std::vector<std::uint8_t> buf(256 * 1024);
+
+                test::unique_fd srv_fd;
+                if (srv) {
+                    srv_fd = sfd_connect(SFD_SRV_SOCKDIR, srvname);
+                    if (!srv_fd)
+                        die("Couldn't connect to server");
+                }
+
+                while (next_req++ < opts.nrequests) {
+                    const corpus_file& f {files[pick(rng)]};
+                    sample s {};
+                    bool ok {};
+
+                    if (!srv) {
+                        ok = do_baseline(f, opts.sink, s, buf);
+                    } else {
+                        switch (opts.op) {
+                        case op_type::send:
+                            ok = do_send(srv_fd, f, opts.sink, s, buf);
+                            break;
+                        case op_type::open:
+                            ok = do_open(srv_fd, f, opts.sink, s, buf);
+                            break;
+                        case op_type::read:
+                            ok = do_read(srv_fd, f, s, buf);
+                            break;
+                        }
+                    }
+
+                    if (ok) {
+                        r.samples.push_back(s);
+                        r.nbytes += f.size;
+                    } else {
+                        r.nerrors++;
+                    }
+                }
+            });
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    results total;
+    total.wall_secs = (double)ns_since(t0) / 1e9;
+    total.cpu_secs = cpu_secs_self() + (srv ? srv->cpu_secs() : 0) - cpu0;
+
+    for (const auto& r : thread_results) {
+        total.samples.insert(total.samples.end(),
+                             r.samples.begin(), r.samples.end());
+        total.nbytes += r.nbytes;
+        total.nerrors += r.nerrors;
+    }
+
+    return total;
+}
+
+// ------------------- Reporting -----------------
+
+double percentile_us(std::vector<std::int64_t>& v, const double p)
+{
+    if (v.empty())
+        return 0;
+
+    const std::size_t idx {std::min(v.size() - 1,
+                                    (std::size_t)(p * (double)v.size()))};
+    std::nth_element(v.begin(), v.begin() + (long)idx, v.end());
+
+    return (double)v[idx] / 1e3;
+}
+
+void report(const char* label, results& r)
+{
+    std::vector<std::int64_t> ttfb, total;
+
+    for (const auto& s : r.samples) {
+        if (s.ttfb >= 0)
+            ttfb.push_back(s.ttfb);
+        total.push_back(s.total);
+    }
+
+    const double gb {(double)r.nbytes / 1e9};
+
+    std::printf("%-9s %9zu %6ld %10.1f %7.3f"
+                " %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %8.3f\n",
+                label,
+                r.samples.size(), r.nerrors,
+                (double)r.samples.size() / r.wall_secs,
+                gb / r.wall_secs,
+                percentile_us(ttfb, 0.5),
+                percentile_us(ttfb, 0.99),
+                percentile_us(ttfb, 0.999),
+                percentile_us(total, 0.5),
+                percentile_us(total, 0.99),
+                percentile_us(total, 0.999),
+                (gb > 0 ? r.cpu_secs / gb : 0.0));
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    options opts {parse_options(argc, argv)};
+
+    // Writes to sinks whose readers have gone away must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    const std::vector<corpus_file> files {make_corpus(opts)};
+
+    static const char* const op_names[] {"send", "read", "open"};
+    static const char* const sink_names[] {"socketpair", "pipe", "null"};
+
+    std::printf("op: %s; sink: %s; files: %d (%zu-%zu bytes);"
+                " concurrency: %d; requests: %ld; server: %s\n\n",
+                op_names[(int)opts.op], sink_names[(int)opts.sink],
+                opts.nfiles, opts.min_size, opts.max_size,
+                opts.concurrency, opts.nrequests,
+                (opts.in_thread ? "thread" : "process"));
+
+    std::printf("%-9s %9s %6s %10s %7s %9s %9s %9s %9s %9s %9s %8s\n",
+                "", "requests", "errors", "req/s", "GB/s",
+                "ttfb_p50", "ttfb_p99", "ttfb_p999",
+                "done_p50", "done_p99", "done_p999", "cpu_s/GB");
+
+    {
+        server srv {opts};
+        results r {run(opts, files, &srv)};
+        report("sendfiled", r);
+    }
+
+    if (opts.baseline) {
+        results r {run(opts, files, nullptr)};
+        report("baseline", r);
+    }
+
+    std::printf("\n(latencies in microseconds)\n");
+
+    if (!opts.keep_corpus)
+        remove_corpus(opts, files);
+
+    return EXIT_SUCCESS;
+}
+
+#pragma GCC diagnostic pop
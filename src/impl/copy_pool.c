@@ -0,0 +1,304 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE 1 /* For pipe2() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "copy_pool.h"
+#include "file_io.h"
+#include "util.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct copy_pool {
+    pthread_mutex_t lock;
+    /** Signalled when a segment is queued, or the threads are to stop */
+    pthread_cond_t work;
+    /** Signalled when the last queued or running segment has been copied */
+    pthread_cond_t idle;
+    /** Segments waiting for a thread (a FIFO) */
+    struct copy_seg* head;
+    struct copy_seg* tail;
+    /** Segments which have been copied, waiting to be reaped */
+    struct copy_seg* done;
+    /** The number of segments being copied */
+    unsigned nbusy;
+    bool stop;
+    /** Written to when @a done becomes non-empty */
+    int notify [2];
+    unsigned nthreads;
+    pthread_t threads [];
+};
+
+#pragma GCC diagnostic pop
+
+static void* worker_main(void* arg);
+
+/** Copies a segment, setting its err and ncalls */
+static void copy(struct copy_seg* seg);
+
+/** Hands a copied segment back, waking the reaper if need be; locked */
+static void complete(struct copy_pool* this, struct copy_seg* seg);
+
+struct copy_pool* copy_pool_new(const unsigned nthreads)
+{
+    struct copy_pool* const this = calloc(1, sizeof(*this) +
+                                          nthreads * sizeof(pthread_t));
+    if (!this)
+        return NULL;
+
+    if (pipe2(this->notify, O_NONBLOCK | O_CLOEXEC) == -1) {
+        PRESERVE_ERRNO(free(this));
+        return NULL;
+    }
+
+    pthread_mutex_init(&this->lock, NULL);
+    pthread_cond_init(&this->work, NULL);
+    pthread_cond_init(&this->idle, NULL);
+
+    /* Signals are for the server's thread (cf. syspoll) */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    int err = 0;
+
+    for (; this->nthreads < nthreads; this->nthreads++) {
+        err = pthread_create(&this->threads[this->nthreads], NULL,
+                             worker_main, this);
+        if (err != 0)
+            break;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err != 0) {
+        copy_pool_delete(this);
+        errno = err;
+        return NULL;
+    }
+
+    return this;
+}
+
+void copy_pool_delete(struct copy_pool* this)
+{
+    if (!this)
+        return;
+
+    pthread_mutex_lock(&this->lock);
+    this->stop = true;
+    pthread_cond_broadcast(&this->work);
+    pthread_mutex_unlock(&this->lock);
+
+    for (unsigned i = 0; i < this->nthreads; i++)
+        pthread_join(this->threads[i], NULL);
+
+    pthread_cond_destroy(&this->idle);
+    pthread_cond_destroy(&this->work);
+    pthread_mutex_destroy(&this->lock);
+
+    close(this->notify[0]);
+    close(this->notify[1]);
+
+    free(this);
+}
+
+int copy_pool_fd(const struct copy_pool* this)
+{
+    return this->notify[0];
+}
+
+void copy_pool_submit(struct copy_pool* this, struct copy_seg* seg)
+{
+    seg->next = NULL;
+
+    pthread_mutex_lock(&this->lock);
+
+    if (this->tail)
+        this->tail->next = seg;
+    else
+        this->head = seg;
+    this->tail = seg;
+
+    pthread_cond_signal(&this->work);
+    pthread_mutex_unlock(&this->lock);
+}
+
+struct copy_seg* copy_pool_reap(struct copy_pool* this)
+{
+    pthread_mutex_lock(&this->lock);
+
+    struct copy_seg* const seg = this->done;
+
+    if (seg) {
+        this->done = seg->next;
+    } else {
+        /* The pipe is written to under the lock, so whatever is in it stands
+           for segments which have been reaped already */
+        uint8_t buf [64];
+        while (read(this->notify[0], buf, sizeof(buf)) > 0)
+            ;
+    }
+
+    pthread_mutex_unlock(&this->lock);
+
+    return seg;
+}
+
+void copy_pool_cancel(struct copy_pool* this, const void* owner)
+{
+    pthread_mutex_lock(&this->lock);
+
+    struct copy_seg** link = &this->head;
+    this->tail = NULL;
+
+    while (*link) {
+        struct copy_seg* const seg = *link;
+
+        if (seg->owner == owner) {
+            *link = seg->next;
+            seg->err = ECANCELED;
+            seg->ncalls = 0;
+            complete(this, seg);
+        } else {
+            this->tail = seg;
+            link = &seg->next;
+        }
+    }
+
+    if (!this->head && this->nbusy == 0)
+        pthread_cond_broadcast(&this->idle);
+
+    pthread_mutex_unlock(&this->lock);
+}
+
+void copy_pool_wait(struct copy_pool* this)
+{
+    pthread_mutex_lock(&this->lock);
+
+    while (this->head || this->nbusy > 0)
+        pthread_cond_wait(&this->idle, &this->lock);
+
+    pthread_mutex_unlock(&this->lock);
+}
+
+/* ------------------ Internal implementations ---------------- */
+
+static void* worker_main(void* arg)
+{
+    struct copy_pool* const this = arg;
+
+    pthread_mutex_lock(&this->lock);
+
+    for (;;) {
+        while (!this->head && !this->stop)
+            pthread_cond_wait(&this->work, &this->lock);
+
+        if (this->stop)
+            break;
+
+        struct copy_seg* const seg = this->head;
+        this->head = seg->next;
+        if (!this->head)
+            this->tail = NULL;
+        this->nbusy++;
+
+        pthread_mutex_unlock(&this->lock);
+        copy(seg);
+        pthread_mutex_lock(&this->lock);
+
+        this->nbusy--;
+        complete(this, seg);
+
+        if (!this->head && this->nbusy == 0)
+            pthread_cond_broadcast(&this->idle);
+    }
+
+    pthread_mutex_unlock(&this->lock);
+
+    return NULL;
+}
+
+static void copy(struct copy_seg* seg)
+{
+    off_t offset = seg->offset;
+    off_t dest_offset = seg->dest_offset;
+    size_t nbytes_left = seg->len;
+
+    seg->err = 0;
+    seg->ncalls = 0;
+
+    while (nbytes_left > 0) {
+        /* Holes may only be skipped where the destination reads as zeroes */
+        const bool zeroed = (dest_offset >= seg->zeroed_from);
+        const size_t nbytes = (zeroed ?
+                               nbytes_left :
+                               SFD_MIN(nbytes_left,
+                                       (size_t)(seg->zeroed_from -
+                                                dest_offset)));
+
+        const ssize_t n = file_copy_at(seg->fd_in, &offset,
+                                       seg->fd_out, &dest_offset,
+                                       nbytes, zeroed);
+        seg->ncalls++;
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            seg->err = errno;
+            return;
+        }
+
+        /* The file has been truncated */
+        if (n == 0) {
+            seg->err = EIO;
+            return;
+        }
+
+        nbytes_left -= (size_t)n;
+    }
+}
+
+static void complete(struct copy_pool* this, struct copy_seg* seg)
+{
+    seg->next = this->done;
+    this->done = seg;
+
+    if (!seg->next) {
+        /* If the pipe is full (EAGAIN), it is readable already */
+        const uint8_t byte = 0;
+        const ssize_t n = write(this->notify[1], &byte, sizeof(byte));
+        (void)n;
+    }
+}
@@ -0,0 +1,118 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SFD_COPY_POOL_H
+#define SFD_COPY_POOL_H
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/**
+   A segment of a file to be copied into a regular file by a struct copy_pool.
+*/
+struct copy_seg {
+    /** The file */
+    int fd_in;
+    /** The destination */
+    int fd_out;
+    /** Where the segment starts in the file */
+    off_t offset;
+    /** Where the segment starts in the destination */
+    off_t dest_offset;
+    /** The destination offset from which on the destination reads as zeroes,
+        so that holes in the file need not be copied there */
+    off_t zeroed_from;
+    /** The segment's length */
+    size_t len;
+    /** The submitter's reference */
+    void* owner;
+    /** Set once copied: zero, or the errno value with which copying failed
+        (ECANCELED if it was cancelled before being started) */
+    int err;
+    /** Set once copied: the number of data-transfer system calls made */
+    uint32_t ncalls;
+    /** Link in the pool's queues */
+    struct copy_seg* next;
+};
+
+struct copy_pool;
+
+#pragma GCC diagnostic pop
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+       Starts a pool of @a nthreads threads which copy segments in order of
+       submission, each thread one at a time.
+
+       The threads are started with all signals blocked.
+    */
+    struct copy_pool* copy_pool_new(unsigned nthreads);
+
+    /**
+       Stops the threads once the segments they are copying have been copied;
+       segments which have not been started yet are dropped.
+    */
+    void copy_pool_delete(struct copy_pool*);
+
+    /**
+       A descriptor which becomes readable when a segment has been copied (cf.
+       copy_pool_reap()).
+    */
+    int copy_pool_fd(const struct copy_pool*);
+
+    /** Queues a segment, which must not be touched until it has been reaped */
+    void copy_pool_submit(struct copy_pool*, struct copy_seg*);
+
+    /**
+       Takes a segment which has been copied, or which has failed to be.
+
+       @retval NULL There are none (left); copy_pool_fd() has been drained, so
+       it only becomes readable again once another segment has been copied
+    */
+    struct copy_seg* copy_pool_reap(struct copy_pool*);
+
+    /**
+       Completes an owner's segments which have not been started with
+       ECANCELED; those being copied still run to completion.
+    */
+    void copy_pool_cancel(struct copy_pool*, const void* owner);
+
+    /** Blocks until no segment is queued or being copied */
+    void copy_pool_wait(struct copy_pool*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
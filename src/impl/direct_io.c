@@ -0,0 +1,280 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE 1 /* For O_DIRECT and MAP_HUGETLB */
+
+#include <sys/mman.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "direct_io.h"
+#include "util.h"
+
+/**
+   The alignment of direct I/O offsets and lengths. Logical block sizes do not
+   exceed it in practice.
+*/
+#define DIO_ALIGN ((off_t)4096)
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct dio_pool {
+    /** The number of buffers handed out or kept */
+    size_t nbufs;
+    size_t max_bufs;
+    /** Returned buffers (a stack) */
+    size_t nfree;
+    void* free [];
+};
+
+struct dio_buf {
+    uint8_t* data;
+    /** The data not written yet: [rp, len) */
+    size_t rp;
+    size_t len;
+};
+
+struct dio_stream {
+    struct dio_pool* pool;
+    int fd;
+    /** The file status flags from before direct I/O was turned on */
+    int fl;
+    /** The next file offset to be written */
+    off_t pos;
+    /** The end of the range */
+    off_t end;
+    /** The (aligned) file offset of the next buffer to be read */
+    off_t next_read;
+    /** The buffer being written from; the other one is read ahead */
+    unsigned cur;
+    struct dio_buf bufs [2];
+};
+
+#pragma GCC diagnostic pop
+
+static void* buf_get(struct dio_pool* pool);
+
+static void buf_put(struct dio_pool* pool, void* buf);
+
+/** Reads the next part of the range into an empty buffer */
+static bool fill(struct dio_stream* this, struct dio_buf* buf);
+
+struct dio_pool* dio_pool_new(const size_t max_bufs)
+{
+    struct dio_pool* const this = malloc(sizeof(*this) +
+                                         max_bufs * sizeof(void*));
+    if (!this)
+        return NULL;
+
+    this->nbufs = 0;
+    this->max_bufs = max_bufs;
+    this->nfree = 0;
+
+    return this;
+}
+
+void dio_pool_delete(struct dio_pool* this)
+{
+    if (!this)
+        return;
+
+    assert (this->nfree == this->nbufs);
+
+    for (size_t i = 0; i < this->nfree; i++)
+        munmap(this->free[i], DIO_BUF_SIZE);
+
+    free(this);
+}
+
+struct dio_stream* dio_stream_new(struct dio_pool* pool,
+                                  const int fd,
+                                  const size_t len)
+{
+    struct dio_stream* const this = calloc(1, sizeof(*this));
+    if (!this)
+        return NULL;
+
+    this->pool = pool;
+    this->fd = fd;
+
+    this->pos = lseek(fd, 0, SEEK_CUR);
+    if (this->pos == -1)
+        goto fail;
+
+    this->end = this->pos + (off_t)len;
+    this->next_read = this->pos & ~(DIO_ALIGN - 1);
+
+    this->bufs[0].data = buf_get(pool);
+    if (!this->bufs[0].data)
+        goto fail;
+
+    this->bufs[1].data = buf_get(pool);
+    if (!this->bufs[1].data)
+        goto fail;
+
+    this->fl = fcntl(fd, F_GETFL);
+    if (this->fl == -1 || fcntl(fd, F_SETFL, this->fl | O_DIRECT) == -1)
+        goto fail;
+
+    return this;
+
+ fail:
+    if (this->bufs[0].data)
+        buf_put(pool, this->bufs[0].data);
+    if (this->bufs[1].data)
+        buf_put(pool, this->bufs[1].data);
+    PRESERVE_ERRNO(free(this));
+
+    return NULL;
+}
+
+bool dio_stream_delete(struct dio_stream* this)
+{
+    if (!this)
+        return true;
+
+    const bool restored =
+        (lseek(this->fd, this->pos, SEEK_SET) != -1 &&
+         fcntl(this->fd, F_SETFL, this->fl) != -1);
+
+    PRESERVE_ERRNO(buf_put(this->pool, this->bufs[0].data));
+    PRESERVE_ERRNO(buf_put(this->pool, this->bufs[1].data));
+    PRESERVE_ERRNO(free(this));
+
+    return restored;
+}
+
+ssize_t dio_send(struct dio_stream* this, const int fd_out, const size_t nbytes)
+{
+    assert (nbytes > 0);
+
+    struct dio_buf* buf = &this->bufs[this->cur];
+
+    if (buf->rp == buf->len) {
+        this->cur ^= 1;
+        buf = &this->bufs[this->cur];
+
+        if (buf->rp == buf->len && !fill(this, buf))
+            return -1;
+    }
+
+    const ssize_t nwritten = write(fd_out, buf->data + buf->rp,
+                                   SFD_MIN(nbytes, buf->len - buf->rp));
+
+    if (nwritten > 0) {
+        buf->rp += (size_t)nwritten;
+        this->pos += nwritten;
+
+    } else if (nwritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        /* Reads ahead while the destination drains. A failure is left to
+           show up again when the buffer is needed. */
+        struct dio_buf* const next = &this->bufs[this->cur ^ 1];
+
+        if (next->rp == next->len && this->next_read < this->end)
+            PRESERVE_ERRNO(fill(this, next));
+    }
+
+    return nwritten;
+}
+
+static void* buf_get(struct dio_pool* pool)
+{
+    if (pool->nfree > 0) {
+        pool->nfree--;
+        return pool->free[pool->nfree];
+    }
+
+    if (pool->nbufs == pool->max_bufs) {
+        errno = ENOBUFS;
+        return NULL;
+    }
+
+    void* buf = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    /* Only succeeds if huge pages have been reserved */
+    buf = mmap(NULL, DIO_BUF_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    if (buf == MAP_FAILED) {
+        buf = mmap(NULL, DIO_BUF_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED)
+            return NULL;
+
+#ifdef MADV_HUGEPAGE
+        /* Transparent huge pages, if enabled; advisory only */
+        madvise(buf, DIO_BUF_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+
+    pool->nbufs++;
+
+    return buf;
+}
+
+static void buf_put(struct dio_pool* pool, void* buf)
+{
+    assert (pool->nfree < pool->nbufs);
+
+    pool->free[pool->nfree] = buf;
+    pool->nfree++;
+}
+
+static bool fill(struct dio_stream* this, struct dio_buf* buf)
+{
+    assert (this->next_read < this->end);
+
+    /* Both ends aligned; the final buffer may be read short by end-of-file */
+    const off_t left = this->end - this->next_read;
+    const size_t size = (size_t)SFD_MIN((off_t)DIO_BUF_SIZE,
+                                        (left + DIO_ALIGN - 1) &
+                                        ~(DIO_ALIGN - 1));
+
+    const ssize_t nread = pread(this->fd, buf->data, size, this->next_read);
+    if (nread == -1)
+        return false;
+
+    if (nread < (ssize_t)size && nread < left) {
+        /* The file has been truncated */
+        errno = EIO;
+        return false;
+    }
+
+    buf->rp = (size_t)SFD_MAX(this->pos - this->next_read, 0);
+    buf->len = (size_t)SFD_MIN((off_t)nread, left);
+
+    this->next_read += (off_t)size;
+
+    return true;
+}
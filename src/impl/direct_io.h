@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SFD_DIRECT_IO_H
+#define SFD_DIRECT_IO_H
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** The size of a direct I/O buffer: that of a (2 MiB) huge page */
+#define DIO_BUF_SIZE ((size_t)2 * 1024 * 1024)
+
+/**
+   Aligned buffers for direct I/O, each DIO_BUF_SIZE bytes, backed by huge
+   pages where possible. Returned buffers are kept for reuse.
+*/
+struct dio_pool;
+
+/**
+   A range of a file read with direct I/O (O_DIRECT), bypassing the page cache,
+   through two of a pool's buffers: the next one is read while the destination
+   drains the current one.
+*/
+struct dio_stream;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /** Creates a pool which hands out up to @a max_bufs buffers at a time */
+    struct dio_pool* dio_pool_new(size_t max_bufs);
+
+    /** Unmaps the buffers, all of which must have been returned */
+    void dio_pool_delete(struct dio_pool*);
+
+    /**
+       Starts reading @a len bytes of a file from its file offset on with
+       direct I/O, which is turned on for its open file description.
+
+       @retval NULL An error occurred; EINVAL if the file system does not
+       support direct I/O, ENOBUFS if the pool has run out of buffers
+    */
+    struct dio_stream* dio_stream_new(struct dio_pool*, int fd, size_t len);
+
+    /**
+       Ends a stream, leaving the file's offset at the first byte which has
+       not been written yet and turning direct I/O off again, so that reading
+       can carry on by other means (e.g., sendfile(2)).
+
+       @retval false The file's offset or status flags could not be restored;
+       the stream is deleted regardless
+    */
+    bool dio_stream_delete(struct dio_stream*);
+
+    /**
+       Writes up to @a nbytes bytes of the range to @a fd_out, which should be
+       non-blocking, reading the file as needed. When @a fd_out is full, the
+       next buffer is read ahead before returning.
+
+       @retval >0 The number of bytes written
+       @retval -1 An error occurred; EIO if the file ended before the range
+       did
+    */
+    ssize_t dio_send(struct dio_stream*, int fd_out, size_t nbytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,13 +24,41 @@
   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#define _GNU_SOURCE 1
+
+#include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "file_io.h"
 #include "util.h"
 
+/**
+   The size of the buffer through which file_copy() and file_copy_at() fall
+   back to copying
+*/
+#define COPY_BUF_SIZE (64 * 1024)
+
+/** The bounds of a struct fio_cache's readahead window */
+#define RA_WINDOW_MIN ((size_t)256 * 1024)
+#define RA_WINDOW_MAX ((size_t)32 * 1024 * 1024)
+
+/** How far ahead of a transfer is read, in terms of its throughput */
+#define RA_HORIZON_US 250000U
+
+/** How often a transfer's throughput is sampled */
+#define RA_SAMPLE_US 100000U
+
+/**
+   The granularity of drop-behind. A (large) folio is only dropped from the page
+   cache once all of it is advised to be, and folios are at most this large (a
+   PMD) and aligned to their size, so data is dropped up to multiples of it.
+*/
+#define DROP_ALIGN ((off_t)2 * 1024 * 1024)
+
 /**
    Read-locks a file.
 
@@ -46,6 +74,30 @@ static bool lock_file(int fd, off_t offset, off_t len);
 */
 static int stat_file(int fd, struct fio_stat*);
 
+/**
+   The length, up to @a nbytes, of the run of data or (@a *hole) of the hole
+   at @a offset of a file.
+*/
+static size_t extent_at(int fd, off_t offset, size_t nbytes, bool* hole);
+
+/**
+   Copies up to @a nbytes bytes of a file, which contain no holes, from @a
+   *offset to @a *dest_offset, or to @a fd_out's file offset if @a dest_offset
+   is NULL.
+*/
+static ssize_t copy_range(int fd_in, off_t* offset,
+                          int fd_out, off_t* dest_offset,
+                          size_t nbytes);
+
+/**
+   Skips @a nbytes bytes (a hole) of @a fd_out, extending it, if it is at or
+   beyond its end-of-file.
+
+   @retval 0 @a fd_out's data would be overwritten, or it is not a regular
+   file, so the hole has to be copied instead
+*/
+static ssize_t skip_hole(int fd_out, size_t nbytes);
+
 int file_open_read(const char* name,
                    const off_t offset, const size_t len,
                    struct fio_stat* info)
@@ -76,8 +128,266 @@ off_t file_offset(const int fd)
     return lseek(fd, 0, SEEK_CUR);
 }
 
+bool fio_cache_start(struct fio_cache* this, const int fd,
+                     const enum fio_access access,
+                     const off_t offset, const size_t len,
+                     const uint64_t now_us)
+{
+    *this = (struct fio_cache) {
+        .end = offset + (off_t)len,
+        .ra_end = offset,
+        .dropped = offset,
+        .sample_pos = offset,
+        .sample_us = now_us,
+        .window = RA_WINDOW_MIN,
+        .access = (uint8_t)access
+    };
+
+    int advice;
+
+    switch (access) {
+    case FIO_ACCESS_SEQUENTIAL:
+        advice = POSIX_FADV_SEQUENTIAL;
+        break;
+    case FIO_ACCESS_RANDOM:
+        advice = POSIX_FADV_RANDOM;
+        break;
+    case FIO_ACCESS_WILLNEED:
+        advice = POSIX_FADV_WILLNEED;
+        this->ra_end = this->end;
+        break;
+    case FIO_ACCESS_NOREUSE:
+        /* NOREUSE alone does little on most kernels; the drop-behind is what
+           keeps the data out of the page cache */
+        posix_fadvise(fd, offset, (off_t)len, POSIX_FADV_NOREUSE);
+        advice = POSIX_FADV_SEQUENTIAL;
+        break;
+    default:
+        return true;
+    }
+
+    const int err = posix_fadvise(fd, offset, (off_t)len, advice);
+    if (err != 0) {
+        errno = err;
+        return false;
+    }
+
+    return true;
+}
+
+void fio_cache_update(struct fio_cache* this, const int fd, const off_t pos,
+                      const uint64_t now_us)
+{
+    if (this->access != FIO_ACCESS_SEQUENTIAL &&
+        this->access != FIO_ACCESS_NOREUSE) {
+        return;
+    }
+
+    if (now_us - this->sample_us >= RA_SAMPLE_US) {
+        const uint64_t rate = ((uint64_t)(pos - this->sample_pos) * 1000000U /
+                               (now_us - this->sample_us));
+        const size_t window = (size_t)SFD_MIN(SFD_MAX(rate * RA_HORIZON_US /
+                                                      1000000U,
+                                                      RA_WINDOW_MIN),
+                                              RA_WINDOW_MAX);
+
+        /* Smoothed, so that a single stall does not collapse the window */
+        this->window = (this->window + window) / 2;
+        this->sample_pos = pos;
+        this->sample_us = now_us;
+    }
+
+    const off_t from = SFD_MAX(this->ra_end, pos);
+    const off_t to = SFD_MIN(pos + (off_t)this->window, this->end);
+
+    if (to - from >= (off_t)this->window / 2 ||
+        (to == this->end && from < to)) {
+        posix_fadvise(fd, from, to - from, POSIX_FADV_WILLNEED);
+        this->ra_end = to;
+    }
+
+    /* The data just written may still be referenced by the destination (a
+       pipe, or a socket's send buffer), which keeps it from being dropped, so
+       drop-behind trails the transfer by a block */
+    const off_t behind = (pos - DROP_ALIGN) & ~(DROP_ALIGN - 1);
+
+    if (this->access == FIO_ACCESS_NOREUSE && behind > this->dropped) {
+        posix_fadvise(fd, this->dropped, behind - this->dropped,
+                      POSIX_FADV_DONTNEED);
+        this->dropped = behind;
+    }
+}
+
+void fio_cache_finish(struct fio_cache* this, const int fd)
+{
+    if (this->access == FIO_ACCESS_NOREUSE && this->dropped < this->end) {
+        posix_fadvise(fd, this->dropped, this->end - this->dropped,
+                      POSIX_FADV_DONTNEED);
+        this->dropped = this->end;
+    }
+}
+
+ssize_t file_copy(const int fd_in, const int fd_out,
+                  struct fio_ctx* ctx,
+                  off_t* offset,
+                  const size_t nbytes)
+{
+    assert (nbytes > 0);
+
+    if (!offset) {
+        /* Looking for holes moves the file offset, so the copy is made at an
+           explicit one, after which the file offset is set to its end */
+        off_t pos = lseek(fd_in, 0, SEEK_CUR);
+        if (pos == -1)
+            return -1;
+
+        const ssize_t n = file_copy(fd_in, fd_out, ctx, &pos, nbytes);
+
+        if (n > 0 && lseek(fd_in, pos, SEEK_SET) == -1)
+            return -1;
+
+        return n;
+    }
+
+    bool hole;
+    const size_t len = extent_at(fd_in, *offset, nbytes, &hole);
+
+    if (hole) {
+        const ssize_t nskipped = skip_hole(fd_out, len);
+
+        if (nskipped != 0) {
+            if (nskipped > 0)
+                *offset += nskipped;
+            return nskipped;
+        }
+    }
+
+    return copy_range(fd_in, offset, fd_out, NULL, len);
+}
+
+ssize_t file_copy_at(const int fd_in, off_t* offset,
+                     const int fd_out, off_t* dest_offset,
+                     const size_t nbytes,
+                     const bool skip_holes)
+{
+    assert (nbytes > 0);
+
+    if (!skip_holes)
+        return copy_range(fd_in, offset, fd_out, dest_offset, nbytes);
+
+    bool hole;
+    const size_t len = extent_at(fd_in, *offset, nbytes, &hole);
+
+    if (hole) {
+        *offset += (off_t)len;
+        *dest_offset += (off_t)len;
+        return (ssize_t)len;
+    }
+
+    return copy_range(fd_in, offset, fd_out, dest_offset, len);
+}
+
 /* ------------------ Internal implementations ---------------- */
 
+static size_t extent_at(const int fd, const off_t offset, const size_t nbytes,
+                        bool* hole)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t data = lseek(fd, offset, SEEK_DATA);
+
+    if (data == -1) {
+        /* E.g., SEEK_DATA unsupported: all data */
+        if (errno != ENXIO) {
+            *hole = false;
+            return nbytes;
+        }
+
+        /* The rest of the file is a hole */
+        data = offset + (off_t)nbytes;
+    }
+
+    if (data > offset) {
+        *hole = true;
+        return SFD_MIN(nbytes, (size_t)(data - offset));
+    }
+
+    *hole = false;
+
+    const off_t end = lseek(fd, offset, SEEK_HOLE);
+
+    return (end == -1 ? nbytes : SFD_MIN(nbytes, (size_t)(end - offset)));
+#else
+    /* Holes cannot be told apart from data: all data */
+    (void)fd;
+    (void)offset;
+    *hole = false;
+    return nbytes;
+#endif
+}
+
+static ssize_t copy_range(const int fd_in, off_t* offset,
+                          const int fd_out, off_t* dest_offset,
+                          const size_t nbytes)
+{
+    const ssize_t n = sfd_copy_file_range(fd_in, offset, fd_out, dest_offset,
+                                          nbytes);
+
+    /* Not supported at all (ENOSYS), or not between these two files, e.g.,
+       across file systems on older kernels, or into one opened with O_APPEND
+       (EBADF) */
+    if (n == -1 &&
+        (errno == EXDEV || errno == EINVAL || errno == EBADF ||
+         errno == EOPNOTSUPP || errno == ENOSYS)) {
+        uint8_t buf [COPY_BUF_SIZE];
+
+        const ssize_t nread = pread(fd_in, buf, SFD_MIN(nbytes, sizeof(buf)),
+                                    *offset);
+        if (nread <= 0)
+            return nread;
+
+        const ssize_t nwritten = (dest_offset ?
+                                  pwrite(fd_out, buf, (size_t)nread,
+                                         *dest_offset) :
+                                  write(fd_out, buf, (size_t)nread));
+        if (nwritten > 0) {
+            *offset += nwritten;
+            if (dest_offset)
+                *dest_offset += nwritten;
+        }
+
+        return nwritten;
+    }
+
+    return n;
+}
+
+/* Where the file is being extended, a hole reads back as zeroes just like the
+   source's did */
+static ssize_t skip_hole(const int fd_out, const size_t nbytes)
+{
+    struct stat st;
+    if (fstat(fd_out, &st) == -1)
+        return -1;
+
+    /* Devices (e.g., /dev/null) have no holes to extend into */
+    if (!S_ISREG(st.st_mode))
+        return 0;
+
+    const off_t pos = lseek(fd_out, 0, SEEK_CUR);
+    if (pos == -1)
+        return -1;
+
+    if (pos < st.st_size)
+        return 0;
+
+    if (ftruncate(fd_out, pos + (off_t)nbytes) == -1 ||
+        lseek(fd_out, (off_t)nbytes, SEEK_CUR) == -1) {
+        return -1;
+    }
+
+    return (ssize_t)nbytes;
+}
+
 static bool lock_file(const int fd, const off_t offset, const off_t len)
 {
     struct flock lock = {
@@ -30,6 +30,7 @@
 #include <sys/types.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
@@ -46,30 +47,206 @@ struct fio_stat {
 
 struct fio_ctx;
 
-#pragma GCC diagnostic pop
-
-struct fio_ctx* fio_ctx_new(size_t capacity);
-
-void fio_ctx_delete(struct fio_ctx*);
-
-bool fio_ctx_valid(const struct fio_ctx*);
+/** How a transfer's file is going to be read (cf. struct fio_cache) */
+enum fio_access {
+    /* The kernel's default policy */
+    FIO_ACCESS_NORMAL,
+    /* Front to back: readahead well ahead of the transfer */
+    FIO_ACCESS_SEQUENTIAL,
+    /* No readahead */
+    FIO_ACCESS_RANDOM,
+    /* The whole range is read into the page cache up front */
+    FIO_ACCESS_WILLNEED,
+    /* Front to back, once: as SEQUENTIAL, but data which has been sent is
+       dropped from the page cache ('drop-behind') */
+    FIO_ACCESS_NOREUSE
+};
 
 /**
-   @retval >0 The file descriptor
-   @retval <0 An error occurred
+   A transfer's page cache policy (readahead and drop-behind), which follows
+   the transfer's progress through its range (cf. fio_cache_update()).
+
+   The readahead window is sized after the transfer's observed throughput, so
+   that slow transfers do not fill the page cache with data which might be
+   evicted again before it is sent.
 */
-int file_open_read(const char* name,
-                   off_t offset, size_t len,
-                   struct fio_stat*);
+struct fio_cache {
+    /** The end of the range */
+    off_t end;
+    /** The end of the data read ahead so far */
+    off_t ra_end;
+    /** The start of the data not dropped yet */
+    off_t dropped;
+    /** The position at sample_us */
+    off_t sample_pos;
+    /** When the throughput was last sampled */
+    uint64_t sample_us;
+    /** The readahead window, in bytes */
+    size_t window;
+    /** enum fio_access */
+    uint8_t access;
+};
 
-off_t file_offset(int fd);
+#pragma GCC diagnostic pop
 
-ssize_t file_splice(int fd_in, int fd_out,
-                    struct fio_ctx*,
-                    size_t nbytes);
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-ssize_t file_sendfile(int fd_in, int fd_out,
+    struct fio_ctx* fio_ctx_new(size_t capacity);
+
+    /**
+       Creates the context of a pump (cf. fio_pump()) or of a member of a
+       fan-out group (cf. fio_tee()), which buffers up to @a capacity bytes.
+
+       @retval NULL An error occurred
+    */
+    struct fio_ctx* fio_ctx_new_pump(size_t capacity);
+
+    void fio_ctx_delete(struct fio_ctx*);
+
+    bool fio_ctx_valid(const struct fio_ctx*);
+
+    /**
+       Discards the data which has been read from the file but not written yet,
+       if any, rewinding the file offset so that it will be read again (e.g.,
+       by another process to which the transfer is being handed over).
+    */
+    bool fio_ctx_unread(struct fio_ctx*, int fd);
+
+    /** The number of bytes buffered by a context; zero if it is NULL */
+    size_t fio_ctx_nbuffered(const struct fio_ctx*);
+
+    /** Discards the data buffered by a context created by fio_ctx_new_pump() */
+    bool fio_ctx_discard(struct fio_ctx*);
+
+    /**
+       @retval >0 The file descriptor
+       @retval <0 An error occurred
+    */
+    int file_open_read(const char* name,
+                       off_t offset, size_t len,
+                       struct fio_stat*);
+
+    off_t file_offset(int fd);
+
+    /**
+       Applies an access pattern to the range of a file a transfer is about to
+       read, which must have an open file description of its own.
+
+       @param now_us The current time, in microseconds
+
+       @retval false posix_fadvise(2) failed; the transfer can carry on
+       regardless
+    */
+    bool fio_cache_start(struct fio_cache*, int fd, enum fio_access,
+                         off_t offset, size_t len, uint64_t now_us);
+
+    /**
+       Reads ahead of a transfer which has got to @a pos in its range, and drops
+       what is behind it (depending on the access pattern). Cheap enough to be
+       called after every burst of writes; advises the kernel only once the
+       transfer has moved on by a fair part of the window.
+    */
+    void fio_cache_update(struct fio_cache*, int fd, off_t pos,
+                          uint64_t now_us);
+
+    /** Drops the rest of a completed transfer's range, if it reads it once */
+    void fio_cache_finish(struct fio_cache*, int fd);
+
+    ssize_t file_splice(int fd_in, int fd_out,
+                        struct fio_ctx*,
+                        size_t nbytes);
+
+    /**
+       Writes up to @a nbytes bytes of a file to @a fd_out.
+
+       @param offset The file offset to read from, which is advanced by the
+       number of bytes written, or NULL to read from (and advance) @a fd_in's
+       own file offset
+    */
+    ssize_t file_sendfile(int fd_in, int fd_out,
+                          struct fio_ctx*,
+                          off_t* offset,
+                          size_t nbytes);
+
+    /**
+       Copies up to @a nbytes bytes of a file to a regular file or character
+       device, @a fd_out, at its file offset, without the data passing through
+       userspace where the system allows (and possibly by sharing the file's
+       blocks; cf. copy_file_range(2)).
+
+       Holes in the file are kept (cf. SEEK_HOLE in lseek(2)) wherever a
+       regular file @a fd_out is being extended, rather than being filled in
+       with zeroes.
+
+       @param offset As for file_sendfile()
+
+       @retval >0 The number of bytes copied or, in the case of a hole,
+       skipped
+    */
+    ssize_t file_copy(int fd_in, int fd_out,
                       struct fio_ctx*,
+                      off_t* offset,
                       size_t nbytes);
 
+    /**
+       Copies up to @a nbytes bytes of a file from @a *offset to a regular
+       file, @a fd_out, at @a *dest_offset, advancing both offsets but leaving
+       the descriptors' own file offsets alone; safe to call concurrently for
+       different parts of the same files.
+
+       @param skip_holes Whether holes in the file may be skipped rather than
+       copied, i.e., if @a fd_out reads as zeroes from @a *dest_offset on
+    */
+    ssize_t file_copy_at(int fd_in, off_t* offset,
+                         int fd_out, off_t* dest_offset,
+                         size_t nbytes,
+                         bool skip_holes);
+
+    /**
+       Moves up to @a nbytes bytes (including those still buffered from a
+       previous call) from a non-seekable, non-blocking descriptor (e.g., a
+       socket or pipe) to @a fd_out, through the buffer of a context created by
+       fio_ctx_new_pump().
+
+       @retval >0 The number of bytes written to @a fd_out
+       @retval 0 @a fd_in has reached end-of-file and nothing is left buffered
+       @retval -1 An error occurred; EAGAIN if @a fd_in is empty or @a fd_out is
+       full
+    */
+    ssize_t fio_pump(int fd_in, int fd_out,
+                     struct fio_ctx*,
+                     size_t nbytes);
+
+    /**
+       Reads up to @a nbytes bytes of a file, starting at @a offset, into the
+       buffer of a context created by fio_ctx_new_pump(), leaving @a fd_in's
+       file offset alone.
+
+       @retval >0 The number of bytes read
+       @retval 0 End-of-file
+       @retval -1 An error occurred
+    */
+    ssize_t fio_fill(int fd_in, off_t offset,
+                     struct fio_ctx*,
+                     size_t nbytes);
+
+    /**
+       Duplicates the data buffered by @a from into @a to, which has to be
+       empty, without consuming it; with @a move, it is consumed instead.
+
+       @retval >=0 The number of bytes duplicated (or moved), which may be fewer
+       than were buffered
+       @retval -1 An error occurred
+    */
+    ssize_t fio_tee(struct fio_ctx* from, struct fio_ctx* to, bool move);
+
+    /** Writes up to @a nbytes bytes of a context's buffered data to @a fd_out */
+    ssize_t fio_flush(struct fio_ctx*, int fd_out, size_t nbytes);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
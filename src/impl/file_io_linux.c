@@ -29,18 +29,50 @@
 #include <sys/sendfile.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "file_io.h"
+#include "util.h"
+
+/* Only pumps and fan-out members have a context: the pipe through which they
+   splice */
+struct fio_ctx {
+    int pipe[2];
+    size_t nbuffered;
+};
 
 struct fio_ctx* fio_ctx_new(size_t capacity __attribute__((unused)))
 {
     return NULL;
 }
 
-void fio_ctx_delete(struct fio_ctx* this __attribute__((unused)))
+struct fio_ctx* fio_ctx_new_pump(size_t capacity __attribute__((unused)))
+{
+    struct fio_ctx* this = malloc(sizeof(*this));
+    if (!this)
+        return NULL;
+
+    if (pipe2(this->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        PRESERVE_ERRNO(free(this));
+        return NULL;
+    }
+
+    this->nbuffered = 0;
+
+    return this;
+}
+
+void fio_ctx_delete(struct fio_ctx* this)
 {
+    if (this) {
+        close(this->pipe[0]);
+        close(this->pipe[1]);
+        free(this);
+    }
 }
 
 bool fio_ctx_valid(const struct fio_ctx* this)
@@ -48,6 +80,50 @@ bool fio_ctx_valid(const struct fio_ctx* this)
     return (this == NULL);
 }
 
+/* The kernel does all of the buffering, except for pumps, whose data can't be
+   put back into their sources (ESPIPE), and fan-out members */
+bool fio_ctx_unread(struct fio_ctx* this, const int fd)
+{
+    if (this && this->nbuffered > 0) {
+        const off_t nbuffered = (off_t)this->nbuffered;
+
+        if (lseek(fd, -nbuffered, SEEK_CUR) == -1)
+            return false;
+
+        if (!fio_ctx_discard(this)) {
+            PRESERVE_ERRNO(lseek(fd, nbuffered, SEEK_CUR));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t fio_ctx_nbuffered(const struct fio_ctx* this)
+{
+    return (this ? this->nbuffered : 0);
+}
+
+/* Replacing the pipe drops its pages without copying them out */
+bool fio_ctx_discard(struct fio_ctx* this)
+{
+    if (this->nbuffered == 0)
+        return true;
+
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1)
+        return false;
+
+    close(this->pipe[0]);
+    close(this->pipe[1]);
+
+    this->pipe[0] = fds[0];
+    this->pipe[1] = fds[1];
+    this->nbuffered = 0;
+
+    return true;
+}
+
 ssize_t file_splice(const int fd_in, const int fd_out,
                     struct fio_ctx* ctx __attribute__((unused)),
                     const size_t nbytes)
@@ -62,9 +138,103 @@ ssize_t file_splice(const int fd_in, const int fd_out,
 
 ssize_t file_sendfile(const int fd_in, const int fd_out,
                       struct fio_ctx* ctx __attribute__((unused)),
+                      off_t* offset,
                       const size_t nbytes)
 {
     assert (nbytes > 0);
 
-    return sendfile(fd_out, fd_in, NULL, nbytes);
+    return sendfile(fd_out, fd_in, offset, nbytes);
+}
+
+ssize_t fio_pump(const int fd_in, const int fd_out,
+                 struct fio_ctx* ctx,
+                 const size_t nbytes)
+{
+    assert (nbytes > 0);
+
+    bool eof = false;
+
+    if (ctx->nbuffered < nbytes) {
+        const ssize_t nread = splice(fd_in, NULL,
+                                     ctx->pipe[1], NULL,
+                                     nbytes - ctx->nbuffered,
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (nread > 0)
+            ctx->nbuffered += (size_t)nread;
+        else if (nread == 0)
+            eof = true;
+        else if (errno != EAGAIN)
+            return -1;
+    }
+
+    if (ctx->nbuffered == 0) {
+        if (eof)
+            return 0;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    const ssize_t nwritten = splice(ctx->pipe[0], NULL,
+                                    fd_out, NULL,
+                                    ctx->nbuffered,
+                                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (nwritten > 0)
+        ctx->nbuffered -= (size_t)nwritten;
+
+    return nwritten;
+}
+
+ssize_t fio_fill(const int fd_in, off_t offset,
+                 struct fio_ctx* ctx,
+                 const size_t nbytes)
+{
+    assert (nbytes > 0);
+
+    const ssize_t nread = splice(fd_in, &offset,
+                                 ctx->pipe[1], NULL,
+                                 nbytes,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (nread > 0)
+        ctx->nbuffered += (size_t)nread;
+
+    return nread;
+}
+
+/* tee(2) only references the pipe's pages; the data is never copied */
+ssize_t fio_tee(struct fio_ctx* from, struct fio_ctx* to, const bool move)
+{
+    assert (to->nbuffered == 0);
+
+    if (from->nbuffered == 0)
+        return 0;
+
+    const ssize_t n = (move ?
+                       splice(from->pipe[0], NULL,
+                              to->pipe[1], NULL,
+                              from->nbuffered,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK) :
+                       tee(from->pipe[0], to->pipe[1],
+                           from->nbuffered,
+                           SPLICE_F_NONBLOCK));
+    if (n > 0) {
+        to->nbuffered += (size_t)n;
+        if (move)
+            from->nbuffered -= (size_t)n;
+    }
+
+    return n;
+}
+
+ssize_t fio_flush(struct fio_ctx* ctx, const int fd_out, const size_t nbytes)
+{
+    assert (nbytes > 0);
+
+    const ssize_t nwritten = splice(ctx->pipe[0], NULL,
+                                    fd_out, NULL,
+                                    SFD_MIN(nbytes, ctx->nbuffered),
+                                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (nwritten > 0)
+        ctx->nbuffered -= (size_t)nwritten;
+
+    return nwritten;
 }
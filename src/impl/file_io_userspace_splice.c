@@ -37,9 +37,11 @@
 #include <sys/socket.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "file_io.h"
@@ -70,6 +72,12 @@ struct fio_ctx* fio_ctx_new(size_t capacity)
     return this;
 }
 
+/* Pumps and fan-out members buffer their data just like file_splice() */
+struct fio_ctx* fio_ctx_new_pump(size_t capacity)
+{
+    return fio_ctx_new(capacity);
+}
+
 void fio_ctx_delete(struct fio_ctx* this)
 {
     free(this->data);
@@ -81,6 +89,30 @@ bool fio_ctx_valid(const struct fio_ctx* this)
     return (this && this->data);
 }
 
+bool fio_ctx_unread(struct fio_ctx* this, const int fd)
+{
+    const off_t nbuffered = (off_t)(this->wp - this->rp);
+
+    if (nbuffered > 0 && lseek(fd, -nbuffered, SEEK_CUR) == -1)
+        return false;
+
+    this->rp = this->wp = this->data;
+
+    return true;
+}
+
+size_t fio_ctx_nbuffered(const struct fio_ctx* this)
+{
+    return (this ? (size_t)(this->wp - this->rp) : 0);
+}
+
+bool fio_ctx_discard(struct fio_ctx* this)
+{
+    this->rp = this->wp = this->data;
+
+    return true;
+}
+
 ssize_t file_splice(const int fd_in, const int fd_out,
                     struct fio_ctx* ctx,
                     const size_t nbytes)
@@ -115,3 +147,95 @@ ssize_t file_splice(const int fd_in, const int fd_out,
 
     return 0;
 }
+
+ssize_t fio_pump(const int fd_in, const int fd_out,
+                 struct fio_ctx* ctx,
+                 const size_t nbytes)
+{
+    assert (nbytes > 0);
+
+    const size_t nbuffered = (size_t)(ctx->wp - ctx->rp);
+    const size_t nunwritten = (ctx->capacity - (size_t)(ctx->wp - ctx->data));
+    bool eof = false;
+
+    if (nbuffered < nbytes && nunwritten > 0) {
+        const ssize_t nread = read(fd_in, ctx->wp,
+                                   SFD_MIN(nbytes - nbuffered, nunwritten));
+        if (nread > 0)
+            ctx->wp += nread;
+        else if (nread == 0)
+            eof = true;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+    }
+
+    if (ctx->rp == ctx->wp) {
+        if (eof)
+            return 0;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    const ssize_t nwritten = write(fd_out, ctx->rp,
+                                   (size_t)(ctx->wp - ctx->rp));
+
+    if (nwritten > 0) {
+        ctx->rp += (size_t)nwritten;
+        if (ctx->rp == ctx->wp)
+            ctx->rp = ctx->wp = ctx->data;
+    }
+
+    return nwritten;
+}
+
+ssize_t fio_fill(const int fd_in, const off_t offset,
+                 struct fio_ctx* ctx,
+                 const size_t nbytes)
+{
+    assert (nbytes > 0);
+
+    const size_t nunwritten = (ctx->capacity - (size_t)(ctx->wp - ctx->data));
+
+    const ssize_t nread = pread(fd_in, ctx->wp, SFD_MIN(nbytes, nunwritten),
+                                offset);
+    if (nread > 0)
+        ctx->wp += nread;
+
+    return nread;
+}
+
+/* Without tee(2), fan-out members get copies of the group's data; the file is
+   still read only once */
+ssize_t fio_tee(struct fio_ctx* from, struct fio_ctx* to, const bool move)
+{
+    assert (to->rp == to->wp);
+
+    const size_t n = SFD_MIN((size_t)(from->wp - from->rp), to->capacity);
+
+    to->rp = to->data;
+    memcpy(to->data, from->rp, n);
+    to->wp = to->data + n;
+
+    if (move) {
+        from->rp += n;
+        if (from->rp == from->wp)
+            from->rp = from->wp = from->data;
+    }
+
+    return (ssize_t)n;
+}
+
+ssize_t fio_flush(struct fio_ctx* ctx, const int fd_out, const size_t nbytes)
+{
+    assert (nbytes > 0);
+
+    const ssize_t nwritten = write(fd_out, ctx->rp,
+                                   SFD_MIN(nbytes, (size_t)(ctx->wp - ctx->rp)));
+    if (nwritten > 0) {
+        ctx->rp += (size_t)nwritten;
+        if (ctx->rp == ctx->wp)
+            ctx->rp = ctx->wp = ctx->data;
+    }
+
+    return nwritten;
+}
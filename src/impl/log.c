@@ -28,10 +28,86 @@
 #define _BSD_SOURCE
 #endif
 
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "log.h"
 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/* ------------- Asynchronous ring -------------- */
+
+/* Must be a power of two */
+#define RING_NSLOTS 256
+/* Longer messages are truncated */
+#define MSG_MAX 256
+
+/* How often the flusher thread wakes up to drain the ring if not signalled */
+#define FLUSH_INTERVAL_NS (50 * 1000 * 1000)
+
+/*
+  A bounded multi-producer ring (cf. Dmitry Vyukov's bounded MPMC queue) with
+  a single consumer, the flusher thread. A slot is free for the producer at
+  position p when its sequence number equals p, and holds a message for the
+  consumer when it equals p + 1.
+*/
+struct ring_slot {
+    size_t seq;
+    int priority;
+    char msg [MSG_MAX];
+};
+
+static struct {
+    struct ring_slot slots [RING_NSLOTS];
+    /* Next position to be claimed by a producer */
+    size_t head;
+    /* Next position to be consumed; accessed by the consumer only */
+    size_t tail;
+    pthread_t flusher;
+    bool async;
+    bool stop;
+} ring;
+
+/* -------------- Rate limiting ---------------- */
+
+/* Must be a power of two. Sites which don't fit are not rate-limited. */
+#define NSITES 64
+
+struct log_site {
+    /* The format string, which identifies the call site */
+    const char* fmt;
+    /* The second in which the current burst started */
+    uint64_t window;
+    /* Number of messages logged during the current window */
+    unsigned n;
+    /* Number of messages suppressed since the last summary */
+    unsigned nsuppressed;
+};
+
+static struct log_site sites [NSITES];
+
+#pragma GCC diagnostic pop
+
+static int level = LOG_DEBUG;
+
+static unsigned long nsuppressed_total;
+static unsigned long ndropped_total;
+
+static bool rate_limit(int priority, const char* fmt);
+static void log_msg(int priority, const char* fmt, va_list args);
+static bool ring_push(int priority, const char* fmt, va_list args);
+static void ring_drain(void);
+static void* flusher_main(void* arg);
+static void expand_errno(char* dst, size_t size, const char* fmt, int err);
+
 void sfd_log_open(const char* ident, int option, int facility)
 {
     openlog(ident, option, facility);
@@ -39,15 +115,301 @@ void sfd_log_open(const char* ident, int option, int facility)
 
 void sfd_log(const int priority, const char* format, ...)
 {
-    va_list args;
-    va_start(args, format);
+    if (LOG_PRI(priority) > __atomic_load_n(&level, __ATOMIC_RELAXED))
+        return;
 
-    vsyslog(priority, format, args);
+    const int err = errno;
 
-    va_end(args);
+    if (!rate_limit(priority, format)) {
+        va_list args;
+        va_start(args, format);
+
+        errno = err;
+        log_msg(priority, format, args);
+
+        va_end(args);
+    }
+
+    errno = err;
 }
 
 void sfd_log_close(void)
 {
+    if (ring.async) {
+        /* Log synchronously from now on; the flusher drains what's left */
+        __atomic_store_n(&ring.async, false, __ATOMIC_RELEASE);
+
+        __atomic_store_n(&ring.stop, true, __ATOMIC_RELEASE);
+        pthread_kill(ring.flusher, SIGUSR1);
+        pthread_join(ring.flusher, NULL);
+
+        ring.stop = false;
+    }
+
     closelog();
 }
+
+bool sfd_log_start_async(void)
+{
+    if (ring.async)
+        return true;
+
+    for (size_t i = 0; i < RING_NSLOTS; i++)
+        ring.slots[i].seq = i;
+    ring.head = ring.tail = 0;
+
+    /* The flusher thread is created with all signals blocked, so that it
+       doesn't receive those meant for the caller (e.g., SIGTERM), and the
+       caller keeps SIGUSR1 and SIGUSR2 blocked so that they are received by
+       the flusher's sigtimedwait(). */
+    sigset_t all, old;
+    sigfillset(&all);
+
+    int err = pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (err != 0) {
+        errno = err;
+        return false;
+    }
+
+    /* Publish before the flusher runs so that the ring is used from now on */
+    __atomic_store_n(&ring.async, true, __ATOMIC_RELEASE);
+
+    err = pthread_create(&ring.flusher, NULL, flusher_main, NULL);
+    if (err != 0)
+        __atomic_store_n(&ring.async, false, __ATOMIC_RELEASE);
+
+    sigaddset(&old, SIGUSR1);
+    sigaddset(&old, SIGUSR2);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err != 0) {
+        errno = err;
+        return false;
+    }
+
+    return true;
+}
+
+void sfd_log_set_level(const int lvl)
+{
+    const int l = (lvl < LOG_EMERG ? LOG_EMERG :
+                   lvl > LOG_DEBUG ? LOG_DEBUG :
+                   lvl);
+
+    __atomic_store_n(&level, l, __ATOMIC_RELAXED);
+}
+
+int sfd_log_level(void)
+{
+    return __atomic_load_n(&level, __ATOMIC_RELAXED);
+}
+
+void sfd_log_get_counters(struct sfd_log_counters* counters)
+{
+    counters->nsuppressed = __atomic_load_n(&nsuppressed_total,
+                                            __ATOMIC_RELAXED);
+    counters->ndropped = __atomic_load_n(&ndropped_total, __ATOMIC_RELAXED);
+}
+
+/* ------------------ Internal implementations ---------------- */
+
+static void log_fmt(const int priority, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+
+    log_msg(priority, fmt, args);
+
+    va_end(args);
+}
+
+static void log_msg(const int priority, const char* fmt, va_list args)
+{
+    if (!__atomic_load_n(&ring.async, __ATOMIC_ACQUIRE)) {
+        vsyslog(priority, fmt, args);
+
+    } else if (!ring_push(priority, fmt, args)) {
+        __atomic_fetch_add(&ndropped_total, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+  Returns true if the message should be suppressed. Approximate under
+  concurrency, which is good enough for its purpose.
+*/
+static bool rate_limit(const int priority, const char* fmt)
+{
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        return false;
+
+    const uintptr_t h = ((uintptr_t)fmt >> 3) * 0x9E3779B97F4A7C15u;
+
+    struct log_site* site = NULL;
+
+    for (size_t i = 0; i < NSITES; i++) {
+        struct log_site* const s = &sites[(h + i) & (NSITES - 1)];
+        const char* cur = __atomic_load_n(&s->fmt, __ATOMIC_ACQUIRE);
+
+        if (!cur &&
+            __atomic_compare_exchange_n(&s->fmt, &cur, fmt, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            cur = fmt;
+        }
+
+        if (cur == fmt) {
+            site = s;
+            break;
+        }
+    }
+
+    if (!site)
+        return false;
+
+    const uint64_t sec = (uint64_t)now.tv_sec;
+
+    if (__atomic_load_n(&site->window, __ATOMIC_RELAXED) != sec) {
+        __atomic_store_n(&site->window, sec, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->n, 0, __ATOMIC_RELAXED);
+
+        const unsigned nsuppressed = __atomic_exchange_n(&site->nsuppressed, 0,
+                                                         __ATOMIC_RELAXED);
+        if (nsuppressed > 0) {
+            char buf [MSG_MAX];
+            strncpy(buf, fmt, sizeof(buf) - 1);
+            buf[sizeof(buf) - 1] = '\0';
+            buf[strcspn(buf, "\n")] = '\0';
+
+            log_fmt(priority, "(%u similar messages suppressed: \"%s\")\n",
+                    nsuppressed, buf);
+        }
+    }
+
+    if (__atomic_fetch_add(&site->n, 1, __ATOMIC_RELAXED) < SFD_LOG_BURST)
+        return false;
+
+    __atomic_fetch_add(&site->nsuppressed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&nsuppressed_total, 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+static bool ring_push(const int priority, const char* fmt, va_list args)
+{
+    size_t pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+    struct ring_slot* slot;
+
+    for (;;) {
+        slot = &ring.slots[pos & (RING_NSLOTS - 1)];
+
+        const size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring.head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;       /* Full */
+        } else {
+            pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+        }
+    }
+
+    /* %m has to be expanded here, where errno is still meaningful */
+    char fmt_buf [MSG_MAX];
+    expand_errno(fmt_buf, sizeof(fmt_buf), fmt, errno);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    vsnprintf(slot->msg, sizeof(slot->msg), fmt_buf, args);
+#pragma GCC diagnostic pop
+
+    slot->priority = priority;
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static void ring_drain(void)
+{
+    for (;;) {
+        struct ring_slot* const slot =
+            &ring.slots[ring.tail & (RING_NSLOTS - 1)];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring.tail + 1)
+            return;
+
+        syslog(slot->priority, "%s", slot->msg);
+
+        __atomic_store_n(&slot->seq, ring.tail + RING_NSLOTS, __ATOMIC_RELEASE);
+        ring.tail++;
+    }
+}
+
+static void* flusher_main(void* arg)
+{
+    (void)arg;
+
+    sigset_t sigmask;
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGUSR1);
+    sigaddset(&sigmask, SIGUSR2);
+
+    const struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = FLUSH_INTERVAL_NS
+    };
+
+    while (!__atomic_load_n(&ring.stop, __ATOMIC_ACQUIRE)) {
+        const int sig = sigtimedwait(&sigmask, NULL, &interval);
+
+        /* (SIGUSR1 is also used by sfd_log_close() to wake this thread) */
+        if ((sig == SIGUSR1 &&
+             !__atomic_load_n(&ring.stop, __ATOMIC_ACQUIRE)) ||
+            sig == SIGUSR2) {
+            sfd_log_set_level(sfd_log_level() + (sig == SIGUSR1 ? 1 : -1));
+            log_fmt(LOG_NOTICE, "Log level changed to %d\n", sfd_log_level());
+        }
+
+        ring_drain();
+    }
+
+    ring_drain();
+
+    return NULL;
+}
+
+/* Copies a format string, replacing %m with the description of an errno
+   value (escaped so as to be printed verbatim) */
+static void expand_errno(char* dst, const size_t size, const char* fmt,
+                         const int err)
+{
+    const char* const errstr = strerror(err);
+    size_t n = 0;
+
+    for (const char* p = fmt; *p && n < size - 1; p++) {
+        if (p[0] == '%' && p[1] == 'm') {
+            for (const char* e = errstr; *e && n < size - 2; e++) {
+                if (*e == '%')
+                    dst[n++] = '%';
+                dst[n++] = *e;
+            }
+            p++;
+
+        } else if (p[0] == '%' && p[1] == '%') {
+            if (n >= size - 2)
+                break;
+            dst[n++] = *p++;
+            dst[n++] = *p;
+
+        } else {
+            dst[n++] = *p;
+        }
+    }
+
+    dst[n] = '\0';
+}
@@ -35,23 +35,74 @@
 /**
    @file
    @ingroup mod_log
+
+   Messages are rate-limited per call site (i.e., per format string): each
+   site may log a burst of SFD_LOG_BURST messages per second, after which its
+   messages are suppressed (and counted) until the next second, when a summary
+   of the suppressed messages is logged.
+
+   By default messages are written synchronously. Once sfd_log_start_async()
+   has been called they are instead formatted into a lock-free ring and
+   written to the system log by a dedicated thread, so that a slow or blocked
+   syslog socket never stalls the caller. Messages are dropped (and counted)
+   if the ring is full.
  */
 
 #ifndef SFD_LOG_H_INCLUDED
 #define SFD_LOG_H_INCLUDED
 
+#include <stdbool.h>
 #include <syslog.h>             /* For constants such as LOG_INFO, etc. */
 
+/** Number of messages per second which may be logged by a call site before
+    its messages are suppressed */
+#define SFD_LOG_BURST 20
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+    /** Counters of messages which were not logged */
+    struct sfd_log_counters {
+        /** Messages suppressed by the rate limiter */
+        unsigned long nsuppressed;
+        /** Messages dropped because the asynchronous ring was full */
+        unsigned long ndropped;
+    };
+
     void sfd_log_open(const char* ident, int option, int facility);
 
     void sfd_log(int priority, const char* format, ...);
 
+    /**
+       Stops the flusher thread, if any, after it has written all pending
+       messages, and closes the system log.
+    */
     void sfd_log_close(void);
 
+    /**
+       Starts writing messages from a dedicated thread.
+
+       Blocks SIGUSR1 and SIGUSR2 in the calling thread (and therefore in
+       threads it subsequently creates). The flusher thread accepts these
+       signals and, respectively, increments and decrements the log level.
+
+       @retval true Success
+       @retval false Couldn't create the thread--check @c errno(3)
+    */
+    bool sfd_log_start_async(void);
+
+    /**
+       Sets the log level: messages with a priority numerically greater than
+       (i.e., less important than) @a level are discarded. The default is
+       LOG_DEBUG.
+    */
+    void sfd_log_set_level(int level);
+
+    int sfd_log_level(void);
+
+    void sfd_log_get_counters(struct sfd_log_counters* counters);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,266 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "util.h"
+
+static struct sfd_stats private_stats;
+
+struct sfd_stats* sfd_metrics = &private_stats;
+
+/* Name of the shared-memory segment, if one has been opened */
+static char shm_name[NAME_MAX + 1];
+
+static int create_segment(const char* name);
+
+bool metrics_open(const char* srvname, const uid_t uid, const gid_t gid)
+{
+    assert (sfd_metrics == &private_stats);
+
+    if (stats_shm_name(shm_name, sizeof(shm_name), srvname) == -1)
+        return false;
+
+    const int fd = create_segment(shm_name);
+    if (fd == -1)
+        goto fail1;
+
+    if (ftruncate(fd, sizeof(struct sfd_stats)) == -1)
+        goto fail2;
+
+    /* Will fail if not running as root, in which case the owner is already
+       correct */
+    (void)fchown(fd, uid, gid);
+
+    void* const p = mmap(NULL, sizeof(struct sfd_stats),
+                         PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd, 0);
+    if (p == MAP_FAILED)
+        goto fail2;
+
+    close(fd);
+
+    struct sfd_stats* const stats = p;
+
+    *stats = (struct sfd_stats) {
+        .magic = SFD_STATS_MAGIC,
+        .version = SFD_STATS_VERSION,
+        .size = sizeof(*stats),
+        .pid = getpid(),
+        .start_time = time(NULL)
+    };
+
+    sfd_metrics = stats;
+
+    return true;
+
+ fail2:
+    PRESERVE_ERRNO(close(fd));
+    PRESERVE_ERRNO(shm_unlink(shm_name));
+ fail1:
+    shm_name[0] = '\0';
+
+    return false;
+}
+
+void metrics_close(void)
+{
+    if (sfd_metrics != &private_stats) {
+        munmap(sfd_metrics, sizeof(*sfd_metrics));
+
+        /* Fails if the server has chroot(2)ed; the next instance of the same
+           name will replace the segment */
+        if (shm_unlink(shm_name) == -1)
+            sfd_log(LOG_NOTICE, "Couldn't remove statistics segment [%m]\n");
+
+        shm_name[0] = '\0';
+        sfd_metrics = &private_stats;
+    }
+}
+
+bool metrics_adopt(const char* srvname, const uid_t uid, const gid_t gid)
+{
+    assert (sfd_metrics == &private_stats);
+
+    if (stats_shm_name(shm_name, sizeof(shm_name), srvname) == -1)
+        return false;
+
+    const int fd = shm_open(shm_name, O_RDWR, 0);
+    if (fd == -1) {
+        shm_name[0] = '\0';
+        return (errno == ENOENT && metrics_open(srvname, uid, gid));
+    }
+
+    struct stat st;
+    void* p = MAP_FAILED;
+
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == sizeof(struct sfd_stats)) {
+        p = mmap(NULL, sizeof(struct sfd_stats),
+                 PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+    }
+
+    close(fd);
+
+    const struct sfd_stats* const stats = p;
+
+    if (p == MAP_FAILED ||
+        stats->magic != SFD_STATS_MAGIC ||
+        stats->version != SFD_STATS_VERSION ||
+        stats->size != sizeof(*stats)) {
+        /* The old server keeps its mapping of the replaced segment */
+        sfd_log(LOG_NOTICE, "Replacing incompatible statistics segment %s\n",
+                shm_name);
+
+        if (p != MAP_FAILED)
+            munmap(p, sizeof(struct sfd_stats));
+
+        if (shm_unlink(shm_name) == -1) {
+            shm_name[0] = '\0';
+            return false;
+        }
+
+        shm_name[0] = '\0';
+        return metrics_open(srvname, uid, gid);
+    }
+
+    sfd_metrics = p;
+
+    return true;
+}
+
+void metrics_claim(void)
+{
+    if (sfd_metrics != &private_stats)
+        __atomic_store_n(&sfd_metrics->pid, (int64_t)getpid(), __ATOMIC_RELAXED);
+}
+
+void metrics_detach(void)
+{
+    if (sfd_metrics != &private_stats) {
+        munmap(sfd_metrics, sizeof(*sfd_metrics));
+
+        shm_name[0] = '\0';
+        sfd_metrics = &private_stats;
+    }
+}
+
+void metrics_hist_add(struct sfd_stats_hist* h, const uint64_t usecs)
+{
+    unsigned idx = 0;
+
+    if (usecs > 1) {
+        idx = (unsigned)(sizeof(unsigned long long) * CHAR_BIT - 1) -
+            (unsigned)__builtin_clzll(usecs);
+
+        if (idx >= SFD_STATS_HIST_NBUCKETS)
+            idx = SFD_STATS_HIST_NBUCKETS - 1;
+    }
+
+    __atomic_store_n(&h->buckets[idx], h->buckets[idx] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum_us, h->sum_us + usecs, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000);
+}
+
+/* --------------- (Uninteresting) Internal implementations ------------- */
+
+/**
+   Returns true if the segment was created by a process which is still
+   running.
+*/
+static bool segment_in_use(const char* name);
+
+static int create_segment(const char* name)
+{
+    const mode_t mode = S_IRUSR | S_IRGRP;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+
+    if (fd == -1 && errno == EEXIST) {
+        if (segment_in_use(name)) {
+            errno = EADDRINUSE;
+            return -1;
+        }
+
+        sfd_log(LOG_NOTICE, "Replacing stale statistics segment %s\n", name);
+
+        if (shm_unlink(name) == -1)
+            return -1;
+
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+    }
+
+    return fd;
+}
+
+static bool segment_in_use(const char* name)
+{
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct sfd_stats)) {
+        close(fd);
+        return false;
+    }
+
+    const struct sfd_stats* const stats = mmap(NULL, sizeof(*stats),
+                                               PROT_READ, MAP_SHARED,
+                                               fd, 0);
+    close(fd);
+
+    if (stats == MAP_FAILED)
+        return false;
+
+    const pid_t pid = (stats->magic == SFD_STATS_MAGIC ? (pid_t)stats->pid : 0);
+
+    munmap((void*)stats, sizeof(*stats));
+
+    return (pid > 0 && (kill(pid, 0) == 0 || errno == EPERM));
+}
@@ -0,0 +1,131 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   @file
+
+   Server-side statistics registry.
+
+   The statistics live in a shared-memory segment (cf. metrics_open()) so that
+   they can be sampled by other processes without the server's involvement. If
+   no segment has been opened (e.g., the server is running in a thread of a
+   test process) the statistics are kept in a private instance instead.
+
+   The server is the sole writer, so updates are plain (relaxed atomic) loads
+   and stores rather than read-modify-write operations.
+*/
+
+#ifndef SFD_METRICS_H
+#define SFD_METRICS_H
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../stats.h"
+
+/** Adds @a n to a field of the current statistics */
+#define METRIC_ADD(field, n)                                            \
+    __atomic_store_n(&sfd_metrics->field,                               \
+                     __atomic_load_n(&sfd_metrics->field,               \
+                                     __ATOMIC_RELAXED) + (uint64_t)(n), \
+                     __ATOMIC_RELAXED)
+
+#define METRIC_INC(field) METRIC_ADD(field, 1)
+
+#define METRIC_DEC(field) METRIC_ADD(field, -1)
+
+/** Sets a field (a gauge) of the current statistics to @a n */
+#define METRIC_SET(field, n)                                            \
+    __atomic_store_n(&sfd_metrics->field, (uint64_t)(n), __ATOMIC_RELAXED)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /** The statistics being updated */
+    extern struct sfd_stats* sfd_metrics;
+
+    /**
+       Creates the named server instance's statistics segment and starts
+       updating it instead of the private instance.
+
+       A segment left behind by a server which is no longer running is
+       replaced.
+
+       @param uid The owner of the segment
+       @param gid The group of the segment
+    */
+    bool metrics_open(const char* srvname, uid_t uid, gid_t gid);
+
+    /**
+       Removes the statistics segment, if any, and reverts to updating the
+       private instance.
+    */
+    void metrics_close(void);
+
+    /**
+       Starts updating the statistics segment of a running server instance
+       which is about to hand over to this process (cf. server_handover.h), so
+       that the statistics carry on across the handover.
+
+       The segment is replaced (and its statistics reset) if its layout differs
+       from this process's; it is created if it does not exist.
+
+       @note The segment's owner (cf. struct sfd_stats.pid) is not changed until
+       metrics_claim() is called.
+    */
+    bool metrics_adopt(const char* srvname, uid_t uid, gid_t gid);
+
+    /** Records this process as the owner of the statistics segment */
+    void metrics_claim(void);
+
+    /**
+       Stops updating the statistics segment, if any, without removing it, and
+       reverts to updating the private instance.
+    */
+    void metrics_detach(void);
+
+    /** Adds a sample (in microseconds) to a histogram */
+    void metrics_hist_add(struct sfd_stats_hist*, uint64_t usecs);
+
+    /** Returns a monotonic timestamp, in microseconds */
+    uint64_t metrics_now_us(void);
+
+    /**
+       Writes the name of a server instance's statistics segment to @a buf.
+
+       @retval -1 The name was too long (@c errno is set to ENAMETOOLONG)
+    */
+    int stats_shm_name(char* buf, size_t size, const char* srvname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
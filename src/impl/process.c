@@ -32,6 +32,7 @@
 #include <sys/stat.h>
 
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -42,6 +43,8 @@
 
 static bool dup_to_open_fd(int srcfd, int dstfd);
 
+static void close_fds(unsigned first, unsigned last, unsigned limit);
+
 bool proc_init_child(const int* excluded_fds, size_t nfds)
 {
     /* Redirect stdin, stdout, and stderr to /dev/null */
@@ -60,7 +63,13 @@ bool proc_init_child(const int* excluded_fds, size_t nfds)
 
     close(nullfd);
 
-    /* Close all other file descriptors except the specified ones */
+    return proc_close_fds(excluded_fds, nfds);
+}
+
+bool proc_close_fds(const int* excluded_fds, const size_t nfds)
+{
+    /* Close all other file descriptors except the specified ones, one range
+       (i.e., the gap between two excluded descriptors) at a time */
     struct rlimit rl;
 
     if (getrlimit(RLIMIT_NOFILE, &rl) == -1) {
@@ -71,24 +80,44 @@ bool proc_init_child(const int* excluded_fds, size_t nfds)
     if (rl.rlim_max == RLIM_INFINITY)
         rl.rlim_max = 1024;
 
-    for (int fd = STDERR_FILENO + 1; fd < (int)rl.rlim_max; fd++) {
-        bool excluded = false;
+    unsigned first = STDERR_FILENO + 1;
+
+    for (;;) {
+        /* The lowest excluded descriptor at or above 'first' */
+        unsigned next = UINT_MAX;
 
-        /* Check whether fd is in exclusion list */
         for (size_t i = 0; i < nfds; i++) {
-            if (fd == excluded_fds[i]) {
-                excluded = true;
-                break;
+            if (excluded_fds[i] >= 0 &&
+                (unsigned)excluded_fds[i] >= first &&
+                (unsigned)excluded_fds[i] < next) {
+                next = (unsigned)excluded_fds[i];
             }
         }
 
-        if (!excluded)
-            close(fd);
+        if (next > first)
+            close_fds(first, (next == UINT_MAX ? UINT_MAX : next - 1),
+                      (unsigned)rl.rlim_max);
+
+        if (next == UINT_MAX)
+            break;
+
+        first = next + 1;
     }
 
     return true;
 }
 
+static void close_fds(const unsigned first, const unsigned last,
+                      const unsigned limit)
+{
+    if (sfd_close_range(first, last) == 0)
+        return;
+
+    /* No close_range(2); close the descriptors below the limit one by one */
+    for (unsigned fd = first; fd <= last && fd < limit; fd++)
+        close((int)fd);
+}
+
 static bool dup_to_open_fd(const int oldfd, const int newfd)
 {
     /* As per Linux's dup(2) manpage, closing newfd manually catches errors that
@@ -43,13 +43,23 @@ static const int PROC_SYNCFD = 3;
    Performs setup common to child server processes.
 
    Redirects stdin, stdout, and stderr to /dev/null, and closes all other file
-   descriptors, excluding those in @a excluded_fds.
+   descriptors, excluding those in @a excluded_fds (using close_range(2), if
+   available, rather than a close(2) call per possible descriptor).
 
    'Child processes' in this context means ones forked by sfd_spawn() and ones
    going into daemon mode.
 */
 bool proc_init_child(const int* excluded_fds, size_t nfds);
 
+/**
+   Closes all file descriptors other than stdin, stdout, stderr, and those in
+   @a excluded_fds.
+
+   For processes whose standard streams are to be left as they are, e.g., ones
+   started by a supervisor.
+*/
+bool proc_close_fds(const int* excluded_fds, size_t nfds);
+
 /** @todo Will probably need to be platform-specific because the glibc and
     FreeBSD implementations apparently differ significantly. */
 bool proc_daemonise(const int* noclose_fds, const size_t nfds);
@@ -47,13 +47,22 @@ enum prot_cmd_req {
     /* Send a previously-opened file */
     PROT_CMD_SEND_OPEN = 0x04,
     /* Close an open file (undoes PROT_CMD_FILE_OPEN) */
-    PROT_CMD_CANCEL = 0x05
+    PROT_CMD_CANCEL = 0x05,
+    /* Hand the request socket and all transfers over to the sender (a new
+       server process; cf. server_handover.h) */
+    PROT_CMD_HANDOVER = 0x06,
+    /* Send a range of an open file handle (cf. PROT_REQ_HANDLE), leaving the
+       handle open */
+    PROT_CMD_SEND_RANGE = 0x07,
+    /* Move data from a client-provided source descriptor (socket or pipe) to
+       a destination descriptor */
+    PROT_CMD_PUMP = 0x08
 };
 
 #define PROT_IS_REQUEST(cmd) (((cmd) & 0x80) == 0)
 
 /* Maximum number of file descriptors transferred in a single message */
-#define PROT_MAXFDS 2
+#define PROT_MAXFDS 3
 
 #define PROT_FILENAME_MAX 512   /* Excludes the terminating '\0' */
 
@@ -73,16 +82,36 @@ struct prot_hdr {
 /* ------------- File Operation Request PDU ------------ */
 
 /**
-   A request PDU.
+   A request PDU, as unmarshalled.
 
-   This is currently the only PDU type which is not sent over the 'wire' as-is
-   (bit-by-bit). The 'wire format' looks something like this:
-   CSOOOOOOOOLLLLLLLLFFFFF0, where C = cmd; D = stat; O = offset bytes; L =
-   transfer length bytes; F = filename characters; 0 = filename-terminating
-   NUL. NOTE that the filename_len field is not transmitted.
+   This is the only PDU type which is not sent over the 'wire' as-is
+   (bit-by-bit). There are two wire formats, told apart by the version byte
+   (PROT_REQ_VERSION_OFFSET):
+
+   - Version 1 (version byte zero, since it used to be padding) is this
+     structure's memory layout up to and including @a len, followed by the
+     filename: CSGxPPPPOOOOOOOOLLLLLLLLFFFFF0, where C = cmd; S = stat; G =
+     flags; x = padding; P = progress notification interval; O = offset bytes;
+     L = transfer length bytes; F = filename characters; 0 = filename-terminating
+     NUL. It therefore depends on the sender's ABI. Sent by old clients, and
+     by the client library for requests which need nothing newer, so that they
+     are understood by old servers (cf. prot_marshal_request_hdr_compat()).
+
+   - Version 2 (PROT_VERSION) has fixed-width, little-endian fields:
+     CSGVEExxOOOOOOOOLLLLLLLLKKKKKKKK, where V = version; E = extension area
+     length; K = request cookie, followed by the extension area (TLVs; cf. enum
+     prot_req_ext) and the filename with its terminating NUL.
+
+   NOTE that the filename_len field is not transmitted.
 */
 struct prot_request {
     PROT_HDR_FIELDS;
+    /* Request flags (PROT_REQ_*). Occupies what used to be padding. */
+    uint8_t flags;
+    /* Minimum number of bytes (or milliseconds, with PROT_REQ_PROGRESS_MS)
+       between transfer status notifications; zero for one whenever the
+       destination is full. Occupies what used to be padding. */
+    uint32_t progress;
     /* Offset from the beginning of the file to start reading from */
     off_t offset;
     /* Number of bytes to transfer */
@@ -92,8 +121,103 @@ struct prot_request {
     const char* filename;
     /* The filename length (not sent--for convenience only) */
     size_t filename_len;
+
+    /* Opaque client-supplied value, echoed in Transfer Statistics PDUs
+       (version 2 only) */
+    uint64_t cookie;
+
+    /* Request flags which do not fit into @a flags (PROT_REQX_*; version 2
+       only) */
+    uint32_t ext_flags;
+
+    /* How the file is going to be read (enum prot_access; version 2 only) */
+    uint8_t access;
+
+    /* The wire format version the request was received in, which its
+       responses are sent in (not sent--set when unmarshalled) */
+    uint8_t version;
 };
 
+/** Request flags */
+enum prot_req_flags {
+    /* Send a Transfer Statistics PDU instead of the regular transfer completion
+       notification (struct sfd_xfer_stat) */
+    PROT_REQ_XFER_STATS = 0x01,
+    /* Send File without a status channel: only the destination descriptor is
+       passed, no response is ever written and errors close the destination */
+    PROT_REQ_NO_STAT = 0x02,
+    /* Don't send any (non-terminal) transfer status notifications */
+    PROT_REQ_NO_PROGRESS = 0x04,
+    /* The progress notification interval is in milliseconds, not bytes */
+    PROT_REQ_PROGRESS_MS = 0x08,
+    /* Open File only: open a reusable file handle which is not consumed by a
+       send (cf. PROT_CMD_SEND_RANGE) and stays open until it is cancelled or
+       has been idle for the open file timeout */
+    PROT_REQ_HANDLE = 0x10,
+    /* Send File/Send Range only: if a pipelined transfer to the same
+       destination (open file description) is running, start only once it has
+       completed, instead of writing to the destination concurrently */
+    PROT_REQ_PIPELINE = 0x20,
+    /* Send File only: share the reading of the file with concurrent sends of
+       the same range which ask for it, too (cf. PROT_REQ_PIPELINE, with which
+       it is ignored) */
+    PROT_REQ_FANOUT = 0x40,
+    /* Send File/Send Range only, to a regular file: copy the range in
+       segments, several at a time (cf. struct copy_pool) */
+    PROT_REQ_PARALLEL = 0x80
+};
+
+/** Request flags carried by the PROT_EXT_FLAGS extension */
+enum prot_req_ext_flags {
+    /* Send File only, to a socket or pipe: read the file with direct I/O,
+       bypassing the page cache (cf. struct dio_stream) */
+    PROT_REQX_DIRECT = 0x01,
+    /* Send File/Open File only: if the request has to wait for room for
+       another transfer, say so (struct sfd_req_queued) */
+    PROT_REQX_QUEUED = 0x02
+};
+
+/** Access hints carried by the PROT_EXT_ACCESS extension; the same values as
+    enum sfd_access_hint's */
+enum prot_access {
+    PROT_ACCESS_NORMAL = 0,
+    PROT_ACCESS_SEQUENTIAL = 1,
+    PROT_ACCESS_RANDOM = 2,
+    PROT_ACCESS_WILLNEED = 3,
+    PROT_ACCESS_NOREUSE = 4
+};
+
+/** The current request wire format version */
+#define PROT_VERSION 2
+
+/** Where the version byte is in all request wire formats */
+#define PROT_REQ_VERSION_OFFSET 3
+
+/**
+   Version 2 request extensions.
+
+   Each is a one-byte type, a one-byte value length and the value. Unknown
+   types are skipped, so that new ones can be added without a version change.
+*/
+enum prot_req_ext {
+    /* Progress notification interval (struct prot_request::progress); 4 bytes */
+    PROT_EXT_PROGRESS = 0x01,
+    /* More request flags (struct prot_request::ext_flags); 4 bytes */
+    PROT_EXT_FLAGS = 0x02,
+    /* Access hint (struct prot_request::access); 1 byte */
+    PROT_EXT_ACCESS = 0x03
+};
+
+/* Size of the fixed part of a version 2 request */
+#define PROT_REQ_V2_HDR_SIZE 32
+
+/* Maximum size of a version 2 request's extension area */
+#define PROT_REQ_EXT_MAX 256
+
+/* Maximum size of a version 2 request, not counting the filename */
+#define PROT_REQ_V2_HDR_MAXSIZE (PROT_REQ_V2_HDR_SIZE + PROT_REQ_EXT_MAX)
+
+/* Size of the fixed part of a version 1 request */
 #define PROT_REQ_BASE_SIZE (offsetof(struct prot_request, len) +        \
                             sizeof(((struct prot_request*)NULL)->len))
 
@@ -101,7 +225,7 @@ struct prot_request {
 #define PROT_REQ_MINSIZE PROT_REQ_BASE_SIZE + 1 + 1
 
 /* Maximum size of a file operation request PDU */
-#define PROT_REQ_MAXSIZE (sizeof(struct prot_request) + \
+#define PROT_REQ_MAXSIZE (sizeof(struct prot_request) + PROT_REQ_EXT_MAX + \
                           PROT_FILENAME_MAX + 1)
 
 /* -------------- 'Send Open File' PDU --------------- */
@@ -111,6 +235,71 @@ struct prot_send_open {
     size_t txnid;
 };
 
+/* -------------- 'Send Range of Open File' PDU --------------- */
+
+/**
+   A Send Range PDU, as unmarshalled.
+
+   Sent in the version 2 wire format only, with fixed-width, little-endian
+   fields: CSGVEExxTTTTTTTTOOOOOOOOLLLLLLLLKKKKKKKK, where C = cmd; S = stat; G =
+   flags; V = version; E = extension area length; x = padding; T = handle
+   transaction ID; O = offset; L = length; K = request cookie, followed by the
+   extension area (cf. enum prot_req_ext; only PROT_EXT_PROGRESS applies).
+*/
+struct prot_send_range {
+    PROT_HDR_FIELDS;
+    /* Request flags (PROT_REQ_XFER_STATS, PROT_REQ_NO_PROGRESS,
+       PROT_REQ_PROGRESS_MS, PROT_REQ_PIPELINE) */
+    uint8_t flags;
+    /* Progress notification interval (cf. struct prot_request) */
+    uint32_t progress;
+    /* The open file handle's transaction ID */
+    size_t txnid;
+    /* Offset from the beginning of the file to start reading from */
+    off_t offset;
+    /* Number of bytes to send; zero for up to the end of the file */
+    size_t len;
+    /* Opaque client-supplied value, echoed in Transfer Statistics PDUs */
+    uint64_t cookie;
+};
+
+/* Size of the fixed part of a Send Range PDU */
+#define PROT_SEND_RANGE_SIZE 40
+
+/* Maximum size of a Send Range PDU */
+#define PROT_SEND_RANGE_MAXSIZE (PROT_SEND_RANGE_SIZE + PROT_REQ_EXT_MAX)
+
+/* -------------- 'Pump' PDU --------------- */
+
+/**
+   A Pump PDU, as unmarshalled. Sent with the status channel, destination and
+   source descriptors, in that order.
+
+   Sent in the version 2 wire format only, with fixed-width, little-endian
+   fields: CSGVEExxLLLLLLLLKKKKKKKK, where C = cmd; S = stat; G = flags; V =
+   version; E = extension area length; x = padding; L = length; K = request
+   cookie, followed by the extension area (cf. enum prot_req_ext; only
+   PROT_EXT_PROGRESS applies).
+*/
+struct prot_pump {
+    PROT_HDR_FIELDS;
+    /* Request flags (PROT_REQ_XFER_STATS, PROT_REQ_NO_PROGRESS,
+       PROT_REQ_PROGRESS_MS, PROT_REQ_PIPELINE) */
+    uint8_t flags;
+    /* Progress notification interval (cf. struct prot_request) */
+    uint32_t progress;
+    /* Number of bytes to move; zero for up to the source's end-of-file */
+    size_t len;
+    /* Opaque client-supplied value, echoed in Transfer Statistics PDUs */
+    uint64_t cookie;
+};
+
+/* Size of the fixed part of a Pump PDU */
+#define PROT_PUMP_SIZE 24
+
+/* Maximum size of a Pump PDU */
+#define PROT_PUMP_MAXSIZE (PROT_PUMP_SIZE + PROT_REQ_EXT_MAX)
+
 /* -------------- 'Close Open File' PDU -------------- */
 
 struct prot_cancel {
@@ -122,6 +311,26 @@ struct prot_cancel {
     notification to indicate a complete transfer */
 #define PROT_XFER_COMPLETE (size_t)-1
 
+/* ------------------ Response PDUs ------------- */
+
+/**
+   Where the version byte is in all response wire formats (other than in error
+   responses, which are headers only).
+
+   Responses (struct sfd_file_info, etc.) are sent in the wire format version
+   of the request they respond to (struct prot_request::version; Send Range and
+   Pump requests are always version 2):
+
+   - Version 1 (version byte zero, since it used to be padding) is the response
+     structure's memory layout, and therefore depends on the server's ABI.
+
+   - Version 2 (PROT_VERSION) is CSVxxxxx, where C = cmd; S = stat; V =
+     version; x = padding, followed by the body's fields in the order in which
+     the structure declares them, each a little-endian 64-bit integer. The
+     sizes are SFD_FILE_INFO_SIZE, etc.
+*/
+#define PROT_RESP_VERSION_OFFSET 2
+
 #pragma GCC diagnostic pop
 
 #endif
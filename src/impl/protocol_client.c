@@ -102,6 +102,108 @@ bool prot_marshal_send(struct prot_request* req,
                        filename);
 }
 
+static void store_le16(uint8_t* p, const uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void store_le32(uint8_t* p, const uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void store_le64(uint8_t* p, const uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+/**
+   Encodes a version 2 PDU's extension area, sending only the extensions which
+   differ from their defaults.
+
+   @return The extension area's size
+*/
+static size_t marshal_exts(uint8_t* const buf,
+                           const uint32_t progress,
+                           const uint32_t ext_flags,
+                           const uint8_t access)
+{
+    uint8_t* ext = buf;
+
+    if (progress > 0) {
+        ext[0] = PROT_EXT_PROGRESS;
+        ext[1] = 4;
+        store_le32(ext + 2, progress);
+        ext += 2 + 4;
+    }
+
+    if (ext_flags != 0) {
+        ext[0] = PROT_EXT_FLAGS;
+        ext[1] = 4;
+        store_le32(ext + 2, ext_flags);
+        ext += 2 + 4;
+    }
+
+    if (access != PROT_ACCESS_NORMAL) {
+        ext[0] = PROT_EXT_ACCESS;
+        ext[1] = 1;
+        ext[2] = access;
+        ext += 2 + 1;
+    }
+
+    return (size_t)(ext - buf);
+}
+
+/** Encodes the part common to all version 2 PDUs' fixed parts */
+static void marshal_v2_hdr(uint8_t* const buf,
+                           const uint8_t cmd,
+                           const uint8_t stat,
+                           const uint8_t flags,
+                           const size_t ext_len)
+{
+    buf[0] = cmd;
+    buf[1] = stat;
+    buf[2] = flags;
+    buf[PROT_REQ_VERSION_OFFSET] = PROT_VERSION;
+    store_le16(buf + 4, (uint16_t)ext_len);
+    store_le16(buf + 6, 0);
+}
+
+size_t prot_marshal_request_hdr(uint8_t* buf, const struct prot_request* req)
+{
+    const size_t ext_len = marshal_exts(buf + PROT_REQ_V2_HDR_SIZE,
+                                        req->progress,
+                                        req->ext_flags,
+                                        req->access);
+
+    marshal_v2_hdr(buf, req->cmd, req->stat, req->flags, ext_len);
+    store_le64(buf + 8, (uint64_t)req->offset);
+    store_le64(buf + 16, req->len);
+    store_le64(buf + 24, req->cookie);
+
+    return PROT_REQ_V2_HDR_SIZE + ext_len;
+}
+
+size_t prot_marshal_request_hdr_compat(uint8_t* buf,
+                                       const struct prot_request* req)
+{
+    if (req->cookie != 0 ||
+        req->ext_flags != 0 ||
+        req->access != PROT_ACCESS_NORMAL) {
+        return prot_marshal_request_hdr(buf, req);
+    }
+
+    memcpy(buf, req, PROT_REQ_BASE_SIZE);
+
+    /* The padding between the flags and the progress interval */
+    buf[PROT_REQ_VERSION_OFFSET] = 0;
+
+    return PROT_REQ_BASE_SIZE;
+}
+
 void prot_marshal_send_open(struct prot_send_open* pdu, const size_t txnid)
 {
     memset(pdu, 0, sizeof(*pdu));
@@ -111,6 +213,41 @@ void prot_marshal_send_open(struct prot_send_open* pdu, const size_t txnid)
     pdu->txnid = txnid;
 }
 
+size_t prot_marshal_send_range(uint8_t* buf,
+                               const size_t txnid,
+                               const off_t offset, const size_t len,
+                               const uint8_t flags,
+                               const uint32_t progress,
+                               const uint64_t cookie)
+{
+    const size_t ext_len = marshal_exts(buf + PROT_SEND_RANGE_SIZE,
+                                        progress, 0, PROT_ACCESS_NORMAL);
+
+    marshal_v2_hdr(buf, PROT_CMD_SEND_RANGE, SFD_STAT_OK, flags, ext_len);
+    store_le64(buf + 8, txnid);
+    store_le64(buf + 16, (uint64_t)offset);
+    store_le64(buf + 24, len);
+    store_le64(buf + 32, cookie);
+
+    return PROT_SEND_RANGE_SIZE + ext_len;
+}
+
+size_t prot_marshal_pump(uint8_t* buf,
+                         const size_t len,
+                         const uint8_t flags,
+                         const uint32_t progress,
+                         const uint64_t cookie)
+{
+    const size_t ext_len = marshal_exts(buf + PROT_PUMP_SIZE,
+                                        progress, 0, PROT_ACCESS_NORMAL);
+
+    marshal_v2_hdr(buf, PROT_CMD_PUMP, SFD_STAT_OK, flags, ext_len);
+    store_le64(buf + 8, len);
+    store_le64(buf + 16, cookie);
+
+    return PROT_PUMP_SIZE + ext_len;
+}
+
 void prot_marshal_cancel(struct prot_cancel* pdu, size_t txnid)
 {
     memset(pdu, 0, sizeof(*pdu));
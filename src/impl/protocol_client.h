@@ -46,6 +46,33 @@ extern "C" {
     void prot_marshal_send_open(struct prot_send_open*,
                                 size_t txnid);
 
+    /**
+       Encodes a Send Range PDU (cf. struct prot_send_range).
+
+       @param[out] buf At least PROT_SEND_RANGE_MAXSIZE bytes
+
+       @return The number of bytes written to @a buf
+    */
+    size_t prot_marshal_send_range(uint8_t* buf,
+                                   size_t txnid,
+                                   off_t offset, size_t len,
+                                   uint8_t flags,
+                                   uint32_t progress,
+                                   uint64_t cookie);
+
+    /**
+       Encodes a Pump PDU (cf. struct prot_pump).
+
+       @param[out] buf At least PROT_PUMP_MAXSIZE bytes
+
+       @return The number of bytes written to @a buf
+    */
+    size_t prot_marshal_pump(uint8_t* buf,
+                             size_t len,
+                             uint8_t flags,
+                             uint32_t progress,
+                             uint64_t cookie);
+
     void prot_marshal_cancel(struct prot_cancel*,
                                  size_t txnid);
 
@@ -53,6 +80,31 @@ extern "C" {
                            const char* filename,
                            off_t offset, size_t len);
 
+    /**
+       Encodes a request's fixed part and extension area in the version 2 wire
+       format (cf. struct prot_request).
+
+       The filename, which follows them on the wire, is not copied; it is to be
+       sent from @a req->filename (including its terminating NUL).
+
+       @param[out] buf At least PROT_REQ_V2_HDR_MAXSIZE bytes
+
+       @return The number of bytes written to @a buf
+    */
+    size_t prot_marshal_request_hdr(uint8_t* buf,
+                                    const struct prot_request* req);
+
+    /**
+       Same as prot_marshal_request_hdr(), except that a request which uses
+       none of the version 2 parameters (the cookie, extended flags and access
+       hint) is encoded in the version 1 wire format instead, which servers
+       predating version 2 also understand.
+
+       @param[out] buf At least PROT_REQ_V2_HDR_MAXSIZE bytes
+    */
+    size_t prot_marshal_request_hdr_compat(uint8_t* buf,
+                                           const struct prot_request* req);
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,6 +24,7 @@
   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <assert.h>
 #include <errno.h>
 #include <string.h>
 
@@ -33,8 +34,155 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
 
+/** The values carried by a version 2 PDU's extension area */
+struct exts {
+    uint32_t progress;
+    uint32_t ext_flags;
+    uint8_t access;
+};
+
 #pragma GCC diagnostic pop
 
+static void store_le64(uint8_t* p, const uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint16_t load_le16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t load_le32(const uint8_t* p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint64_t load_le64(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static bool unmarshal_request_v1(struct prot_request* pdu,
+                                 const uint8_t* buf, const size_t size)
+{
+    const size_t fname_len = (size - PROT_REQ_BASE_SIZE - 1);
+
+    if (fname_len > PROT_FILENAME_MAX) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    memcpy(pdu, buf, PROT_REQ_BASE_SIZE);
+
+    /* The rest of the PDU is the filename */
+
+    pdu->filename = (const char*)buf + PROT_REQ_BASE_SIZE;
+    pdu->filename_len = fname_len;
+    pdu->cookie = 0;
+    pdu->ext_flags = 0;
+    pdu->access = PROT_ACCESS_NORMAL;
+    pdu->version = 1;
+
+    return true;
+}
+
+static bool unmarshal_exts(struct exts* exts,
+                           const uint8_t* ext, size_t ext_len)
+{
+    *exts = (struct exts) {
+        .access = PROT_ACCESS_NORMAL
+    };
+
+    while (ext_len >= 2) {
+        const uint8_t type = ext[0];
+        const uint8_t len = ext[1];
+
+        if (len > ext_len - 2)
+            return false;
+
+        switch ((enum prot_req_ext)type) {
+        case PROT_EXT_PROGRESS:
+            if (len != 4)
+                return false;
+            exts->progress = load_le32(ext + 2);
+            break;
+        case PROT_EXT_FLAGS:
+            if (len != 4)
+                return false;
+            exts->ext_flags = load_le32(ext + 2);
+            break;
+        case PROT_EXT_ACCESS:
+            if (len != 1)
+                return false;
+            exts->access = ext[2];
+            break;
+        default:
+            /* Unknown extensions are skipped */
+            break;
+        }
+
+        ext += 2 + len;
+        ext_len -= 2U + len;
+    }
+
+    return (ext_len == 0);
+}
+
+static bool unmarshal_request_v2(struct prot_request* pdu,
+                                 const uint8_t* buf, const size_t size)
+{
+    if (size < PROT_REQ_V2_HDR_SIZE + 1 + 1)
+        return false;
+
+    const size_t ext_len = load_le16(buf + 4);
+
+    if (ext_len > PROT_REQ_EXT_MAX ||
+        size < PROT_REQ_V2_HDR_SIZE + ext_len + 1 + 1) {
+        return false;
+    }
+
+    const size_t fname_offset = PROT_REQ_V2_HDR_SIZE + ext_len;
+    const size_t fname_len = (size - fname_offset - 1);
+
+    if (fname_len > PROT_FILENAME_MAX) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    memset(pdu, 0, sizeof(*pdu));
+
+    pdu->cmd = buf[0];
+    pdu->stat = buf[1];
+    pdu->flags = buf[2];
+    pdu->offset = (off_t)load_le64(buf + 8);
+    pdu->len = (size_t)load_le64(buf + 16);
+    pdu->cookie = load_le64(buf + 24);
+    pdu->version = PROT_VERSION;
+
+    struct exts exts;
+    if (!unmarshal_exts(&exts, buf + PROT_REQ_V2_HDR_SIZE, ext_len))
+        return false;
+
+    pdu->progress = exts.progress;
+    pdu->ext_flags = exts.ext_flags;
+    pdu->access = exts.access;
+
+    /* The rest of the PDU is the filename, pointed to where it is */
+
+    pdu->filename = (const char*)buf + fname_offset;
+    pdu->filename_len = fname_len;
+
+    return true;
+}
+
 bool prot_unmarshal_request(struct prot_request* pdu,
                             const void* buf, const size_t size)
 {
@@ -53,24 +201,32 @@ bool prot_unmarshal_request(struct prot_request* pdu,
         return false;
 
     /* Check that filename is NUL-terminated */
-    if (*((char*)buf + (size - 1)) != '\0')
+    if (*((const char*)buf + (size - 1)) != '\0')
         return false;
 
-    const size_t fname_len = (size - PROT_REQ_BASE_SIZE - 1);
-
-    if (fname_len > PROT_FILENAME_MAX) {
-        errno = ENAMETOOLONG;
+    switch (((const uint8_t*)buf)[PROT_REQ_VERSION_OFFSET]) {
+    case 0:
+        return unmarshal_request_v1(pdu, buf, size);
+    case PROT_VERSION:
+        return unmarshal_request_v2(pdu, buf, size);
+    default:
+        errno = EPROTONOSUPPORT;
         return false;
     }
+}
 
-    memcpy(pdu, buf, PROT_REQ_BASE_SIZE);
-
-    /* The rest of the PDU is the filename */
+int prot_get_req_flags(const void* buf, const size_t size)
+{
+    const int cmd = sfd_get_cmd(buf);
 
-    pdu->filename = (char*)buf + PROT_REQ_BASE_SIZE;
-    pdu->filename_len = fname_len;
+    if ((cmd != PROT_CMD_SEND &&
+         cmd != PROT_CMD_READ &&
+         cmd != PROT_CMD_FILE_OPEN) ||
+        size < PROT_REQ_BASE_SIZE) {
+        return 0;
+    }
 
-    return true;
+    return ((const uint8_t*)buf)[offsetof(struct prot_request, flags)];
 }
 
 bool prot_unmarshal_send_open(struct prot_send_open* pdu, const void* buf)
@@ -85,6 +241,84 @@ bool prot_unmarshal_send_open(struct prot_send_open* pdu, const void* buf)
     return true;
 }
 
+/**
+   Checks a version 2 PDU's command ID, status and version, and unmarshals its
+   extension area, which follows its fixed part of @a hdr_size bytes.
+*/
+static bool unmarshal_v2_hdr(struct exts* exts,
+                             const uint8_t* buf, const size_t size,
+                             const uint8_t cmd, const size_t hdr_size)
+{
+    if (size < hdr_size ||
+        sfd_get_cmd(buf) != cmd ||
+        sfd_get_stat(buf) != SFD_STAT_OK) {
+        return false;
+    }
+
+    if (buf[PROT_REQ_VERSION_OFFSET] != PROT_VERSION) {
+        errno = EPROTONOSUPPORT;
+        return false;
+    }
+
+    const size_t ext_len = load_le16(buf + 4);
+
+    if (ext_len > PROT_REQ_EXT_MAX || size != hdr_size + ext_len)
+        return false;
+
+    return unmarshal_exts(exts, buf + hdr_size, ext_len);
+}
+
+bool prot_unmarshal_send_range(struct prot_send_range* pdu,
+                               const void* buf, const size_t size)
+{
+    const uint8_t* const p = buf;
+    struct exts exts;
+
+    if (!unmarshal_v2_hdr(&exts, p, size,
+                          PROT_CMD_SEND_RANGE, PROT_SEND_RANGE_SIZE)) {
+        return false;
+    }
+
+    memset(pdu, 0, sizeof(*pdu));
+
+    pdu->cmd = p[0];
+    pdu->stat = p[1];
+    pdu->flags = p[2];
+    pdu->progress = exts.progress;
+    pdu->txnid = (size_t)load_le64(p + 8);
+    pdu->offset = (off_t)load_le64(p + 16);
+    pdu->len = (size_t)load_le64(p + 24);
+    pdu->cookie = load_le64(p + 32);
+
+    if (pdu->offset < 0) {
+        errno = EINVAL;
+        return false;
+    }
+
+    return true;
+}
+
+bool prot_unmarshal_pump(struct prot_pump* pdu,
+                         const void* buf, const size_t size)
+{
+    const uint8_t* const p = buf;
+    struct exts exts;
+
+    if (!unmarshal_v2_hdr(&exts, p, size, PROT_CMD_PUMP, PROT_PUMP_SIZE))
+        return false;
+
+    memset(pdu, 0, sizeof(*pdu));
+
+    pdu->cmd = p[0];
+    pdu->stat = p[1];
+    pdu->flags = p[2];
+    pdu->progress = exts.progress;
+    pdu->len = (size_t)load_le64(p + 8);
+    pdu->cookie = load_le64(p + 16);
+
+    return true;
+}
+
 bool prot_unmarshal_cancel(struct prot_cancel* pdu, const void* buf)
 {
     if (sfd_get_cmd(buf) != PROT_CMD_CANCEL ||
@@ -132,3 +366,108 @@ void prot_marshal_xfer_stat(struct sfd_xfer_stat* pdu, const size_t file_size)
     pdu->stat = SFD_STAT_OK;
     pdu->size = file_size;
 }
+
+void prot_marshal_xfer_stats(struct sfd_xfer_stats* pdu,
+                             const uint64_t size,
+                             const uint64_t duration_us,
+                             const uint64_t ttfb_us,
+                             const uint64_t queue_us,
+                             const uint64_t nwrites,
+                             const uint64_t nstalls,
+                             const uint64_t ndeferrals,
+                             const uint64_t cookie)
+{
+    memset(pdu, 0, sizeof(*pdu));
+
+    pdu->cmd = SFD_XFER_STATS;
+    pdu->stat = SFD_STAT_OK;
+    pdu->size = size;
+    pdu->duration_us = duration_us;
+    pdu->ttfb_us = ttfb_us;
+    pdu->queue_us = queue_us;
+    pdu->nwrites = nwrites;
+    pdu->nstalls = nstalls;
+    pdu->ndeferrals = ndeferrals;
+    pdu->cookie = cookie;
+}
+
+size_t prot_marshal_response(uint8_t* buf, const void* pdu, const int version)
+{
+    size_t size;
+    uint64_t fields [8];
+    size_t nfields;
+
+    switch (sfd_get_cmd(pdu)) {
+    case SFD_FILE_INFO: {
+        const struct sfd_file_info* const p = pdu;
+        size = sizeof(*p);
+        fields[0] = p->size;
+        fields[1] = (uint64_t)p->atime;
+        fields[2] = (uint64_t)p->mtime;
+        fields[3] = (uint64_t)p->ctime;
+        fields[4] = p->txnid;
+        nfields = 5;
+    } break;
+
+    case SFD_XFER_STAT: {
+        const struct sfd_xfer_stat* const p = pdu;
+        size = sizeof(*p);
+        /* Keeps PROT_XFER_COMPLETE all-ones where size_t is narrower */
+        fields[0] = (p->size == PROT_XFER_COMPLETE ? UINT64_MAX : p->size);
+        nfields = 1;
+    } break;
+
+    case SFD_XFER_STATS: {
+        const struct sfd_xfer_stats* const p = pdu;
+        size = sizeof(*p);
+        fields[0] = p->size;
+        fields[1] = p->duration_us;
+        fields[2] = p->ttfb_us;
+        fields[3] = p->queue_us;
+        fields[4] = p->nwrites;
+        fields[5] = p->nstalls;
+        fields[6] = p->ndeferrals;
+        fields[7] = p->cookie;
+        nfields = 8;
+    } break;
+
+    case SFD_REQ_QUEUED: {
+        const struct sfd_req_queued* const p = pdu;
+        size = sizeof(*p);
+        fields[0] = p->position;
+        fields[1] = p->max_wait_ms;
+        nfields = 2;
+    } break;
+
+    default:
+        assert (false);
+        return 0;
+    }
+
+    if (version != PROT_VERSION) {
+        memcpy(buf, pdu, size);
+        return size;
+    }
+
+    memset(buf, 0, 8);
+    buf[0] = (uint8_t)sfd_get_cmd(pdu);
+    buf[1] = (uint8_t)sfd_get_stat(pdu);
+    buf[PROT_RESP_VERSION_OFFSET] = PROT_VERSION;
+
+    for (size_t i = 0; i < nfields; i++)
+        store_le64(buf + 8 + 8 * i, fields[i]);
+
+    return 8 + 8 * nfields;
+}
+
+void prot_marshal_req_queued(struct sfd_req_queued* pdu,
+                             const uint64_t position,
+                             const uint64_t max_wait_ms)
+{
+    memset(pdu, 0, sizeof(*pdu));
+
+    pdu->cmd = SFD_REQ_QUEUED;
+    pdu->stat = SFD_STAT_OK;
+    pdu->position = position;
+    pdu->max_wait_ms = max_wait_ms;
+}
@@ -34,6 +34,8 @@
 struct sfd_file_info;
 struct sfd_open_file_info;
 struct sfd_xfer_stat;
+struct sfd_xfer_stats;
+struct sfd_req_queued;
 
 #ifdef __cplusplus
 extern "C" {
@@ -42,8 +44,17 @@ extern "C" {
     bool prot_unmarshal_request(struct prot_request*,
                                 const void* buf, size_t size);
 
+    /** Returns a raw request's flags (PROT_REQ_*), or zero if it has none */
+    int prot_get_req_flags(const void* buf, size_t size);
+
     bool prot_unmarshal_send_open(struct prot_send_open*, const void* buf);
 
+    bool prot_unmarshal_send_range(struct prot_send_range*,
+                                   const void* buf, size_t size);
+
+    bool prot_unmarshal_pump(struct prot_pump*,
+                             const void* buf, size_t size);
+
     bool prot_unmarshal_cancel(struct prot_cancel*, const void* buf);
 
     void prot_marshal_file_info(struct sfd_file_info* pdu,
@@ -55,6 +66,30 @@ extern "C" {
 
     void prot_marshal_xfer_stat(struct sfd_xfer_stat* pdu, size_t val);
 
+    void prot_marshal_xfer_stats(struct sfd_xfer_stats* pdu,
+                                 uint64_t size,
+                                 uint64_t duration_us,
+                                 uint64_t ttfb_us,
+                                 uint64_t queue_us,
+                                 uint64_t nwrites,
+                                 uint64_t nstalls,
+                                 uint64_t ndeferrals,
+                                 uint64_t cookie);
+
+    void prot_marshal_req_queued(struct sfd_req_queued* pdu,
+                                 uint64_t position,
+                                 uint64_t max_wait_ms);
+
+    /**
+       Encodes a marshalled response (struct sfd_file_info, etc.) in the wire
+       format @a version (cf. PROT_RESP_VERSION_OFFSET).
+
+       @param[out] buf At least SFD_MAX_RESP_SIZE bytes
+
+       @return The number of bytes written to @a buf
+    */
+    size_t prot_marshal_response(uint8_t* buf, const void* pdu, int version);
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,23 +24,139 @@
   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#define _POSIX_C_SOURCE 200809L /* For F_DUPFD_CLOEXEC */
+
+#include <sys/stat.h>
+
 #include <assert.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "copy_pool.h"
+#include "direct_io.h"
 #include "errors.h"
 #include "log.h"
+#include "metrics.h"
 #include "server.h"
+#include "server_handover.h"
 #include "server_resources.h"
 #include "server_responses.h"
 #include "server_xfer_table.h"
 #include "syspoll.h"
+#include "trace.h"
 #include "unix_socket_server.h"
 #include "util.h"
 
+/** The initial number of transfer slots */
+#define SRV_INITIAL_XFERS 16U
+
+/** The size of a pump which runs until its source reaches end-of-file */
+#define PUMP_UNBOUNDED SIZE_MAX
+
+/** The number of threads which copy the segments of parallel copies */
+#define COPY_NTHREADS 4U
+
+/** The size of the segments into which parallel copies are split */
+#define COPY_SEG_SIZE ((size_t)16 * 1024 * 1024)
+
+/** The maximum number of direct I/O buffers in use at once, two per send */
+#define DIO_NBUFS 32U
+
+/**
+   The most a transfer to a regular file or device copies per pass, since these
+   are always 'writable' and the copy blocks the event loop (unless it is made
+   by the copy pool; cf. copies_in_parallel())
+*/
+#define FILE_DEST_PASS_SIZE ((size_t)64 * 1024)
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
 
+/**
+   A request waiting for room in the transfer table.
+*/
+struct queued_req {
+    /** The request PDU, as received */
+    void* buf;
+    /** Size of @a buf */
+    size_t size;
+    /** The file descriptors received with the request; -1 if absent */
+    int fds [PROT_MAXFDS];
+    pid_t client_pid;
+    /** When the request was received (cf. metrics_now_us()) */
+    uint64_t recv_us;
+};
+
+/**
+   A group of Send File transfers of the same range of the same file, which
+   share its reading (cf. PROT_REQ_FANOUT).
+
+   The file is read a chunk at a time into the group's buffer, from which the
+   chunk is duplicated into each member's own buffer, and written from there
+   by each member at its own pace. A member which has not taken the buffered
+   chunk by the time another one needs the next chunk is a straggler: it takes
+   the chunk then if its buffer is empty, and leaves the group otherwise.
+*/
+struct fanout {
+    /** The file (cf. fstat(2)) */
+    dev_t dev;
+    ino_t ino;
+    /** The range */
+    off_t offset;
+    size_t size;
+    /** A duplicate of the founding member's file descriptor */
+    int fd;
+    /** The chunk read last (a pipe on Linux) */
+    struct fio_ctx* ctx;
+    /** The file offset of the next chunk */
+    off_t pos;
+    /** The sequence number of the chunk read last, starting with 1; zero until
+        the first one has been read */
+    size_t chunk;
+    /** The members (a doubly-linked list) */
+    struct resrc_xfer* members;
+    /** The number of members */
+    size_t nmembers;
+    /** The number of members which have not taken the chunk read last */
+    size_t npending;
+    /** Neighbours in the server's list of groups */
+    struct fanout* prev;
+    struct fanout* next;
+};
+
+/**
+   A Send File transfer to a regular file which is copied in segments, several
+   at a time, by the server's copy pool (cf. PROT_REQ_PARALLEL).
+
+   Segments complete in any order, so the transfer's offsets are only moved
+   once it has completed (or is handed over). A job outlives its transfer if
+   the transfer is deleted while segments are being copied, which is why it
+   copies through descriptors of its own.
+*/
+struct copy_job {
+    /** The transfer; NULL once it has been deleted */
+    struct resrc_xfer* xfer;
+    /** Duplicates of the transfer's file and destination descriptors */
+    int fd_in;
+    int fd_out;
+    /** Where the range starts in the file */
+    off_t offset;
+    /** Where the range starts in the destination */
+    off_t dest_offset;
+    /** The destination offset from which on it reads as zeroes (having been
+        extended), so that the file's holes need not be copied there */
+    off_t zeroed_from;
+    /** The number of bytes to be copied */
+    size_t len;
+    /** The number of bytes whose segments have been submitted */
+    size_t nsubmitted;
+    /** The number of segments submitted but not reaped yet */
+    unsigned ninflight;
+    /** Segments are free while their length is zero */
+    struct copy_seg segs [COPY_NTHREADS];
+};
+
 /**
    Server context.
 */
@@ -48,16 +164,72 @@ struct server
 {
     /** The poller (epoll, kqueue, etc.) */
     struct syspoll* poller;
-    /** The table of running file transfers */
+    /** The table of running file transfers. Grows and shrinks with demand. */
     struct xfer_table* xfers;
+    /** Storage for the transfers in @a xfers */
+    struct xfer_pool* xfer_pool;
     /** Table of open file timers */
     struct xfer_table* xfer_timers;
+    /** The maximum number of transfers */
+    size_t maxxfers;
+    /** The transfer table capacity to which @a deferred_xfers, @a clients and
+        the poller's event buffer were last sized */
+    size_t fitted_capacity;
     /** Transfers which are to be processed in the secondary event-processing
         loop. E.g., ones that have been cancelled or ones with unexhausted I/O
         spaces. */
     struct resrc_xfer** deferred_xfers;
     /** Size of @a deferred_xfers */
     size_t ndeferred_xfers;
+    /** Requests which arrived while the transfer table was full, in order of
+        arrival (a ring buffer which grows up to @a maxxfers) */
+    struct queued_req* admq;
+    /** Capacity of @a admq */
+    size_t admq_capacity;
+    /** Index of the oldest request in @a admq */
+    size_t admq_head;
+    /** Number of requests in @a admq */
+    size_t admq_size;
+    /** Fires when the oldest queued request's deadline has passed */
+    struct resrc_timer admq_timer;
+    /** Whether or not @a admq_timer is armed */
+    bool admq_timer_armed;
+    /** Client processes with transfers, watched for exit (a hash table of
+        chains of records, keyed by process ID) */
+    struct resrc_client** clients;
+    /** Number of records in @a clients */
+    size_t nclients;
+    /** Number of buckets in @a clients (a power of two) */
+    size_t clients_nbuckets;
+    /** Clients which may have no transfers left, to be released at the end of
+        the current batch of events */
+    struct resrc_client* idle_clients;
+    /** The last transfer pipelined to each destination (a hash table of chains
+        of transfers, keyed by the destination's identity; cf.
+        find_pipeline_tail()) */
+    struct resrc_xfer** pipeline_tails;
+    /** Number of buckets in @a pipeline_tails (a power of two) */
+    size_t pipeline_tails_nbuckets;
+    /** Fires periodically while there are transfers, in order to find those
+        which have stalled */
+    struct resrc_timer sweep_timer;
+    /** Whether or not @a sweep_timer is armed */
+    bool sweep_timer_armed;
+    /** Responses waiting to be delivered (a doubly-linked list) */
+    struct resrc_resp* resps;
+    /** Fan-out groups (a doubly-linked list) */
+    struct fanout* fanouts;
+    /** The threads which copy the segments of parallel copies; NULL until the
+        first one is started */
+    struct copy_pool* copy_pool;
+    /** Becomes readable when @a copy_pool has copied segments */
+    struct syspoll_resrc copy_done;
+    /** The buffers of sends read with direct I/O; NULL until the first one is
+        started */
+    struct dio_pool* dio_pool;
+    /** The handover channel of a process which has asked to take over; -1 if
+        none has */
+    int handover_fd;
     /** The next transfer ID to be assigned. Starts at 1 and is incremented by 1
         for each new transaction. */
     size_t next_txnid;
@@ -65,18 +237,42 @@ struct server
     int reqfd;
     /** The number of milliseconds after which open files are closed */
     unsigned open_file_timeout_ms;
+    /** The number of milliseconds after which queued requests are rejected.
+        The same for all requests, so that they expire in order of arrival
+        (cf. @a admq_timer). */
+    unsigned admission_wait_ms;
+    /** The period within which transfers have to make progress; zero if
+        unlimited */
+    unsigned idle_timeout_ms;
+    /** The minimum number of bytes per second transfers have to sustain over
+        each idle timeout period */
+    size_t min_rate;
     /* The user ID of this, the server process */
     uid_t uid;
 };
 
 #pragma GCC diagnostic pop
 
-static struct server* srv_new(long open_file_timeout_ms, int reqfd, int maxfds);
+static struct server* srv_new(long open_file_timeout_ms,
+                              long admission_wait_ms,
+                              long idle_timeout_ms, long min_rate,
+                              int reqfd, int maxfds);
 
 static void srv_delete(struct server* srv);
 
 static bool errno_is_fatal(int err);
 
+/**
+   Registers a response whose delivery has to be retried, taking ownership of
+   its status channel file descriptor on success.
+*/
+static struct resrc_resp* add_pending_resp(struct server* srv,
+                                           int stat_fd,
+                                           const void* pdu, size_t pdu_size);
+
+/** Closes and frees a pending response */
+static void delete_pending_resp(struct server* srv, struct resrc_resp* r);
+
 /**
    Adds a new transfer.
 
@@ -93,10 +289,87 @@ static struct resrc_xfer* add_xfer(struct server* srv,
                                    int stat_fd, int dest_fd,
                                    struct fio_stat* info);
 
+/**
+   Adds a transfer of a file which has already been opened and checked, taking
+   ownership of @a file's descriptor (i.e., closing it on failure).
+*/
+static struct resrc_xfer* add_opened_xfer(struct server* srv,
+                                          const struct prot_request* req,
+                                          const struct resrc_xfer_file* file,
+                                          pid_t client_pid,
+                                          int stat_fd, int dest_fd,
+                                          uint64_t start_us);
+
+/**
+   Adds a Send File transfer of a range of an open file handle (cf.
+   PROT_REQ_HANDLE), leaving the handle itself open.
+*/
+static struct resrc_xfer* add_range_xfer(struct server* srv,
+                                         const struct prot_send_range* pdu,
+                                         pid_t client_pid,
+                                         int stat_fd, int dest_fd,
+                                         struct fio_stat* finfo);
+
+/**
+   Starts the timer which closes an open file unless it is sent within @a ms
+   milliseconds.
+*/
+static struct resrc_timer* add_open_file_timer(struct server* srv,
+                                               struct resrc_xfer* xfer,
+                                               unsigned ms);
+
+/**
+   Adds a pump, which moves data from a client-provided source descriptor to a
+   destination descriptor.
+
+   @post The file descriptors are still open, regardless of whether the call
+   succeeded or not; the transfer reads from a duplicate of @a src_fd.
+*/
+static struct resrc_xfer* add_pump_xfer(struct server* srv,
+                                        const struct prot_pump* pdu,
+                                        pid_t client_pid,
+                                        int stat_fd, int dest_fd, int src_fd,
+                                        struct fio_stat* finfo);
+
+/** Whether an open file is a reusable file handle */
+static bool is_file_handle(const struct resrc_xfer* x);
+
+/**
+   Puts a pump's source back into blocking mode if it was in it before the pump
+   started.
+
+   Only called when the pump ends; not when it is handed over.
+*/
+static void restore_pump_src(struct resrc_xfer* x);
+
 static void delete_xfer_and_close_file_fd(void* p);
 
 static void delete_xfer_and_close_all_fds(void* p);
 
+/** Adjusts the active transfers gauge corresponding to a transfer's command */
+static void count_active_xfer(const struct resrc_xfer* x, int delta);
+
+/**
+   Whether or not a transfer has a status channel separate from its data
+   channel (i.e., if it is not a Read File transfer)
+*/
+static bool has_stat_channel(const struct resrc_xfer* x);
+
+/**
+   Sends a (non-terminal) transfer status notification after a group of
+   writes of @a nwritten bytes, unless the client asked for none or the
+   progress notification interval it asked for has not elapsed yet.
+
+   @retval false The notification could not be sent--check @c errno(3)
+*/
+static bool send_progress(struct resrc_xfer* x, size_t nwritten);
+
+/**
+   Updates the rejected request counters according to the reason (errno value)
+   for the rejection.
+*/
+static void count_rejected_req(int err);
+
 /**
    Deletes a transfer which has not been registered.
 
@@ -129,8 +402,94 @@ static void defer_xfer(struct server* srv,
 */
 static size_t undefer_xfer(struct server* srv, size_t idx);
 
+/**
+   Counts a new transfer against its client, starting to watch the client
+   process for exit if it was not being watched yet.
+
+   The transfer keeps a reference to the client's record, so that the record it
+   is counted against cannot be confused with that of a later process which has
+   been given the same ID.
+
+   Send File transfers without a status channel are not counted: they are meant
+   to outlive their clients.
+*/
+static void watch_client(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Counts the deletion of a transfer against its client.
+*/
+static void unwatch_client(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Cancels the transfers and open files, and drops the queued requests, of a
+   client process which has exited.
+*/
+static void reclaim_client(struct server* srv, struct resrc_client* client);
+
+/**
+   Stops watching client processes which no longer have any transfers.
+*/
+static void release_idle_clients(struct server* srv);
+
+/**
+   Resizes the structures whose sizes depend on the transfer table's capacity
+   to match it.
+
+   @retval false Memory for growing them could not be allocated
+*/
+static bool fit_to_xfers(struct server* srv);
+
+/**
+   Moves the client records into a hash table of @a nbuckets buckets.
+
+   @retval false Memory for the new table could not be allocated
+*/
+static bool rehash_clients(struct server* srv, size_t nbuckets);
+
+/**
+   Moves the pipelines' last transfers into a hash table of @a nbuckets
+   buckets.
+
+   @retval false Memory for the new table could not be allocated
+*/
+static bool rehash_pipeline_tails(struct server* srv, size_t nbuckets);
+
+/** Updates the memory footprint statistic */
+static void count_footprint(const struct server* srv);
+
 /* ----------------- ----------------- */
 
+/**
+   Runs the request-processing loop, deleting the server when it ends.
+*/
+static enum srv_exit run(struct server* srv);
+
+/** How an attempt to hand over ended (cf. hand_over()) */
+enum handover_result {
+    HANDOVER_FAILED,
+    HANDOVER_IN_DOUBT,
+    HANDOVER_DONE
+};
+
+/**
+   Sends the request socket, transfers, queued requests and pending responses
+   to the process which has asked to take over, and waits for it to do so.
+
+   @retval HANDOVER_FAILED The handover failed or was refused; nothing has
+   changed
+
+   @retval HANDOVER_IN_DOUBT The end record was sent but not acknowledged, so
+   the other process may have taken over
+*/
+static enum handover_result hand_over(struct server* srv);
+
+/**
+   Receives the request socket, transfers, queued requests and pending
+   responses from the process handing over, and acknowledges the handover
+   once all of them have been set up.
+*/
+static bool take_over(struct server* srv, int handover_fd);
+
 static bool process_events(struct server* srv,
                            int nevents,
                            void* buf, size_t buf_size);
@@ -148,23 +507,205 @@ static bool process_request(struct server* srv,
 
 static bool transfer_file(struct server* srv, struct resrc_xfer* xfer);
 
-bool srv_run(const int reqfd,
-             const int maxfds,
-             const long open_file_timeout_ms)
+/**
+   Whether or not a request has to wait in the admission queue, i.e., if it
+   would add a transfer while the transfer table is full or while other
+   requests are already waiting.
+*/
+static bool must_queue_request(const struct server* srv, const void* buf);
+
+/**
+   Appends a request to the admission queue, taking ownership of its file
+   descriptors.
+
+   @param recv_us When the request was received (cf. metrics_now_us())
+
+   @retval false The queue is full (errno EMFILE)
+*/
+static bool queue_request(struct server* srv,
+                          const void* buf, size_t size,
+                          pid_t client_pid, const int* fds, size_t nfds,
+                          uint64_t recv_us);
+
+/**
+   The number of milliseconds (at least one) left until @a timeout_ms have
+   passed since @a since_us (cf. metrics_now_us()).
+*/
+static unsigned ms_until_timeout(uint64_t since_us, unsigned timeout_ms);
+
+/**
+   Tells the client of a request which has just been queued so, if it has asked
+   to be told (PROT_REQX_QUEUED).
+*/
+static void send_queued(const struct server* srv,
+                        const void* buf, size_t size, const int* fds);
+
+/**
+   Processes queued requests, in order of arrival, while there is room in the
+   transfer table.
+*/
+static void admit_queued_requests(struct server* srv);
+
+/**
+   Rejects queued requests which have waited for longer than the admission wait
+   limit with ETIMEDOUT, and rearms the admission queue timer if any requests
+   remain.
+*/
+static void expire_queued_requests(struct server* srv);
+
+/**
+   Arms the stalled-transfer sweep timer, if idle timeouts are enabled and it is
+   not armed already.
+*/
+static void arm_sweep_timer(struct server* srv);
+
+/**
+   Cancels, with ETIMEDOUT, transfers which have not made enough progress during
+   the last idle timeout period, and rearms the sweep timer if any transfers
+   remain.
+*/
+static void cancel_stalled_xfers(struct server* srv);
+
+/**
+   Whether a transfer is to be copied in segments (cf. PROT_REQ_PARALLEL),
+   which requires its destination to be a regular file which it can write to
+   at any offset (i.e., not opened with O_APPEND).
+*/
+static bool copies_in_parallel(const struct resrc_xfer* xfer);
+
+/**
+   Starts copying a transfer in segments, extending its destination up front
+   (so that the segments can be written in any order), and starting the copy
+   pool if it has not been started yet.
+*/
+static bool start_copy_job(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Processes the segments which the copy pool has copied, completing, failing
+   or continuing their transfers.
+*/
+static void reap_copy_segs(struct server* srv);
+
+/**
+   Detaches a transfer from its copy job (if any), whose segments which have
+   not been started yet are cancelled. The job itself is deleted once none of
+   its segments is being copied.
+*/
+static void drop_copy_job(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Turns parallel copies into sequential ones (e.g., to be handed over), once
+   the segments being copied have been, with their offsets moved past the data
+   which has been copied.
+*/
+static bool settle_copy_jobs(struct server* srv);
+
+/**
+   Whether a transfer's file is to be read with direct I/O (cf.
+   PROT_REQX_DIRECT), which is only worth its while for large ranges which do
+   not share their reading with other transfers.
+*/
+static bool streams_direct(const struct resrc_xfer* xfer);
+
+/**
+   Starts reading a transfer's file with direct I/O, creating the buffer pool if
+   it has not been created yet. On failure (e.g., the file system does not
+   support direct I/O, or all buffers are in use) the transfer reads through the
+   page cache instead.
+*/
+static void start_dio_stream(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Stops reading a transfer's file with direct I/O (if it does), leaving its
+   file offset at the first byte which has not been sent yet.
+*/
+static bool drop_dio_stream(struct resrc_xfer* xfer);
+
+/**
+   Whether a transfer's file is read after its access hint (cf.
+   PROT_EXT_ACCESS), which only sends reading their own open file descriptions
+   through the page cache do.
+*/
+static bool follows_access_hint(const struct resrc_xfer* xfer);
+
+/** Applies a transfer's access hint to the range it is about to read */
+static void start_cache_policy(struct resrc_xfer* xfer);
+
+/** Reads ahead of, and drops behind, a transfer as it progresses */
+static void update_cache_policy(struct resrc_xfer* xfer);
+
+/** Counts data written by a transfer, which might be its first */
+static void count_written(struct resrc_xfer* xfer, size_t nwritten);
+
+/** Counts a transfer's completion, and sends its terminal response */
+static void complete_xfer(struct server* srv, struct resrc_xfer* xfer);
+
+/** Counts a transfer's failure, and sends it its error */
+static void fail_xfer(struct server* srv, struct resrc_xfer* xfer, int err);
+
+enum srv_exit srv_run(const int reqfd,
+                      const int maxfds,
+                      const long open_file_timeout_ms,
+                      const long admission_wait_ms,
+                      const long idle_timeout_ms,
+                      const long min_rate)
 {
-    struct server* const srv = srv_new(open_file_timeout_ms, reqfd, maxfds);
+    struct server* const srv = srv_new(open_file_timeout_ms,
+                                       admission_wait_ms,
+                                       idle_timeout_ms, min_rate,
+                                       reqfd, maxfds);
     if (!srv)
-        return false;
+        return SRV_EXIT_FAILED;
 
     if (!syspoll_register(srv->poller,
                           (struct syspoll_resrc*)&srv->reqfd,
                           SYSPOLL_READ)) {
-        goto fail;
+        PRESERVE_ERRNO(srv_delete(srv));
+        return SRV_EXIT_FAILED;
+    }
+
+    return run(srv);
+}
+
+enum srv_exit srv_resume(const int handover_fd,
+                         const int maxfds,
+                         const long open_file_timeout_ms,
+                         const long admission_wait_ms,
+                         const long idle_timeout_ms,
+                         const long min_rate)
+{
+    struct server* const srv = srv_new(open_file_timeout_ms,
+                                       admission_wait_ms,
+                                       idle_timeout_ms, min_rate,
+                                       -1, maxfds);
+    if (!srv) {
+        PRESERVE_ERRNO(close(handover_fd));
+        return SRV_EXIT_FAILED;
+    }
+
+    const bool taken_over = take_over(srv, handover_fd);
+
+    PRESERVE_ERRNO(close(handover_fd));
+
+    if (!taken_over) {
+        PRESERVE_ERRNO(srv_delete(srv));
+        return SRV_EXIT_FAILED;
     }
 
+    metrics_claim();
+
+    return run(srv);
+}
+
+static enum srv_exit run(struct server* srv)
+{
     void* const recvbuf = calloc(PROT_REQ_MAXSIZE, 1);
-    if (!recvbuf)
-        goto fail;
+    if (!recvbuf) {
+        PRESERVE_ERRNO(srv_delete(srv));
+        return SRV_EXIT_FAILED;
+    }
+
+    enum srv_exit how = SRV_EXIT_SHUTDOWN;
 
     for (;;) {
         /* If there are deferred transfers, don't block on waiting for events
@@ -184,17 +725,51 @@ bool srv_run(const int reqfd,
         }
 
         process_deferred(srv);
+
+        if (srv->idle_clients)
+            release_idle_clients(srv);
+
+        if (srv->admq_size > 0)
+            admit_queued_requests(srv);
+
+        /* Shrinking is left until now because the poller's event buffer may
+           not be shrunk while events are being processed */
+        if (srv->xfers->capacity < srv->fitted_capacity)
+            fit_to_xfers(srv);
+
+        if (srv->xfer_pool->nempty > 1)
+            xfer_pool_trim(srv->xfer_pool);
+
+        count_footprint(srv);
+
+        /* Left until now so that no transfer is in the middle of being
+           cancelled or admitted */
+        if (srv->handover_fd != -1) {
+            const enum handover_result result = hand_over(srv);
+
+            if (result == HANDOVER_DONE) {
+                how = SRV_EXIT_HANDOVER;
+                break;
+            }
+
+            if (result == HANDOVER_IN_DOUBT) {
+                sfd_log(LOG_CRIT, "Handover not acknowledged [%m]; exiting in"
+                        " case the new server has taken over\n");
+                how = SRV_EXIT_HANDOVER;
+                break;
+            }
+
+            sfd_log(LOG_ERR, "Handover failed [%m]; carrying on\n");
+
+            close(srv->handover_fd);
+            srv->handover_fd = -1;
+        }
     }
 
     free(recvbuf);
     srv_delete(srv);
 
-    return true;
-
- fail:
-    PRESERVE_ERRNO(srv_delete(srv));
-
-    return false;
+    return how;
 }
 
 static bool process_events(struct server* srv,
@@ -223,20 +798,50 @@ static bool process_events(struct server* srv,
                         "Fatal error on resource (from system poller)");
             }
 
-            if (is_timer(events.udata)) {
+            if (events.udata == &srv->admq_timer) {
+                close(srv->admq_timer.ident);
+                srv->admq_timer_armed = false;
+
+                expire_queued_requests(srv);
+
+            } else if (events.udata == &srv->copy_done) {
+                reap_copy_segs(srv);
+
+            } else if (events.udata == &srv->sweep_timer) {
+                close(srv->sweep_timer.ident);
+                srv->sweep_timer_armed = false;
+
+                cancel_stalled_xfers(srv);
+
+            } else if (is_client(events.udata)) {
+                reclaim_client(srv, events.udata);
+
+            } else if (is_timer(events.udata)) {
                 struct resrc_timer* const timer = events.udata;
                 struct resrc_xfer* const xfer = xfer_table_find(srv->xfers,
                                                                 timer->txnid);
+                struct resrc_xfer* rearm = NULL;
+
+                METRIC_INC(timer_expiries);
 
                 if (xfer) {
                     /* Timer has elapsed and a transfer with the same txnid
                        exists */
                     if (xfer == timer->xfer_addr) {
-                        if (xfer->nbytes_left == xfer->file.size) {
+                        if (is_file_handle(xfer) &&
+                            xfer->defer != CANCEL &&
+                            ms_until_timeout(xfer_cold(xfer)->window_us,
+                                             srv->open_file_timeout_ms) > 1) {
+                            /* File handle has been used since the timer was
+                               started */
+                            rearm = xfer;
+
+                        } else if (xfer->nbytes_left == xfer->file.size) {
                             /* Transfer has expired before first byte was
                                transferred */
                             send_xfer_err(xfer->stat_fd, ETIMEDOUT);
                             defer_xfer(srv, xfer, CANCEL);
+                            METRIC_INC(open_file_timeouts);
                         }
                     } else {
                         /* Transfer has same txnid but different address ->
@@ -246,25 +851,49 @@ static bool process_events(struct server* srv,
                 }
 
                 xfer_table_erase(srv->xfer_timers, timer->txnid);
-                timer_delete(timer);
+                resrc_timer_delete(timer);
+
+                if (rearm &&
+                    !add_open_file_timer(srv, rearm,
+                                         ms_until_timeout(
+                                             xfer_cold(rearm)->window_us,
+                                             srv->open_file_timeout_ms))) {
+                    send_xfer_err(rearm->stat_fd, errno);
+                    defer_xfer(srv, rearm, CANCEL);
+                }
 
             } else if (is_response(events.udata)) {
                 struct resrc_resp* r = (struct resrc_resp*)events.udata;
 
-                if (error_event || send_pdu(r->stat_fd, &r->pdu, r->pdu_size) ||
+                if (error_event || send_pdu(r->stat_fd, r->pdu, r->pdu_size) ||
                     errno_is_fatal(errno)) {
-                    close(r->stat_fd);
-                    free(r);
+                    delete_pending_resp(srv, r);
                 }
 
             } else {
-                assert (is_xfer(events.udata));
-
-                struct resrc_xfer* const xfer = events.udata;
-
-                if (xfer->defer != CANCEL &&
+                assert (is_xfer(events.udata) || is_pump_src(events.udata));
+
+                /* A pump makes progress whenever its source becomes readable
+                   as well as whenever its destination becomes writable */
+                struct resrc_xfer* const xfer =
+                    (is_pump_src(events.udata) ?
+                     ((struct resrc_pump_src*)events.udata)->xfer :
+                     events.udata);
+
+                if (xfer->cmd == PROT_CMD_PUMP) {
+                    /* Both of a pump's descriptors may have events in this
+                       batch, so it must not be deleted before the batch has
+                       been processed. It is always moved during secondary
+                       processing, where errors (if any) surface from the next
+                       read or write. */
+                    if (xfer->defer == NONE)
+                        defer_xfer(srv, xfer, READY);
+
+                } else if (xfer->defer != CANCEL &&
                     (error_event ||
                      (xfer->defer != READY && !transfer_file(srv, xfer)))) {
+                    if (error_event)
+                        METRIC_INC(xfers_failed);
                     PRESERVE_ERRNO(delete_registered_xfer(srv, xfer));
                 }
             }
@@ -285,6 +914,7 @@ static void process_deferred(struct server* const ctx)
         case CANCEL:
             i = undefer_xfer(ctx, i);
             delete_registered_xfer(ctx, x);
+            METRIC_INC(xfers_cancelled);
             break;
 
         case READY:
@@ -316,6 +946,13 @@ static void process_deferred(struct server* const ctx)
 
 static void close_fds(int* fds, size_t nfds);
 
+/**
+   Returns the descriptor to which responses to a request are to be written, or
+   -1 if the request is for a Send File without a status channel (in which case
+   only the destination descriptor is passed).
+*/
+static int req_stat_fd(const void* buf, size_t size, const int* fds);
+
 static bool handle_reqfd(struct server* srv,
                          const int events,
                          void* buf,
@@ -332,6 +969,11 @@ static bool handle_reqfd(struct server* srv,
     for (;;) {
         nfds = PROT_MAXFDS;
 
+        /* The transaction ID is only known if a new transfer is added */
+        const size_t next_txnid = srv->next_txnid;
+        uint64_t t0;
+        TRACE_BEGIN(t0, recv_req, next_txnid);
+
         const ssize_t nread = us_recv(srv->reqfd,
                                       buf, buf_size,
                                       recvd_fds, &nfds,
@@ -344,23 +986,46 @@ static bool handle_reqfd(struct server* srv,
             return !errno_is_fatal(errno);
 
         } else {
-            if (sfd_get_cmd(buf) != PROT_CMD_CANCEL &&
-                (nfds < 1 || nfds > PROT_MAXFDS)) {
+            if ((sfd_get_cmd(buf) != PROT_CMD_CANCEL &&
+                 (nfds < 1 || nfds > PROT_MAXFDS)) ||
+                (sfd_get_cmd(buf) == PROT_CMD_PUMP) != (nfds == 3)) {
                 sfd_log(LOG_ERR,
                         "Received unexpected number of file descriptors (%lu)"
                         " from client; ignoring request\n",
                         nfds);
+                close_fds(recvd_fds, nfds);
 
             } else if (uid != srv->uid) {
                 sfd_log(LOG_ERR, "Invalid UID: expected %d; got %d\n",
                         srv->uid, uid);
-                send_xfer_err(recvd_fds[0], EACCES);
+                if (req_stat_fd(buf, (size_t)nread, recvd_fds) != -1)
+                    send_xfer_err(recvd_fds[0], EACCES);
                 close_fds(recvd_fds, nfds);
 
+            } else if (must_queue_request(srv, buf)) {
+                METRIC_INC(requests);
+
+                if (!queue_request(srv, buf, (size_t)nread,
+                                   pid, recvd_fds, nfds, metrics_now_us())) {
+                    count_rejected_req(errno);
+                    if (req_stat_fd(buf, (size_t)nread, recvd_fds) != -1)
+                        send_req_err(recvd_fds[0], errno);
+                    close_fds(recvd_fds, nfds);
+                } else {
+                    METRIC_INC(requests_queued);
+                    send_queued(srv, buf, (size_t)nread, recvd_fds);
+                }
+
             } else {
+                METRIC_INC(requests);
+
                 if (!process_request(srv, buf, (size_t)nread, pid, recvd_fds))
                     close_fds(recvd_fds, nfds);
             }
+
+            TRACE_END(t0, recv_req,
+                      (srv->next_txnid != next_txnid ? next_txnid : 0),
+                      nread);
         }
     }
 
@@ -369,11 +1034,15 @@ static bool handle_reqfd(struct server* srv,
 
 static void close_fds(int* fds, const size_t nfds)
 {
-    if (nfds > 0) {
-        close(fds[0]);
-        if (nfds == 2)
-            close(fds[1]);
-    }
+    for (size_t i = 0; i < nfds; i++)
+        close(fds[i]);
+}
+
+static int req_stat_fd(const void* buf, const size_t size, const int* fds)
+{
+    return ((sfd_get_cmd(buf) == PROT_CMD_SEND &&
+             (prot_get_req_flags(buf, size) & PROT_REQ_NO_STAT)) ?
+            -1 : fds[0]);
 }
 
 static struct resrc_timer* add_open_file(struct server* srv,
@@ -385,52 +1054,155 @@ static struct resrc_xfer* get_open_file(struct server* srv,
                                         const pid_t client_pid,
                                         const size_t txnid);
 
+/**
+   Sets a Send File transfer's destination type (resrc_xfer::dest_type) from
+   the kind of file its destination descriptor refers to.
+*/
+static bool classify_dest(struct resrc_xfer* xfer);
+
+/**
+   Whether a transfer's destination is always writable (a regular file or a
+   character device), in which case the poller would refuse it, so it is
+   written to from the deferred list instead.
+*/
+static bool dest_always_writable(const struct resrc_xfer* xfer);
+
 static bool register_xfer(struct server* srv, struct resrc_xfer* xfer);
 
-static bool deregister_xfer(struct server* srv, struct resrc_xfer* xfer);
+/**
+   Registers a new Send File transfer with the poller or, if it is pipelined
+   (PROT_REQ_PIPELINE) behind another transfer to the same destination, queues
+   it to be started once that one has completed (cf. delete_registered_xfer()).
+*/
+static bool start_or_queue_xfer(struct server* srv, struct resrc_xfer* xfer);
 
-#define MALFORMED_REQ_MSG "Received malformed request\n"
-#define INVALID_CMD_MSG "Received invalid command ID (%d) in request\n"
+/** Whether a transfer is to wait for those sent to its destination earlier */
+static bool is_pipelined(const struct resrc_xfer* x);
 
-static bool process_request(struct server* srv,
-                            const void* buf, const size_t size,
-                            const pid_t client_pid, const int* fds)
-{
-    if (sfd_get_stat(buf) != SFD_STAT_OK) {
-        sfd_log(LOG_NOTICE, "Received error status (%x) in request\n",
-                sfd_get_stat(buf));
-        return false;
-    }
+/**
+   Finds the last transfer pipelined to the same destination as @a xfer, if
+   any.
+*/
+static struct resrc_xfer* find_pipeline_tail(const struct server* srv,
+                                             const struct resrc_xfer* xfer);
 
-    if (!PROT_IS_REQUEST(sfd_get_cmd(buf))) {
-        sfd_log(LOG_NOTICE, INVALID_CMD_MSG, sfd_get_cmd(buf));
-        return false;
-    }
+/** Makes a pipelined transfer its destination's last one */
+static void track_pipeline_tail(struct server* srv, struct resrc_xfer* xfer);
 
-    const int cmd_id = sfd_get_cmd(buf);
+/**
+   Removes a transfer from the index of pipelines' last transfers.
 
-    switch ((const enum prot_cmd_req)cmd_id) {
-    case PROT_CMD_FILE_OPEN: {
-        struct prot_request pdu;
-        if (!prot_unmarshal_request(&pdu, buf, size)) {
-            sfd_log(LOG_NOTICE, MALFORMED_REQ_MSG);
-            /* TODO: send NACK */
-            return false;
-        }
+   @retval true The transfer was its destination's last one
+*/
+static bool untrack_pipeline_tail(struct server* srv, struct resrc_xfer* xfer);
 
-        struct fio_stat finfo;
-        const struct resrc_timer* const timer = add_open_file(srv,
+static bool deregister_xfer(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Makes a Send File transfer a member of the fan-out group of its file and
+   range, founding the group if there is none which it can join yet. Failure
+   leaves the transfer to read the file by itself.
+*/
+static void join_fanout(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Removes a transfer from its fan-out group (if any), deleting the group once
+   it has no members left. The transfer's file offset is not touched.
+*/
+static void leave_fanout(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Removes a transfer from its fan-out group, after which it reads its file by
+   itself, starting after the data it has taken from the group.
+*/
+static bool detach_from_fanout(struct server* srv, struct resrc_xfer* xfer);
+
+/**
+   Writes up to @a nbytes of a Send File transfer's data which goes through a
+   buffer (cf. struct fanout), taking the group's next chunk when it has
+   written the previous one, or of its file once it has left the group.
+*/
+static ssize_t fanout_send(struct server* srv,
+                           struct resrc_xfer* xfer,
+                           size_t nbytes);
+
+#define MALFORMED_REQ_MSG "Received malformed request\n"
+#define INVALID_CMD_MSG "Received invalid command ID (%d) in request\n"
+
+/**
+   Logs why a request could not be unmarshalled.
+
+   Clients using a newer protocol version than this server's are told so
+   (EPROTONOSUPPORT), so that they can fall back to an older one.
+*/
+static void reject_request(const void* buf, size_t size, const int* fds);
+
+/** Unmarshals a file operation request (cf. reject_request()) */
+static bool unmarshal_request(struct prot_request* pdu,
+                              const void* buf, const size_t size,
+                              const int* fds)
+{
+    errno = 0;
+
+    if (prot_unmarshal_request(pdu, buf, size))
+        return true;
+
+    reject_request(buf, size, fds);
+
+    return false;
+}
+
+static void reject_request(const void* buf, const size_t size, const int* fds)
+{
+    if (errno == EPROTONOSUPPORT) {
+        sfd_log(LOG_NOTICE, "Received request of unsupported version (%d)\n",
+                ((const uint8_t*)buf)[PROT_REQ_VERSION_OFFSET]);
+
+        if (req_stat_fd(buf, size, fds) != -1)
+            send_req_err(fds[0], EPROTONOSUPPORT);
+    } else {
+        sfd_log(LOG_NOTICE, MALFORMED_REQ_MSG);
+        /* TODO: send NACK */
+    }
+}
+
+static bool process_request(struct server* srv,
+                            const void* buf, const size_t size,
+                            const pid_t client_pid, const int* fds)
+{
+    if (sfd_get_stat(buf) != SFD_STAT_OK) {
+        sfd_log(LOG_NOTICE, "Received error status (%x) in request\n",
+                sfd_get_stat(buf));
+        return false;
+    }
+
+    if (!PROT_IS_REQUEST(sfd_get_cmd(buf))) {
+        sfd_log(LOG_NOTICE, INVALID_CMD_MSG, sfd_get_cmd(buf));
+        return false;
+    }
+
+    const int cmd_id = sfd_get_cmd(buf);
+
+    switch ((const enum prot_cmd_req)cmd_id) {
+    case PROT_CMD_FILE_OPEN: {
+        struct prot_request pdu;
+        if (!unmarshal_request(&pdu, buf, size, fds))
+            return false;
+
+        struct fio_stat finfo;
+        const struct resrc_timer* const timer = add_open_file(srv,
                                                               &pdu,
                                                               client_pid,
                                                               fds[0],
                                                               &finfo);
 
         if (!timer) {
+            count_rejected_req(errno);
             send_req_err(fds[0], errno);
             return false;
         }
 
-        send_file_info(fds[0], timer->txnid, &finfo);
+        send_file_info(fds[0], timer->txnid, &finfo, pdu.version);
 
     } break;
 
@@ -444,20 +1216,112 @@ static bool process_request(struct server* srv,
         struct resrc_xfer* const xfer = get_open_file(srv,
                                                       client_pid,
                                                       pdu.txnid);
-        if (!xfer || xfer->defer == CANCEL) {
+        if (!xfer || xfer->defer == CANCEL || is_file_handle(xfer)) {
+            /* File handles are only ever sent in ranges */
             close(fds[0]);
             return false;
         }
 
+        METRIC_DEC(open_files);
+        METRIC_INC(active_sends);
+
         xfer->cmd = PROT_CMD_SEND;
         xfer->dest_fd = fds[0];
+        struct resrc_xfer_cold* const c = xfer_cold(xfer);
+        c->start_us = metrics_now_us();
+        c->window_us = c->start_us;
+        c->progress_us = c->start_us;
 
-        if (!register_xfer(srv, xfer)) {
+        if (!start_or_queue_xfer(srv, xfer)) {
+            count_rejected_req(errno);
             send_xfer_err(xfer->stat_fd, errno);
             delete_unregistered_xfer(srv, xfer);
             return false;
         }
 
+        arm_sweep_timer(srv);
+
+    } break;
+
+    case PROT_CMD_SEND_RANGE: {
+        struct prot_send_range pdu;
+        errno = 0;
+        if (!prot_unmarshal_send_range(&pdu, buf, size)) {
+            reject_request(buf, size, fds);
+            return false;
+        }
+
+        struct fio_stat finfo;
+        uint64_t t0;
+        TRACE_BEGIN(t0, add_xfer, srv->next_txnid);
+
+        struct resrc_xfer* const xfer = add_range_xfer(srv,
+                                                       &pdu,
+                                                       client_pid,
+                                                       fds[0], fds[1],
+                                                       &finfo);
+
+        TRACE_END(t0, add_xfer, (xfer ? xfer->txnid : 0), (xfer ? 0 : errno));
+
+        if (!xfer) {
+            count_rejected_req(errno);
+            send_req_err(fds[0], errno);
+            return false;
+        }
+
+        if (!start_or_queue_xfer(srv, xfer)) {
+            count_rejected_req(errno);
+            send_req_err(fds[0], errno);
+            delete_unregistered_xfer(srv, xfer);
+            return false;
+        }
+
+        send_file_info(fds[0], xfer->txnid, &finfo, PROT_VERSION);
+
+        arm_sweep_timer(srv);
+
+    } break;
+
+    case PROT_CMD_PUMP: {
+        struct prot_pump pdu;
+        errno = 0;
+        if (!prot_unmarshal_pump(&pdu, buf, size)) {
+            reject_request(buf, size, fds);
+            return false;
+        }
+
+        struct fio_stat finfo;
+        uint64_t t0;
+        TRACE_BEGIN(t0, add_xfer, srv->next_txnid);
+
+        struct resrc_xfer* const xfer = add_pump_xfer(srv,
+                                                      &pdu,
+                                                      client_pid,
+                                                      fds[0], fds[1], fds[2],
+                                                      &finfo);
+
+        TRACE_END(t0, add_xfer, (xfer ? xfer->txnid : 0), (xfer ? 0 : errno));
+
+        if (!xfer) {
+            count_rejected_req(errno);
+            send_req_err(fds[0], errno);
+            return false;
+        }
+
+        if (!start_or_queue_xfer(srv, xfer)) {
+            count_rejected_req(errno);
+            send_req_err(fds[0], errno);
+            delete_unregistered_xfer(srv, xfer);
+            return false;
+        }
+
+        /* The transfer reads from its own duplicate of the source */
+        close(fds[2]);
+
+        send_file_info(fds[0], xfer->txnid, &finfo, PROT_VERSION);
+
+        arm_sweep_timer(srv);
+
     } break;
 
     case PROT_CMD_CANCEL: {
@@ -477,34 +1341,65 @@ static bool process_request(struct server* srv,
 
     } break;
 
+    case PROT_CMD_HANDOVER:
+        /* Only acted upon once the current batch of events has been
+           processed */
+        if (srv->handover_fd != -1) {
+            sfd_log(LOG_NOTICE, "Handover already in progress\n");
+            return false;
+        }
+
+        sfd_log(LOG_INFO, "Received handover request from process %d\n",
+                client_pid);
+
+        srv->handover_fd = fds[0];
+        break;
+
     case PROT_CMD_READ:
     case PROT_CMD_SEND: {
         struct prot_request pdu;
-        if (!prot_unmarshal_request(&pdu, buf, size)) {
-            sfd_log(LOG_NOTICE, MALFORMED_REQ_MSG);
+        if (!unmarshal_request(&pdu, buf, size, fds))
             return false;
-        }
+
+        /* A Send File without a status channel has its destination as its
+           only descriptor; it is treated as its own 'status channel' so that
+           has_stat_channel() is false for it, as for Read File */
+        const int stat_fd = req_stat_fd(buf, size, fds);
+        const int dest_fd = (pdu.cmd == PROT_CMD_SEND && stat_fd != -1 ?
+                             fds[1] :
+                             fds[0]);
 
         struct fio_stat finfo;
-        struct resrc_xfer* const xfer =
-            add_xfer(srv,
-                     &pdu,
-                     client_pid,
-                     fds[0], (pdu.cmd == PROT_CMD_SEND ? fds[1] : fds[0]),
-                     &finfo);
+        uint64_t t0;
+        TRACE_BEGIN(t0, add_xfer, srv->next_txnid);
+
+        struct resrc_xfer* const xfer = add_xfer(srv,
+                                                 &pdu,
+                                                 client_pid,
+                                                 fds[0], dest_fd,
+                                                 &finfo);
+
+        TRACE_END(t0, add_xfer, (xfer ? xfer->txnid : 0), (xfer ? 0 : errno));
 
         if (!xfer) {
-            send_req_err(fds[0], errno);
+            count_rejected_req(errno);
+            if (stat_fd != -1)
+                send_req_err(stat_fd, errno);
             return false;
         }
 
-        if (!register_xfer(srv, xfer)) {
-            send_req_err(xfer->stat_fd, errno);
+        if (!start_or_queue_xfer(srv, xfer)) {
+            count_rejected_req(errno);
+            if (stat_fd != -1)
+                send_req_err(stat_fd, errno);
             delete_unregistered_xfer(srv, xfer);
             return false;
         }
 
-        send_file_info(xfer->stat_fd, xfer->txnid, &finfo);
+        if (stat_fd != -1)
+            send_file_info(stat_fd, xfer->txnid, &finfo, pdu.version);
+
+        arm_sweep_timer(srv);
 
     } break;
 
@@ -516,164 +1411,2075 @@ static bool process_request(struct server* srv,
     return true;
 }
 
-static struct resrc_xfer* get_open_file(struct server* srv,
-                                        const pid_t client_pid,
-                                        const size_t txnid)
+static void count_rejected_req(const int err)
 {
-    struct resrc_xfer* const xfer = xfer_table_find(srv->xfers, txnid);
-    if (!xfer) {
-        /* Timer probably expired; can't send any errors because the status
-           channel would've been closed when the timer expired */
-        return NULL;
+    switch (err) {
+    case EMFILE:
+        METRIC_INC(rejected_emfile);
+        break;
+    case ERANGE:
+        METRIC_INC(rejected_erange);
+        break;
+    case ETIMEDOUT:
+        METRIC_INC(rejected_timeout);
+        break;
+    default:
+        METRIC_INC(rejected_other);
+        break;
     }
+}
 
-    /* If the transfer's client PID is US_INVALID_PID it could not be
-       determined. This would be the case on FreeBSD, on which the recommended
-       way of transferring process credentials (see recvmsg(2) on FreeBSD) does
-       not transfer the PID. */
-    if (xfer->client_pid != US_INVALID_PID && xfer->client_pid != client_pid) {
-        /* Client trying to send a file or cancel a transfer it did not open or
-           initiate itself */
-        sfd_log(LOG_ALERT,
-                "Client with PID %d tried to access transaction with"
-                " mismatching PID %d (txnid %lu)\n",
-                client_pid, xfer->client_pid, xfer->txnid);
-        return NULL;
+static bool must_queue_request(const struct server* srv, const void* buf)
+{
+    switch (sfd_get_cmd(buf)) {
+    case PROT_CMD_READ:
+    case PROT_CMD_SEND:
+    case PROT_CMD_FILE_OPEN:
+    case PROT_CMD_SEND_RANGE:
+    case PROT_CMD_PUMP:
+        return (srv->xfers->size == srv->maxxfers ||
+                srv->admq_size > 0);
+    default:
+        return false;
     }
-
-    return xfer;
 }
 
-static bool register_xfer(struct server* srv, struct resrc_xfer* xfer)
+/* Doubles the admission queue's capacity (up to the transfer limit) */
+static bool grow_admq(struct server* srv)
 {
-    return syspoll_register(srv->poller,
-                            (struct syspoll_resrc*)xfer,
-                            SYSPOLL_WRITE);
+    const size_t capacity = SFD_MIN(SFD_MAX(srv->admq_capacity * 2, (size_t)1),
+                                    srv->maxxfers);
+
+    struct queued_req* const admq = malloc(sizeof(*admq) * capacity);
+    if (!admq)
+        return false;
+
+    /* Unwrap the ring */
+    for (size_t i = 0; i < srv->admq_size; i++)
+        admq[i] = srv->admq[(srv->admq_head + i) % srv->admq_capacity];
+
+    free(srv->admq);
+
+    srv->admq = admq;
+    srv->admq_capacity = capacity;
+    srv->admq_head = 0;
+
+    return true;
 }
 
-static bool deregister_xfer(struct server* srv, struct resrc_xfer* xfer)
+static bool queue_request(struct server* srv,
+                          const void* buf, const size_t size,
+                          const pid_t client_pid,
+                          const int* fds, const size_t nfds,
+                          const uint64_t recv_us)
 {
-    return syspoll_deregister(srv->poller, xfer->dest_fd);
-}
+    if (srv->admq_size == srv->maxxfers) {
+        errno = EMFILE;
+        return false;
+    }
 
-static bool has_stat_channel(const struct resrc_xfer* x);
+    if (srv->admq_size == srv->admq_capacity && !grow_admq(srv))
+        return false;
 
-/**
-   Sends a terminal response to the client.
-*/
-static void send_terminal_resp(struct server* srv,
-                               struct resrc_xfer* x,
-                               const void* pdu, const size_t size);
+    struct queued_req* const q =
+        &srv->admq[(srv->admq_head + srv->admq_size) % srv->admq_capacity];
 
-static bool transfer_file(struct server* srv, struct resrc_xfer* xfer)
-{
-    switch (xfer->cmd) {
-    case PROT_CMD_READ:
-    case PROT_CMD_SEND: {
-        size_t total_nwritten = 0;
+    *q = (struct queued_req) {
+        .buf = malloc(size),
+        .size = size,
+        .client_pid = client_pid,
+        .recv_us = recv_us
+    };
 
-        for (;;) {
-            const size_t write_size =
-                SFD_MIN(xfer->file.blksize,
-                    SFD_MIN(xfer->nbytes_left,
-                        pipe_capacity() - total_nwritten));
+    if (!q->buf)
+        return false;
 
-            assert (write_size > 0);
+    memcpy(q->buf, buf, size);
 
-            const ssize_t nwritten = (xfer->cmd == PROT_CMD_READ ?
-                                      file_splice(xfer->file.fd,
-                                                  xfer->dest_fd,
-                                                  xfer->fio_ctx,
-                                                  write_size) :
-                                      file_sendfile(xfer->file.fd,
-                                                    xfer->dest_fd,
-                                                    xfer->fio_ctx,
-                                                    write_size));
+    for (size_t i = 0; i < PROT_MAXFDS; i++)
+        q->fds[i] = (i < nfds ? fds[i] : -1);
 
-            if (nwritten == -1) {
-                if (errno_is_fatal(errno)) {
-                    if (!has_stat_channel(xfer))
-                        return false;
+    if (!srv->admq_timer_armed) {
+        srv->admq_timer.ident = -1;
 
-                    struct prot_hdr pdu = {
-                        .cmd = SFD_XFER_STAT,
-                        .stat = (uint8_t)errno
-                    };
+        /* This is the oldest request */
+        if (!syspoll_timer(srv->poller,
+                           (struct syspoll_resrc*)&srv->admq_timer,
+                           ms_until_timeout(recv_us,
+                                            srv->admission_wait_ms))) {
+            PRESERVE_ERRNO(free(q->buf));
+            return false;
+        }
 
-                    send_terminal_resp(srv, xfer, &pdu, sizeof(pdu));
+        srv->admq_timer_armed = true;
+    }
 
-                    return false;
-                }
+    srv->admq_size++;
 
-            } else {
-                /* (write_size > 0) ==> (xfer->nbytes_left > 0) ==> EOF could
-                   not have been seen by the read */
-                assert (nwritten > 0);
+    METRIC_INC(queued_requests);
 
-                xfer->nbytes_left -= (size_t)nwritten;
-                total_nwritten += (size_t)nwritten;
-            }
+    return true;
+}
 
-            assert (nwritten > 0 || (nwritten == -1 && !errno_is_fatal(errno)));
+/* Removes the oldest request from the admission queue */
+static struct queued_req pop_queued_request(struct server* srv)
+{
+    assert (srv->admq_size > 0);
 
-            if (xfer->nbytes_left == 0) {
-                if (has_stat_channel(xfer)) {
-                    /* Terminal notification; delivery is critical */
-                    struct sfd_xfer_stat pdu;
-                    prot_marshal_xfer_stat(&pdu, PROT_XFER_COMPLETE);
-                    send_terminal_resp(srv, xfer, &pdu, sizeof(pdu));
+    const struct queued_req q = srv->admq[srv->admq_head];
 
-                    return false;
-                }
+    srv->admq_head = (srv->admq_head + 1) % srv->admq_capacity;
+    srv->admq_size--;
 
-                return false;
+    METRIC_DEC(queued_requests);
 
-            } else if (nwritten == -1) {
-                /* Nonterminal notification; delivery not critical */
-                if (has_stat_channel(xfer)) {
-                    if (!send_xfer_stat(xfer->stat_fd, total_nwritten) &&
-                        errno_is_fatal(errno)) {
-                        return false;
-                    }
-                }
-            }
+    return q;
+}
 
-            if (nwritten == -1) {
-                xfer->defer = NONE;
-                return true;
-            }
+static void close_queued_fds(const struct queued_req* q)
+{
+    for (size_t i = 0; i < PROT_MAXFDS; i++) {
+        if (q->fds[i] != -1)
+            close(q->fds[i]);
+    }
+}
 
-            if (total_nwritten >= pipe_capacity()) {
-                if (xfer->defer == NONE)
-                    defer_xfer(srv, xfer, READY);
-                return true;
+static void admit_queued_requests(struct server* srv)
+{
+    while (srv->admq_size > 0 && srv->xfers->size < srv->maxxfers) {
+        struct queued_req q = pop_queued_request(srv);
+
+        const size_t txnid = srv->next_txnid;
+
+        if (!process_request(srv, q.buf, q.size, q.client_pid, q.fds)) {
+            close_queued_fds(&q);
+
+        } else if (srv->next_txnid != txnid) {
+            /* Account for the time spent waiting */
+            struct resrc_xfer* const xfer = xfer_table_find(srv->xfers, txnid);
+
+            if (xfer) {
+                struct resrc_xfer_cold* const c = xfer_cold(xfer);
+                c->queue_us = c->start_us - q.recv_us;
+                c->start_us = q.recv_us;
             }
         }
+
+        free(q.buf);
     }
+}
 
-    default:
-        sfd_log(LOG_NOTICE, "Invalid state for command ID %d\n", xfer->cmd);
+static void send_queued(const struct server* srv,
+                        const void* buf, const size_t size, const int* fds)
+{
+    switch (sfd_get_cmd(buf)) {
+    case PROT_CMD_SEND:
+    case PROT_CMD_FILE_OPEN:
         break;
+    default:
+        return;
     }
 
-    return false;
+    struct prot_request req;
+
+    if (req_stat_fd(buf, size, fds) != -1 &&
+        prot_unmarshal_request(&req, buf, size) &&
+        (req.ext_flags & PROT_REQX_QUEUED)) {
+        send_req_queued(fds[0], srv->admq_size - 1, srv->admission_wait_ms,
+                        req.version);
+    }
 }
 
-static bool has_stat_channel(const struct resrc_xfer* x)
+static void expire_queued_requests(struct server* srv)
 {
-    assert ((x->stat_fd == x->dest_fd) || x->cmd == PROT_CMD_SEND);
-    return (x->stat_fd != x->dest_fd);
+    const uint64_t timeout_us = (uint64_t)srv->admission_wait_ms * 1000;
+    const uint64_t now = metrics_now_us();
+
+    while (srv->admq_size > 0 &&
+           now - srv->admq[srv->admq_head].recv_us >= timeout_us) {
+        struct queued_req q = pop_queued_request(srv);
+
+        count_rejected_req(ETIMEDOUT);
+        if (req_stat_fd(q.buf, q.size, q.fds) != -1)
+            send_req_err(q.fds[0], ETIMEDOUT);
+        close_queued_fds(&q);
+        free(q.buf);
+    }
+
+    if (srv->admq_size > 0) {
+        /* Wait for the (new) oldest request's deadline */
+        const unsigned ms = ms_until_timeout(srv->admq[srv->admq_head].recv_us,
+                                             srv->admission_wait_ms);
+
+        srv->admq_timer.ident = -1;
+
+        if (syspoll_timer(srv->poller,
+                          (struct syspoll_resrc*)&srv->admq_timer,
+                          ms)) {
+            srv->admq_timer_armed = true;
+        } else {
+            sfd_log(LOG_CRIT, "Couldn't arm admission queue timer [%m]\n");
+        }
+    }
 }
 
-static struct resrc_resp* new_resrc_resp(int fd,
-                                         const void* pdu,
-                                         size_t pdu_size);
+static unsigned ms_until_timeout(const uint64_t since_us,
+                                 const unsigned timeout_ms)
+{
+    const uint64_t timeout_us = (uint64_t)timeout_ms * 1000;
+    const uint64_t waited_us = metrics_now_us() - since_us;
 
-static void send_terminal_resp(struct server* srv,
-                               struct resrc_xfer* x,
-                               const void* pdu, const size_t pdu_size)
+    if (waited_us >= timeout_us)
+        return 1;
+
+    return (unsigned)((timeout_us - waited_us) / 1000) + 1;
+}
+
+static void arm_sweep_timer(struct server* srv)
 {
-    if (send_pdu(x->stat_fd, pdu, pdu_size) || errno_is_fatal(errno))
+    if (srv->idle_timeout_ms == 0 || srv->sweep_timer_armed)
+        return;
+
+    /* Sweeping twice per period bounds detection latency to 1.5 periods */
+    const unsigned ms = SFD_MAX(srv->idle_timeout_ms / 2, 1U);
+
+    srv->sweep_timer.ident = -1;
+
+    if (!syspoll_timer(srv->poller,
+                       (struct syspoll_resrc*)&srv->sweep_timer,
+                       ms)) {
+        sfd_log(LOG_CRIT, "Couldn't arm stalled-transfer timer [%m]\n");
+        return;
+    }
+
+    srv->sweep_timer_armed = true;
+}
+
+static void cancel_stalled_xfers(struct server* srv)
+{
+    const uint64_t period_us = (uint64_t)srv->idle_timeout_ms * 1000;
+    /* At least one byte per period, even if there is no minimum rate */
+    const size_t min_nbytes =
+        SFD_MAX((size_t)((uint64_t)srv->min_rate * srv->idle_timeout_ms / 1000),
+                (size_t)1);
+    const uint64_t now = metrics_now_us();
+
+    for (size_t i = 0; i < srv->xfers->capacity; i++) {
+        struct resrc_xfer* const x = srv->xfers->elems[i];
+
+        /* Open files which have not been sent yet are covered by their own
+           timers */
+        if (!x || x->cmd == PROT_CMD_FILE_OPEN || x->defer == CANCEL)
+            continue;
+
+        struct resrc_xfer_cold* const c = xfer_cold(x);
+
+        /* Pipelined transfers waiting for their turn are not stalled */
+        if (c->prev_xfer || now - c->window_us < period_us)
+            continue;
+
+        if (c->window_nbytes_left - x->nbytes_left >= min_nbytes) {
+            c->window_us = now;
+            c->window_nbytes_left = x->nbytes_left;
+            continue;
+        }
+
+        /* Read File transfers have no separate status channel; their clients
+           will see the data channel being closed */
+        if (has_stat_channel(x))
+            send_xfer_err(x->stat_fd, ETIMEDOUT);
+
+        defer_xfer(srv, x, CANCEL);
+        METRIC_INC(xfer_timeouts);
+    }
+
+    if (srv->xfers->size > 0)
+        arm_sweep_timer(srv);
+}
+
+static size_t client_bucket(const struct server* srv, const pid_t pid)
+{
+    return (size_t)pid & (srv->clients_nbuckets - 1);
+}
+
+static struct resrc_client* find_client(const struct server* srv,
+                                        const pid_t pid)
+{
+    struct resrc_client* client = srv->clients[client_bucket(srv, pid)];
+
+    /* Processes' IDs are reused once they have exited */
+    while (client && (client->pid != pid || client->exited))
+        client = client->next;
+
+    return client;
+}
+
+static void list_idle_client(struct server* srv, struct resrc_client* client)
+{
+    if (!client->idle) {
+        client->idle = true;
+        client->next_idle = srv->idle_clients;
+        srv->idle_clients = client;
+    }
+}
+
+static void watch_client(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+    const pid_t pid = c->client_pid;
+
+    if (xfer->cmd == PROT_CMD_SEND && !has_stat_channel(xfer))
+        return;
+
+    /* PIDs are not available on all platforms */
+    if (pid == US_INVALID_PID) {
+        static bool logged = false;
+        if (!logged) {
+            sfd_log(LOG_WARNING, "Client process IDs are not available;"
+                    " transfers will not be reclaimed when clients exit\n");
+            logged = true;
+        }
+        return;
+    }
+
+    struct resrc_client* client = find_client(srv, pid);
+
+    if (!client) {
+        client = malloc(sizeof(*client));
+        if (!client) {
+            sfd_log(LOG_WARNING, "Couldn't watch client process %d [%m]\n",
+                    pid);
+            return;
+        }
+
+        *client = (struct resrc_client) {
+            .ident = -1,
+            .tag = CLIENT_RESRC_TAG,
+            .pid = pid
+        };
+
+        if (!syspoll_watch_proc(srv->poller,
+                                (struct syspoll_resrc*)client,
+                                pid)) {
+            /* Transfers will still be cleaned up when they fail or time
+               out */
+            sfd_log(LOG_WARNING, "Couldn't watch client process %d [%m]\n",
+                    pid);
+            free(client);
+            return;
+        }
+
+        const size_t bucket = client_bucket(srv, pid);
+        client->next = srv->clients[bucket];
+        srv->clients[bucket] = client;
+        srv->nclients++;
+    }
+
+    client->nxfers++;
+    c->client = client;
+}
+
+static void unwatch_client(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+    struct resrc_client* const client = c->client;
+
+    if (!client)
+        return;
+
+    c->client = NULL;
+
+    assert (client->nxfers > 0);
+
+    if (--client->nxfers == 0)
+        list_idle_client(srv, client);
+}
+
+static void reclaim_client(struct server* srv, struct resrc_client* client)
+{
+    client->exited = true;
+
+    for (size_t i = 0; i < srv->xfers->capacity; i++) {
+        struct resrc_xfer* const x = srv->xfers->elems[i];
+
+        if (x && x->defer != CANCEL && xfer_cold(x)->client == client) {
+            defer_xfer(srv, x, CANCEL);
+            METRIC_INC(xfers_reclaimed);
+        }
+    }
+
+    /* Compact the admission queue, preserving the order of the requests of
+       other clients */
+    const size_t capacity = srv->admq_capacity;
+    size_t nkept = 0;
+
+    for (size_t i = 0; i < srv->admq_size; i++) {
+        struct queued_req* const q =
+            &srv->admq[(srv->admq_head + i) % capacity];
+
+        /* Except for Send File requests without a status channel (cf.
+           watch_client()) */
+        if (q->client_pid == client->pid &&
+            req_stat_fd(q->buf, q->size, q->fds) != -1) {
+            close_queued_fds(q);
+            free(q->buf);
+            METRIC_DEC(queued_requests);
+        } else {
+            srv->admq[(srv->admq_head + nkept) % capacity] = *q;
+            nkept++;
+        }
+    }
+
+    srv->admq_size = nkept;
+}
+
+static void release_idle_clients(struct server* srv)
+{
+    struct resrc_client* client = srv->idle_clients;
+
+    srv->idle_clients = NULL;
+
+    while (client) {
+        struct resrc_client* const next_idle = client->next_idle;
+
+        client->idle = false;
+
+        /* Unless it has been given new transfers since */
+        if (client->nxfers == 0) {
+            struct resrc_client** link =
+                &srv->clients[client_bucket(srv, client->pid)];
+
+            while (*link != client)
+                link = &(*link)->next;
+            *link = client->next;
+            srv->nclients--;
+
+            syspoll_unwatch_proc(srv->poller,
+                                 (struct syspoll_resrc*)client,
+                                 client->exited);
+            free(client);
+        }
+
+        client = next_idle;
+    }
+}
+
+/*
+  Sends a transfer's state and file descriptors; @a prev is the transfer it is
+  waiting for, if any.
+*/
+static bool hand_over_xfer(const int fd,
+                           struct resrc_xfer* x,
+                           const struct resrc_xfer* prev)
+{
+    /* The new server reads whatever data has been buffered again, so the old
+       server can still carry on if the handover fails */
+    if (!fio_ctx_unread(x->fio_ctx, x->file.fd))
+        return false;
+
+    const struct resrc_xfer_cold* const c = xfer_cold(x);
+
+    const struct ho_xfer rec = {
+        .type = HO_REC_XFER,
+        .cmd = x->cmd,
+        .txnid = x->txnid,
+        .size = x->file.size,
+        .nbytes_left = x->nbytes_left,
+        .start_us = c->start_us,
+        .ttfb_us = c->ttfb_us,
+        .queue_us = c->queue_us,
+        .window_us = c->window_us,
+        .window_nbytes_left = c->window_nbytes_left,
+        .progress_us = c->progress_us,
+        .progress_nbytes_left = c->progress_nbytes_left,
+        .cookie = c->cookie,
+        .offset = (x->shared_file ? (int64_t)c->offset : -1),
+        .prev_txnid = (prev ? prev->txnid : 0),
+        .nwrites = x->nwrites,
+        .nstalls = x->nstalls,
+        .ndeferrals = c->ndeferrals,
+        .flags = c->flags,
+        .ext_flags = c->ext_flags,
+        .access = c->access,
+        .resp_version = c->resp_version,
+        .progress_interval = c->progress_interval,
+        .blksize = x->file.blksize,
+        .client_pid = c->client_pid,
+        .src_was_blocking = (x->cmd == PROT_CMD_PUMP &&
+                             c->src.was_blocking)
+    };
+
+    const int fds [HO_MAXFDS] = {x->file.fd, x->stat_fd, x->dest_fd};
+
+    /* Open files have no destination yet, and the status channel of Read File
+       transfers and of Send File transfers without one is their destination. A
+       pump's source takes the place of the file. */
+    return ho_send(fd, &rec, sizeof(rec), NULL, 0,
+                   fds,
+                   ((x->cmd == PROT_CMD_SEND || x->cmd == PROT_CMD_PUMP) &&
+                    has_stat_channel(x) ? 3 : 2));
+}
+
+static enum handover_result hand_over(struct server* srv)
+{
+    const int fd = srv->handover_fd;
+
+    if (!ho_set_timeouts(fd))
+        return HANDOVER_FAILED;
+
+    const struct ho_hello hello = {
+        .type = HO_REC_HELLO,
+        .magic = HO_MAGIC,
+        .version = HO_VERSION,
+        .next_txnid = srv->next_txnid
+    };
+
+    bool refused;
+
+    if (!ho_send(fd, &hello, sizeof(hello), NULL, 0, &srv->reqfd, 1) ||
+        !ho_recv_ack(fd, &refused)) {
+        return HANDOVER_FAILED;
+    }
+
+    /* Fan-out groups are not handed over; their members carry on by
+       themselves */
+    while (srv->fanouts) {
+        if (!detach_from_fanout(srv, srv->fanouts->members))
+            return HANDOVER_FAILED;
+    }
+
+    /* Neither are copy jobs, whose transfers carry on sequentially */
+    if (!settle_copy_jobs(srv))
+        return HANDOVER_FAILED;
+
+    /* Nor direct I/O streams, whose transfers carry on through the page
+       cache */
+    for (size_t i = 0; i < srv->xfers->capacity; i++) {
+        struct resrc_xfer* const x = srv->xfers->elems[i];
+
+        if (x && !drop_dio_stream(x))
+            return HANDOVER_FAILED;
+    }
+
+    size_t nxfers = 0;
+
+    for (size_t i = 0; i < srv->xfers->capacity; i++) {
+        struct resrc_xfer* const x = srv->xfers->elems[i];
+
+        /* Pipelined transfers are handed over after the ones they are
+           waiting for, in order */
+        if (!x || x->defer == CANCEL || xfer_cold(x)->prev_xfer)
+            continue;
+
+        const struct resrc_xfer* prev = NULL;
+
+        for (struct resrc_xfer* p = x; p; p = xfer_cold(p)->next_xfer) {
+            /* Those behind a cancelled transfer which has started writing are
+               to be cancelled as well, but a cancelled transfer which is
+               still waiting is merely taken out of the line */
+            if (p->defer == CANCEL) {
+                if (p == x)
+                    break;
+                continue;
+            }
+
+            if (!hand_over_xfer(fd, p, prev))
+                return HANDOVER_FAILED;
+
+            prev = p;
+            nxfers++;
+        }
+    }
+
+    for (size_t i = 0; i < srv->admq_size; i++) {
+        const struct queued_req* const q =
+            &srv->admq[(srv->admq_head + i) % srv->admq_capacity];
+
+        const struct ho_queued rec = {
+            .type = HO_REC_QUEUED,
+            .client_pid = q->client_pid,
+            .recv_us = q->recv_us
+        };
+
+        size_t nfds = 0;
+        while (nfds < PROT_MAXFDS && q->fds[nfds] != -1)
+            nfds++;
+
+        if (!ho_send(fd, &rec, sizeof(rec), q->buf, q->size, q->fds, nfds))
+            return HANDOVER_FAILED;
+    }
+
+    for (const struct resrc_resp* r = srv->resps; r; r = r->next) {
+        const struct ho_resp rec = {
+            .type = HO_REC_RESP
+        };
+
+        if (!ho_send(fd, &rec, sizeof(rec),
+                     r->pdu, r->pdu_size,
+                     &r->stat_fd, 1)) {
+            return HANDOVER_FAILED;
+        }
+    }
+
+    const struct ho_ack end = {
+        .type = HO_REC_END
+    };
+
+    if (!ho_send(fd, &end, sizeof(end), NULL, 0, NULL, 0))
+        return HANDOVER_FAILED;
+
+    /* The other process starts serving as soon as it has acknowledged the end
+       record, so unless it has certainly not done so this one must not carry
+       on */
+    if (!ho_recv_ack(fd, &refused))
+        return (refused ? HANDOVER_FAILED : HANDOVER_IN_DOUBT);
+
+    sfd_log(LOG_INFO,
+            "Handed over %lu transfers and %lu queued requests\n",
+            nxfers, srv->admq_size);
+
+    return HANDOVER_DONE;
+}
+
+/**
+   Sets up a transfer received from the server handing over, taking ownership of
+   its file descriptors (i.e., closing them on failure).
+*/
+static bool take_over_xfer(struct server* srv,
+                           const struct ho_xfer* rec,
+                           const int* fds, const size_t nfds)
+{
+    const enum prot_cmd_req cmd = (enum prot_cmd_req)rec->cmd;
+    const bool stat_channel = ((cmd == PROT_CMD_SEND &&
+                                !(rec->flags & PROT_REQ_NO_STAT)) ||
+                               cmd == PROT_CMD_PUMP);
+
+    if ((cmd != PROT_CMD_READ &&
+         cmd != PROT_CMD_SEND &&
+         cmd != PROT_CMD_PUMP &&
+         cmd != PROT_CMD_FILE_OPEN) ||
+        nfds != (stat_channel ? 3U : 2U)) {
+        for (size_t i = 0; i < nfds; i++)
+            close(fds[i]);
+        errno = EPROTO;
+        return false;
+    }
+
+    const int dest_fd = (stat_channel ? fds[2] :
+                         cmd != PROT_CMD_FILE_OPEN ? fds[1] :
+                         -1);
+
+    struct resrc_xfer* prev = NULL;
+
+    if (rec->prev_txnid != 0) {
+        prev = xfer_table_find(srv->xfers, (size_t)rec->prev_txnid);
+
+        if (!prev || xfer_cold(prev)->next_xfer) {
+            errno = EPROTO;
+            goto fail1;
+        }
+    }
+
+    const struct resrc_xfer_file file = {
+        .size = rec->size,
+        .fd = fds[0],
+        .blksize = rec->blksize
+    };
+
+    struct resrc_xfer* const x = xfer_new(srv->xfer_pool, cmd, &file,
+                                          rec->nbytes_left,
+                                          rec->client_pid,
+                                          fds[1], dest_fd,
+                                          rec->txnid);
+    if (!x)
+        goto fail1;
+
+    struct resrc_xfer_cold* const c = xfer_cold(x);
+
+    c->start_us = rec->start_us;
+    c->ttfb_us = rec->ttfb_us;
+    c->queue_us = rec->queue_us;
+    c->window_us = rec->window_us;
+    c->window_nbytes_left = rec->window_nbytes_left;
+    c->progress_us = rec->progress_us;
+    c->progress_nbytes_left = rec->progress_nbytes_left;
+    c->cookie = rec->cookie;
+    if (rec->offset >= 0) {
+        x->shared_file = 1;
+        c->offset = (off_t)rec->offset;
+    }
+    x->nwrites = rec->nwrites;
+    x->nstalls = rec->nstalls;
+    c->ndeferrals = rec->ndeferrals;
+    c->flags = rec->flags;
+    /* Direct I/O and the access hint's cache policy start over once the
+       transfer is registered (cf. register_xfer()), from where the old server
+       left off */
+    c->ext_flags = rec->ext_flags;
+    c->access = (uint8_t)rec->access;
+    c->resp_version = (uint8_t)rec->resp_version;
+    c->src.was_blocking = (rec->src_was_blocking != 0);
+    c->progress_interval = rec->progress_interval;
+
+    if (srv->xfers->size == srv->maxxfers) {
+        errno = EMFILE;
+        goto fail2;
+    }
+
+    if (!xfer_table_insert(srv->xfers, x)) {
+        /* E.g., the transfer table is smaller than the old server's */
+        errno = EEXIST;
+        goto fail2;
+    }
+
+    if (srv->xfers->capacity > srv->fitted_capacity && !fit_to_xfers(srv)) {
+        PRESERVE_ERRNO(xfer_table_erase(srv->xfers, x->txnid));
+        goto fail2;
+    }
+
+    count_active_xfer(x, 1);
+    watch_client(srv, x);
+
+    if (cmd == PROT_CMD_FILE_OPEN) {
+        if (!add_open_file_timer(srv, x,
+                                 ms_until_timeout(c->window_us,
+                                                  srv->open_file_timeout_ms)))
+            goto fail3;
+    } else {
+        if (c->flags & PROT_REQ_PIPELINE) {
+            struct stat st;
+            if (fstat(dest_fd, &st) == -1)
+                goto fail3;
+            c->dest_dev = st.st_dev;
+            c->dest_ino = st.st_ino;
+        }
+
+        if (prev) {
+            xfer_cold(prev)->next_xfer = x;
+            c->prev_xfer = prev;
+        } else if (!register_xfer(srv, x)) {
+            goto fail3;
+        }
+
+        /* Pipelined transfers are handed over in order, so this one is its
+           destination's last one so far */
+        if (is_pipelined(x)) {
+            if (prev)
+                untrack_pipeline_tail(srv, prev);
+            track_pipeline_tail(srv, x);
+        }
+
+        arm_sweep_timer(srv);
+    }
+
+    return true;
+
+ fail3:
+    if (dest_fd != -1 && dest_fd != x->stat_fd)
+        PRESERVE_ERRNO(close(dest_fd));
+    PRESERVE_ERRNO(close(x->stat_fd));
+    PRESERVE_ERRNO(delete_unregistered_xfer(srv, x));
+    return false;
+
+ fail2:
+    PRESERVE_ERRNO(xfer_delete(x));
+ fail1:
+    PRESERVE_ERRNO(close(fds[0]));
+    PRESERVE_ERRNO(close(fds[1]));
+    if (stat_channel)
+        PRESERVE_ERRNO(close(fds[2]));
+    return false;
+}
+
+static bool take_over(struct server* srv, const int fd)
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+    union {
+        struct ho_hello hello;
+        struct ho_ack ack;
+        struct ho_xfer xfer;
+        struct ho_queued queued;
+        struct ho_resp resp;
+        uint8_t buf [sizeof(struct ho_queued) + PROT_REQ_MAXSIZE];
+    } rec;
+#pragma GCC diagnostic pop
+
+    int fds [HO_MAXFDS];
+    size_t nfds = HO_MAXFDS;
+
+    ssize_t size = ho_recv(fd, &rec, sizeof(rec), fds, &nfds);
+    if (size == -1)
+        return false;
+
+    if ((size_t)size != sizeof(rec.hello) ||
+        rec.hello.type != HO_REC_HELLO ||
+        rec.hello.magic != HO_MAGIC ||
+        rec.hello.version != HO_VERSION ||
+        nfds != 1) {
+        for (size_t i = 0; i < nfds; i++)
+            close(fds[i]);
+
+        sfd_log(LOG_ERR, "Refusing handover with unknown record format\n");
+
+        PRESERVE_ERRNO(ho_send_ack(fd, EPROTO));
+        errno = EPROTO;
+        return false;
+    }
+
+    srv->reqfd = fds[0];
+    srv->next_txnid = (size_t)rec.hello.next_txnid;
+
+    if (!ho_send_ack(fd, 0))
+        return false;
+
+    size_t nxfers = 0;
+
+    for (;;) {
+        nfds = HO_MAXFDS;
+
+        size = ho_recv(fd, &rec, sizeof(rec), fds, &nfds);
+        if (size == -1)
+            goto fail;
+
+        bool ok = false;
+        bool owned = false;
+
+        /* Unless failing calls set it to something more specific */
+        errno = EPROTO;
+
+        switch (rec.ack.type) {
+        case HO_REC_XFER:
+            if ((size_t)size == sizeof(rec.xfer)) {
+                owned = true;
+                ok = take_over_xfer(srv, &rec.xfer, fds, nfds);
+                nxfers++;
+            }
+            break;
+
+        case HO_REC_QUEUED:
+            if ((size_t)size > sizeof(rec.queued) &&
+                nfds >= 1 && nfds <= PROT_MAXFDS) {
+                ok = queue_request(srv,
+                                   rec.buf + sizeof(rec.queued),
+                                   (size_t)size - sizeof(rec.queued),
+                                   rec.queued.client_pid,
+                                   fds, nfds,
+                                   rec.queued.recv_us);
+            }
+            break;
+
+        case HO_REC_RESP:
+            if ((size_t)size > sizeof(rec.resp) && nfds == 1) {
+                ok = (add_pending_resp(srv, fds[0],
+                                       rec.buf + sizeof(rec.resp),
+                                       (size_t)size - sizeof(rec.resp))
+                      != NULL);
+            }
+            break;
+
+        case HO_REC_END:
+            /* The old server only closes its copies of the file descriptors
+               (and the request socket) and exits once this has been
+               acknowledged */
+            if (!syspoll_register(srv->poller,
+                                  (struct syspoll_resrc*)&srv->reqfd,
+                                  SYSPOLL_READ)) {
+                goto fail;
+            }
+
+            if (!ho_send_ack(fd, 0))
+                return false;
+
+            sfd_log(LOG_INFO,
+                    "Took over %lu transfers and %lu queued requests\n",
+                    nxfers, srv->admq_size);
+
+            return true;
+
+        default:
+            break;
+        }
+
+        if (!ok) {
+            if (!owned) {
+                for (size_t i = 0; i < nfds; i++)
+                    PRESERVE_ERRNO(close(fds[i]));
+            }
+
+            goto fail;
+        }
+    }
+
+ fail:
+    sfd_log(LOG_ERR, "Refusing handover [%m]\n");
+
+    PRESERVE_ERRNO(ho_send_ack(fd, errno));
+
+    return false;
+}
+
+static struct resrc_xfer* get_open_file(struct server* srv,
+                                        const pid_t client_pid,
+                                        const size_t txnid)
+{
+    struct resrc_xfer* const xfer = xfer_table_find(srv->xfers, txnid);
+    if (!xfer) {
+        /* Timer probably expired; can't send any errors because the status
+           channel would've been closed when the timer expired */
+        METRIC_INC(open_file_misses);
+        return NULL;
+    }
+
+    /* If the transfer's client PID is US_INVALID_PID it could not be
+       determined. This would be the case on FreeBSD, on which the recommended
+       way of transferring process credentials (see recvmsg(2) on FreeBSD) does
+       not transfer the PID. */
+    const pid_t xfer_pid = xfer_cold(xfer)->client_pid;
+
+    if (xfer_pid != US_INVALID_PID && xfer_pid != client_pid) {
+        /* Client trying to send a file or cancel a transfer it did not open or
+           initiate itself */
+        sfd_log(LOG_ALERT,
+                "Client with PID %d tried to access transaction with"
+                " mismatching PID %d (txnid %lu)\n",
+                client_pid, xfer_pid, xfer->txnid);
+        METRIC_INC(open_file_misses);
+        return NULL;
+    }
+
+    METRIC_INC(open_file_hits);
+
+    return xfer;
+}
+
+static bool classify_dest(struct resrc_xfer* xfer)
+{
+    struct stat st;
+    if (fstat(xfer->dest_fd, &st) == -1)
+        return false;
+
+    if (S_ISREG(st.st_mode))
+        xfer->dest_type = XFER_DEST_FILE;
+    else if (S_ISCHR(st.st_mode))
+        xfer->dest_type = XFER_DEST_DEVICE;
+    else if (S_ISFIFO(st.st_mode))
+        xfer->dest_type = XFER_DEST_PIPE;
+    else
+        xfer->dest_type = XFER_DEST_SOCKET;
+
+    return true;
+}
+
+static bool register_xfer(struct server* srv, struct resrc_xfer* xfer)
+{
+    uint64_t t0;
+    TRACE_BEGIN(t0, register_xfer, xfer->txnid);
+
+    if (xfer->cmd == PROT_CMD_SEND && !classify_dest(xfer)) {
+        TRACE_END(t0, register_xfer, xfer->txnid, false);
+        return false;
+    }
+
+    if (streams_direct(xfer))
+        start_dio_stream(srv, xfer);
+    else if (follows_access_hint(xfer))
+        start_cache_policy(xfer);
+
+    if (dest_always_writable(xfer)) {
+        bool started = true;
+
+        /* Regular files and devices are always writable, and the poller would
+           refuse them, so they are written to from the deferred list
+           throughout, unless the copy pool writes to them */
+        if (copies_in_parallel(xfer))
+            started = start_copy_job(srv, xfer);
+        else if (xfer->defer == NONE)
+            defer_xfer(srv, xfer, READY);
+
+        TRACE_END(t0, register_xfer, xfer->txnid, started);
+        return started;
+    }
+
+    bool registered = syspoll_register(srv->poller,
+                                       (struct syspoll_resrc*)xfer,
+                                       SYSPOLL_WRITE);
+
+    if (registered && xfer->cmd == PROT_CMD_PUMP) {
+        registered = syspoll_register(srv->poller,
+                                      (struct syspoll_resrc*)
+                                      &xfer_cold(xfer)->src,
+                                      SYSPOLL_READ);
+        if (!registered)
+            PRESERVE_ERRNO(syspoll_deregister(srv->poller, xfer->dest_fd));
+    }
+
+    TRACE_END(t0, register_xfer, xfer->txnid, registered);
+
+    return registered;
+}
+
+static bool is_pipelined(const struct resrc_xfer* x)
+{
+    return ((x->cmd == PROT_CMD_SEND || x->cmd == PROT_CMD_PUMP) &&
+            (xfer_cold(x)->flags & PROT_REQ_PIPELINE));
+}
+
+static size_t pipeline_bucket(const struct server* srv,
+                              const struct resrc_xfer* x)
+{
+    const struct resrc_xfer_cold* const c = xfer_cold(x);
+
+    return (((size_t)c->dest_ino * 31 + (size_t)c->dest_dev) &
+            (srv->pipeline_tails_nbuckets - 1));
+}
+
+static struct resrc_xfer* find_pipeline_tail(const struct server* srv,
+                                             const struct resrc_xfer* xfer)
+{
+    const struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    for (struct resrc_xfer* x = srv->pipeline_tails[pipeline_bucket(srv, xfer)];
+         x;
+         x = xfer_cold(x)->next_tail) {
+
+        const struct resrc_xfer_cold* const xc = xfer_cold(x);
+
+        if (xc->dest_dev == c->dest_dev && xc->dest_ino == c->dest_ino)
+            return x;
+    }
+
+    return NULL;
+}
+
+static void track_pipeline_tail(struct server* srv, struct resrc_xfer* xfer)
+{
+    const size_t bucket = pipeline_bucket(srv, xfer);
+
+    xfer_cold(xfer)->next_tail = srv->pipeline_tails[bucket];
+    srv->pipeline_tails[bucket] = xfer;
+}
+
+static bool untrack_pipeline_tail(struct server* srv, struct resrc_xfer* xfer)
+{
+    if (!is_pipelined(xfer))
+        return false;
+
+    struct resrc_xfer** link = &srv->pipeline_tails[pipeline_bucket(srv, xfer)];
+
+    while (*link && *link != xfer)
+        link = &xfer_cold(*link)->next_tail;
+
+    if (!*link)
+        return false;
+
+    *link = xfer_cold(xfer)->next_tail;
+    xfer_cold(xfer)->next_tail = NULL;
+
+    return true;
+}
+
+static bool start_or_queue_xfer(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    const bool pipelined = is_pipelined(xfer);
+    struct resrc_xfer* prev = NULL;
+
+    if (pipelined) {
+        /* Each request passes its own descriptor, so the destination can only
+           be told apart by the file (socket or pipe) it refers to */
+        struct stat st;
+        if (fstat(xfer->dest_fd, &st) == -1)
+            return false;
+
+        c->dest_dev = st.st_dev;
+        c->dest_ino = st.st_ino;
+
+        prev = find_pipeline_tail(srv, xfer);
+
+        /* A cancelled transfer which has started writing is not waited for,
+           as those behind it are cancelled along with it */
+        if (prev && (prev->defer != CANCEL || xfer_cold(prev)->prev_xfer)) {
+            untrack_pipeline_tail(srv, prev);
+            track_pipeline_tail(srv, xfer);
+            xfer_cold(prev)->next_xfer = xfer;
+            c->prev_xfer = prev;
+            METRIC_INC(xfers_pipelined);
+            return true;
+        }
+    }
+
+    if (!register_xfer(srv, xfer))
+        return false;
+
+    if (pipelined) {
+        if (prev)
+            untrack_pipeline_tail(srv, prev);
+        track_pipeline_tail(srv, xfer);
+    }
+
+    if (xfer->cmd == PROT_CMD_SEND &&
+        !xfer->shared_file &&
+        !dest_always_writable(xfer) &&
+        (c->flags & (PROT_REQ_FANOUT | PROT_REQ_PIPELINE)) == PROT_REQ_FANOUT) {
+        join_fanout(srv, xfer);
+    }
+
+    return true;
+}
+
+static bool dest_always_writable(const struct resrc_xfer* xfer)
+{
+    return (xfer->dest_type == XFER_DEST_FILE ||
+            xfer->dest_type == XFER_DEST_DEVICE);
+}
+
+static bool deregister_xfer(struct server* srv, struct resrc_xfer* xfer)
+{
+    if (dest_always_writable(xfer))
+        return true;
+
+    if (xfer->cmd == PROT_CMD_PUMP)
+        syspoll_deregister(srv->poller, xfer->file.fd);
+
+    return syspoll_deregister(srv->poller, xfer->dest_fd);
+}
+
+/* A group can only be joined while its first chunk has not been superseded */
+static struct fanout* find_fanout(const struct server* srv,
+                                  const struct stat* st,
+                                  const off_t offset, const size_t size)
+{
+    for (struct fanout* g = srv->fanouts; g; g = g->next) {
+        if (g->dev == st->st_dev &&
+            g->ino == st->st_ino &&
+            g->offset == offset &&
+            g->size == size &&
+            (g->chunk == 0 ||
+             (g->chunk == 1 && fio_ctx_nbuffered(g->ctx) > 0))) {
+            return g;
+        }
+    }
+
+    return NULL;
+}
+
+static struct fanout* fanout_new(struct server* srv,
+                                 const struct resrc_xfer* founder,
+                                 const struct stat* st,
+                                 const off_t offset)
+{
+    struct fanout* const this = malloc(sizeof(*this));
+    if (!this)
+        return NULL;
+
+    *this = (struct fanout) {
+        .dev = st->st_dev,
+        .ino = st->st_ino,
+        .offset = offset,
+        .size = founder->file.size,
+        .fd = fcntl(founder->file.fd, F_DUPFD_CLOEXEC, 0),
+        .ctx = fio_ctx_new_pump(pipe_capacity()),
+        .pos = offset,
+        .next = srv->fanouts
+    };
+
+    if (this->fd == -1 || !this->ctx) {
+        if (this->fd != -1)
+            PRESERVE_ERRNO(close(this->fd));
+        if (this->ctx)
+            PRESERVE_ERRNO(fio_ctx_delete(this->ctx));
+        PRESERVE_ERRNO(free(this));
+        return NULL;
+    }
+
+    if (srv->fanouts)
+        srv->fanouts->prev = this;
+    srv->fanouts = this;
+
+    return this;
+}
+
+static void fanout_delete(struct server* srv, struct fanout* g)
+{
+    if (g->prev)
+        g->prev->next = g->next;
+    else
+        srv->fanouts = g->next;
+
+    if (g->next)
+        g->next->prev = g->prev;
+
+    close(g->fd);
+    fio_ctx_delete(g->ctx);
+    free(g);
+}
+
+static void join_fanout(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    struct stat st;
+    const off_t offset = file_offset(xfer->file.fd);
+
+    if (offset == -1 || fstat(xfer->file.fd, &st) == -1)
+        return;
+
+    /* Each member writes from its own buffer */
+    struct fio_ctx* const ctx = fio_ctx_new_pump(pipe_capacity());
+    if (!ctx)
+        return;
+
+    struct fanout* g = find_fanout(srv, &st, offset, xfer->file.size);
+
+    if (g) {
+        METRIC_INC(fanout_joins);
+
+    } else {
+        g = fanout_new(srv, xfer, &st, offset);
+        if (!g) {
+            fio_ctx_delete(ctx);
+            return;
+        }
+    }
+
+    fio_ctx_delete(xfer->fio_ctx);
+    xfer->fio_ctx = ctx;
+
+    c->fanout = g;
+    c->fanout_prev = NULL;
+    c->fanout_next = g->members;
+    c->fanout_chunk = 0;
+    c->fanout_pos = offset;
+
+    if (g->members)
+        xfer_cold(g->members)->fanout_prev = xfer;
+    g->members = xfer;
+    g->nmembers++;
+
+    if (c->fanout_chunk != g->chunk)
+        g->npending++;
+}
+
+static void leave_fanout(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+    struct fanout* const g = c->fanout;
+
+    if (!g)
+        return;
+
+    if (c->fanout_chunk != g->chunk) {
+        assert (g->npending > 0);
+        g->npending--;
+    }
+
+    if (c->fanout_prev)
+        xfer_cold(c->fanout_prev)->fanout_next = c->fanout_next;
+    else
+        g->members = c->fanout_next;
+
+    if (c->fanout_next)
+        xfer_cold(c->fanout_next)->fanout_prev = c->fanout_prev;
+
+    c->fanout = NULL;
+    c->fanout_prev = c->fanout_next = NULL;
+
+    g->nmembers--;
+    if (g->nmembers == 0)
+        fanout_delete(srv, g);
+}
+
+static bool detach_from_fanout(struct server* srv, struct resrc_xfer* xfer)
+{
+    leave_fanout(srv, xfer);
+
+    return (lseek(xfer->file.fd, xfer_cold(xfer)->fanout_pos, SEEK_SET) != -1);
+}
+
+/**
+   Gives a member of a fan-out group (whose buffer is empty) the buffered chunk.
+   The last member to take a chunk after the first one takes it over instead of
+   duplicating it.
+
+   @retval false The chunk could only be taken in part, if at all; the member
+   has to leave the group
+*/
+static bool fanout_give(struct fanout* g, struct resrc_xfer* x)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(x);
+    const size_t nbytes = fio_ctx_nbuffered(g->ctx);
+
+    const ssize_t n = fio_tee(g->ctx, x->fio_ctx,
+                              (g->npending == 1 && g->chunk > 1));
+
+    c->fanout_chunk = g->chunk;
+    g->npending--;
+
+    if (n > 0)
+        c->fanout_pos += n;
+
+    return ((size_t)n == nbytes);
+}
+
+/**
+   Gives a member of a fan-out group (whose buffer is empty) the next chunk it
+   needs, first settling the buffered chunk if the member has taken it already.
+
+   @retval false An error occurred--check @c errno(3)
+*/
+static bool fanout_take(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+    struct fanout* const g = c->fanout;
+
+    if (c->fanout_chunk != g->chunk) {
+        if (!fanout_give(g, xfer) && !detach_from_fanout(srv, xfer))
+            return false;
+        return true;
+    }
+
+    for (struct resrc_xfer* m = g->members, *next; m; m = next) {
+        struct resrc_xfer_cold* const mc = xfer_cold(m);
+        next = mc->fanout_next;
+
+        if (mc->fanout_chunk == g->chunk || m->defer == CANCEL)
+            continue;
+
+        const bool idle = (fio_ctx_nbuffered(m->fio_ctx) == 0);
+
+        if (!idle || !fanout_give(g, m)) {
+            METRIC_INC(fanout_stragglers);
+
+            if (!detach_from_fanout(srv, m)) {
+                if (has_stat_channel(m))
+                    send_xfer_err(m->stat_fd, errno);
+                defer_xfer(srv, m, CANCEL);
+                continue;
+            }
+        }
+
+        /* The member's destination may well have been writable all along */
+        if (fio_ctx_nbuffered(m->fio_ctx) > 0 && m->defer == NONE)
+            defer_xfer(srv, m, READY);
+    }
+
+    if (!fio_ctx_discard(g->ctx))
+        return false;
+
+    assert (g->pos < g->offset + (off_t)g->size);
+
+    const ssize_t nread = fio_fill(g->fd, g->pos, g->ctx,
+                                   SFD_MIN(pipe_capacity(),
+                                           (size_t)(g->offset +
+                                                    (off_t)g->size -
+                                                    g->pos)));
+    if (nread <= 0) {
+        /* The file is locked, so it cannot have been truncated */
+        if (nread == 0)
+            errno = EIO;
+        return false;
+    }
+
+    g->pos += nread;
+    g->chunk++;
+    g->npending = g->nmembers;
+
+    if (!fanout_give(g, xfer) && !detach_from_fanout(srv, xfer))
+        return false;
+
+    return true;
+}
+
+static ssize_t fanout_send(struct server* srv,
+                           struct resrc_xfer* xfer,
+                           const size_t nbytes)
+{
+    if (fio_ctx_nbuffered(xfer->fio_ctx) == 0) {
+        if (xfer_cold(xfer)->fanout && !fanout_take(srv, xfer))
+            return -1;
+
+        /* Left the group without any data */
+        if (fio_ctx_nbuffered(xfer->fio_ctx) == 0) {
+            return file_sendfile(xfer->file.fd, xfer->dest_fd, xfer->fio_ctx,
+                                 NULL, nbytes);
+        }
+    }
+
+    return fio_flush(xfer->fio_ctx, xfer->dest_fd, nbytes);
+}
+
+/**
+   Writes up to @a nbytes of a Send File transfer's data with the primitive
+   which suits its destination (cf. enum xfer_dest).
+*/
+static ssize_t send_data(struct server* srv,
+                         struct resrc_xfer* xfer,
+                         const size_t nbytes)
+{
+    /* Written from the server's own buffers, whatever the destination */
+    if (xfer->direct)
+        return dio_send(xfer_cold(xfer)->dio, xfer->dest_fd, nbytes);
+
+    off_t* const offset = (xfer->shared_file ?
+                           &xfer_cold(xfer)->offset :
+                           NULL);
+
+    switch (xfer->dest_type) {
+    case XFER_DEST_FILE:
+    case XFER_DEST_DEVICE:
+        return file_copy(xfer->file.fd, xfer->dest_fd, xfer->fio_ctx,
+                         offset, nbytes);
+
+    case XFER_DEST_PIPE:
+        /* Splicing reads at the file's own offset */
+        if (!offset && !xfer->fio_ctx) {
+            return file_splice(xfer->file.fd, xfer->dest_fd, xfer->fio_ctx,
+                               nbytes);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    /* Only (former) fan-out members have contexts on Linux */
+    if (xfer->fio_ctx && !offset)
+        return fanout_send(srv, xfer, nbytes);
+
+    return file_sendfile(xfer->file.fd, xfer->dest_fd, xfer->fio_ctx,
+                         offset, nbytes);
+}
+
+/**
+   Sends a terminal response to the client.
+
+   If the status channel is full, the response is retried once it becomes
+   writable (cf. add_pending_resp()).
+*/
+static void send_terminal_resp(struct server* srv,
+                               struct resrc_xfer* x,
+                               const void* pdu, const size_t size);
+
+static bool copies_in_parallel(const struct resrc_xfer* xfer)
+{
+    if (xfer->dest_type != XFER_DEST_FILE ||
+        !(xfer_cold(xfer)->flags & PROT_REQ_PARALLEL) ||
+        xfer->nbytes_left <= COPY_SEG_SIZE) {
+        return false;
+    }
+
+    const int flags = fcntl(xfer->dest_fd, F_GETFL);
+
+    return (flags != -1 && !(flags & O_APPEND));
+}
+
+static bool start_copy_pool(struct server* srv)
+{
+    srv->copy_pool = copy_pool_new(COPY_NTHREADS);
+    if (!srv->copy_pool)
+        return false;
+
+    srv->copy_done.ident = copy_pool_fd(srv->copy_pool);
+
+    if (!syspoll_register(srv->poller, &srv->copy_done, SYSPOLL_READ)) {
+        PRESERVE_ERRNO(copy_pool_delete(srv->copy_pool));
+        srv->copy_pool = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static void copy_job_delete(struct copy_job* job)
+{
+    if (job->fd_in != -1)
+        close(job->fd_in);
+    if (job->fd_out != -1)
+        close(job->fd_out);
+    free(job);
+}
+
+/** Submits segments of a job's range until all of its segments are busy */
+static void submit_copy_segs(struct server* srv, struct copy_job* job)
+{
+    for (size_t i = 0; i < COPY_NTHREADS && job->nsubmitted < job->len; i++) {
+        struct copy_seg* const seg = &job->segs[i];
+
+        if (seg->len > 0)
+            continue;
+
+        const off_t pos = (off_t)job->nsubmitted;
+
+        *seg = (struct copy_seg) {
+            .fd_in = job->fd_in,
+            .fd_out = job->fd_out,
+            .offset = job->offset + pos,
+            .dest_offset = job->dest_offset + pos,
+            .zeroed_from = job->zeroed_from,
+            .len = SFD_MIN(COPY_SEG_SIZE, job->len - job->nsubmitted),
+            .owner = job
+        };
+
+        job->nsubmitted += seg->len;
+        job->ninflight++;
+
+        copy_pool_submit(srv->copy_pool, seg);
+    }
+}
+
+/**
+   Moves a transfer's file and destination offsets past the first @a ncopied
+   bytes of its job, as if they had been copied sequentially.
+*/
+static bool skip_copied(struct resrc_xfer* xfer,
+                        const struct copy_job* job,
+                        const size_t ncopied)
+{
+    if (xfer->shared_file)
+        xfer_cold(xfer)->offset = job->offset + (off_t)ncopied;
+    else if (lseek(xfer->file.fd, job->offset + (off_t)ncopied, SEEK_SET) == -1)
+        return false;
+
+    return (lseek(xfer->dest_fd,
+                  job->dest_offset + (off_t)ncopied, SEEK_SET) != -1);
+}
+
+static bool start_copy_job(struct server* srv, struct resrc_xfer* xfer)
+{
+    if (!srv->copy_pool && !start_copy_pool(srv))
+        return false;
+
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    const off_t offset = (xfer->shared_file ?
+                          c->offset :
+                          file_offset(xfer->file.fd));
+    const off_t dest_offset = file_offset(xfer->dest_fd);
+    struct stat st;
+
+    if (offset == -1 || dest_offset == -1 || fstat(xfer->dest_fd, &st) == -1)
+        return false;
+
+    const off_t end = dest_offset + (off_t)xfer->nbytes_left;
+
+    if (end > st.st_size && ftruncate(xfer->dest_fd, end) == -1)
+        return false;
+
+    struct copy_job* const job = malloc(sizeof(*job));
+    if (!job)
+        return false;
+
+    *job = (struct copy_job) {
+        .xfer = xfer,
+        .fd_in = fcntl(xfer->file.fd, F_DUPFD_CLOEXEC, 0),
+        .fd_out = fcntl(xfer->dest_fd, F_DUPFD_CLOEXEC, 0),
+        .offset = offset,
+        .dest_offset = dest_offset,
+        .zeroed_from = SFD_MAX(st.st_size, dest_offset),
+        .len = xfer->nbytes_left
+    };
+
+    if (job->fd_in == -1 || job->fd_out == -1) {
+        PRESERVE_ERRNO(copy_job_delete(job));
+        return false;
+    }
+
+    c->copy_job = job;
+
+    submit_copy_segs(srv, job);
+
+    return true;
+}
+
+static void reap_copy_segs(struct server* srv)
+{
+    struct copy_seg* seg;
+
+    while ((seg = copy_pool_reap(srv->copy_pool))) {
+        struct copy_job* const job = seg->owner;
+        struct resrc_xfer* const x = job->xfer;
+        const size_t len = seg->len;
+
+        seg->len = 0;
+        job->ninflight--;
+
+        if (!x) {
+            if (job->ninflight == 0)
+                copy_job_delete(job);
+            continue;
+        }
+
+        /* Left to process_deferred() to delete */
+        if (x->defer == CANCEL)
+            continue;
+
+        METRIC_ADD(writes, seg->ncalls);
+        x->nwrites += seg->ncalls;
+
+        if (seg->err != 0) {
+            fail_xfer(srv, x, seg->err);
+            delete_registered_xfer(srv, x);
+            continue;
+        }
+
+        METRIC_INC(copy_segments);
+        count_written(x, len);
+
+        if (x->nbytes_left == 0) {
+            skip_copied(x, job, job->len);
+            complete_xfer(srv, x);
+            delete_registered_xfer(srv, x);
+            continue;
+        }
+
+        /* Nonterminal notification; delivery not critical */
+        if (has_stat_channel(x) &&
+            !send_progress(x, len) &&
+            errno_is_fatal(errno)) {
+            delete_registered_xfer(srv, x);
+            continue;
+        }
+
+        submit_copy_segs(srv, job);
+    }
+}
+
+static void drop_copy_job(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+    struct copy_job* const job = c->copy_job;
+
+    if (!job)
+        return;
+
+    c->copy_job = NULL;
+    job->xfer = NULL;
+
+    if (job->ninflight > 0)
+        copy_pool_cancel(srv->copy_pool, job);
+    else
+        copy_job_delete(job);
+}
+
+static bool settle_copy_jobs(struct server* srv)
+{
+    if (!srv->copy_pool)
+        return true;
+
+    /* No more segments are submitted, so that the copied ones will be the
+       first ones */
+    for (size_t i = 0; i < srv->xfers->capacity; i++) {
+        const struct resrc_xfer* const x = srv->xfers->elems[i];
+        if (x && xfer_cold(x)->copy_job)
+            xfer_cold(x)->copy_job->len = xfer_cold(x)->copy_job->nsubmitted;
+    }
+
+    copy_pool_wait(srv->copy_pool);
+    reap_copy_segs(srv);
+
+    for (size_t i = 0; i < srv->xfers->capacity; i++) {
+        struct resrc_xfer* const x = srv->xfers->elems[i];
+
+        if (!x || x->defer == CANCEL || !xfer_cold(x)->copy_job)
+            continue;
+
+        const struct copy_job* const job = xfer_cold(x)->copy_job;
+
+        if (!skip_copied(x, job, job->nsubmitted))
+            return false;
+
+        drop_copy_job(srv, x);
+
+        /* Carries on by itself if the handover fails */
+        defer_xfer(srv, x, READY);
+    }
+
+    return true;
+}
+
+static bool streams_direct(const struct resrc_xfer* xfer)
+{
+    const struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    return (xfer->cmd == PROT_CMD_SEND &&
+            (c->ext_flags & PROT_REQX_DIRECT) &&
+            !(c->flags & PROT_REQ_FANOUT) &&
+            !xfer->shared_file &&
+            !dest_always_writable(xfer) &&
+            xfer->nbytes_left >= DIO_BUF_SIZE);
+}
+
+static void start_dio_stream(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    if (!srv->dio_pool)
+        srv->dio_pool = dio_pool_new(DIO_NBUFS);
+
+    if (srv->dio_pool)
+        c->dio = dio_stream_new(srv->dio_pool, xfer->file.fd, xfer->nbytes_left);
+
+    if (!c->dio) {
+        sfd_log(LOG_INFO,
+                "Transfer %lu reads through the page cache; direct I/O"
+                " failed (errno %d)\n", xfer->txnid, errno);
+        return;
+    }
+
+    xfer->direct = true;
+    METRIC_INC(direct_xfers);
+}
+
+static bool drop_dio_stream(struct resrc_xfer* xfer)
+{
+    if (!xfer->direct)
+        return true;
+
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    const bool restored = dio_stream_delete(c->dio);
+    c->dio = NULL;
+    xfer->direct = false;
+
+    return restored;
+}
+
+static bool follows_access_hint(const struct resrc_xfer* xfer)
+{
+    const struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    return (xfer->cmd == PROT_CMD_SEND &&
+            c->access != PROT_ACCESS_NORMAL &&
+            !(c->flags & PROT_REQ_FANOUT) &&
+            !xfer->shared_file &&
+            !xfer->direct);
+}
+
+static enum fio_access fio_access_of(const uint8_t access)
+{
+    switch ((enum prot_access)access) {
+    case PROT_ACCESS_SEQUENTIAL:
+        return FIO_ACCESS_SEQUENTIAL;
+    case PROT_ACCESS_RANDOM:
+        return FIO_ACCESS_RANDOM;
+    case PROT_ACCESS_WILLNEED:
+        return FIO_ACCESS_WILLNEED;
+    case PROT_ACCESS_NOREUSE:
+        return FIO_ACCESS_NOREUSE;
+    default:
+        /* Including hints from newer clients */
+        return FIO_ACCESS_NORMAL;
+    }
+}
+
+static void start_cache_policy(struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    const off_t offset = file_offset(xfer->file.fd);
+    if (offset == -1)
+        return;
+
+    /* Advice is only ever a hint, so its failure is not the transfer's */
+    fio_cache_start(&c->cache, xfer->file.fd, fio_access_of(c->access),
+                    offset, xfer->nbytes_left, metrics_now_us());
+
+    xfer->hinted = true;
+}
+
+static void update_cache_policy(struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+
+    /* The range ends where the policy's does, so the position follows from
+       what is left to send */
+    fio_cache_update(&c->cache, xfer->file.fd,
+                     c->cache.end - (off_t)xfer->nbytes_left,
+                     metrics_now_us());
+}
+
+static void count_written(struct resrc_xfer* xfer, const size_t nwritten)
+{
+    if (xfer->nbytes_left == xfer->file.size) {
+        struct resrc_xfer_cold* const c = xfer_cold(xfer);
+        c->ttfb_us = metrics_now_us() - c->start_us;
+        metrics_hist_add(&sfd_metrics->ttfb, c->ttfb_us);
+    }
+
+    METRIC_ADD(bytes_sent, nwritten);
+
+    xfer->nbytes_left -= nwritten;
+}
+
+static void complete_xfer(struct server* srv, struct resrc_xfer* xfer)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+    const uint64_t duration_us = metrics_now_us() - c->start_us;
+
+    if (xfer->hinted)
+        fio_cache_finish(&c->cache, xfer->file.fd);
+
+    METRIC_INC(xfers_completed);
+    metrics_hist_add(&sfd_metrics->duration, duration_us);
+
+    if (!has_stat_channel(xfer))
+        return;
+
+    /* Terminal notification; delivery is critical */
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+
+    if (c->flags & PROT_REQ_XFER_STATS) {
+        struct sfd_xfer_stats pdu;
+        prot_marshal_xfer_stats(&pdu,
+                                xfer->file.size,
+                                duration_us,
+                                c->ttfb_us,
+                                c->queue_us,
+                                xfer->nwrites,
+                                xfer->nstalls,
+                                c->ndeferrals,
+                                c->cookie);
+        send_terminal_resp(srv, xfer, buf,
+                           prot_marshal_response(buf, &pdu, c->resp_version));
+
+    } else {
+        struct sfd_xfer_stat pdu;
+        prot_marshal_xfer_stat(&pdu, PROT_XFER_COMPLETE);
+        send_terminal_resp(srv, xfer, buf,
+                           prot_marshal_response(buf, &pdu, c->resp_version));
+    }
+}
+
+static void fail_xfer(struct server* srv, struct resrc_xfer* xfer,
+                      const int err)
+{
+    METRIC_INC(xfers_failed);
+
+    if (!has_stat_channel(xfer))
+        return;
+
+    struct prot_hdr pdu = {
+        .cmd = SFD_XFER_STAT,
+        .stat = (uint8_t)err
+    };
+
+    send_terminal_resp(srv, xfer, &pdu, sizeof(pdu));
+}
+
+/**
+   Transfers file data until the destination's I/O space has been filled, or
+   until enough has been written that other transfers would be starved.
+
+   @retval false The transfer has completed or failed, and has to be deleted
+*/
+static bool transfer_file_pass(struct server* srv, struct resrc_xfer* xfer);
+
+static bool transfer_file(struct server* srv, struct resrc_xfer* xfer)
+{
+    const size_t txnid = xfer->txnid;
+    const size_t nbytes_left = xfer->nbytes_left;
+    uint64_t t0;
+
+    if (xfer->defer == READY) {
+        xfer_cold(xfer)->ndeferrals++;
+
+        TRACE_BEGIN(t0, xfer_pass_deferred, txnid);
+        const bool ret = transfer_file_pass(srv, xfer);
+        TRACE_END(t0, xfer_pass_deferred, txnid,
+                  nbytes_left - xfer->nbytes_left);
+
+        /* The transfer is gone unless it carries on */
+        if (ret && xfer->hinted)
+            update_cache_policy(xfer);
+        return ret;
+
+    } else {
+        TRACE_BEGIN(t0, xfer_pass, txnid);
+        const bool ret = transfer_file_pass(srv, xfer);
+        TRACE_END(t0, xfer_pass, txnid, nbytes_left - xfer->nbytes_left);
+
+        if (ret && xfer->hinted)
+            update_cache_policy(xfer);
+        return ret;
+    }
+}
+
+static bool transfer_file_pass(struct server* srv, struct resrc_xfer* xfer)
+{
+    switch (xfer->cmd) {
+    case PROT_CMD_READ:
+    case PROT_CMD_SEND:
+    case PROT_CMD_PUMP: {
+        size_t total_nwritten = 0;
+
+        /* Other transfers get a turn once a destination's worth of data has
+           been written */
+        const size_t pass_size = (dest_always_writable(xfer) ?
+                                  FILE_DEST_PASS_SIZE :
+                                  pipe_capacity());
+
+        for (;;) {
+            const size_t write_size =
+                SFD_MIN(xfer->file.blksize,
+                    SFD_MIN(xfer->nbytes_left,
+                        pass_size - total_nwritten));
+
+            assert (write_size > 0);
+
+            ssize_t nwritten = (xfer->cmd == PROT_CMD_READ ?
+                                file_splice(xfer->file.fd,
+                                            xfer->dest_fd,
+                                            xfer->fio_ctx,
+                                            write_size) :
+                                xfer->cmd != PROT_CMD_SEND ?
+                                fio_pump(xfer->file.fd,
+                                         xfer->dest_fd,
+                                         xfer->fio_ctx,
+                                         write_size) :
+                                send_data(srv, xfer, write_size));
+
+            METRIC_INC(writes);
+            xfer->nwrites++;
+
+            if (nwritten == 0) {
+                /* Only a pump's source can reach end-of-file. Doing so
+                   completes an unbounded pump, but a bounded one has been cut
+                   short. */
+                assert (xfer->cmd == PROT_CMD_PUMP);
+
+                if (xfer->file.size == PUMP_UNBOUNDED) {
+                    xfer->file.size -= xfer->nbytes_left;
+                    xfer->nbytes_left = 0;
+                } else {
+                    errno = EPIPE;
+                    nwritten = -1;
+                }
+            }
+
+            if (nwritten == -1) {
+                /* Nothing reports a regular file or device as having room
+                   again (e.g., after ENOSPC or EDQUOT), so retrying it would
+                   only spin */
+                if (errno_is_fatal(errno) ||
+                    (dest_always_writable(xfer) &&
+                     errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    fail_xfer(srv, xfer, errno);
+                    return false;
+                }
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    METRIC_INC(writes_eagain);
+                    xfer->nstalls++;
+                }
+
+            } else if (nwritten > 0) {
+                count_written(xfer, (size_t)nwritten);
+                total_nwritten += (size_t)nwritten;
+            }
+
+            assert (nwritten > 0 ||
+                    xfer->nbytes_left == 0 ||
+                    (nwritten == -1 && !errno_is_fatal(errno)));
+
+            if (xfer->nbytes_left == 0) {
+                complete_xfer(srv, xfer);
+                return false;
+
+            } else if (nwritten == -1) {
+                /* Nonterminal notification; delivery not critical */
+                if (has_stat_channel(xfer)) {
+                    if (!send_progress(xfer, total_nwritten) &&
+                        errno_is_fatal(errno)) {
+                        return false;
+                    }
+                }
+            }
+
+            if (nwritten == -1) {
+                /* A regular file or device will not be reported as
+                   writable, so it is retried from the deferred list
+                   instead */
+                if (dest_always_writable(xfer)) {
+                    if (xfer->defer == NONE)
+                        defer_xfer(srv, xfer, READY);
+                } else {
+                    xfer->defer = NONE;
+                }
+                return true;
+            }
+
+            if (total_nwritten >= pass_size) {
+                if (xfer->defer == NONE)
+                    defer_xfer(srv, xfer, READY);
+                return true;
+            }
+        }
+    }
+
+    default:
+        sfd_log(LOG_NOTICE, "Invalid state for command ID %d\n", xfer->cmd);
+        break;
+    }
+
+    return false;
+}
+
+static bool send_progress(struct resrc_xfer* x, const size_t nwritten)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(x);
+
+    if (c->flags & PROT_REQ_NO_PROGRESS)
+        return true;
+
+    /* Coalesced notifications report everything written since the previous
+       one */
+    size_t nbytes = nwritten;
+
+    if (c->progress_interval > 0) {
+        nbytes = c->progress_nbytes_left - x->nbytes_left;
+
+        if (c->flags & PROT_REQ_PROGRESS_MS) {
+            const uint64_t now = metrics_now_us();
+            if (now - c->progress_us < (uint64_t)c->progress_interval * 1000)
+                return true;
+            c->progress_us = now;
+        } else if (nbytes < c->progress_interval) {
+            return true;
+        }
+    }
+
+    if (!send_xfer_stat(x->stat_fd, nbytes, c->resp_version))
+        return false;
+
+    c->progress_nbytes_left = x->nbytes_left;
+
+    METRIC_INC(progress_notifications);
+
+    return true;
+}
+
+static bool has_stat_channel(const struct resrc_xfer* x)
+{
+    assert ((x->stat_fd == x->dest_fd) ||
+            x->cmd == PROT_CMD_SEND ||
+            x->cmd == PROT_CMD_PUMP);
+    return (x->stat_fd != x->dest_fd);
+}
+
+static void send_terminal_resp(struct server* srv,
+                               struct resrc_xfer* x,
+                               const void* pdu, const size_t pdu_size)
+{
+    uint64_t t0;
+    TRACE_BEGIN(t0, terminal_resp, x->txnid);
+
+    const bool sent = send_pdu(x->stat_fd, pdu, pdu_size);
+
+    PRESERVE_ERRNO(TRACE_END(t0, terminal_resp, x->txnid, sent));
+
+    if (sent || errno_is_fatal(errno))
         return;
 
     /* Temporary send error--retry it later.
@@ -693,46 +3499,69 @@ static void send_terminal_resp(struct server* srv,
         return;
     }
 
-    struct resrc_resp* const resp = new_resrc_resp(stat_fd, pdu, pdu_size);
-    if (!resp) {
-        sfd_log(LOG_EMERG,
-                "Couldn't allocate memory for response retry [%m]\n");
-        close(stat_fd);
-    }
-
-    if (!syspoll_register(srv->poller,
-                          (struct syspoll_resrc*)resp,
-                          SYSPOLL_WRITE)) {
-        sfd_log(LOG_EMERG, "Unable to register transfer's stat fd [%m]\n");
-        free(resp);
+    if (!add_pending_resp(srv, stat_fd, pdu, pdu_size)) {
+        sfd_log(LOG_EMERG, "Couldn't set up response retry [%m]\n");
         close(stat_fd);
     }
 }
 
-static struct resrc_resp* new_resrc_resp(int fd,
-                                         const void* pdu,
-                                         size_t pdu_size)
+static struct resrc_resp* add_pending_resp(struct server* srv,
+                                           const int stat_fd,
+                                           const void* pdu,
+                                           const size_t pdu_size)
 {
-    assert (pdu_size <= sizeof(struct sfd_xfer_stat));
+    if (pdu_size > sizeof(((struct resrc_resp*)NULL)->pdu)) {
+        errno = EINVAL;
+        return NULL;
+    }
 
     struct resrc_resp* this = malloc(sizeof(*this));
     if (!this)
         return NULL;
 
     *this = (struct resrc_resp) {
-        .stat_fd = fd,
+        .stat_fd = stat_fd,
         .tag = PENDING_RESP_TAG,
         .pdu_size = pdu_size,
+        .next = srv->resps
     };
 
-    memcpy(&this->pdu, pdu, pdu_size);
+    memcpy(this->pdu, pdu, pdu_size);
+
+    if (!syspoll_register(srv->poller,
+                          (struct syspoll_resrc*)this,
+                          SYSPOLL_WRITE)) {
+        PRESERVE_ERRNO(free(this));
+        return NULL;
+    }
+
+    if (srv->resps)
+        srv->resps->prev = this;
+    srv->resps = this;
 
     return this;
 }
 
+static void delete_pending_resp(struct server* srv, struct resrc_resp* r)
+{
+    if (r->prev)
+        r->prev->next = r->next;
+    else
+        srv->resps = r->next;
+
+    if (r->next)
+        r->next->prev = r->prev;
+
+    close(r->stat_fd);
+    free(r);
+}
+
 /* --------------- (Uninteresting) Internal implementations ------------- */
 
 static struct server* srv_new(const long open_file_timeout_ms,
+                              const long admission_wait_ms,
+                              const long idle_timeout_ms,
+                              const long min_rate,
                               const int reqfd,
                               const int maxfds)
 {
@@ -742,44 +3571,254 @@ static struct server* srv_new(const long open_file_timeout_ms,
     if (!this)
         return NULL;
 
+    /* Start small; the transfer tables and the structures sized according to
+       them grow with demand */
+    const size_t nxfers = SFD_MIN((size_t)maxfds, SRV_INITIAL_XFERS);
+
     *this = (struct server) {
-        .poller = syspoll_new(maxfds),
-        .xfers = xfer_table_new(resrc_xfer_txnid, (size_t)maxfds),
-        .xfer_timers = xfer_table_new(resrc_timer_txnid, (size_t)maxfds),
-        .deferred_xfers = malloc(sizeof(struct resrc_xfer) * (size_t)maxfds),
+        .xfers = xfer_table_new_range(resrc_xfer_txnid,
+                                      nxfers, (size_t)maxfds),
+        .xfer_timers = xfer_table_new_range(resrc_timer_txnid,
+                                            nxfers, (size_t)maxfds),
+        .xfer_pool = xfer_pool_new((size_t)maxfds),
+        .maxxfers = (size_t)maxfds,
         .ndeferred_xfers = 0,
+        .admq_timer = {
+            .ident = -1,
+            .tag = TIMER_RESRC_TAG
+        },
+        .sweep_timer = {
+            .ident = -1,
+            .tag = TIMER_RESRC_TAG
+        },
         .open_file_timeout_ms = (unsigned)open_file_timeout_ms,
+        .admission_wait_ms = (unsigned)admission_wait_ms,
+        .idle_timeout_ms = (unsigned)idle_timeout_ms,
+        .min_rate = (size_t)min_rate,
         .reqfd = reqfd,
+        .handover_fd = -1,
         .next_txnid = 1,
         .uid = geteuid()
     };
 
-    if (!this->poller ||
-        !this->xfers ||
+    if (!this->xfers ||
         !this->xfer_timers ||
-        !this->deferred_xfers) {
+        !this->xfer_pool ||
+        !(this->poller = syspoll_new((int)this->xfers->capacity)) ||
+        !fit_to_xfers(this)) {
         PRESERVE_ERRNO(srv_delete(this));
         return NULL;
     }
 
+    count_footprint(this);
+
     return this;
 }
 
 static void srv_delete(struct server* this)
 {
+    if (this->clients) {
+        /* The poller is about to be deleted, so there is no need to
+           deregister (which is what 'exited' avoids) */
+        for (size_t i = 0; i < this->clients_nbuckets; i++) {
+            struct resrc_client* client = this->clients[i];
+
+            while (client) {
+                struct resrc_client* const next = client->next;
+
+                syspoll_unwatch_proc(this->poller,
+                                     (struct syspoll_resrc*)client,
+                                     true);
+                free(client);
+                client = next;
+            }
+        }
+        free(this->clients);
+    }
+
+    free(this->pipeline_tails);
+
+    if (this->copy_pool) {
+        /* The threads may still be copying for transfers which are about to
+           be deleted */
+        for (size_t i = 0; i < this->xfers->capacity; i++) {
+            if (this->xfers->elems[i])
+                drop_copy_job(this, this->xfers->elems[i]);
+        }
+
+        copy_pool_wait(this->copy_pool);
+        reap_copy_segs(this);
+        copy_pool_delete(this->copy_pool);
+    }
+
     syspoll_delete(this->poller);
 
     close(this->reqfd);
 
+    if (this->dio_pool) {
+        /* The buffers go back to the pool before it is deleted */
+        for (size_t i = 0; i < this->xfers->capacity; i++) {
+            if (this->xfers->elems[i])
+                drop_dio_stream(this->xfers->elems[i]);
+        }
+    }
+
     xfer_table_delete(this->xfers, delete_xfer_and_close_all_fds);
-    xfer_table_delete(this->xfer_timers, timer_delete);
+    dio_pool_delete(this->dio_pool);
+    xfer_table_delete(this->xfer_timers, resrc_timer_delete);
+
+    /* The groups' members have just been deleted */
+    while (this->fanouts)
+        fanout_delete(this, this->fanouts);
+    xfer_pool_delete(this->xfer_pool);
 
     /* Deferred xfers were also in this->xfers (the running transfer table) */
+    METRIC_ADD(deferred_xfers, -this->ndeferred_xfers);
     free(this->deferred_xfers);
 
+    while (this->admq_size > 0) {
+        struct queued_req q = pop_queued_request(this);
+        close_queued_fds(&q);
+        free(q.buf);
+    }
+    free(this->admq);
+
+    if (this->admq_timer_armed)
+        close(this->admq_timer.ident);
+
+    if (this->sweep_timer_armed)
+        close(this->sweep_timer.ident);
+
+    while (this->resps)
+        delete_pending_resp(this, this->resps);
+
+    if (this->handover_fd != -1)
+        close(this->handover_fd);
+
     free(this);
 }
 
+static bool rehash_clients(struct server* srv, const size_t nbuckets)
+{
+    struct resrc_client** const clients = calloc(nbuckets, sizeof(*clients));
+    if (!clients)
+        return false;
+
+    struct resrc_client** const old_clients = srv->clients;
+    const size_t old_nbuckets = srv->clients_nbuckets;
+
+    srv->clients = clients;
+    srv->clients_nbuckets = nbuckets;
+
+    for (size_t i = 0; i < old_nbuckets; i++) {
+        struct resrc_client* client = old_clients[i];
+
+        while (client) {
+            struct resrc_client* const next = client->next;
+            const size_t bucket = client_bucket(srv, client->pid);
+
+            client->next = clients[bucket];
+            clients[bucket] = client;
+            client = next;
+        }
+    }
+
+    free(old_clients);
+
+    return true;
+}
+
+static bool rehash_pipeline_tails(struct server* srv, const size_t nbuckets)
+{
+    struct resrc_xfer** const tails = calloc(nbuckets, sizeof(*tails));
+    if (!tails)
+        return false;
+
+    struct resrc_xfer** const old_tails = srv->pipeline_tails;
+    const size_t old_nbuckets = srv->pipeline_tails_nbuckets;
+
+    srv->pipeline_tails = tails;
+    srv->pipeline_tails_nbuckets = nbuckets;
+
+    for (size_t i = 0; i < old_nbuckets; i++) {
+        struct resrc_xfer* x = old_tails[i];
+
+        while (x) {
+            struct resrc_xfer* const next = xfer_cold(x)->next_tail;
+
+            track_pipeline_tail(srv, x);
+            x = next;
+        }
+    }
+
+    free(old_tails);
+
+    return true;
+}
+
+static bool fit_to_xfers(struct server* srv)
+{
+    const size_t capacity = srv->xfers->capacity;
+
+    /* The number of deferred transfers is bounded by the number of
+       transfers */
+    assert (srv->ndeferred_xfers <= capacity);
+
+    struct resrc_xfer** const deferred =
+        realloc(srv->deferred_xfers, sizeof(*deferred) * capacity);
+    if (!deferred)
+        return false;
+    srv->deferred_xfers = deferred;
+
+    /* There is at most a client per transfer, and records can outlive their
+       transfers until the end of a batch of events, hence the factor of two */
+    size_t clients_nbuckets = 1;
+    while (clients_nbuckets < capacity * 2)
+        clients_nbuckets *= 2;
+
+    if (clients_nbuckets != srv->clients_nbuckets &&
+        !rehash_clients(srv, clients_nbuckets)) {
+        return false;
+    }
+
+    size_t tails_nbuckets = 1;
+    while (tails_nbuckets < capacity)
+        tails_nbuckets *= 2;
+
+    if (tails_nbuckets != srv->pipeline_tails_nbuckets &&
+        !rehash_pipeline_tails(srv, tails_nbuckets)) {
+        return false;
+    }
+
+    if (!syspoll_resize(srv->poller, (int)capacity))
+        return false;
+
+    if (capacity != srv->fitted_capacity) {
+        sfd_log(LOG_INFO, "Resized transfer table to %lu slots (max. %lu)\n",
+                capacity, srv->xfers->max_capacity);
+    }
+
+    srv->fitted_capacity = capacity;
+
+    METRIC_SET(xfer_slots, capacity);
+
+    return true;
+}
+
+static void count_footprint(const struct server* srv)
+{
+    METRIC_SET(footprint,
+               sizeof(*srv) +
+               xfer_table_footprint(srv->xfers) +
+               xfer_table_footprint(srv->xfer_timers) +
+               xfer_pool_footprint(srv->xfer_pool) +
+               sizeof(*srv->deferred_xfers) * srv->fitted_capacity +
+               sizeof(*srv->clients) * srv->clients_nbuckets +
+               sizeof(*srv->pipeline_tails) * srv->pipeline_tails_nbuckets +
+               sizeof(*srv->admq) * srv->admq_capacity +
+               syspoll_footprint(srv->poller));
+}
+
 static bool errno_is_fatal(const int err)
 {
     switch (err) {
@@ -807,9 +3846,11 @@ static struct resrc_xfer* add_xfer(struct server* srv,
             req->cmd == PROT_CMD_SEND ||
             req->cmd == PROT_CMD_FILE_OPEN);
 
-    if (srv->xfers->size == srv->xfers->capacity) {
+    const uint64_t start_us = metrics_now_us();
+
+    if (srv->xfers->size == srv->maxxfers) {
         sfd_log(LOG_CRIT, "Transfer table is full (%lu/%lu items)\n",
-                srv->xfers->size, srv->xfers->capacity);
+                srv->xfers->size, srv->maxxfers);
         errno = EMFILE;
         return NULL;
     }
@@ -836,23 +3877,49 @@ static struct resrc_xfer* add_xfer(struct server* srv,
 
     finfo->size = xfer_nbytes;
 
-    struct resrc_xfer_file file = {
+    const struct resrc_xfer_file file = {
         .size = xfer_nbytes,
         .fd = fd,
         .blksize = finfo->blksize
     };
 
-    struct resrc_xfer* const xfer = xfer_new(req->cmd,
-                                             &file,
-                                             xfer_nbytes,
+    return add_opened_xfer(srv, req, &file,
+                           client_pid,
+                           stat_fd, dest_fd,
+                           start_us);
+}
+
+static struct resrc_xfer* add_opened_xfer(struct server* srv,
+                                          const struct prot_request* req,
+                                          const struct resrc_xfer_file* file,
+                                          const pid_t client_pid,
+                                          const int stat_fd, const int dest_fd,
+                                          const uint64_t start_us)
+{
+    struct resrc_xfer* const xfer = xfer_new(srv->xfer_pool,
+                                             req->cmd,
+                                             file,
+                                             file->size,
                                              client_pid,
                                              stat_fd, dest_fd,
                                              srv->next_txnid);
     if (!xfer) {
-        PRESERVE_ERRNO(close(fd));
+        PRESERVE_ERRNO(close(file->fd));
         return NULL;
     }
 
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+    c->start_us = start_us;
+    c->window_us = start_us;
+    c->progress_us = start_us;
+    c->flags = req->flags;
+    c->ext_flags = req->ext_flags;
+    c->access = req->access;
+    c->resp_version = req->version;
+    c->progress_interval = req->progress;
+    c->cookie = req->cookie;
+    count_active_xfer(xfer, 1);
+
     srv->next_txnid++;
 
     if (!xfer_table_insert(srv->xfers, xfer)) {
@@ -864,7 +3931,196 @@ static struct resrc_xfer* add_xfer(struct server* srv,
         return NULL;
     }
 
+    if (srv->xfers->capacity > srv->fitted_capacity && !fit_to_xfers(srv)) {
+        PRESERVE_ERRNO(xfer_table_erase(srv->xfers, xfer->txnid));
+        PRESERVE_ERRNO(delete_xfer_and_close_file_fd(xfer));
+        return NULL;
+    }
+
+    watch_client(srv, xfer);
+
+    return xfer;
+}
+
+static struct resrc_xfer* add_range_xfer(struct server* srv,
+                                         const struct prot_send_range* pdu,
+                                         const pid_t client_pid,
+                                         const int stat_fd, const int dest_fd,
+                                         struct fio_stat* finfo)
+{
+    const uint64_t start_us = metrics_now_us();
+
+    struct resrc_xfer* const handle = get_open_file(srv, client_pid, pdu->txnid);
+    if (!handle || !is_file_handle(handle) || handle->defer == CANCEL) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if (srv->xfers->size == srv->maxxfers) {
+        sfd_log(LOG_CRIT, "Transfer table is full (%lu/%lu items)\n",
+                srv->xfers->size, srv->maxxfers);
+        errno = EMFILE;
+        return NULL;
+    }
+
+    const size_t file_size = handle->file.size;
+
+    if ((size_t)pdu->offset >= file_size ||
+        pdu->len > file_size - (size_t)pdu->offset) {
+        errno = ERANGE;
+        return NULL;
+    }
+
+    /* The duplicate shares the handle's open file description, which the
+       kernel keeps open until the handle and all of its ranged sends have
+       closed their descriptors. Its file offset is shared, too, which is why
+       ranged sends read at their own offsets (cf. resrc_xfer::shared_file). */
+    const int fd = fcntl(handle->file.fd, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1)
+        return NULL;
+
+    const size_t xfer_nbytes = (pdu->len > 0 ?
+                                pdu->len :
+                                file_size - (size_t)pdu->offset);
+
+    const struct resrc_xfer_file file = {
+        .size = xfer_nbytes,
+        .fd = fd,
+        .blksize = handle->file.blksize
+    };
+
+    const struct prot_request req = {
+        .cmd = PROT_CMD_SEND,
+        .flags = (uint8_t)(pdu->flags &
+                           (PROT_REQ_XFER_STATS | PROT_REQ_NO_PROGRESS |
+                            PROT_REQ_PROGRESS_MS | PROT_REQ_PIPELINE)),
+        .progress = pdu->progress,
+        .offset = pdu->offset,
+        .len = xfer_nbytes,
+        .cookie = pdu->cookie,
+        .version = PROT_VERSION
+    };
+
+    struct resrc_xfer* const xfer = add_opened_xfer(srv, &req, &file,
+                                                    client_pid,
+                                                    stat_fd, dest_fd,
+                                                    start_us);
+    if (!xfer)
+        return NULL;
+
+    xfer->shared_file = 1;
+    xfer_cold(xfer)->offset = pdu->offset;
+
+    /* Restarts the handle's idle timeout (cf. process_events()) */
+    xfer_cold(handle)->window_us = start_us;
+
+    *finfo = (struct fio_stat) {
+        .size = xfer_nbytes,
+        .blksize = file.blksize
+    };
+
+    return xfer;
+}
+
+static struct resrc_xfer* add_pump_xfer(struct server* srv,
+                                        const struct prot_pump* pdu,
+                                        const pid_t client_pid,
+                                        const int stat_fd,
+                                        const int dest_fd,
+                                        const int src_fd,
+                                        struct fio_stat* finfo)
+{
+    const uint64_t start_us = metrics_now_us();
+
+    if (srv->xfers->size == srv->maxxfers) {
+        sfd_log(LOG_CRIT, "Transfer table is full (%lu/%lu items)\n",
+                srv->xfers->size, srv->maxxfers);
+        errno = EMFILE;
+        return NULL;
+    }
+
+    /* Files are sent with Send File, which knows their sizes */
+    struct stat st;
+    if (fstat(src_fd, &st) == -1)
+        return NULL;
+
+    if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* The source is shared with the client, which may have left it in blocking
+       mode; a pump must never block the server */
+    const int fl = fcntl(src_fd, F_GETFL);
+    if (fl == -1 || (!(fl & O_NONBLOCK) &&
+                     fcntl(src_fd, F_SETFL, fl | O_NONBLOCK) == -1)) {
+        return NULL;
+    }
+
+    /* The transfer owns a duplicate, so that the descriptors received with the
+       request are closed the same way whether or not it is added */
+    const int fd = fcntl(src_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1)
+        goto fail;
+
+    const size_t nbytes = (pdu->len > 0 ? pdu->len : PUMP_UNBOUNDED);
+
+    const struct resrc_xfer_file file = {
+        .size = nbytes,
+        .fd = fd,
+        .blksize = (unsigned)pipe_capacity()
+    };
+
+    const struct prot_request req = {
+        .cmd = PROT_CMD_PUMP,
+        .flags = (uint8_t)(pdu->flags &
+                           (PROT_REQ_XFER_STATS | PROT_REQ_NO_PROGRESS |
+                            PROT_REQ_PROGRESS_MS | PROT_REQ_PIPELINE)),
+        .progress = pdu->progress,
+        .len = pdu->len,
+        .cookie = pdu->cookie,
+        .version = PROT_VERSION
+    };
+
+    struct resrc_xfer* const xfer = add_opened_xfer(srv, &req, &file,
+                                                    client_pid,
+                                                    stat_fd, dest_fd,
+                                                    start_us);
+    if (!xfer)
+        goto fail;
+
+    xfer_cold(xfer)->src.was_blocking = !(fl & O_NONBLOCK);
+
+    *finfo = (struct fio_stat) {
+        .size = pdu->len,
+        .blksize = file.blksize
+    };
+
     return xfer;
+
+ fail:
+    if (!(fl & O_NONBLOCK))
+        PRESERVE_ERRNO(fcntl(src_fd, F_SETFL, fl));
+
+    return NULL;
+}
+
+static void restore_pump_src(struct resrc_xfer* x)
+{
+    if (x->cmd != PROT_CMD_PUMP || !xfer_cold(x)->src.was_blocking)
+        return;
+
+    /* The client's descriptor shares its flags with the server's copy */
+    const int fl = fcntl(x->file.fd, F_GETFL);
+    if (fl == -1 || fcntl(x->file.fd, F_SETFL, fl & ~O_NONBLOCK) == -1)
+        sfd_log(LOG_WARNING, "Couldn't restore pump source's blocking mode"
+                " [%m]\n");
+}
+
+static bool is_file_handle(const struct resrc_xfer* x)
+{
+    return (x->cmd == PROT_CMD_FILE_OPEN &&
+            (xfer_cold(x)->flags & PROT_REQ_HANDLE));
 }
 
 static struct resrc_timer* add_open_file(struct server* srv,
@@ -873,17 +4129,44 @@ static struct resrc_timer* add_open_file(struct server* srv,
                                          const int stat_fd,
                                          struct fio_stat* finfo)
 {
+    /* Ranges of a file handle are relative to the beginning of the file */
+    if ((req->flags & PROT_REQ_HANDLE) && (req->offset != 0 || req->len != 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    uint64_t t0;
+    TRACE_BEGIN(t0, add_xfer, srv->next_txnid);
+
     struct resrc_xfer* const xfer = add_xfer(srv,
                                              req,
                                              client_pid,
                                              stat_fd, -1,
                                              finfo);
+
+    TRACE_END(t0, add_xfer, (xfer ? xfer->txnid : 0), (xfer ? 0 : errno));
+
     if (!xfer)
         return NULL;
 
+    struct resrc_timer* const timer =
+        add_open_file_timer(srv, xfer, srv->open_file_timeout_ms);
+
+    if (!timer) {
+        PRESERVE_ERRNO(delete_unregistered_xfer(srv, xfer));
+        return NULL;
+    }
+
+    return timer;
+}
+
+static struct resrc_timer* add_open_file_timer(struct server* srv,
+                                               struct resrc_xfer* xfer,
+                                               const unsigned ms)
+{
     struct resrc_timer* timer = malloc(sizeof(*timer));
     if (!timer)
-        goto fail1;
+        return NULL;
 
     *timer = (struct resrc_timer) {
         .ident = -1,
@@ -893,32 +4176,49 @@ static struct resrc_timer* add_open_file(struct server* srv,
     };
 
     if (!xfer_table_insert(srv->xfer_timers, timer))
-        goto fail2;
+        goto fail1;
 
-    if (!syspoll_timer(srv->poller,
-                       (struct syspoll_resrc*)timer,
-                       srv->open_file_timeout_ms)) {
-        goto fail3;
-    }
+    if (!syspoll_timer(srv->poller, (struct syspoll_resrc*)timer, ms))
+        goto fail2;
 
     return timer;
 
- fail3:
-    PRESERVE_ERRNO(xfer_table_erase(srv->xfer_timers, timer->txnid));
  fail2:
-    PRESERVE_ERRNO(timer_delete(timer));
+    PRESERVE_ERRNO(xfer_table_erase(srv->xfer_timers, timer->txnid));
  fail1:
-    PRESERVE_ERRNO(delete_unregistered_xfer(srv, xfer));
+    PRESERVE_ERRNO(resrc_timer_delete(timer));
 
     return NULL;
 }
 
+static void count_active_xfer(const struct resrc_xfer* x, const int delta)
+{
+    switch (x->cmd) {
+    case PROT_CMD_READ:
+        METRIC_ADD(active_reads, delta);
+        break;
+    case PROT_CMD_SEND:
+        METRIC_ADD(active_sends, delta);
+        break;
+    case PROT_CMD_PUMP:
+        METRIC_ADD(active_pumps, delta);
+        break;
+    case PROT_CMD_FILE_OPEN:
+        METRIC_ADD(open_files, delta);
+        break;
+    default:
+        break;
+    }
+}
+
 static void delete_xfer_and_close_file_fd(void* p)
 {
     if (p) {
         struct resrc_xfer* const this = p;
         assert (this->tag == XFER_RESRC_TAG);
 
+        count_active_xfer(this, -1);
+
         close(this->file.fd);
         xfer_delete(this);
     }
@@ -930,22 +4230,113 @@ static void delete_xfer_and_close_all_fds(void* p)
         struct resrc_xfer* const this = p;
         assert (this->tag == XFER_RESRC_TAG);
 
-        close(this->stat_fd);
-        if (this->dest_fd != this->stat_fd && this->dest_fd >= 0)
-            close(this->dest_fd);
+        const int stat_fd = this->stat_fd;
+        const int dest_fd = this->dest_fd;
 
         delete_xfer_and_close_file_fd(p);
+
+        /* Closed last, so that by the time a client sees its status or data
+           channel close the transfer is already gone */
+        close(stat_fd);
+        if (dest_fd != stat_fd && dest_fd >= 0)
+            close(dest_fd);
     }
 }
 
 static void delete_unregistered_xfer(struct server* srv, struct resrc_xfer* x)
 {
+    leave_fanout(srv, x);
+    drop_copy_job(srv, x);
+    drop_dio_stream(x);
+    unwatch_client(srv, x);
+    untrack_pipeline_tail(srv, x);
+    restore_pump_src(x);
     xfer_table_erase(srv->xfers, x->txnid);
     delete_xfer_and_close_file_fd(x);
 }
 
+/**
+   Deletes the transfers pipelined behind a failed or cancelled transfer, whose
+   destination's data stream has been broken off, sending them @a err.
+
+   Transfers which have been cancelled already are left to process_deferred(),
+   along with those behind them.
+*/
+static void cancel_pipelined_xfers(struct server* srv,
+                                   struct resrc_xfer* x,
+                                   const int err)
+{
+    while (x) {
+        struct resrc_xfer_cold* const c = xfer_cold(x);
+        struct resrc_xfer* const next = c->next_xfer;
+
+        c->prev_xfer = NULL;
+
+        if (x->defer == CANCEL)
+            return;
+
+        if (has_stat_channel(x))
+            send_xfer_err(x->stat_fd, err);
+
+        unwatch_client(srv, x);
+        untrack_pipeline_tail(srv, x);
+        restore_pump_src(x);
+        xfer_table_erase(srv->xfers, x->txnid);
+        delete_xfer_and_close_all_fds(x);
+        METRIC_INC(xfers_cancelled);
+
+        x = next;
+    }
+}
+
+/** Starts a pipelined transfer once the one ahead of it has completed */
+static void start_pipelined_xfer(struct server* srv, struct resrc_xfer* x)
+{
+    struct resrc_xfer_cold* const c = xfer_cold(x);
+
+    c->prev_xfer = NULL;
+
+    if (x->defer == CANCEL)
+        return;
+
+    if (!register_xfer(srv, x)) {
+        cancel_pipelined_xfers(srv, x, errno);
+        return;
+    }
+
+    /* The idle timeout and progress notifications start now */
+    c->window_us = metrics_now_us();
+    c->progress_us = c->window_us;
+
+    /* Starts writing in this event loop iteration instead of waiting for the
+       poller to report the destination as writable */
+    if (x->defer == NONE && !c->copy_job)
+        defer_xfer(srv, x, READY);
+}
+
 static void delete_registered_xfer(struct server* srv, struct resrc_xfer* xfer)
 {
+    struct resrc_xfer_cold* const c = xfer_cold(xfer);
+    struct resrc_xfer* const prev = c->prev_xfer;
+    struct resrc_xfer* const next = c->next_xfer;
+    const bool completed = (xfer->nbytes_left == 0);
+
+    /* A pipelined transfer which is still waiting has not written anything
+       yet, so it is simply taken out of the line */
+    if (prev) {
+        xfer_cold(prev)->next_xfer = next;
+        if (next)
+            xfer_cold(next)->prev_xfer = prev;
+    }
+
+    if (untrack_pipeline_tail(srv, xfer) && prev)
+        track_pipeline_tail(srv, prev);
+
+    leave_fanout(srv, xfer);
+    drop_copy_job(srv, xfer);
+    drop_dio_stream(xfer);
+    unwatch_client(srv, xfer);
+    restore_pump_src(xfer);
     xfer_table_erase(srv->xfers, xfer->txnid);
 
     /* The client and server processes share the dest fd's file table entry (it
@@ -958,6 +4349,15 @@ static void delete_registered_xfer(struct server* srv, struct resrc_xfer* xfer)
     deregister_xfer(srv, xfer);
 
     delete_xfer_and_close_all_fds(xfer);
+
+    /* The next pipelined transfer starts the moment this one has completed,
+       but only if it did */
+    if (next && !prev) {
+        if (completed)
+            start_pipelined_xfer(srv, next);
+        else
+            cancel_pipelined_xfers(srv, next, ECANCELED);
+    }
 }
 
 static void defer_xfer(struct server* const srv,
@@ -971,6 +4371,7 @@ static void defer_xfer(struct server* const srv,
         if (xfer->defer == NONE) {    /* Not in the list yet */
             srv->deferred_xfers[srv->ndeferred_xfers] = xfer;
             srv->ndeferred_xfers++;
+            METRIC_INC(deferred_xfers);
         }
 
         xfer->defer = CANCEL;
@@ -982,6 +4383,8 @@ static void defer_xfer(struct server* const srv,
 
         srv->deferred_xfers[srv->ndeferred_xfers] = xfer;
         srv->ndeferred_xfers++;
+        METRIC_INC(deferred_xfers);
+        METRIC_INC(deferrals);
 
         xfer->defer = READY;
         break;
@@ -1002,6 +4405,7 @@ static size_t undefer_xfer(struct server* const srv, const size_t i)
     }
 
     srv->ndeferred_xfers--;
+    METRIC_DEC(deferred_xfers);
 
     return i;
 }
@@ -29,11 +29,53 @@
 
 #include <stdbool.h>
 
+/** How the request-processing loop ended */
+enum srv_exit {
+    /** The server could not be started (errno is set) */
+    SRV_EXIT_FAILED = 0,
+    /** SIGTERM was received, or a fatal error occurred */
+    SRV_EXIT_SHUTDOWN,
+    /** The request socket and all transfers were handed over to another
+        process, which now owns the request socket's file */
+    SRV_EXIT_HANDOVER
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-    bool srv_run(const int listenfd, int maxfds, long open_file_timeout_ms);
+    /**
+       Runs the request-processing loop until SIGTERM is received or another
+       process takes over (cf. server_handover.h).
+
+       @param admission_wait_ms The longest a request waits for room for
+       another transfer (in the admission queue) before it is rejected with
+       ETIMEDOUT
+
+       @param idle_timeout_ms Transfers which have made less than @a min_rate
+       bytes per second's (and at least a single byte's) worth of progress
+       within this many milliseconds are cancelled with ETIMEDOUT; zero
+       disables the check
+
+       @param min_rate Minimum transfer rate, in bytes per second
+    */
+    enum srv_exit srv_run(const int listenfd, int maxfds,
+                          long open_file_timeout_ms, long admission_wait_ms,
+                          long idle_timeout_ms, long min_rate);
+
+    /**
+       Takes over the request socket and transfers of a running server, and
+       then runs the request-processing loop as srv_run() does.
+
+       @param handover_fd The handover channel (cf. ho_request()); closed by
+       this function
+
+       @retval SRV_EXIT_FAILED The handover failed, in which case the other
+       server carries on serving
+    */
+    enum srv_exit srv_resume(int handover_fd, int maxfds,
+                             long open_file_timeout_ms, long admission_wait_ms,
+                             long idle_timeout_ms, long min_rate);
 
 #ifdef __cplusplus
 }
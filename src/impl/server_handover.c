@@ -0,0 +1,287 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+#include "server_handover.h"
+#include "unix_sockets.h"
+#include "util.h"
+
+/* Defined in unix_sockets_<platform>.c */
+int us_socket(int, int, int);
+
+int ho_request(const char* sockdir, const char* srvname)
+{
+    int chan[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, chan) == -1)
+        return -1;
+
+    if (!set_cloexec(chan[0], true) || !set_cloexec(chan[1], true))
+        goto fail1;
+
+    const int sockfd = us_socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sockfd == -1)
+        goto fail1;
+
+    const char* const sockpath = us_make_sockpath(sockdir, srvname);
+    if (!sockpath)
+        goto fail2;
+
+    struct sockaddr_un un = {
+        .sun_family = AF_UNIX
+    };
+
+    const size_t sockpath_len = strlen(sockpath);
+    memcpy(un.sun_path, sockpath, sockpath_len + 1);
+    free((void*)sockpath);
+
+    const socklen_t addrlen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) +
+                                          sockpath_len + 1);
+
+    if (connect(sockfd, (struct sockaddr*)&un, addrlen) == -1 ||
+        !set_nonblock(sockfd, false)) {
+        goto fail2;
+    }
+
+    /* The server's credentials are attached by the kernel (the request socket
+       has the credential-passing option set), and checked against the old
+       server's */
+    const struct prot_hdr pdu = {
+        .cmd = PROT_CMD_HANDOVER
+    };
+
+    if (!ho_send(sockfd, &pdu, sizeof(pdu), NULL, 0, &chan[1], 1))
+        goto fail2;
+
+    close(sockfd);
+    close(chan[1]);
+
+    if (!ho_set_timeouts(chan[0])) {
+        PRESERVE_ERRNO(close(chan[0]));
+        return -1;
+    }
+
+    return chan[0];
+
+ fail2:
+    PRESERVE_ERRNO(close(sockfd));
+ fail1:
+    PRESERVE_ERRNO(close(chan[0]));
+    PRESERVE_ERRNO(close(chan[1]));
+
+    return -1;
+}
+
+bool ho_set_timeouts(const int fd)
+{
+    const struct timeval tv = {
+        .tv_sec = HO_TIMEOUT_MS / 1000,
+        .tv_usec = (HO_TIMEOUT_MS % 1000) * 1000
+    };
+
+    return (set_nonblock(fd, false) &&
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0);
+}
+
+bool ho_send(const int fd,
+             const void* rec, const size_t size,
+             const void* data, const size_t data_size,
+             const int* fds, const size_t nfds)
+{
+    if (nfds > HO_MAXFDS) {
+        errno = EINVAL;
+        return false;
+    }
+
+    struct iovec iovs[] = {
+        {.iov_base = (void*)rec, .iov_len = size},
+        {.iov_base = (void*)data, .iov_len = data_size}
+    };
+
+    struct msghdr msg = {
+        .msg_iov = iovs,
+        .msg_iovlen = (data_size > 0 ? 2 : 1)
+    };
+
+    union {
+        struct cmsghdr align;
+        uint8_t buf [CMSG_SPACE(sizeof(int) * HO_MAXFDS)];
+    } cmsg_buf;
+
+    if (nfds > 0) {
+        const size_t rightslen = sizeof(int) * nfds;
+
+        memset(&cmsg_buf, 0, sizeof(cmsg_buf));
+
+        msg.msg_control = cmsg_buf.buf;
+        msg.msg_controllen = (socklen_t)us_cmsg_space(rightslen);
+
+        struct cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = (socklen_t)us_cmsg_len(rightslen);
+        memcpy(CMSG_DATA(cmsg), fds, rightslen);
+    }
+
+    ssize_t nsent;
+    do {
+        nsent = sendmsg(fd, &msg, 0);
+    } while (nsent == -1 && errno == EINTR);
+
+    if (nsent == -1)
+        return false;
+
+    if ((size_t)nsent != size + data_size) {
+        errno = EMSGSIZE;
+        return false;
+    }
+
+    return true;
+}
+
+ssize_t ho_recv(const int fd,
+                void* buf, const size_t size,
+                int* fds, size_t* nfds)
+{
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = size
+    };
+
+    union {
+        struct cmsghdr align;
+        uint8_t buf [CMSG_SPACE(sizeof(int) * HO_MAXFDS)];
+    } cmsg_buf;
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = cmsg_buf.buf,
+        .msg_controllen = sizeof(cmsg_buf)
+    };
+
+    const size_t capacity = *nfds;
+    *nfds = 0;
+
+    ssize_t nrecvd;
+    do {
+        nrecvd = recvmsg(fd, &msg, 0);
+    } while (nrecvd == -1 && errno == EINTR);
+
+    if (nrecvd == -1)
+        return -1;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+         cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        const size_t data_off = (size_t)((char*)CMSG_DATA(cmsg) - (char*)cmsg);
+        const size_t n = (cmsg->cmsg_len - data_off) / sizeof(int);
+        const int* const recvd = (const int*)(void*)CMSG_DATA(cmsg);
+
+        for (size_t i = 0; i < n; i++) {
+            if (*nfds < capacity) {
+                fds[(*nfds)++] = recvd[i];
+                set_cloexec(recvd[i], true);
+            } else {
+                close(recvd[i]);
+                msg.msg_flags |= MSG_CTRUNC;
+            }
+        }
+    }
+
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        for (size_t i = 0; i < *nfds; i++)
+            close(fds[i]);
+        *nfds = 0;
+
+        errno = EPROTO;
+        return -1;
+    }
+
+    return nrecvd;
+}
+
+bool ho_send_ack(const int fd, const int err)
+{
+    const struct ho_ack ack = {
+        .type = HO_REC_ACK,
+        .err = err
+    };
+
+    return ho_send(fd, &ack, sizeof(ack), NULL, 0, NULL, 0);
+}
+
+bool ho_recv_ack(const int fd, bool* refused)
+{
+    struct ho_ack ack;
+    size_t nfds = 0;
+
+    *refused = false;
+
+    const ssize_t nrecvd = ho_recv(fd, &ack, sizeof(ack), NULL, &nfds);
+    if (nrecvd == -1)
+        return false;
+
+    /* The other side only closes the channel without acknowledging if it has
+       given up */
+    if (nrecvd == 0) {
+        *refused = true;
+        errno = ECONNRESET;
+        return false;
+    }
+
+    if ((size_t)nrecvd != sizeof(ack) || ack.type != HO_REC_ACK) {
+        errno = EPROTO;
+        return false;
+    }
+
+    if (ack.err != 0) {
+        *refused = true;
+        errno = ack.err;
+        return false;
+    }
+
+    return true;
+}
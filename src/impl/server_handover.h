@@ -0,0 +1,237 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/**
+   @file
+
+   The channel over which a running server hands its request socket and
+   in-flight transfers over to its replacement.
+
+   The new server process connects to the old one's request socket and sends it
+   a Handover request (PROT_CMD_HANDOVER) along with one end of a
+   SOCK_SEQPACKET socket pair (cf. ho_request()). The old server then sends,
+   over that socket, a HO_REC_HELLO record (with the request socket); once the
+   new server has acknowledged it (HO_REC_ACK) follow one record per transfer,
+   queued request and pending response, and a HO_REC_END record. The new server
+   only starts serving (and the old one only closes its copies of the file
+   descriptors and exits) once the new server has acknowledged the end
+   record.
+
+   The end record is the point of no return for the old server: if anything
+   fails before it has been sent, or the new server refuses it (or closes the
+   channel instead of acknowledging it), the old server carries on as if
+   nothing had happened. Otherwise--e.g., if the acknowledgement does not
+   arrive in time--the new server may already be serving, so the old one exits
+   regardless.
+*/
+
+#ifndef SFD_SERVER_HANDOVER_H
+#define SFD_SERVER_HANDOVER_H
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Identifies handover records */
+#define HO_MAGIC 0x53464448U    /* "SFDH" */
+
+/** Incremented whenever the records' layout changes */
+#define HO_VERSION 8U
+
+/** The maximum number of file descriptors sent with a record */
+#define HO_MAXFDS 3
+
+/** How long either side waits for the other to send or receive a record before
+    giving up */
+#define HO_TIMEOUT_MS 5000
+
+/** Handover record types */
+enum ho_rec_type {
+    /** Old to new: protocol version, etc.; carries the request socket */
+    HO_REC_HELLO = 1,
+    /** New to old: acknowledges the HELLO or END record (or not) */
+    HO_REC_ACK,
+    /** Old to new: a transfer or open file */
+    HO_REC_XFER,
+    /** Old to new: a request waiting in the admission queue */
+    HO_REC_QUEUED,
+    /** Old to new: a terminal response waiting to be delivered */
+    HO_REC_RESP,
+    /** Old to new: there are no more records */
+    HO_REC_END
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct ho_hello {
+    uint32_t type;
+    uint32_t magic;
+    uint32_t version;
+    /** The next transfer ID to be assigned */
+    uint64_t next_txnid;
+};
+
+/** Also used for HO_REC_END records */
+struct ho_ack {
+    uint32_t type;
+    /** Zero, or the errno value describing why the handover was refused */
+    int32_t err;
+};
+
+/**
+   A transfer.
+
+   Sent with the file, status channel, and (if separate from the status
+   channel) destination file descriptors, in that order. File data read but not
+   yet written by the old server is 'unread' first (cf. fio_ctx_unread()).
+*/
+struct ho_xfer {
+    uint32_t type;
+    uint32_t cmd;
+    uint64_t txnid;
+    uint64_t size;
+    uint64_t nbytes_left;
+    uint64_t start_us;
+    uint64_t ttfb_us;
+    uint64_t queue_us;
+    uint64_t window_us;
+    uint64_t window_nbytes_left;
+    uint64_t progress_us;
+    uint64_t progress_nbytes_left;
+    uint64_t cookie;
+    /* The file offset of a ranged send from an open file handle (cf. struct
+       resrc_xfer::shared_file); -1 for other transfers */
+    int64_t offset;
+    /* The pipelined transfer this one is waiting for (which is handed over
+       first; cf. PROT_REQ_PIPELINE); zero if none */
+    uint64_t prev_txnid;
+    uint32_t nwrites;
+    uint32_t nstalls;
+    uint32_t ndeferrals;
+    uint32_t flags;
+    /* Extension flags (e.g., direct I/O; cf. PROT_REQX_DIRECT) */
+    uint32_t ext_flags;
+    /* The access hint (enum prot_access) */
+    uint32_t access;
+    /* The wire format version of the transfer's responses */
+    uint32_t resp_version;
+    uint32_t progress_interval;
+    uint32_t blksize;
+    int32_t client_pid;
+    /* Whether a pump's source is to be put back into blocking mode when the
+       pump ends (cf. struct resrc_pump_src::was_blocking) */
+    uint32_t src_was_blocking;
+};
+
+/**
+   A queued request.
+
+   Sent with the request's file descriptors and followed by the request PDU.
+*/
+struct ho_queued {
+    uint32_t type;
+    int32_t client_pid;
+    uint64_t recv_us;
+};
+
+/**
+   A pending response.
+
+   Sent with the status channel file descriptor and followed by the PDU.
+*/
+struct ho_resp {
+    uint32_t type;
+};
+
+#pragma GCC diagnostic pop
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+       Asks the server listening on the named request socket to hand over to
+       the calling process.
+
+       @return The (blocking) handover channel file descriptor, from which the
+       old server's records are to be received, or -1 on error
+    */
+    int ho_request(const char* sockdir, const char* srvname);
+
+    /**
+       Makes a handover channel blocking and bounds its send and receive
+       operations by HO_TIMEOUT_MS.
+    */
+    bool ho_set_timeouts(int fd);
+
+    /**
+       Sends a record, followed by @a data (if any), along with up to HO_MAXFDS
+       file descriptors.
+    */
+    bool ho_send(int fd,
+                 const void* rec, size_t size,
+                 const void* data, size_t data_size,
+                 const int* fds, size_t nfds);
+
+    /**
+       Receives a record.
+
+       @param[out] fds The file descriptors received with the record
+
+       @param[in,out] nfds The capacity of @a fds on input; the number of file
+       descriptors received on output
+
+       @return The size of the record, or -1 on error. Errno values:
+
+       @li EPROTO The record, or its file descriptors, were truncated (and the
+       latter have been closed)
+    */
+    ssize_t ho_recv(int fd, void* buf, size_t size, int* fds, size_t* nfds);
+
+    /** Sends an acknowledgement (@a err being zero) or refusal */
+    bool ho_send_ack(int fd, int err);
+
+    /**
+       Receives an acknowledgement.
+
+       @param[out] refused Whether or not the other side has certainly not
+       accepted the handover, i.e., it has refused it or has closed the channel
+       instead of acknowledging it
+
+       @retval false The handover was refused (errno is set to the other side's
+       reason) or no acknowledgement was received
+    */
+    bool ho_recv_ack(int fd, bool* refused);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
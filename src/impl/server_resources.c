@@ -24,14 +24,147 @@
   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#define _POSIX_C_SOURCE 200809L /* For posix_memalign */
+
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include "file_io.h"
 #include "server_resources.h"
+#include "util.h"
+
+/** The number of transfers per block of a struct xfer_pool */
+#define XFER_BLOCK_NSLOTS 256
+
+/* struct resrc_xfer has to fill exactly one cache line */
+typedef char xfer_hot_size_check
+[(sizeof(struct resrc_xfer) == XFER_HOT_SIZE) ? 1 : -1];
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct xfer_block {
+    /** Transfers' hot state; first so that it is cache-line aligned */
+    struct resrc_xfer hot[XFER_BLOCK_NSLOTS];
+    /** Transfers' cold state, by slot */
+    struct resrc_xfer_cold cold[XFER_BLOCK_NSLOTS];
+    /** The pool to which this block belongs */
+    struct xfer_pool* pool;
+    /** The index of this block in the pool */
+    size_t idx;
+    /** The free slots (a stack of which the top @a pool->block_sizes[idx]
+        items are in use) */
+    uint8_t slots[XFER_BLOCK_NSLOTS];
+};
+
+#pragma GCC diagnostic pop
+
+struct xfer_pool* xfer_pool_new(const size_t max_xfers)
+{
+    struct xfer_pool* const this = malloc(sizeof(*this));
+    if (!this)
+        return NULL;
+
+    const size_t nblocks = ((max_xfers + XFER_BLOCK_NSLOTS - 1) /
+                            XFER_BLOCK_NSLOTS);
+
+    *this = (struct xfer_pool) {
+        .blocks = calloc(nblocks, sizeof(*this->blocks)),
+        .block_sizes = calloc(nblocks, sizeof(*this->block_sizes)),
+        .nblocks = nblocks
+    };
+
+    if (!this->blocks || !this->block_sizes) {
+        PRESERVE_ERRNO(xfer_pool_delete(this));
+        return NULL;
+    }
+
+    return this;
+}
+
+void xfer_pool_delete(struct xfer_pool* this)
+{
+    if (this) {
+        assert (this->size == 0);
+
+        if (this->blocks) {
+            for (size_t i = 0; i < this->nblocks; i++)
+                free(this->blocks[i]);
+        }
+
+        free(this->blocks);
+        free(this->block_sizes);
+        free(this);
+    }
+}
+
+void xfer_pool_trim(struct xfer_pool* this)
+{
+    for (size_t i = this->nblocks; i > 0 && this->nempty > 1; i--) {
+        struct xfer_block* const block = this->blocks[i - 1];
+
+        if (block && this->block_sizes[i - 1] == 0) {
+            free(block);
+            this->blocks[i - 1] = NULL;
+            this->nallocated--;
+            this->nempty--;
+        }
+    }
+}
+
+size_t xfer_pool_footprint(const struct xfer_pool* this)
+{
+    return (sizeof(*this) +
+            this->nblocks * (sizeof(*this->blocks) +
+                             sizeof(*this->block_sizes)) +
+            this->nallocated * sizeof(struct xfer_block));
+}
+
+static struct xfer_block* block_new(struct xfer_pool* pool, const size_t idx)
+{
+    void* p;
+
+    const int err = posix_memalign(&p, XFER_HOT_SIZE,
+                                   sizeof(struct xfer_block));
+    if (err != 0) {
+        errno = err;
+        return NULL;
+    }
+
+    struct xfer_block* const this = p;
+
+    this->pool = pool;
+    this->idx = idx;
+
+    for (size_t i = 0; i < XFER_BLOCK_NSLOTS; i++)
+        this->slots[i] = (uint8_t)i;
 
-struct resrc_xfer* xfer_new(const enum prot_cmd_req cmd,
+    pool->blocks[idx] = this;
+    pool->nallocated++;
+    pool->nempty++;
+
+    return this;
+}
+
+/** Finds (or allocates) the lowest block with a free slot */
+static struct xfer_block* find_free_block(struct xfer_pool* pool)
+{
+    for (size_t i = 0; i < pool->nblocks; i++) {
+        if (pool->block_sizes[i] < XFER_BLOCK_NSLOTS) {
+            return (pool->blocks[i] ?
+                    pool->blocks[i] :
+                    block_new(pool, i));
+        }
+    }
+
+    errno = EMFILE;
+    return NULL;
+}
+
+struct resrc_xfer* xfer_new(struct xfer_pool* pool,
+                            const enum prot_cmd_req cmd,
                             const struct resrc_xfer_file* file,
                             const size_t nbytes,
                             const pid_t client_pid,
@@ -39,31 +172,72 @@ struct resrc_xfer* xfer_new(const enum prot_cmd_req cmd,
                             const int dest_fd,
                             const size_t txnid)
 {
-    struct resrc_xfer* this = malloc(sizeof(*this));
-    if (!this)
+    const bool pump = (cmd == PROT_CMD_PUMP);
+
+    struct fio_ctx* const fio_ctx = (pump ?
+                                     fio_ctx_new_pump(file->blksize) :
+                                     fio_ctx_new(file->blksize));
+    if (pump ? !fio_ctx : !fio_ctx_valid(fio_ctx))
         return NULL;
 
+    struct xfer_block* const block = find_free_block(pool);
+    if (!block) {
+        PRESERVE_ERRNO(fio_ctx_delete(fio_ctx));
+        return NULL;
+    }
+
+    uint16_t* const block_size = &pool->block_sizes[block->idx];
+
+    if (*block_size == 0)
+        pool->nempty--;
+
+    const size_t slot = block->slots[*block_size];
+    (*block_size)++;
+    pool->size++;
+
+    struct resrc_xfer* const this = &block->hot[slot];
+
     *this = (struct resrc_xfer) {
         .dest_fd = dest_fd,
         .tag = XFER_RESRC_TAG,
         .stat_fd = stat_fd,
+        .cmd = (uint8_t)cmd,
+        .defer = NONE,
+        .slot = (uint8_t)slot,
+        .nbytes_left = nbytes,
         .txnid = txnid,
         .file = *file,
-        .fio_ctx = fio_ctx_new(file->blksize),
-        .nbytes_left = nbytes,
-        .cmd = cmd,
-        .client_pid = client_pid,
-        .defer = NONE
+        .fio_ctx = fio_ctx
     };
 
-    if (!fio_ctx_valid(this->fio_ctx)) {
-        free(this);
-        return NULL;
+    block->cold[slot] = (struct resrc_xfer_cold) {
+        .window_nbytes_left = nbytes,
+        .progress_nbytes_left = nbytes,
+        .client_pid = client_pid
+    };
+
+    if (pump) {
+        block->cold[slot].src = (struct resrc_pump_src) {
+            .ident = file->fd,
+            .tag = PUMP_SRC_RESRC_TAG,
+            .xfer = this
+        };
     }
 
     return this;
 }
 
+/* Transfers are at their slot index in their block's (leading) array */
+static struct xfer_block* block_of(const struct resrc_xfer* x)
+{
+    return (struct xfer_block*)(void*)(x - x->slot);
+}
+
+struct resrc_xfer_cold* xfer_cold(const struct resrc_xfer* x)
+{
+    return &block_of(x)->cold[x->slot];
+}
+
 bool is_xfer(const void* p)
 {
     return (((const struct resrc_xfer*)p)->tag == XFER_RESRC_TAG);
@@ -82,7 +256,21 @@ void xfer_delete(void* p)
         assert (this->tag == XFER_RESRC_TAG);
 
         fio_ctx_delete(this->fio_ctx);
-        free(this);
+
+        struct xfer_block* const block = block_of(this);
+
+        struct xfer_pool* const pool = block->pool;
+        uint16_t* const block_size = &pool->block_sizes[block->idx];
+
+        /* Catches use-after-free of the slot */
+        this->tag = -1;
+
+        (*block_size)--;
+        block->slots[*block_size] = (uint8_t)this->slot;
+        pool->size--;
+
+        if (*block_size == 0)
+            pool->nempty++;
     }
 }
 
@@ -96,12 +284,22 @@ bool is_timer(const void* p)
     return (((const struct resrc_timer*)p)->tag == TIMER_RESRC_TAG);
 }
 
+bool is_pump_src(const void* p)
+{
+    return (((const struct resrc_pump_src*)p)->tag == PUMP_SRC_RESRC_TAG);
+}
+
+bool is_client(const void* p)
+{
+    return (((const struct resrc_client*)p)->tag == CLIENT_RESRC_TAG);
+}
+
 size_t resrc_timer_txnid(void* p)
 {
     return ((struct resrc_timer*)p)->txnid;
 }
 
-void timer_delete(void* p)
+void resrc_timer_delete(void* p)
 {
     if (p) {
         struct resrc_timer* const this = p;
@@ -27,6 +27,7 @@
 #ifndef SFD_SERVER_RESOURCES_H_INCLUDED
 #define SFD_SERVER_RESOURCES_H_INCLUDED
 
+#include "file_io.h"
 #include "protocol_server.h"
 #include "../responses.h"
 
@@ -52,7 +53,11 @@ enum {
     /** Tag which identifies a resource as a timer. */
     TIMER_RESRC_TAG,
     /** Identifies a response pending delivery */
-    PENDING_RESP_TAG
+    PENDING_RESP_TAG,
+    /** Identifies a client process whose exit is being watched for */
+    CLIENT_RESRC_TAG,
+    /** Identifies the source of a pump (cf. PROT_CMD_PUMP) */
+    PUMP_SRC_RESRC_TAG
 };
 
 /**
@@ -95,8 +100,61 @@ struct resrc_xfer_file {
     unsigned blksize;
 };
 
+struct fanout;
+struct copy_job;
+struct dio_stream;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/**
+   The source descriptor of a pump, which is registered with the poller (for
+   readability) in addition to the transfer's destination.
+*/
+struct resrc_pump_src {
+    /** The source file descriptor (struct resrc_xfer_file::fd) */
+    int ident;
+    /* The type tag */
+    int tag;
+    /** The pump */
+    struct resrc_xfer* xfer;
+    /** Whether the source was in blocking mode before the server made it
+        non-blocking, to be restored when the pump ends */
+    bool was_blocking;
+};
+
+#pragma GCC diagnostic pop
+
+bool is_pump_src(const void* p);
+
+/**
+   The kind of file a Send File transfer's destination descriptor refers to,
+   which decides how the file's data is written to it (cf. register_xfer()).
+*/
+enum xfer_dest {
+    /** A socket, or anything else; written to with sendfile(2) */
+    XFER_DEST_SOCKET,
+    /** A pipe or FIFO; spliced into */
+    XFER_DEST_PIPE,
+    /** A regular file; copied into in-kernel (cf. file_copy()), which is
+        never registered with the poller since it is always writable */
+    XFER_DEST_FILE,
+    /** A character device (e.g., /dev/null); always writable as well, so
+        written to like a regular file, but never in parallel */
+    XFER_DEST_DEVICE
+};
+
+/** The size, and alignment, of struct resrc_xfer: a cache line */
+#define XFER_HOT_SIZE 64
+
 /**
-   A file transfer resource.
+   A file transfer resource: the state touched while processing the
+   transfer's I/O events (cf. transfer_file()), which fills exactly one cache
+   line (XFER_HOT_SIZE).
+
+   Transfers live in the slots of a struct xfer_pool; the rest of a transfer's
+   state (struct resrc_xfer_cold), which is only needed when processing
+   requests, timers and completions, is kept apart from it (cf. xfer_cold()).
 
    @note The first few fields must be identical to the other resource structures
    due to the use of type punning.
@@ -109,8 +167,28 @@ struct resrc_xfer {
     /** The status channel file descriptor. Hijacked by other resource
         structures for use as a type tag (shameful!). */
     int stat_fd;
-    /** The command ID */
-    enum prot_cmd_req cmd;
+    /** The command ID (enum prot_cmd_req; narrowed to fit the cache line) */
+    uint8_t cmd;
+    /** The deferral type (enum deferral) */
+    uint8_t defer;
+    /** The index of the transfer's slot in its block of the pool */
+    uint8_t slot;
+    /** Whether the file descriptor's file offset is shared with other
+        transfers (i.e., this is a ranged send from an open file handle), in
+        which case the transfer's own offset is kept in its cold state */
+    unsigned shared_file : 1;
+    /** The kind of destination (enum xfer_dest; a bit-field so as to share
+        shared_file's byte) */
+    unsigned dest_type : 2;
+    /** Whether the file is read with direct I/O (cf. struct
+        resrc_xfer_cold::dio) */
+    unsigned direct : 1;
+    /** Whether the transfer follows an access hint (cf. struct
+        resrc_xfer_cold::cache) */
+    unsigned hinted : 1;
+    unsigned : 3;
+    /** Number of bytes left to transfer */
+    size_t nbytes_left;
     /** The unique identifier for this transfer */
     size_t txnid;
     /** Static information about the file being transferred, as it is on disk */
@@ -118,15 +196,144 @@ struct resrc_xfer {
     /** Context used by data-transfer functions on some platforms; NULL on
         others */
     struct fio_ctx* fio_ctx;
-    /** Number of bytes left to transfer */
-    size_t nbytes_left;
+    /** Number of data-transfer system calls made */
+    uint32_t nwrites;
+    /** Number of times the destination was full (EAGAIN) */
+    uint32_t nstalls;
+} __attribute__((aligned(XFER_HOT_SIZE)));
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/**
+   The state of a file transfer which is not needed to process its I/O
+   events.
+*/
+struct resrc_xfer_cold {
+    /** When the transfer was requested (cf. metrics_now_us()) */
+    uint64_t start_us;
+    /** When the first byte was written, relative to start_us; zero until
+        then */
+    uint64_t ttfb_us;
+    /** Time spent in the admission queue before start_us */
+    uint64_t queue_us;
+    /** Start of the current idle timeout period (cf. metrics_now_us()) */
+    uint64_t window_us;
+    /** The value of nbytes_left at window_us */
+    size_t window_nbytes_left;
+    /** When the last transfer status notification was sent (or the transfer
+        started) */
+    uint64_t progress_us;
+    /** The value of nbytes_left at progress_us */
+    size_t progress_nbytes_left;
+    /** Number of deferred (secondary loop) passes */
+    uint32_t ndeferrals;
+    /** Request flags (PROT_REQ_*) */
+    unsigned flags;
+    /** More request flags (PROT_REQX_*) */
+    uint32_t ext_flags;
+    /** The access hint (enum prot_access) */
+    uint8_t access;
+    /** The wire format version of the transfer's responses (cf. struct
+        prot_request::version) */
+    uint8_t resp_version;
+    /** Progress notification interval (cf. struct prot_request) */
+    uint32_t progress_interval;
+    /** The client-supplied request cookie */
+    uint64_t cookie;
+    /** The next file offset to be read from, if the file is shared (cf.
+        struct resrc_xfer::shared_file) */
+    off_t offset;
+    /** The pipelined transfer to the same destination which is waiting for
+        this one to complete (cf. PROT_REQ_PIPELINE); NULL if none */
+    struct resrc_xfer* next_xfer;
+    /** The transfer this one is waiting for; NULL once started */
+    struct resrc_xfer* prev_xfer;
+    /** The next transfer in the same bucket of the server's index of the last
+        transfers pipelined to each destination */
+    struct resrc_xfer* next_tail;
+    /** The destination's identity, if pipelined (cf. fstat(2)) */
+    dev_t dest_dev;
+    ino_t dest_ino;
+    /** The source, if this is a pump */
+    struct resrc_pump_src src;
+    /** The fan-out group whose reading of the file this transfer shares (cf.
+        PROT_REQ_FANOUT); NULL if none */
+    struct fanout* fanout;
+    /** Neighbours in the group's list of members */
+    struct resrc_xfer* fanout_prev;
+    struct resrc_xfer* fanout_next;
+    /** The sequence number of the group's chunk taken last */
+    size_t fanout_chunk;
+    /** The file offset following the data taken from the group */
+    off_t fanout_pos;
+    /** The segments into which the transfer is split, if it is a parallel
+        copy (cf. PROT_REQ_PARALLEL); NULL if it is not */
+    struct copy_job* copy_job;
+    /** The stream through which the file is read, if it is read with direct
+        I/O (cf. PROT_REQX_DIRECT); NULL if it is not */
+    struct dio_stream* dio;
+    /** The page cache policy which follows the access hint, if any */
+    struct fio_cache cache;
     /** The client process ID */
     pid_t client_pid;
-    /** The deferral type */
-    enum deferral defer;
+    /** The client's record, if the client is being watched for exit */
+    struct resrc_client* client;
 };
 
-struct resrc_xfer* xfer_new(enum prot_cmd_req cmd,
+#pragma GCC diagnostic pop
+
+/**
+   Storage for transfers.
+
+   Slots are allocated a block (struct xfer_block) at a time as transfers are
+   added, and blocks are released again once empty, so transfers never move
+   (they are registered with the poller by address). A block's transfers (hot
+   state) form a dense, cache-line aligned array, and their cold state a
+   separate array indexed by the same slot numbers.
+
+   New transfers take the lowest block with a free slot so that transfers stay
+   packed into as few blocks (and cache lines) as possible, and so that blocks
+   at the top can empty out.
+*/
+struct xfer_pool {
+    /** The blocks; NULL where not allocated */
+    struct xfer_block** blocks;
+    /** The number of transfers in each block. Kept apart from the blocks so
+        that finding a free slot does not touch them. */
+    uint16_t* block_sizes;
+    /** The number of items in @a blocks and @a block_sizes */
+    size_t nblocks;
+    /** The number of allocated blocks */
+    size_t nallocated;
+    /** The number of allocated blocks without transfers */
+    size_t nempty;
+    /** The number of transfers */
+    size_t size;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Creates a pool for at least @a max_xfers transfers (whole blocks) */
+struct xfer_pool* xfer_pool_new(size_t max_xfers);
+
+/** Deletes the pool, which must not contain any transfers */
+void xfer_pool_delete(struct xfer_pool*);
+
+/**
+   Releases empty blocks, except for one which is kept spare so that a
+   transfer being added and deleted at a block boundary does not allocate and
+   free a block every time.
+*/
+void xfer_pool_trim(struct xfer_pool*);
+
+/** The number of bytes of memory used by the pool */
+size_t xfer_pool_footprint(const struct xfer_pool*);
+
+struct resrc_xfer* xfer_new(struct xfer_pool* pool,
+                            enum prot_cmd_req cmd,
                             const struct resrc_xfer_file* file,
                             size_t nbytes,
                             pid_t client_pid,
@@ -134,12 +341,20 @@ struct resrc_xfer* xfer_new(enum prot_cmd_req cmd,
                             int dest_fd,
                             size_t txnid);
 
+/** Returns a transfer's cold state */
+struct resrc_xfer_cold* xfer_cold(const struct resrc_xfer*);
+
 bool is_xfer(const void*);
 
 size_t resrc_xfer_txnid(void*);
 
+/** Returns the transfer's slot to its pool */
 void xfer_delete(void*);
 
+#ifdef __cplusplus
+}
+#endif
+
 /**
    A response waiting to be delivered.
 
@@ -152,10 +367,14 @@ struct resrc_resp {
     /* The type tag */
     int tag;
     /** The size of the PDU. Error notifications are headers only, but transfer
-        completion notifications have a size_t field in the body. */
+        completion notifications have a size_t field in the body, and transfer
+        statistics several more. */
     size_t pdu_size;
-    /** The PDU to be sent */
-    struct sfd_xfer_stat pdu;
+    /** Neighbours in the server's list of pending responses */
+    struct resrc_resp* prev;
+    struct resrc_resp* next;
+    /** The PDU to be sent, as encoded (cf. prot_marshal_response()) */
+    uint8_t pdu [SFD_MAX_RESP_SIZE];
 };
 
 bool is_response(const void* p);
@@ -176,8 +395,38 @@ struct resrc_timer {
 
 bool is_timer(const void* p);
 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/**
+   A client process with transfers, whose exit is watched for so that its
+   transfers can be reclaimed immediately.
+*/
+struct resrc_client {
+    /** Identifies the process (registered with poller) */
+    int ident;
+    /** The type tag */
+    int tag;
+    /** The client process ID */
+    pid_t pid;
+    /** The number of the client's transfers (including open files) */
+    unsigned nxfers;
+    /** Whether or not the process's exit has been reported */
+    bool exited;
+    /** Whether or not the record is in the server's list of idle clients */
+    bool idle;
+    /** The next record in the same hash bucket */
+    struct resrc_client* next;
+    /** The next record in the server's list of idle clients */
+    struct resrc_client* next_idle;
+};
+
+#pragma GCC diagnostic pop
+
+bool is_client(const void* p);
+
 size_t resrc_timer_txnid(void*);
 
-void timer_delete(void* p);
+void resrc_timer_delete(void* p);
 
 #endif
@@ -25,6 +25,7 @@
 */
 
 #include <assert.h>
+#include <stdint.h>
 #include <unistd.h>
 
 #include "protocol_server.h"
@@ -38,9 +39,16 @@ bool send_pdu(const int fd, const void* pdu, const size_t size)
     return ((size_t)n == size);
 }
 
+bool send_resp(const int fd, const void* pdu, const int version)
+{
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    return send_pdu(fd, buf, prot_marshal_response(buf, pdu, version));
+}
+
 bool send_file_info(int cli_fd,
                     const size_t txnid,
-                    const struct fio_stat* info)
+                    const struct fio_stat* info,
+                    const int version)
 {
     struct sfd_file_info pdu;
 
@@ -49,14 +57,24 @@ bool send_file_info(int cli_fd,
                            info->atime, info->mtime, info->ctime,
                            txnid);
 
-    return send_pdu(cli_fd, &pdu, sizeof(pdu));
+    return send_resp(cli_fd, &pdu, version);
 }
 
-bool send_xfer_stat(const int fd, const size_t file_size)
+bool send_xfer_stat(const int fd, const size_t file_size, const int version)
 {
     struct sfd_xfer_stat pdu;
     prot_marshal_xfer_stat(&pdu, file_size);
-    return send_pdu(fd, &pdu, sizeof(pdu));
+    return send_resp(fd, &pdu, version);
+}
+
+bool send_req_queued(const int fd,
+                     const size_t position,
+                     const unsigned max_wait_ms,
+                     const int version)
+{
+    struct sfd_req_queued pdu;
+    prot_marshal_req_queued(&pdu, position, max_wait_ms);
+    return send_resp(fd, &pdu, version);
 }
 
 bool send_req_err(const int fd, const int stat)
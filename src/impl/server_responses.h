@@ -33,11 +33,22 @@
 
 bool send_pdu(const int fd, const void* pdu, size_t size);
 
+/** Sends a marshalled response (struct sfd_file_info, etc.) in the wire format
+    @a version, that of the request it responds to (cf.
+    PROT_RESP_VERSION_OFFSET) */
+bool send_resp(int fd, const void* pdu, int version);
+
 bool send_file_info(int cli_fd,
                     size_t txnid,
-                    const struct fio_stat* info);
+                    const struct fio_stat* info,
+                    int version);
+
+bool send_xfer_stat(int fd, size_t file_size, int version);
 
-bool send_xfer_stat(int fd, size_t file_size);
+/** Tells the client that its request is waiting for room for another transfer,
+    behind @a position other requests, for at most @a max_wait_ms */
+bool send_req_queued(int fd, size_t position, unsigned max_wait_ms,
+                     int version);
 
 /** Sends an error in response to a request to the client (over the status
     channel) */
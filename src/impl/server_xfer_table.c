@@ -31,7 +31,8 @@
 /**
    A ceil() which returns powers of 2.
 
-   Clarity over efficiency because it will only be executed at startup.
+   Clarity over efficiency because it will only be executed at startup and
+   when resizing.
 */
 static size_t clp2(const size_t x)
 {
@@ -44,12 +45,22 @@ bool xfer_table_construct(struct xfer_table* this,
                           xfer_table_hash_func hash,
                           const size_t max_xfers)
 {
-    const size_t capacity = clp2(max_xfers);
+    return xfer_table_construct_range(this, hash, max_xfers, max_xfers);
+}
+
+bool xfer_table_construct_range(struct xfer_table* this,
+                                xfer_table_hash_func hash,
+                                const size_t min_xfers,
+                                const size_t max_xfers)
+{
+    const size_t capacity = clp2(min_xfers);
 
     *this = (struct xfer_table) {
         .elems = calloc(capacity, sizeof(void*)),
         .capacity = capacity,
-        .hash = hash
+        .hash = hash,
+        .min_capacity = capacity,
+        .max_capacity = clp2(max_xfers)
     };
 
     return (bool)this->elems;
@@ -70,12 +81,22 @@ void xfer_table_destruct(struct xfer_table* this,
 
 struct xfer_table* xfer_table_new(xfer_table_hash_func hash,
                                   size_t max_xfers)
+{
+    return xfer_table_new_range(hash, max_xfers, max_xfers);
+}
+
+struct xfer_table* xfer_table_new_range(xfer_table_hash_func hash,
+                                        const size_t min_xfers,
+                                        const size_t max_xfers)
 {
     struct xfer_table* this = malloc(sizeof(*this));
     if (!this)
         return NULL;
 
-    xfer_table_construct(this, hash, max_xfers);
+    if (!xfer_table_construct_range(this, hash, min_xfers, max_xfers)) {
+        free(this);
+        return NULL;
+    }
 
     return this;
 }
@@ -87,19 +108,63 @@ void xfer_table_delete(struct xfer_table* this,
     free(this);
 }
 
+size_t xfer_table_footprint(const struct xfer_table* this)
+{
+    return (sizeof(*this) + this->capacity * sizeof(void*));
+}
+
 static size_t indexof(const struct xfer_table* this, const size_t hash)
 {
     return (hash & (this->capacity - 1));
 }
 
+/**
+   Rehashes the table's elements into a new array of @a capacity slots.
+
+   @retval false Memory could not be allocated, or two elements would occupy
+   the same slot (which is only possible when shrinking)
+*/
+static bool resize(struct xfer_table* this, const size_t capacity)
+{
+    void** const elems = calloc(capacity, sizeof(void*));
+    if (!elems)
+        return false;
+
+    for (size_t i = 0; i < this->capacity; i++) {
+        if (!this->elems[i])
+            continue;
+
+        const size_t idx = (this->hash(this->elems[i]) & (capacity - 1));
+
+        if (elems[idx]) {
+            free(elems);
+            return false;
+        }
+
+        elems[idx] = this->elems[i];
+    }
+
+    free(this->elems);
+
+    this->elems = elems;
+    this->capacity = capacity;
+
+    return true;
+}
+
 bool xfer_table_insert(struct xfer_table* this, void* elem)
 {
-    const size_t idx = indexof(this, this->hash(elem));
+    const size_t hash = this->hash(elem);
 
-    if (this->elems[idx])
-        return false;
+    /* Doubling the capacity never causes existing elements to collide */
+    while (this->elems[indexof(this, hash)]) {
+        if (this->capacity == this->max_capacity ||
+            !resize(this, this->capacity * 2)) {
+            return false;
+        }
+    }
 
-    this->elems[idx] = elem;
+    this->elems[indexof(this, hash)] = elem;
     this->size++;
 
     return true;
@@ -109,6 +174,13 @@ void xfer_table_erase(struct xfer_table* this, const size_t hash)
 {
     this->elems[indexof(this, hash)] = NULL;
     this->size--;
+
+    /* Only attempted when crossing the threshold, so that a shrink which fails
+       because of collisions is not retried on every erasure */
+    if (this->size == this->capacity / 4 &&
+        this->capacity > this->min_capacity) {
+        resize(this, this->capacity / 2);
+    }
 }
 
 void* xfer_table_find(const struct xfer_table* this, const size_t hash)
@@ -35,11 +35,22 @@ typedef void (*xfer_table_elem_deleter) (void*);
 
 typedef size_t (*xfer_table_hash_func) (void* elem);
 
+/**
+   A direct-mapped table.
+
+   Tables constructed with a range of sizes double their capacity when an
+   insertion collides with an existing element, and halve it (if that does not
+   cause collisions) when they become a quarter full, within the range.
+*/
 struct xfer_table {
     void** elems;
+    /** Current number of slots (a power of 2) */
     size_t capacity;
     size_t size;
     xfer_table_hash_func hash;
+    /** Bounds of @a capacity */
+    size_t min_capacity;
+    size_t max_capacity;
 };
 
 #ifdef __cplusplus
@@ -50,13 +61,29 @@ extern "C" {
                               xfer_table_hash_func hash,
                               size_t max_xfers);
 
+    /**
+       Constructs a table which starts with room for @a min_xfers elements and
+       grows, as required, to have room for up to @a max_xfers.
+    */
+    bool xfer_table_construct_range(struct xfer_table*,
+                                    xfer_table_hash_func hash,
+                                    size_t min_xfers,
+                                    size_t max_xfers);
+
     void xfer_table_destruct(struct xfer_table*, xfer_table_elem_deleter);
 
     struct xfer_table* xfer_table_new(xfer_table_hash_func hash,
                                       size_t max_xfers);
 
+    struct xfer_table* xfer_table_new_range(xfer_table_hash_func hash,
+                                            size_t min_xfers,
+                                            size_t max_xfers);
+
     void xfer_table_delete(struct xfer_table*, xfer_table_elem_deleter);
 
+    /** The number of bytes of memory used by the table */
+    size_t xfer_table_footprint(const struct xfer_table*);
+
     bool xfer_table_insert(struct xfer_table*, void* elem);
 
     void xfer_table_erase(struct xfer_table*, size_t hash);
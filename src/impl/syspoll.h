@@ -27,7 +27,10 @@
 #ifndef SFD_SYSPOLL_H
 #define SFD_SYSPOLL_H
 
+#include <sys/types.h>
+
 #include <stdbool.h>
+#include <stddef.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
@@ -55,6 +58,18 @@ extern "C" {
 
     void syspoll_delete(struct syspoll*);
 
+    /**
+       Changes the maximum number of events retrieved per call to
+       syspoll_wait()/syspoll_poll().
+
+       @note Must not be called while events retrieved by a previous call are
+       still being processed, unless growing.
+    */
+    bool syspoll_resize(struct syspoll*, int maxevents);
+
+    /** The number of bytes of memory used by the poller's event buffer */
+    size_t syspoll_footprint(const struct syspoll*);
+
     /**
        @param data User data. The first item at this address must be the file
        descriptor (i.e., of type 'int').
@@ -65,6 +80,26 @@ extern "C" {
 
     bool syspoll_timer(struct syspoll*, struct syspoll_resrc*, unsigned millis);
 
+    /**
+       Registers for notification (as a SYSPOLL_READ event) of a process's
+       exit.
+
+       Sets the resource's identifier (a descriptor which refers to the
+       process, on some platforms).
+
+       @sa syspoll_unwatch_proc()
+    */
+    bool syspoll_watch_proc(struct syspoll*, struct syspoll_resrc*, pid_t pid);
+
+    /**
+       Releases a resource registered with syspoll_watch_proc().
+
+       @param exited Whether or not the process's exit has been reported
+    */
+    void syspoll_unwatch_proc(struct syspoll*,
+                              struct syspoll_resrc*,
+                              bool exited);
+
     /**
         @todo Should also take a struct syspoll_resrc, like
         syspoll_register().
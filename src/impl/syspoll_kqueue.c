@@ -125,6 +125,29 @@ void syspoll_delete(struct syspoll* this)
     free(this);
 }
 
+bool syspoll_resize(struct syspoll* this, const int maxevents)
+{
+    assert (maxevents > 0);
+
+    /* Pending changes have to be preserved */
+    const size_t capacity = SFD_MAX((size_t)maxevents * 2, this->size);
+
+    struct kevent* const events =
+        realloc(this->events, sizeof(*this->events) * capacity);
+    if (!events)
+        return false;
+
+    this->events = events;
+    this->capacity = capacity;
+
+    return true;
+}
+
+size_t syspoll_footprint(const struct syspoll* this)
+{
+    return (sizeof(*this) + sizeof(*this->events) * this->capacity);
+}
+
 bool syspoll_register(struct syspoll* this,
                       struct syspoll_resrc* resrc,
                       const int events)
@@ -161,6 +184,37 @@ bool syspoll_timer(struct syspoll* this,
     return true;
 }
 
+bool syspoll_watch_proc(struct syspoll* this,
+                        struct syspoll_resrc* resrc,
+                        const pid_t pid)
+{
+    resrc->ident = pid;
+
+    kq_add(this, resrc, EVFILT_PROC, 0, 0, NOTE_EXIT);
+
+    return true;
+}
+
+void syspoll_unwatch_proc(struct syspoll* this,
+                          struct syspoll_resrc* resrc,
+                          const bool exited)
+{
+    /* Process filters are removed automatically once NOTE_EXIT has been
+       delivered */
+    if (exited)
+        return;
+
+    assert (this->size < this->capacity);
+
+    EV_SET(&this->events[this->size],
+           resrc->ident,
+           EVFILT_PROC, EV_DELETE,
+           0, 0,
+           0);                 /* user data */
+
+    this->size++;
+}
+
 bool syspoll_deregister(struct syspoll* this, int fd)
 {
     assert (this->size < this->capacity);
@@ -229,7 +283,8 @@ struct syspoll_events syspoll_get(struct syspoll* this, const int eventnum)
         assert (ev->flags == EV_ERROR ||
                 ev->filter == EVFILT_READ ||
                 ev->filter == EVFILT_WRITE ||
-                ev->filter == EVFILT_TIMER);
+                ev->filter == EVFILT_TIMER ||
+                ev->filter == EVFILT_PROC);
 
         info.udata = (void*)ev->udata;
 
@@ -249,6 +304,7 @@ struct syspoll_events syspoll_get(struct syspoll* this, const int eventnum)
                 break;
 
             case EVFILT_TIMER:
+            case EVFILT_PROC:
                 info.events = SYSPOLL_READ;
                 break;
 
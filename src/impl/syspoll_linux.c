@@ -24,10 +24,11 @@
   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE 1
 
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <sys/timerfd.h>
 
 #include <unistd.h>
@@ -109,6 +110,26 @@ void syspoll_delete(struct syspoll* this)
     }
 }
 
+bool syspoll_resize(struct syspoll* this, const int maxevents)
+{
+    assert (maxevents > 0);
+
+    struct epoll_event* const events =
+        realloc(this->events, sizeof(*this->events) * (unsigned long)maxevents);
+    if (!events)
+        return false;
+
+    this->events = events;
+    this->nevents = maxevents;
+
+    return true;
+}
+
+size_t syspoll_footprint(const struct syspoll* this)
+{
+    return (sizeof(*this) + sizeof(*this->events) * (size_t)this->nevents);
+}
+
 bool syspoll_register(struct syspoll* this,
                       struct syspoll_resrc* resrc,
                       int events)
@@ -167,6 +188,45 @@ bool syspoll_timer(struct syspoll* this,
     return false;
 }
 
+bool syspoll_watch_proc(struct syspoll* this,
+                        struct syspoll_resrc* resrc,
+                        const pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    /* Via syscall(2) because glibc only wraps it since version 2.36 */
+    const int fd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (fd == -1)
+        return false;
+
+    resrc->ident = fd;
+
+    if (!syspoll_register(this, resrc, SYSPOLL_READ)) {
+        PRESERVE_ERRNO(close(fd));
+        return false;
+    }
+
+    return true;
+#else
+    (void)this;
+    (void)resrc;
+    (void)pid;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+void syspoll_unwatch_proc(struct syspoll* this,
+                          struct syspoll_resrc* resrc,
+                          const bool exited)
+{
+    (void)this;
+    (void)exited;
+
+    /* The pidfd is never duplicated, so closing it also removes it from the
+       epoll set */
+    close(resrc->ident);
+}
+
 bool syspoll_deregister(struct syspoll* this, int fd)
 {
     struct epoll_event event;
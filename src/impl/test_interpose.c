@@ -0,0 +1,80 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+
+#include "test_interpose.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+static struct {
+    unsigned long counts [MOCK_CALL_NCALLS];
+    pthread_t thread;
+    bool enabled;
+} count_data;
+
+#pragma GCC diagnostic pop
+
+void mock_count_start(const pthread_t thread)
+{
+    mock_count_stop();
+
+    for (int i = 0; i < MOCK_CALL_NCALLS; i++)
+        __atomic_store_n(&count_data.counts[i], 0, __ATOMIC_RELAXED);
+
+    count_data.thread = thread;
+
+    __atomic_store_n(&count_data.enabled, true, __ATOMIC_RELEASE);
+}
+
+void mock_count_stop(void)
+{
+    __atomic_store_n(&count_data.enabled, false, __ATOMIC_RELEASE);
+}
+
+unsigned long mock_count(const enum mock_call call)
+{
+    return __atomic_load_n(&count_data.counts[call], __ATOMIC_RELAXED);
+}
+
+unsigned long mock_count_total(void)
+{
+    unsigned long total = 0;
+
+    for (int i = 0; i < MOCK_CALL_NCALLS; i++)
+        total += mock_count((enum mock_call)i);
+
+    return total;
+}
+
+void mock_count_call(const enum mock_call call)
+{
+    if (__atomic_load_n(&count_data.enabled, __ATOMIC_ACQUIRE) &&
+        pthread_equal(pthread_self(), count_data.thread)) {
+        __atomic_fetch_add(&count_data.counts[call], 1, __ATOMIC_RELAXED);
+    }
+}
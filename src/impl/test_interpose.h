@@ -28,6 +28,7 @@
 #define SFD_TEST_INTERPOSE_H
 
 #include <sys/types.h>
+#include <pthread.h>
 
 /* Special return value which causes the real function to be invoked */
 #define MOCK_REALRV ~(ssize_t)0
@@ -50,6 +51,54 @@ extern "C" {
 
     DECL_MOCK_FUNCS(sendfile);
 
+    /**
+       Interposed functions whose calls are counted.
+
+       The mocked functions above are counted too, as are a few others which
+       are merely passed through to the real implementation.
+    */
+    enum mock_call {
+        MOCK_CALL_read,
+        MOCK_CALL_write,
+        MOCK_CALL_splice,
+        MOCK_CALL_sendfile,
+        MOCK_CALL_open,
+        MOCK_CALL_close,
+        MOCK_CALL_recvmsg,
+        /* epoll_wait(2) or kevent(2) */
+        MOCK_CALL_poll_wait,
+        /* epoll_ctl(2) or kevent(2) changelist submission */
+        MOCK_CALL_poll_ctl,
+        MOCK_CALL_NCALLS
+    };
+
+    /**
+       Starts counting calls made by a given thread, after zeroing the
+       counters.
+
+       Calls made by other threads (e.g., the client in tests which run the
+       server in a thread) are ignored.
+    */
+    void mock_count_start(pthread_t thread);
+
+    /**
+       Stops counting calls. The counters retain their values.
+    */
+    void mock_count_stop(void);
+
+    /**
+       Returns the number of counted calls to a function.
+    */
+    unsigned long mock_count(enum mock_call call);
+
+    /**
+       Returns the total number of counted calls.
+    */
+    unsigned long mock_count_total(void);
+
+    /* Internal: counts a call if made by the thread being counted */
+    void mock_count_call(enum mock_call call);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,10 +27,12 @@
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/event.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 
 #include <assert.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -78,3 +80,68 @@ int sendfile(int fd, int s, off_t offset, size_t nbytes,
 
     return real_sendfile(fd, s, offset, nbytes, hdtr, sbytes, flags);
 }
+
+/* Counted, but not mocked */
+
+int open(const char* path, int flags, ...)
+{
+    mock_count_call(MOCK_CALL_open);
+
+    mode_t mode = 0;
+
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = (mode_t)va_arg(ap, int);
+        va_end(ap);
+    }
+
+    typedef int (*fptr) (const char*, int, ...);
+
+    fptr real_open = (fptr)dlsym(RTLD_NEXT, "open");
+    assert (real_open);
+
+    return real_open(path, flags, mode);
+}
+
+int close(int fd)
+{
+    mock_count_call(MOCK_CALL_close);
+
+    typedef int (*fptr) (int);
+
+    fptr real_close = (fptr)dlsym(RTLD_NEXT, "close");
+    assert (real_close);
+
+    return real_close(fd);
+}
+
+ssize_t recvmsg(int fd, struct msghdr* msg, int flags)
+{
+    mock_count_call(MOCK_CALL_recvmsg);
+
+    typedef ssize_t (*fptr) (int, struct msghdr*, int);
+
+    fptr real_recvmsg = (fptr)dlsym(RTLD_NEXT, "recvmsg");
+    assert (real_recvmsg);
+
+    return real_recvmsg(fd, msg, flags);
+}
+
+int kevent(int kq, const struct kevent* changelist, int nchanges,
+           struct kevent* eventlist, int nevents,
+           const struct timespec* timeout)
+{
+    if (nchanges > 0)
+        mock_count_call(MOCK_CALL_poll_ctl);
+    if (nevents > 0)
+        mock_count_call(MOCK_CALL_poll_wait);
+
+    typedef int (*fptr) (int, const struct kevent*, int,
+                         struct kevent*, int, const struct timespec*);
+
+    fptr real_kevent = (fptr)dlsym(RTLD_NEXT, "kevent");
+    assert (real_kevent);
+
+    return real_kevent(kq, changelist, nchanges, eventlist, nevents, timeout);
+}
@@ -79,6 +79,8 @@
 /* Emacs completely destroys the alignment of this macro :( */
 #define MOCK_RETURN_IMPL(name, return_type, fd_out)                     \
     {                                                                   \
+        mock_count_call(MOCK_CALL_##name);                              \
+                                                                        \
         if (mock_data_##name.i == mock_data_##name.size ||              \
             mock_data_##name.i == MOCK_NVALS) {                         \
             mock_data_##name.i = -1;                                    \
@@ -27,10 +27,13 @@
 #define _GNU_SOURCE 1
 
 #include <dlfcn.h>
+#include <sys/epoll.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 
 #include <assert.h>
 #include <fcntl.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -96,4 +99,76 @@ ssize_t sendfile(int s, int fd, off_t* offset, size_t count)
     return real_sendfile(s, fd, offset, count);
 }
 
+/* Counted, but not mocked */
+
+int open(const char* path, int flags, ...)
+{
+    mock_count_call(MOCK_CALL_open);
+
+    mode_t mode = 0;
+
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = (mode_t)va_arg(ap, int);
+        va_end(ap);
+    }
+
+    typedef int (*fptr) (const char*, int, ...);
+
+    fptr real_open = (fptr)dlsym(RTLD_NEXT, "open");
+    assert (real_open);
+
+    return real_open(path, flags, mode);
+}
+
+int close(int fd)
+{
+    mock_count_call(MOCK_CALL_close);
+
+    typedef int (*fptr) (int);
+
+    fptr real_close = (fptr)dlsym(RTLD_NEXT, "close");
+    assert (real_close);
+
+    return real_close(fd);
+}
+
+ssize_t recvmsg(int fd, struct msghdr* msg, int flags)
+{
+    mock_count_call(MOCK_CALL_recvmsg);
+
+    typedef ssize_t (*fptr) (int, struct msghdr*, int);
+
+    fptr real_recvmsg = (fptr)dlsym(RTLD_NEXT, "recvmsg");
+    assert (real_recvmsg);
+
+    return real_recvmsg(fd, msg, flags);
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents,
+               int timeout)
+{
+    mock_count_call(MOCK_CALL_poll_wait);
+
+    typedef int (*fptr) (int, struct epoll_event*, int, int);
+
+    fptr real_epoll_wait = (fptr)dlsym(RTLD_NEXT, "epoll_wait");
+    assert (real_epoll_wait);
+
+    return real_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    mock_count_call(MOCK_CALL_poll_ctl);
+
+    typedef int (*fptr) (int, int, int, struct epoll_event*);
+
+    fptr real_epoll_ctl = (fptr)dlsym(RTLD_NEXT, "epoll_ctl");
+    assert (real_epoll_ctl);
+
+    return real_epoll_ctl(epfd, op, fd, event);
+}
+
 #pragma GCC diagnostic pop
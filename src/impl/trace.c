@@ -0,0 +1,176 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "metrics.h"
+#include "trace.h"
+#include "util.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct span {
+    /** Sequence number + 1 of the span in this slot; written last so that
+        partially-written slots can be detected */
+    uint64_t seq;
+    uint64_t start_us;
+    uint64_t end_us;
+    size_t txnid;
+    long val;
+    enum trace_stage stage;
+};
+
+#pragma GCC diagnostic pop
+
+bool trace_enabled = false;
+
+static struct span* spans;
+static size_t capacity;
+/* The sequence number of the next span to be written */
+static uint64_t next_seq;
+static int out_fd = -1;
+
+static const char* const stage_names[TRACE_NSTAGES] = {
+    [TRACE_STAGE_recv_req] = "recv_req",
+    [TRACE_STAGE_add_xfer] = "add_xfer",
+    [TRACE_STAGE_register_xfer] = "register_xfer",
+    [TRACE_STAGE_xfer_pass] = "xfer_pass",
+    [TRACE_STAGE_xfer_pass_deferred] = "xfer_pass_deferred",
+    [TRACE_STAGE_terminal_resp] = "terminal_resp"
+};
+
+bool trace_open(const int fd, const size_t nspans)
+{
+    capacity = 1;
+    while (capacity < nspans)
+        capacity <<= 1;
+
+    spans = calloc(capacity, sizeof(*spans));
+    if (!spans)
+        return false;
+
+    out_fd = fd;
+    next_seq = 0;
+    trace_enabled = true;
+
+    return true;
+}
+
+static bool dump(FILE* f);
+
+bool trace_close(void)
+{
+    if (!trace_enabled)
+        return true;
+
+    trace_enabled = false;
+
+    bool ok = false;
+
+    FILE* const f = fdopen(out_fd, "w");
+    if (f) {
+        ok = dump(f);
+        if (fclose(f) != 0)
+            ok = false;
+    } else {
+        PRESERVE_ERRNO(close(out_fd));
+    }
+
+    out_fd = -1;
+
+    free(spans);
+    spans = NULL;
+
+    return ok;
+}
+
+uint64_t trace_now(void)
+{
+    return (trace_enabled ? metrics_now_us() : 0);
+}
+
+void trace_record(const enum trace_stage stage,
+                  const size_t txnid,
+                  const uint64_t start_us,
+                  const long val)
+{
+    const uint64_t seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    struct span* const s = &spans[seq & (capacity - 1)];
+
+    /* Invalidate the slot while it's being overwritten */
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+
+    s->start_us = start_us;
+    s->end_us = metrics_now_us();
+    s->txnid = txnid;
+    s->val = val;
+    s->stage = stage;
+
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* --------------- (Uninteresting) Internal implementations ------------- */
+
+static bool dump(FILE* f)
+{
+    const uint64_t end = __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE);
+    const uint64_t begin = (end > capacity ? end - capacity : 0);
+    const long pid = (long)getpid();
+
+    bool first = true;
+
+    if (fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n") < 0)
+        return false;
+
+    for (uint64_t seq = begin; seq < end; seq++) {
+        const struct span* const s = &spans[seq & (capacity - 1)];
+
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != seq + 1)
+            continue;
+
+        if (fprintf(f,
+                    "%s{\"name\":\"%s\",\"cat\":\"sendfiled\",\"ph\":\"X\","
+                    "\"ts\":%llu,\"dur\":%llu,\"pid\":%ld,\"tid\":%zu,"
+                    "\"args\":{\"txnid\":%zu,\"val\":%ld}}",
+                    (first ? "" : ",\n"),
+                    stage_names[s->stage],
+                    (unsigned long long)s->start_us,
+                    (unsigned long long)(s->end_us - s->start_us),
+                    pid, s->txnid, s->txnid, s->val) < 0) {
+            return false;
+        }
+
+        first = false;
+    }
+
+    return (fprintf(f, "\n]}\n") >= 0);
+}
@@ -0,0 +1,157 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   @file
+
+   Per-transaction lifecycle tracing.
+
+   Two independent facilities instrument the same points in the server:
+
+   - USDT probes (Linux, if <sys/sdt.h> is available), which cost a no-op
+     instruction unless a tracer such as @c perf or @c bpftrace attaches to
+     them. Each stage has a @c <stage>__start probe (argument: the transaction
+     ID, or the next one to be assigned if not yet known) and a @c
+     <stage>__done probe (arguments: the transaction ID and a stage-specific
+     value).
+
+   - An opt-in in-memory ring of timestamped spans (cf. trace_open()), dumped
+     in the Chrome trace event format (loadable by @c chrome://tracing and
+     Perfetto) when tracing is stopped. Each transaction is displayed as a
+     separate thread.
+*/
+
+#ifndef SFD_TRACE_H
+#define SFD_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__linux__) && !defined(SFD_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SFD_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef SFD_HAVE_SDT
+#define SFD_PROBE1(name, a) DTRACE_PROBE1(sendfiled, name, a)
+#define SFD_PROBE2(name, a, b) DTRACE_PROBE2(sendfiled, name, a, b)
+#else
+#define SFD_PROBE1(name, a) ((void)(a))
+#define SFD_PROBE2(name, a, b) ((void)(a), (void)(b))
+#endif
+
+/**
+   Traced stages.
+
+   The names are those of the USDT probes (without the @c __start and @c
+   __done suffixes).
+*/
+enum trace_stage {
+    /** Receipt and processing of a request (handle_reqfd()) */
+    TRACE_STAGE_recv_req,
+    /** Opening and locking of a file (add_xfer()) */
+    TRACE_STAGE_add_xfer,
+    /** Registration of a destination with the poller (register_xfer()) */
+    TRACE_STAGE_register_xfer,
+    /** A transfer_file() pass from the primary event loop; the value is the
+        number of bytes written */
+    TRACE_STAGE_xfer_pass,
+    /** A transfer_file() pass from the deferred (secondary) loop; the value is
+        the number of bytes written */
+    TRACE_STAGE_xfer_pass_deferred,
+    /** Sending of a terminal response (send_terminal_resp()); the value is 1
+        if it was sent immediately and 0 otherwise (queued for a retry or
+        failed) */
+    TRACE_STAGE_terminal_resp,
+    TRACE_NSTAGES
+};
+
+/**
+   Starts a span, assigning its start time to @a start_var.
+*/
+#define TRACE_BEGIN(start_var, stage, txnid)                \
+    do {                                                    \
+        SFD_PROBE1(stage##__start, (txnid));                \
+        (start_var) = trace_now();                          \
+    } while (0)
+
+/**
+   Ends a span begun by TRACE_BEGIN().
+
+   @param val A stage-specific value
+*/
+#define TRACE_END(start_var, stage, txnid, val)                     \
+    do {                                                            \
+        SFD_PROBE2(stage##__done, (txnid), (val));                  \
+        if (trace_enabled)                                          \
+            trace_record(TRACE_STAGE_##stage, (txnid),              \
+                         (start_var), (long)(val));                 \
+    } while (0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /** Whether spans are being recorded */
+    extern bool trace_enabled;
+
+    /**
+       Starts recording spans.
+
+       @param fd The file descriptor to which the spans will be written by
+       trace_close(). Owned by the trace module from here on.
+
+       @param nspans The capacity of the ring; the oldest spans are overwritten
+       once it is full. Rounded up to a power of 2.
+    */
+    bool trace_open(int fd, size_t nspans);
+
+    /**
+       Stops recording spans, writes them to the file descriptor passed to
+       trace_open(), and closes it.
+    */
+    bool trace_close(void);
+
+    /**
+       Returns the current time (in microseconds) if recording spans, zero
+       otherwise.
+    */
+    uint64_t trace_now(void);
+
+    /**
+       Records a span ending now. Safe to call from any thread.
+    */
+    void trace_record(enum trace_stage, size_t txnid, uint64_t start_us,
+                      long val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -34,6 +34,10 @@
 struct iovec;
 struct msghdr;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 int us_connect(const char* server_sockdir, const char* server_name);
 
 ssize_t us_sendv(int srv_fd,
@@ -46,4 +50,8 @@ void us_attach_fds_and_creds(struct msghdr* msg,
                              int cred_type,
                              const void* creds, size_t creds_size);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -104,6 +104,30 @@ int us_serve(const char* sockdir,
     return -1;
 }
 
+bool us_serve_inherited(const int fd)
+{
+    int type;
+    socklen_t optlen = sizeof(type);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &optlen) == -1)
+        return false;
+
+    struct sockaddr_un un;
+    socklen_t addrlen = sizeof(un);
+
+    if (getsockname(fd, (struct sockaddr*)&un, &addrlen) == -1)
+        return false;
+
+    if (type != SOCK_DGRAM || un.sun_family != AF_UNIX) {
+        errno = EINVAL;
+        return false;
+    }
+
+    return (set_nonblock(fd, true) &&
+            set_cloexec(fd, true) &&
+            us_set_passcred_option(fd));
+}
+
 void us_stop_serving(const char* sockdir,
                      const char* srv_name,
                      const int listenfd)
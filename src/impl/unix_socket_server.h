@@ -44,6 +44,20 @@ extern "C" {
                  const char* srv_instance_name,
                  uid_t socket_uid, uid_t socket_gid);
 
+    /**
+       Prepares a request socket which was created and bound by another process
+       (e.g., a supervisor such as systemd; cf. sd_listen_fds(3)) for use by
+       the server.
+
+       The socket's pathname, ownership, and permissions are the supervisor's
+       responsibility, so the socket should simply be closed (rather than
+       passed to us_stop_serving()) on shutdown.
+
+       @retval false @a fd is not a UNIX datagram socket (errno ENOTSOCK or
+       EINVAL), or it could not be set up.
+    */
+    bool us_serve_inherited(int fd);
+
     void us_stop_serving(const char* sockdir,
                          const char* srv_instance_name,
                          int request_fd);
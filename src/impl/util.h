@@ -27,10 +27,13 @@
 #ifndef SFD_UTIL_H
 #define SFD_UTIL_H
 
+#include <sys/types.h>
+
 #include <errno.h>
 #include <stdbool.h>
 
 #define SFD_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define SFD_MAX(a, b) ((a) > (b) ? (a) : (b))
 
 #define PRESERVE_ERRNO(statement)               \
     {                                           \
@@ -62,6 +65,29 @@ extern "C" {
      */
     int sfd_pipe(int fds[2], int flags);
 
+    /**
+       Closes the file descriptors from @a first to @a last, inclusive, in a
+       single system call (@c close_range(2)).
+
+       @retval -1 The range could not be closed, e.g., because the system does
+       not support @c close_range(2) (errno ENOSYS), in which case the
+       descriptors have to be closed one at a time.
+     */
+    int sfd_close_range(unsigned first, unsigned last);
+
+    /**
+       Copies up to @a len bytes from one regular file to another within the
+       kernel (@c copy_file_range(2)), advancing @a *off_in and @a *off_out, or
+       the files' offsets where they are NULL.
+
+       @retval -1 The data could not be copied, e.g., because the system does
+       not support @c copy_file_range(2) (errno ENOSYS), in which case it has
+       to be read and written instead.
+     */
+    ssize_t sfd_copy_file_range(int fd_in, off_t* off_in,
+                                int fd_out, off_t* off_out,
+                                size_t len);
+
     /**
        Returns the capacity of a pipe, in bytes.
      */
@@ -26,6 +26,7 @@
 
 #define _GNU_SOURCE 1
 
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "util.h"
@@ -34,3 +35,35 @@ int sfd_pipe(int fds[2], const int flags)
 {
     return pipe2(fds, flags);
 }
+
+int sfd_close_range(const unsigned first, const unsigned last)
+{
+    /* Linux 5.9+; called directly for the sake of older C libraries */
+#ifdef SYS_close_range
+    return (int)syscall(SYS_close_range, first, last, 0U);
+#else
+    (void)first;
+    (void)last;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+ssize_t sfd_copy_file_range(const int fd_in, off_t* const off_in,
+                            const int fd_out, off_t* const off_out,
+                            const size_t len)
+{
+    /* Linux 4.5+; the C library's wrapper only exists as of glibc 2.27 */
+#ifdef SYS_copy_file_range
+    return (ssize_t)syscall(SYS_copy_file_range,
+                            fd_in, off_in, fd_out, off_out, len, 0U);
+#else
+    (void)fd_in;
+    (void)off_in;
+    (void)fd_out;
+    (void)off_out;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
@@ -24,6 +24,8 @@
   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <sys/param.h>
+
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -53,3 +55,32 @@ int sfd_pipe(int fds[2], const int flags)
     PRESERVE_ERRNO(close(fds[1]));
     return -1;
 }
+
+int sfd_close_range(const unsigned first, const unsigned last)
+{
+#if defined(__FreeBSD_version) && __FreeBSD_version >= 1202000
+    return close_range(first, last, 0);
+#else
+    (void)first;
+    (void)last;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+ssize_t sfd_copy_file_range(const int fd_in, off_t* const off_in,
+                            const int fd_out, off_t* const off_out,
+                            const size_t len)
+{
+#if defined(__FreeBSD_version) && __FreeBSD_version >= 1300000
+    return copy_file_range(fd_in, off_in, fd_out, off_out, len, 0);
+#else
+    (void)fd_in;
+    (void)off_in;
+    (void)fd_out;
+    (void)off_out;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
@@ -42,15 +42,29 @@
 
 #include "impl/errors.h"
 #include "impl/log.h"
+#include "impl/metrics.h"
 #include "impl/process.h"
 #include "impl/server.h"
+#include "impl/server_handover.h"
+#include "impl/trace.h"
 #include "impl/unix_socket_server.h"
+#include "impl/util.h"
 
 static const long OPEN_FD_TIMEOUT_MS_MAX = 60 * 60 * 1000;
 
-static void print_usage(long fd_timeout_ms);
+/* Capacity of the trace span ring (cf. -T) */
+static const size_t TRACE_NSPANS = 1 << 16;
+
+/* The first descriptor passed in by a supervisor (cf. sd_listen_fds(3)) */
+static const int LISTEN_FDS_START = 3;
+
+static void print_usage(long fd_timeout_ms, long admission_wait_ms,
+                        long idle_timeout_ms);
+static bool get_listen_fd(int* fd);
 static bool sync_parent(int status_code);
 static long opt_strtol(const char*);
+/* Like opt_strtol() but accepts zero (LOG_EMERG) */
+static long opt_log_level(const char*);
 static bool chroot_and_drop_privs(const char* root_dir,
                                   uid_t new_uid,
                                   gid_t new_gid);
@@ -97,6 +111,11 @@ extern char** environ;
 
 int main(const int argc, char** argv)
 {
+    /* A request socket passed in by a supervisor, if any (-1 otherwise); the
+       environment variables describing it are about to be cleared */
+    int listen_fd = -1;
+    const bool listen_fd_ok = get_listen_fd(&listen_fd);
+
     environ = NULL;
 
     const char* srvname = NULL;
@@ -104,11 +123,17 @@ int main(const int argc, char** argv)
     const char* sockdir = SFD_SRV_SOCKDIR;
     const char* uname = NULL;
     const char* gname = NULL;
+    const char* trace_file = NULL;
     long maxfiles = 0;
     long fd_timeout_ms = 30000;
+    long admission_wait_ms = 30000;
+    long idle_timeout_ms = 0;
+    long min_rate = 0;
+    long log_level = LOG_DEBUG;
+    bool handover = false;
 
     int opt;
-    while ((opt = getopt(argc, argv, "+s:S:n:t:r:u:g:pd")) != -1) {
+    while ((opt = getopt(argc, argv, "+s:S:n:t:w:i:m:r:u:g:T:l:pdH")) != -1) {
         switch (opt) {
         case 'r':
             root_dir = optarg;
@@ -138,6 +163,26 @@ int main(const int argc, char** argv)
             fd_timeout_ms = opt_strtol(optarg);
             break;
 
+        case 'w':
+            admission_wait_ms = opt_strtol(optarg);
+            break;
+
+        case 'i':
+            idle_timeout_ms = opt_strtol(optarg);
+            break;
+
+        case 'm':
+            min_rate = opt_strtol(optarg);
+            break;
+
+        case 'T':
+            trace_file = optarg;
+            break;
+
+        case 'l':
+            log_level = opt_log_level(optarg);
+            break;
+
         case 'p':
             do_sync = true;
             break;
@@ -146,18 +191,43 @@ int main(const int argc, char** argv)
             daemonise = true;
             break;
 
+        case 'H':
+            handover = true;
+            break;
+
         case '?':
             return EXIT_FAILURE;
 
         default:
-            print_usage(fd_timeout_ms);
+            print_usage(fd_timeout_ms, admission_wait_ms, idle_timeout_ms);
             return EXIT_FAILURE;
         }
     }
 
+    /* sfd_spawn() leaves the closing of descriptors inherited from the client
+       process to the server */
+    if (do_sync && !proc_init_child(&PROC_SYNCFD, 1)) {
+        LOGERRNO_("Couldn't close inherited file descriptors");
+        goto fail1;
+    }
+
+    if (!listen_fd_ok) {
+        LOGERRNO_("Invalid LISTEN_FDS/LISTEN_PID");
+        goto fail1;
+    }
+
+    /* Both the sync pipe and the supervisor's request socket use descriptor 3,
+       and a server which is taking over receives its request socket from its
+       predecessor */
+    if (listen_fd != -1 && (do_sync || handover)) {
+        errno = EINVAL;
+        LOG_("An inherited request socket can't be used with -p or -H");
+        goto fail1;
+    }
+
     if (!root_dir || !srvname || maxfiles == 0) {
         if (!do_sync)
-            print_usage(fd_timeout_ms);
+            print_usage(fd_timeout_ms, admission_wait_ms, idle_timeout_ms);
         LOG_("Missing command-line argument");
         errno = EINVAL;
         goto fail1;
@@ -178,6 +248,35 @@ int main(const int argc, char** argv)
         goto fail1;
     }
 
+    if (admission_wait_ms == -1 || admission_wait_ms > OPEN_FD_TIMEOUT_MS_MAX) {
+        errno = EINVAL;
+        LOG_("Invalid value for admission wait limit");
+        goto fail1;
+    }
+
+    if (idle_timeout_ms == -1 || idle_timeout_ms > OPEN_FD_TIMEOUT_MS_MAX) {
+        errno = EINVAL;
+        LOG_("Invalid value for idle transfer timeout");
+        goto fail1;
+    }
+
+    if (min_rate == -1) {
+        LOGERRNO_("Invalid value for minimum transfer rate");
+        goto fail1;
+    }
+
+    if (min_rate > 0 && idle_timeout_ms == 0) {
+        errno = EINVAL;
+        LOG_("Minimum transfer rate requires an idle transfer timeout");
+        goto fail1;
+    }
+
+    if (log_level < LOG_EMERG || log_level > LOG_DEBUG) {
+        errno = EINVAL;
+        LOG_("Invalid value for log level");
+        goto fail1;
+    }
+
     uid_t new_uid = getuid();
     gid_t new_gid = getgid();
 
@@ -208,20 +307,71 @@ int main(const int argc, char** argv)
         goto fail1;
     }
 
-    if (daemonise && !proc_daemonise(NULL, 0)) {
+    if (daemonise && !proc_daemonise(&listen_fd, (listen_fd != -1 ? 1 : 0))) {
         LOGERRNO_("Couldn't enter daemon mode");
         goto fail1;
     }
 
+    /* A supervisor which passes in the request socket may pass other
+       descriptors along with it, but its standard streams are left alone (its
+       log, e.g.) */
+    if (!daemonise && listen_fd != -1 && !proc_close_fds(&listen_fd, 1)) {
+        LOGERRNO_("Couldn't close inherited file descriptors");
+        goto fail1;
+    }
+
     sfd_log_open(SFD_PROGNAME, LOG_NDELAY | LOG_CONS | LOG_PID, LOG_DAEMON);
+    sfd_log_set_level((int)log_level);
+
+    /* Before chroot(2)ing, which would hide the shared-memory filesystem.
+       Statistics are not critical, so carry on without them on failure. */
+    if (!(handover ?
+          metrics_adopt(srvname, new_uid, new_gid) :
+          metrics_open(srvname, new_uid, new_gid))) {
+        sfd_log(LOG_WARNING, "Couldn't create statistics segment [%m]\n");
+    }
+
+    /* Also before chroot(2)ing, so that the trace can be written outside of
+       the root directory */
+    if (trace_file) {
+        const int fd = open(trace_file,
+                            O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                            S_IRUSR | S_IWUSR);
+
+        if (fd == -1 || !trace_open(fd, TRACE_NSPANS)) {
+            LOGERRNOV_("Couldn't start tracing to %s", trace_file);
+            if (fd != -1)
+                close(fd);
+            goto fail1;
+        }
+    }
 
     if (!chroot_and_drop_privs(root_dir, new_uid, new_gid))
         goto fail1;
 
-    const int requestfd = us_serve(sockdir, srvname, new_uid, new_gid);
-    if (requestfd == -1) {
-        sfd_log(LOG_ERR, "Couldn't bind and/or listen [%m]");
-        goto fail1;
+    /* When taking over, the request socket is received from the running
+       server instead */
+    int requestfd = -1;
+    int handover_fd = -1;
+
+    if (listen_fd != -1) {
+        if (!us_serve_inherited(listen_fd)) {
+            sfd_log(LOG_ERR, "Unusable inherited request socket [%m]");
+            goto fail1;
+        }
+        requestfd = listen_fd;
+    } else if (handover) {
+        handover_fd = ho_request(sockdir, srvname);
+        if (handover_fd == -1) {
+            sfd_log(LOG_ERR, "Couldn't request handover [%m]");
+            goto fail1;
+        }
+    } else {
+        requestfd = us_serve(sockdir, srvname, new_uid, new_gid);
+        if (requestfd == -1) {
+            sfd_log(LOG_ERR, "Couldn't bind and/or listen [%m]");
+            goto fail1;
+        }
     }
 
     if (do_sync) {
@@ -232,32 +382,86 @@ int main(const int argc, char** argv)
         close(PROC_SYNCFD);
     }
 
+    /* From here on, log from a separate thread so that the request-processing
+       loop never waits for the system logger */
+    if (!sfd_log_start_async())
+        sfd_log(LOG_WARNING, "Couldn't start logging thread [%m]\n");
+
     sfd_log(LOG_INFO,
             "Starting; name: %s; root_dir: \"%s\";"
             " uid: %d %s; gid: %d %s;"
-            " maxfiles: %ld; fd_timeout_ms: %ld\n",
+            " maxfiles: %ld; fd_timeout_ms: %ld; admission_wait_ms: %ld;"
+            " idle_timeout_ms: %ld; min_rate: %ld; handover: %d;"
+            " inherited socket: %d\n",
             srvname, root_dir,
-            getuid(), uname, getgid(), gname, maxfiles, fd_timeout_ms);
+            getuid(), uname, getgid(), gname, maxfiles, fd_timeout_ms,
+            admission_wait_ms, idle_timeout_ms, min_rate, handover,
+            (listen_fd != -1));
 
-    const bool success = srv_run(requestfd, (int)maxfiles, fd_timeout_ms);
+    const enum srv_exit how =
+        (handover ?
+         srv_resume(handover_fd, (int)maxfiles, fd_timeout_ms,
+                    admission_wait_ms, idle_timeout_ms, min_rate) :
+         srv_run(requestfd, (int)maxfiles, fd_timeout_ms,
+                 admission_wait_ms, idle_timeout_ms, min_rate));
 
-    if (!success) {
+    const bool success = (how != SRV_EXIT_FAILED);
+
+    switch (how) {
+    case SRV_EXIT_FAILED:
         sfd_log(LOG_EMERG, "srv_run() failed [%m]; server shutting down\n");
-    } else {
+        break;
+    case SRV_EXIT_SHUTDOWN:
         sfd_log(LOG_INFO, "Shutting down\n");
+        break;
+    case SRV_EXIT_HANDOVER:
+        sfd_log(LOG_INFO, "Handed over to new server process\n");
+        break;
+    }
+
+    if (how == SRV_EXIT_HANDOVER || (handover && how == SRV_EXIT_FAILED)) {
+        /* The socket file and the statistics segment belong to the server
+           which has taken over (or, if this one failed to take over, to the
+           one which is carrying on) */
+        close(requestfd);
+        metrics_detach();
+    } else {
+        /* An inherited socket's file belongs to the supervisor */
+        if (listen_fd != -1)
+            close(requestfd);
+        else
+            us_stop_serving(sockdir, srvname, requestfd);
+        metrics_close();
     }
 
-    us_stop_serving(sockdir, srvname, requestfd);
+    if (!trace_close())
+        sfd_log(LOG_ERR, "Couldn't write trace [%m]\n");
+
+    sfd_log_close();
 
     return (success ? EXIT_SUCCESS : EXIT_FAILURE);
 
  fail2:
-    us_stop_serving(sockdir, srvname, requestfd);
+    if (handover)
+        close(handover_fd);
+    else if (listen_fd != -1)
+        close(requestfd);
+    else
+        us_stop_serving(sockdir, srvname, requestfd);
  fail1:
+    if (handover) {
+        PRESERVE_ERRNO(metrics_detach());
+    } else {
+        PRESERVE_ERRNO(metrics_close());
+    }
+    PRESERVE_ERRNO(trace_close());
+
     if (do_sync && !sync_parent(errno)) {
         sfd_log(LOG_ERR, "Couldn't sync with parent process; errno: %m\n");
     }
 
+    sfd_log_close();
+
     return EXIT_FAILURE;
 }
 
@@ -328,7 +532,25 @@ static long opt_strtol(const char* s)
     }
 }
 
-static void print_usage(const long fd_timeout_ms)
+static long opt_log_level(const char* s)
+{
+    char* end;
+
+    errno = 0;
+    const long l = strtol(s, &end, 10);
+
+    if (errno != 0 || end == s || *end != '\0') {
+        if (errno != 0)
+            LOGERRNO_("strtol");
+        return -1;
+    }
+
+    return l;
+}
+
+static void print_usage(const long fd_timeout_ms,
+                        const long admission_wait_ms,
+                        const long idle_timeout_ms)
 {
     printf("Usage: "
            SFD_PROGNAME" OPTION\n"
@@ -341,8 +563,59 @@ static void print_usage(const long fd_timeout_ms)
            "[-u <user_name>] (run as different user)\n"
            "[-g <group_name>] (run as different group)\n"
            "[-p (sync with parent process (via a pipe))]\n"
-           "[-t <open_fd_timeout_ms> (default: %ld)]\n",
-           fd_timeout_ms);
+           "[-H (take over the request socket and transfers of the running"
+           " server of the same name, which exits once done)]\n"
+           "(If LISTEN_PID and LISTEN_FDS (=1) are set, descriptor 3 is used"
+           " as the request socket instead of binding one)\n"
+           "[-t <open_fd_timeout_ms> (default: %ld)]\n"
+           "[-w <admission_wait_ms> (reject requests which have waited this"
+           " long for room for another transfer; default: %ld)]\n"
+           "[-i <idle_timeout_ms> (cancel transfers which make no progress for"
+           " this long; default: %ld (disabled))]\n"
+           "[-m <min_bytes_per_sec> (cancel transfers slower than this over"
+           " any idle timeout period; requires -i; default: 0)]\n"
+           "[-T <trace_file> (record per-transfer spans; written in Chrome"
+           " trace format on exit)]\n"
+           "[-l <log_level> (syslog priority, 0-7; default: 7 (LOG_DEBUG);"
+           " SIGUSR1/SIGUSR2 raise/lower it at runtime)]\n",
+           fd_timeout_ms, admission_wait_ms, idle_timeout_ms);
+}
+
+/*
+  Checks for a request socket passed in by a supervisor (socket activation):
+  LISTEN_PID must be this process's ID, and LISTEN_FDS the number of descriptors
+  passed in, starting at LISTEN_FDS_START, of which only one is supported.
+
+  *fd is set to -1 if there is none.
+*/
+static bool get_listen_fd(int* fd)
+{
+    *fd = -1;
+
+    const char* const pid_str = getenv("LISTEN_PID");
+    const char* const nfds_str = getenv("LISTEN_FDS");
+
+    if (!pid_str || !nfds_str)
+        return true;
+
+    /* Not meant for this process (e.g., inherited from an ancestor) */
+    if (strtol(pid_str, NULL, 10) != (long)getpid())
+        return true;
+
+    errno = 0;
+    const long nfds = strtol(nfds_str, NULL, 10);
+
+    if (errno != 0)
+        return false;
+
+    if (nfds != 1) {
+        errno = EINVAL;
+        return false;
+    }
+
+    *fd = LISTEN_FDS_START;
+
+    return true;
 }
 
 static bool sync_parent(const int status)
@@ -43,27 +43,118 @@ int sfd_get_stat(const void* buf)
 #define HDR_OK(buf, cmd)                                          \
     (sfd_get_cmd(buf) == cmd && sfd_get_stat(buf) == SFD_STAT_OK)
 
-bool sfd_unmarshal_file_info(struct sfd_file_info* pdu, const void* buf)
+/**
+   Returns a response's wire format version (cf. PROT_RESP_VERSION_OFFSET), or
+   -1 if it has an unexpected command ID, error response code or version.
+*/
+static int resp_version(const void* buf, const int cmd)
 {
-    if (!HDR_OK(buf, SFD_FILE_INFO))
-        return false;
+    if (!HDR_OK(buf, cmd))
+        return -1;
 
-    memcpy(pdu, buf, sizeof(*pdu));
+    const int version = ((const uint8_t*)buf)[PROT_RESP_VERSION_OFFSET];
 
-    return true;
+    return (version == 0 || version == PROT_VERSION ? version : -1);
 }
 
-bool sfd_unmarshal_xfer_stat(struct sfd_xfer_stat* pdu, const void* buf)
+/** Returns the @a i th body field of a version 2 response */
+static uint64_t load_field(const void* buf, const size_t i)
 {
-    if (!HDR_OK(buf, SFD_XFER_STAT))
-        return false;
+    const uint8_t* const p = (const uint8_t*)buf + 8 + 8 * i;
 
-    memcpy(pdu, buf, sizeof(*pdu));
+    uint64_t v = 0;
+    for (int j = 0; j < 8; j++)
+        v |= (uint64_t)p[j] << (8 * j);
+    return v;
+}
+
+bool sfd_unmarshal_file_info(struct sfd_file_info* pdu, const void* buf)
+{
+    switch (resp_version(buf, SFD_FILE_INFO)) {
+    case 0:
+        memcpy(pdu, buf, sizeof(*pdu));
+        return true;
+
+    case PROT_VERSION:
+        pdu->cmd = SFD_FILE_INFO;
+        pdu->stat = SFD_STAT_OK;
+        pdu->size = (size_t)load_field(buf, 0);
+        pdu->atime = (time_t)(int64_t)load_field(buf, 1);
+        pdu->mtime = (time_t)(int64_t)load_field(buf, 2);
+        pdu->ctime = (time_t)(int64_t)load_field(buf, 3);
+        pdu->txnid = (size_t)load_field(buf, 4);
+        return true;
+
+    default:
+        return false;
+    }
+}
 
-    return true;
+bool sfd_unmarshal_xfer_stat(struct sfd_xfer_stat* pdu, const void* buf)
+{
+    switch (resp_version(buf, SFD_XFER_STAT)) {
+    case 0:
+        memcpy(pdu, buf, sizeof(*pdu));
+        return true;
+
+    case PROT_VERSION: {
+        const uint64_t size = load_field(buf, 0);
+        pdu->cmd = SFD_XFER_STAT;
+        pdu->stat = SFD_STAT_OK;
+        pdu->size = (size == UINT64_MAX ? PROT_XFER_COMPLETE : (size_t)size);
+        return true;
+    }
+
+    default:
+        return false;
+    }
 }
 
 bool sfd_xfer_complete(const struct sfd_xfer_stat* this)
 {
     return (this->size == PROT_XFER_COMPLETE);
 }
+
+bool sfd_unmarshal_xfer_stats(struct sfd_xfer_stats* pdu, const void* buf)
+{
+    switch (resp_version(buf, SFD_XFER_STATS)) {
+    case 0:
+        memcpy(pdu, buf, sizeof(*pdu));
+        return true;
+
+    case PROT_VERSION:
+        pdu->cmd = SFD_XFER_STATS;
+        pdu->stat = SFD_STAT_OK;
+        pdu->size = load_field(buf, 0);
+        pdu->duration_us = load_field(buf, 1);
+        pdu->ttfb_us = load_field(buf, 2);
+        pdu->queue_us = load_field(buf, 3);
+        pdu->nwrites = load_field(buf, 4);
+        pdu->nstalls = load_field(buf, 5);
+        pdu->ndeferrals = load_field(buf, 6);
+        pdu->cookie = load_field(buf, 7);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool sfd_unmarshal_req_queued(struct sfd_req_queued* pdu, const void* buf)
+{
+    switch (resp_version(buf, SFD_REQ_QUEUED)) {
+    case 0:
+        memcpy(pdu, buf, sizeof(*pdu));
+        return true;
+
+    case PROT_VERSION:
+        pdu->cmd = SFD_REQ_QUEUED;
+        pdu->stat = SFD_STAT_OK;
+        pdu->position = load_field(buf, 0);
+        pdu->max_wait_ms = load_field(buf, 1);
+        return true;
+
+    default:
+        return false;
+    }
+}
@@ -51,7 +51,11 @@ enum sfd_cmd_id {
     /** File information */
     SFD_FILE_INFO = 0x81,
     /** File transfer request/operation status */
-    SFD_XFER_STAT = 0x82
+    SFD_XFER_STAT = 0x82,
+    /** File transfer completion, with statistics */
+    SFD_XFER_STATS = 0x83,
+    /** Request waiting for room for another transfer */
+    SFD_REQ_QUEUED = 0x84
 };
 
 /**
@@ -101,6 +105,71 @@ struct sfd_xfer_stat {
     size_t size;                /**< Size of the most recent group of writes */
 };
 
+/**
+   A response message containing server-side statistics about a completed
+   transfer.
+
+   Sent, instead of the sfd_xfer_stat transfer completion notification, in
+   response to sfd_send_ex() and sfd_open_ex() requests made with the @c
+   SFD_REQ_XFER_STATS flag.
+
+   @sa sfd_unmarshal_xfer_stats()
+*/
+struct sfd_xfer_stats {
+    /* header */
+    uint8_t cmd;                /**< Command ID */
+    uint8_t stat;               /**< Status Code */
+
+    /* body */
+    /** Number of bytes transferred */
+    uint64_t size;
+    /** Time from the receipt of the request (or of the Send Open File request)
+        to the completion of the transfer, in microseconds */
+    uint64_t duration_us;
+    /** Time from the receipt of the request (or of the Send Open File request)
+        to the writing of the first byte, in microseconds */
+    uint64_t ttfb_us;
+    /** Time the request spent waiting for the server to have room for
+        another transfer (included in @a duration_us and @a ttfb_us), in
+        microseconds */
+    uint64_t queue_us;
+    /** Number of data-transfer system calls (e.g., sendfile(2) or
+        splice(2)) */
+    uint64_t nwrites;
+    /** Number of times the destination was full (EAGAIN), i.e., the number of
+        times the transfer stalled waiting for the client */
+    uint64_t nstalls;
+    /** Number of passes made by the server's secondary (deferred) processing
+        loop, i.e., the number of times the transfer was paused in order to
+        avoid starving other transfers */
+    uint64_t ndeferrals;
+    /** The cookie supplied with the request (cf. sfd_req_opts), or zero */
+    uint64_t cookie;
+};
+
+/**
+   A response message reporting that a request is waiting for the server to
+   have room for another transfer.
+
+   Sent, before any other response, in response to requests made with the @c
+   SFD_REQ_QUEUED_STATUS flag which have been queued. The request's other
+   responses follow once it has been admitted.
+
+   @sa sfd_unmarshal_req_queued()
+*/
+struct sfd_req_queued {
+    /* header */
+    uint8_t cmd;                /**< Command ID */
+    uint8_t stat;               /**< Status Code */
+
+    /* body */
+    /** Number of requests queued ahead of this one */
+    uint64_t position;
+    /** The longest the request waits, in milliseconds, before it is rejected
+        with ETIMEDOUT */
+    uint64_t max_wait_ms;
+};
+
 #pragma GCC diagnostic pop
 
 /**
@@ -111,10 +180,29 @@ struct sfd_xfer_stat {
 #define SFD_HDR_SIZE (offsetof(struct sfd_file_info, stat) +        \
                       sizeof(((struct sfd_file_info*)NULL)->stat))
 
+/**
+   @name Fixed-width response sizes
+
+   The sizes of the response messages sent, in a fixed-width format which does
+   not depend on the server's ABI, in response to requests sent in the version
+   2 request wire format (cf. sfd_send_opts()). Other requests' responses are
+   the size of the corresponding structures, as are these on LP64 platforms.
+   @{
+*/
+#define SFD_FILE_INFO_SIZE 48
+#define SFD_XFER_STAT_SIZE 16
+#define SFD_XFER_STATS_SIZE 72
+#define SFD_REQ_QUEUED_SIZE 24
+/** @} */
+
 /**
    Size of the biggest response message that can be received from the server.
  */
-#define SFD_MAX_RESP_SIZE sizeof(struct sfd_file_info)
+#define SFD_MAX_RESP_SIZE                                               \
+    (sizeof(struct sfd_file_info) > SFD_XFER_STATS_SIZE ?               \
+     sizeof(struct sfd_file_info) :                                     \
+     sizeof(struct sfd_xfer_stats) > SFD_XFER_STATS_SIZE ?              \
+     sizeof(struct sfd_xfer_stats) : SFD_XFER_STATS_SIZE)
 
 #ifdef __cplusplus
 extern "C" {
@@ -140,12 +228,13 @@ extern "C" {
 
        @param[out] pdu The PDU
 
-       @param[in] buf The source buffer
+       @param[in] buf The source buffer, which holds the PDU in either wire
+       format (cf. SFD_FILE_INFO_SIZE)
 
        @retval true Success
 
-       @retval false The buffer contained an unexpected command ID or error
-       response code.
+       @retval false The buffer contained an unexpected command ID, error
+       response code or wire format version.
     */
     bool sfd_unmarshal_file_info(struct sfd_file_info* pdu,
                                  const void* buf) SFD_API;
@@ -155,12 +244,13 @@ extern "C" {
 
        @param[out] pdu The PDU
 
-       @param[in] buf The source buffer
+       @param[in] buf The source buffer, which holds the PDU in either wire
+       format (cf. SFD_FILE_INFO_SIZE)
 
        @retval true Success
 
-       @retval false The buffer contained an unexpected command ID or error
-       response code.
+       @retval false The buffer contained an unexpected command ID, error
+       response code or wire format version.
     */
     bool sfd_unmarshal_xfer_stat(struct sfd_xfer_stat* pdu,
                                  const void* buf) SFD_API;
@@ -170,6 +260,38 @@ extern "C" {
     */
     bool sfd_xfer_complete(const struct sfd_xfer_stat*) SFD_API;
 
+    /**
+       Unmarshals a Transfer Statistics PDU.
+
+       @param[out] pdu The PDU
+
+       @param[in] buf The source buffer, which holds the PDU in either wire
+       format (cf. SFD_FILE_INFO_SIZE)
+
+       @retval true Success
+
+       @retval false The buffer contained an unexpected command ID, error
+       response code or wire format version.
+    */
+    bool sfd_unmarshal_xfer_stats(struct sfd_xfer_stats* pdu,
+                                  const void* buf) SFD_API;
+
+    /**
+       Unmarshals a Request Queued PDU.
+
+       @param[out] pdu The PDU
+
+       @param[in] buf The source buffer, which holds the PDU in either wire
+       format (cf. SFD_FILE_INFO_SIZE)
+
+       @retval true Success
+
+       @retval false The buffer contained an unexpected command ID, error
+       response code or wire format version.
+    */
+    bool sfd_unmarshal_req_queued(struct sfd_req_queued* pdu,
+                                  const void* buf) SFD_API;
+
     /**@}*/
 
 #ifdef __cplusplus
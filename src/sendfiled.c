@@ -34,6 +34,7 @@
 
 #include <assert.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdlib.h>
 
 #include <sfd_config.h>
@@ -48,13 +49,27 @@
 
 #include "sendfiled.h"
 
+extern char** environ;
+
 static int wait_child(pid_t pid);
 
-static bool exec_server(const char* srvname,
-                        const char* root_dir,
-                        const char* srv_sockdir,
-                        int maxfiles,
-                        int open_fd_timeout_ms);
+static pid_t spawn_server(const char* srvname,
+                          const char* root_dir,
+                          const char* srv_sockdir,
+                          int maxfiles,
+                          int open_fd_timeout_ms,
+                          const struct sfd_srv_opts* opts,
+                          int syncfd);
+
+/* Formats @a val into @a buf; returns false if it does not fit */
+static bool format_long(char* buf, size_t size, long val);
+
+/* Sends an Open File request with the given (wire) request flags */
+static int open_file(int srv_sockfd,
+                     const char* filename,
+                     off_t offset, size_t len,
+                     bool stat_fd_nonblock,
+                     uint8_t flags, uint32_t ext_flags);
 
 pid_t sfd_spawn(const char* srvname,
                 const char* root_dir,
@@ -62,6 +77,22 @@ pid_t sfd_spawn(const char* srvname,
                 const int maxfiles,
                 const int open_fd_timeout_ms)
 {
+    return sfd_spawn_opts(srvname, root_dir, sockdir,
+                          maxfiles, open_fd_timeout_ms, NULL);
+}
+
+pid_t sfd_spawn_opts(const char* srvname,
+                     const char* root_dir,
+                     const char* sockdir,
+                     const int maxfiles,
+                     const int open_fd_timeout_ms,
+                     const struct sfd_srv_opts* opts)
+{
+    static const struct sfd_srv_opts default_opts;
+
+    if (!opts)
+        opts = &default_opts;
+
     /* Pipe used to sync with child */
     int pfd[2];
 
@@ -70,98 +101,67 @@ pid_t sfd_spawn(const char* srvname,
         return -1;
     }
 
-    const pid_t pid = fork();
+    /* The write end of the pipe is passed to the server, which only writes
+       the status/error code (0 or errno) to it after it has bound to its
+       request socket and is therefore ready to accept requests.
+    */
+    const pid_t pid = spawn_server(srvname, root_dir, sockdir,
+                                   maxfiles, open_fd_timeout_ms, opts,
+                                   pfd[1]);
+
+    PRESERVE_ERRNO(close(pfd[1]));
 
     if (pid == -1) {
-        LOGERRNO("fork");
+        LOGERRNO("Couldn't spawn server process");
         PRESERVE_ERRNO(close(pfd[0]));
-        PRESERVE_ERRNO(close(pfd[1]));
         return -1;
-
-    } else if (pid > 0) {
-        /* In the parent process */
-
-        close(pfd[1]);
-
-        int child_err = 0;
-        if (read(pfd[0], &child_err, sizeof(child_err)) != sizeof(child_err)) {
-            LOGERRNO("Read error synching with child");
-            PRESERVE_ERRNO(close(pfd[0]));
-            return -1;
-        }
-
-        close(pfd[0]);
-
-        if (child_err != 0) {
-            if (child_err == EADDRINUSE) {
-                printf("%s: daemon named '%s' already running"
-                       " (UNIX socket exists)\n",
-                       __func__, srvname);
-                wait_child(pid);
-                return 0;
-
-            } else {
-                fprintf(stderr, "%s: child failed with errno %d [%s]\n",
-                        __func__, child_err, strerror(child_err));
-                wait_child(pid);
-                errno = child_err;
-                return -1;
-            }
-        }
-
-        return pid;
     }
 
-    /* In the child process */
-
-    close(pfd[0]);
-
-    /* Descriptor to which the status code (0 or errno) is written (the write
-       end of the pipe shared with the parent); the server only writes the
-       status/error code after it has bound to its request socket and is
-       therefore ready to accept requests.
-    */
-    int syncfd = pfd[1];
-
-    /* If the write end of the pipe does not have the value expected be the
-       server (PROC_SYNCFD), dupe it to PROC_SYNCFD and close it */
-    if (syncfd != PROC_SYNCFD) {
-        if (dup2(syncfd, PROC_SYNCFD) == -1)
-            goto fail;
-        close(syncfd);
-        syncfd = PROC_SYNCFD;
+    int child_err = 0;
+    if (read(pfd[0], &child_err, sizeof(child_err)) != sizeof(child_err)) {
+        LOGERRNO("Read error synching with child");
+        PRESERVE_ERRNO(close(pfd[0]));
+        return -1;
     }
 
-    if (!proc_init_child(&PROC_SYNCFD, 1))
-        goto fail;
-
-    exec_server(srvname, root_dir, sockdir, maxfiles, open_fd_timeout_ms);
-
-    /* exec_server() only returns on failure, so something has gone wrong */
-
- fail: {
-        LOGERRNO("Couldn't exec server process");
-
-        size_t total_nwritten = 0;
+    close(pfd[0]);
 
-        while (total_nwritten < sizeof(errno)) {
-            const ssize_t nwritten = write(syncfd, &errno, sizeof(errno));
-            if (nwritten < 0) {
-                LOGERRNO("Couldn't send errno to parent process");
-                break;
-            }
-            total_nwritten += (size_t)nwritten;
+    if (child_err != 0) {
+        if (child_err == EADDRINUSE) {
+            printf("%s: daemon named '%s' already running"
+                   " (UNIX socket exists)\n",
+                   __func__, srvname);
+            wait_child(pid);
+            return 0;
+
+        } else {
+            fprintf(stderr, "%s: child failed with errno %d [%s]\n",
+                    __func__, child_err, strerror(child_err));
+            wait_child(pid);
+            errno = child_err;
+            return -1;
         }
-
-        exit(EXIT_FAILURE);
     }
+
+    return pid;
 }
 
-static bool exec_server(const char* srvname,
-                        const char* root_dir,
-                        const char* srv_sockdir,
-                        const int maxfiles,
-                        const int open_fd_timeout_ms)
+/*
+  Starts the server with posix_spawnp(3) rather than fork(2) and exec(2) so
+  that the (possibly large) client process's address space need not be
+  duplicated, even if only copy-on-write.
+
+  Only the standard streams (redirected to /dev/null) and @a syncfd (as
+  PROC_SYNCFD) are set up here; the server itself closes all other inherited
+  descriptors at startup (proc_init_child()).
+*/
+static pid_t spawn_server(const char* srvname,
+                          const char* root_dir,
+                          const char* srv_sockdir,
+                          const int maxfiles,
+                          const int open_fd_timeout_ms,
+                          const struct sfd_srv_opts* opts,
+                          int syncfd)
 {
     const long line_max = sysconf(_SC_LINE_MAX);
 
@@ -171,26 +171,32 @@ static bool exec_server(const char* srvname,
 
     if (srvname_len == (size_t)line_max + 1) {
         errno = ENAMETOOLONG;
-        return false;
+        return -1;
     }
 
-    char maxfiles_str [10];
-
-    int ndigits = snprintf(maxfiles_str,
-                           sizeof(maxfiles_str),
-                           "%d", maxfiles);
-
-    if (ndigits >= (int)sizeof(maxfiles_str))
-        return false;
+    if (opts->admission_wait_ms < 0 || opts->idle_timeout_ms < 0 ||
+        opts->min_rate < 0) {
+        errno = EINVAL;
+        return -1;
+    }
 
+    char maxfiles_str [10];
     char open_fd_timeout_ms_str [10];
-
-    ndigits = snprintf(open_fd_timeout_ms_str,
-                       sizeof(open_fd_timeout_ms_str),
-                       "%d", open_fd_timeout_ms);
-
-    if (ndigits >= (int)sizeof(open_fd_timeout_ms_str))
-        return false;
+    char admission_wait_ms_str [10];
+    char idle_timeout_ms_str [10];
+    char min_rate_str [20];
+
+    if (!format_long(maxfiles_str, sizeof(maxfiles_str), maxfiles) ||
+        !format_long(open_fd_timeout_ms_str, sizeof(open_fd_timeout_ms_str),
+                     open_fd_timeout_ms) ||
+        !format_long(admission_wait_ms_str, sizeof(admission_wait_ms_str),
+                     opts->admission_wait_ms) ||
+        !format_long(idle_timeout_ms_str, sizeof(idle_timeout_ms_str),
+                     opts->idle_timeout_ms) ||
+        !format_long(min_rate_str, sizeof(min_rate_str), opts->min_rate)) {
+        errno = EINVAL;
+        return -1;
+    }
 
     const char* args[] = {
         SFD_PROGNAME,
@@ -200,13 +206,83 @@ static bool exec_server(const char* srvname,
         "-n", maxfiles_str,
         "-t", open_fd_timeout_ms_str,
         "-p",
+        /* Optional arguments; only those which are set are passed */
+        NULL, NULL,
+        NULL, NULL,
+        NULL, NULL,
         NULL
     };
 
-    execvp(SFD_PROGNAME, (char**)args);
+    size_t nargs = 12;
+
+    if (opts->admission_wait_ms > 0) {
+        args[nargs++] = "-w";
+        args[nargs++] = admission_wait_ms_str;
+    }
+
+    if (opts->idle_timeout_ms > 0) {
+        args[nargs++] = "-i";
+        args[nargs++] = idle_timeout_ms_str;
+    }
+
+    if (opts->min_rate > 0) {
+        args[nargs++] = "-m";
+        args[nargs++] = min_rate_str;
+    }
+
+    /* A descriptor dup'ed onto itself would keep its close-on-exec flag */
+    int tmpfd = -1;
+
+    if (syncfd == PROC_SYNCFD) {
+        tmpfd = fcntl(syncfd, F_DUPFD_CLOEXEC, PROC_SYNCFD + 1);
+        if (tmpfd == -1)
+            return -1;
+        syncfd = tmpfd;
+    }
+
+    pid_t pid = -1;
+    posix_spawn_file_actions_t actions;
+
+    int err = posix_spawn_file_actions_init(&actions);
+    if (err != 0)
+        goto done;
+
+    /* The sync descriptor is dup'ed first, in case it is one of the standard
+       stream descriptors (i.e., if the client has closed any of them) */
+    if ((err = posix_spawn_file_actions_adddup2(&actions,
+                                                syncfd, PROC_SYNCFD)) != 0 ||
+        (err = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                                "/dev/null", O_RDWR, 0)) != 0 ||
+        (err = posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO,
+                                                STDOUT_FILENO)) != 0 ||
+        (err = posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO,
+                                                STDERR_FILENO)) != 0) {
+        goto destroy;
+    }
+
+    err = posix_spawnp(&pid, SFD_PROGNAME, &actions, NULL,
+                       (char**)args, environ);
+    if (err != 0)
+        pid = -1;
+
+ destroy:
+    posix_spawn_file_actions_destroy(&actions);
+
+ done:
+    if (tmpfd != -1)
+        close(tmpfd);
+
+    if (pid == -1)
+        errno = err;
 
-    /* execve does not return on success */
-    return false;
+    return pid;
+}
+
+static bool format_long(char* buf, const size_t size, const long val)
+{
+    const int ndigits = snprintf(buf, size, "%ld", val);
+
+    return (ndigits >= 0 && (size_t)ndigits < size);
 }
 
 int sfd_connect(const char* sockdir, const char* name)
@@ -227,13 +303,51 @@ int sfd_shutdown(const pid_t pid)
     return wait_child(pid);
 }
 
-#define REQ_IOVS(req) {                                       \
-        (struct iovec) { .iov_base = &req,                    \
-                .iov_len = PROT_REQ_BASE_SIZE },              \
-            (struct iovec) { .iov_base = (void*)req.filename, \
-                    .iov_len = req.filename_len + 1 }         \
+/* The request's fixed part and extensions, encoded into hdr (in the oldest
+   wire format which can carry them), followed by its filename straight from
+   the caller's string */
+#define REQ_IOVS(hdr, req) {                                            \
+        (struct iovec) { .iov_base = hdr,                               \
+                .iov_len = prot_marshal_request_hdr_compat(hdr, &req) }, \
+            (struct iovec) { .iov_base = (void*)req.filename,       \
+                    .iov_len = req.filename_len + 1 }               \
     }
 
+/* Maps public request flags (enum sfd_req_flags) to their wire values */
+static uint8_t req_flags(const int flags)
+{
+    uint8_t ret = 0;
+
+    if (flags & SFD_REQ_XFER_STATS)
+        ret |= PROT_REQ_XFER_STATS;
+    if (flags & SFD_REQ_NO_PROGRESS)
+        ret |= PROT_REQ_NO_PROGRESS;
+    if (flags & SFD_REQ_PROGRESS_MS)
+        ret |= PROT_REQ_PROGRESS_MS;
+    if (flags & SFD_REQ_PIPELINE)
+        ret |= PROT_REQ_PIPELINE;
+    if (flags & SFD_REQ_FANOUT)
+        ret |= PROT_REQ_FANOUT;
+    if (flags & SFD_REQ_PARALLEL)
+        ret |= PROT_REQ_PARALLEL;
+
+    return ret;
+}
+
+/* Maps the public request flags which do not fit into the flags byte to their
+   wire values (cf. PROT_EXT_FLAGS) */
+static uint32_t req_ext_flags(const int flags)
+{
+    uint32_t ret = 0;
+
+    if (flags & SFD_REQ_DIRECT)
+        ret |= PROT_REQX_DIRECT;
+    if (flags & SFD_REQ_QUEUED_STATUS)
+        ret |= PROT_REQX_QUEUED;
+
+    return ret;
+}
+
 int sfd_read(const int sockfd,
              const char* filename,
              const off_t offset,
@@ -252,7 +366,8 @@ int sfd_read(const int sockfd,
     if (!prot_marshal_read(&req, filename, offset, len))
         goto fail;
 
-    struct iovec iovs[] = REQ_IOVS(req);
+    uint8_t hdr [PROT_REQ_V2_HDR_MAXSIZE];
+    struct iovec iovs[] = REQ_IOVS(hdr, req);
 
     const ssize_t nsent = us_sendv(sockfd, iovs, 2, &fds[1], 1);
     if (nsent == -1)
@@ -274,6 +389,33 @@ int sfd_open(int srv_sockfd,
              const char* filename,
              off_t offset, size_t len,
              bool stat_fd_nonblock)
+{
+    return sfd_open_ex(srv_sockfd, filename, offset, len, stat_fd_nonblock, 0);
+}
+
+int sfd_open_ex(int srv_sockfd,
+                const char* filename,
+                off_t offset, size_t len,
+                bool stat_fd_nonblock,
+                int flags)
+{
+    return open_file(srv_sockfd, filename, offset, len, stat_fd_nonblock,
+                     req_flags(flags), req_ext_flags(flags));
+}
+
+int sfd_open_handle(int srv_sockfd,
+                    const char* filename,
+                    bool stat_fd_nonblock)
+{
+    return open_file(srv_sockfd, filename, 0, 0, stat_fd_nonblock,
+                     PROT_REQ_HANDLE, 0);
+}
+
+static int open_file(const int srv_sockfd,
+                     const char* filename,
+                     const off_t offset, const size_t len,
+                     const bool stat_fd_nonblock,
+                     const uint8_t flags, const uint32_t ext_flags)
 {
     int fds[2];
 
@@ -287,7 +429,11 @@ int sfd_open(int srv_sockfd,
     if (!prot_marshal_file_open(&req, filename, offset, len))
         goto fail;
 
-    struct iovec iovs[] = REQ_IOVS(req);
+    req.flags = flags;
+    req.ext_flags = ext_flags;
+
+    uint8_t hdr [PROT_REQ_V2_HDR_MAXSIZE];
+    struct iovec iovs[] = REQ_IOVS(hdr, req);
 
     if (us_sendv(srv_sockfd, iovs, 2, &fds[1], 1) == -1)
         goto fail;
@@ -309,6 +455,34 @@ int sfd_send(const int srv_sockfd,
              const off_t offset,
              const size_t len,
              const bool stat_fd_nonblock)
+{
+    return sfd_send_ex(srv_sockfd, filename, dest_fd,
+                       offset, len, stat_fd_nonblock, 0);
+}
+
+int sfd_send_ex(const int srv_sockfd,
+                const char* filename,
+                const int dest_fd,
+                const off_t offset,
+                const size_t len,
+                const bool stat_fd_nonblock,
+                const int flags)
+{
+    const struct sfd_req_opts opts = {
+        .flags = flags
+    };
+
+    return sfd_send_opts(srv_sockfd, filename, dest_fd,
+                         offset, len, stat_fd_nonblock, &opts);
+}
+
+int sfd_send_opts(const int srv_sockfd,
+                  const char* filename,
+                  const int dest_fd,
+                  const off_t offset,
+                  const size_t len,
+                  const bool stat_fd_nonblock,
+                  const struct sfd_req_opts* opts)
 {
     int fds[3];
 
@@ -324,7 +498,14 @@ int sfd_send(const int srv_sockfd,
     if (!prot_marshal_send(&req, filename, offset, len))
         goto fail;
 
-    struct iovec iovs[] = REQ_IOVS(req);
+    req.flags = req_flags(opts->flags);
+    req.ext_flags = req_ext_flags(opts->flags);
+    req.access = (uint8_t)opts->access_hint;
+    req.progress = opts->progress_interval;
+    req.cookie = opts->cookie;
+
+    uint8_t hdr [PROT_REQ_V2_HDR_MAXSIZE];
+    struct iovec iovs[] = REQ_IOVS(hdr, req);
 
     if (us_sendv(srv_sockfd, iovs, 2, &fds[1], 2) == -1)
         goto fail;
@@ -341,6 +522,24 @@ int sfd_send(const int srv_sockfd,
     return -1;
 }
 
+bool sfd_send_nostat(const int srv_sockfd,
+                     const char* filename,
+                     const int dest_fd,
+                     const off_t offset,
+                     const size_t len)
+{
+    struct prot_request req;
+    if (!prot_marshal_send(&req, filename, offset, len))
+        return false;
+
+    req.flags = PROT_REQ_NO_STAT;
+
+    uint8_t hdr [PROT_REQ_V2_HDR_MAXSIZE];
+    struct iovec iovs[] = REQ_IOVS(hdr, req);
+
+    return (us_sendv(srv_sockfd, iovs, 2, &dest_fd, 1) != -1);
+}
+
 bool sfd_send_open(const int srv_sockfd,
                    const size_t txnid,
                    const int dest_fd)
@@ -359,6 +558,117 @@ bool sfd_send_open(const int srv_sockfd,
     return true;
 }
 
+int sfd_send_range(const int srv_sockfd,
+                   const size_t handle,
+                   const int dest_fd,
+                   const off_t offset,
+                   const size_t len,
+                   const bool stat_fd_nonblock,
+                   const int flags)
+{
+    const struct sfd_req_opts opts = {
+        .flags = flags
+    };
+
+    return sfd_send_range_opts(srv_sockfd, handle, dest_fd, offset, len,
+                               stat_fd_nonblock, &opts);
+}
+
+int sfd_send_range_opts(const int srv_sockfd,
+                        const size_t handle,
+                        const int dest_fd,
+                        const off_t offset,
+                        const size_t len,
+                        const bool stat_fd_nonblock,
+                        const struct sfd_req_opts* opts)
+{
+    int fds[3];
+
+    if (sfd_pipe(fds, O_NONBLOCK | O_CLOEXEC) == -1)
+        return -1;
+
+    if (!stat_fd_nonblock && !set_nonblock(fds[0], false))
+        goto fail;
+
+    fds[2] = dest_fd;
+
+    uint8_t pdu [PROT_SEND_RANGE_MAXSIZE];
+    const size_t pdu_len =
+        prot_marshal_send_range(pdu, handle, offset, len,
+                                (uint8_t)(opts ? req_flags(opts->flags) : 0),
+                                (opts ? opts->progress_interval : 0),
+                                (opts ? opts->cookie : 0));
+
+    struct iovec iov = {
+        .iov_base = pdu,
+        .iov_len = pdu_len
+    };
+
+    if (us_sendv(srv_sockfd, &iov, 1, &fds[1], 2) == -1)
+        goto fail;
+
+    /* No use for the write end of the pipe in this process */
+    close (fds[1]);
+
+    return fds[0];
+
+ fail:
+    PRESERVE_ERRNO(close(fds[0]));
+    PRESERVE_ERRNO(close(fds[1]));
+
+    return -1;
+}
+
+bool sfd_close_handle(int srv_sockfd, size_t handle)
+{
+    return sfd_cancel(srv_sockfd, handle);
+}
+
+int sfd_pump(const int srv_sockfd,
+             const int src_fd,
+             const int dest_fd,
+             const size_t len,
+             const bool stat_fd_nonblock,
+             const struct sfd_req_opts* opts)
+{
+    int fds[4];
+
+    if (sfd_pipe(fds, O_NONBLOCK | O_CLOEXEC) == -1)
+        return -1;
+
+    if (!stat_fd_nonblock && !set_nonblock(fds[0], false))
+        goto fail;
+
+    fds[2] = dest_fd;
+    fds[3] = src_fd;
+
+    uint8_t pdu [PROT_PUMP_MAXSIZE];
+    const size_t pdu_len =
+        prot_marshal_pump(pdu, len,
+                          (uint8_t)(opts ? req_flags(opts->flags) : 0),
+                          (opts ? opts->progress_interval : 0),
+                          (opts ? opts->cookie : 0));
+
+    struct iovec iov = {
+        .iov_base = pdu,
+        .iov_len = pdu_len
+    };
+
+    if (us_sendv(srv_sockfd, &iov, 1, &fds[1], 3) == -1)
+        goto fail;
+
+    /* No use for the write end of the pipe in this process */
+    close (fds[1]);
+
+    return fds[0];
+
+ fail:
+    PRESERVE_ERRNO(close(fds[0]));
+    PRESERVE_ERRNO(close(fds[1]));
+
+    return -1;
+}
+
 bool sfd_cancel(int srv_sockfd, size_t txnid)
 {
     struct prot_cancel pdu;
@@ -40,6 +40,7 @@
 #define SFD_SENDFILED_H
 
 #include "responses.h"
+#include "stats.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,6 +54,135 @@ extern "C" {
        @{
     */
 
+    /**
+       Request flags accepted by sfd_send_ex() and sfd_open_ex().
+    */
+    enum sfd_req_flags {
+        /**
+           Replace the transfer completion notification (sfd_xfer_stat) with a
+           message of type sfd_xfer_stats, which describes the server-side cost
+           of the transfer.
+        */
+        SFD_REQ_XFER_STATS = 0x01,
+        /**
+           Don't send any transfer status notifications besides the terminal
+           one (transfer completion, statistics or error).
+        */
+        SFD_REQ_NO_PROGRESS = 0x02,
+        /**
+           The progress notification interval (struct
+           sfd_req_opts::progress_interval) is in milliseconds rather than
+           bytes.
+        */
+        SFD_REQ_PROGRESS_MS = 0x04,
+        /**
+           Pipeline Send File requests to the same destination (e.g., the
+           responses to pipelined HTTP requests on a keep-alive connection): a
+           request made with this flag while another one made with it is still
+           sending to the same destination socket or pipe is queued, and its
+           transfer starts as soon as the one ahead of it completes, without
+           having to wait for the client to see that completion. The status
+           channel responds as usual (the file information at once, transfer
+           status once it has started). If a transfer fails or is cancelled,
+           the ones queued behind it are cancelled with ECANCELED.
+        */
+        SFD_REQ_PIPELINE = 0x08,
+        /**
+           Share the reading of the file with concurrent Send File requests
+           for the same file and range made with this flag (e.g., many clients
+           downloading the same file at once): the server reads each chunk of
+           it once and duplicates it to every destination (with tee(2) on
+           Linux). A request can only join a group of sends before any of them
+           has asked for the file's second chunk. A send which falls a chunk
+           behind the others leaves the group and carries on by itself.
+           Ignored for sends which are pipelined (SFD_REQ_PIPELINE).
+        */
+        SFD_REQ_FANOUT = 0x10,
+        /**
+           Copy a file sent to a regular file (e.g., a large image being
+           backed up) in segments, several of which are copied at once by the
+           server's copy threads, so that fast storage is kept busy. Progress
+           is reported as segments complete. Ignored for destinations which
+           are not regular files, or which were opened with O_APPEND, and for
+           ranges no longer than a segment.
+        */
+        SFD_REQ_PARALLEL = 0x20,
+        /**
+           Read the file with direct I/O (O_DIRECT), through the server's own
+           buffers, instead of through the page cache (e.g., for streaming
+           large archive files which are rarely read, without evicting the
+           small, frequently read files the cache serves). Sends only; ignored
+           for destinations which are regular files, for ranges smaller than
+           two MiB, for files whose file systems do not support direct I/O,
+           and for sends made with SFD_REQ_FANOUT.
+        */
+        SFD_REQ_DIRECT = 0x40,
+        /**
+           If the server has no room for another transfer, so that the request
+           has to wait in its admission queue, respond with a message of type
+           sfd_req_queued (before any other response) instead of waiting
+           silently. Send File (sfd_send_opts() and the like) and Open File
+           (sfd_open_ex()) requests only.
+        */
+        SFD_REQ_QUEUED_STATUS = 0x80
+    };
+
+    /**
+       How the file of a Send File request is going to be read, which decides
+       the server's readahead and drop-behind policy for it (cf.
+       posix_fadvise(2)). Servers which do not know a hint ignore it.
+    */
+    enum sfd_access_hint {
+        /** The server's default policy */
+        SFD_ACCESS_NORMAL = 0,
+        /**
+           Front to back: the server reads ahead of the transfer, by as much
+           as it sends in a fraction of a second.
+        */
+        SFD_ACCESS_SEQUENTIAL = 1,
+        /** Without readahead (e.g., small ranges of a large file) */
+        SFD_ACCESS_RANDOM = 2,
+        /** The whole range is read into the page cache up front */
+        SFD_ACCESS_WILLNEED = 3,
+        /**
+           Front to back, once (e.g., a large download unlikely to be
+           repeated soon): as SFD_ACCESS_SEQUENTIAL, but what has been sent is
+           dropped from the page cache, so as not to evict files which are
+           read often.
+        */
+        SFD_ACCESS_NOREUSE = 4
+    };
+
+    /**
+       Optional request parameters, for sfd_send_opts().
+
+       Zero-initialise, then set the members of interest.
+    */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+    struct sfd_req_opts {
+        /** Bitwise OR of zero or more values of enum sfd_req_flags */
+        int flags;
+        /**
+           The minimum number of bytes (or milliseconds, with
+           SFD_REQ_PROGRESS_MS) between transfer status notifications; zero
+           for the default behaviour.
+
+           By default, the server writes a transfer status notification
+           whenever the destination is full, which for a slow destination can
+           mean one per few kilobytes. With a non-zero interval, notifications
+           are coalesced, each reporting the number of bytes written since the
+           previous one.
+        */
+        unsigned progress_interval;
+        /** Opaque value echoed in the request's sfd_xfer_stats response (cf.
+            SFD_REQ_XFER_STATS) */
+        uint64_t cookie;
+        /** How the file is going to be read */
+        enum sfd_access_hint access_hint;
+    };
+#pragma GCC diagnostic pop
+
     /**
        Spawns a server process.
 
@@ -69,8 +199,11 @@ extern "C" {
        the server's UNIX socket file. Must begin with a '/'.
 
        @param maxfiles The maximum number of concurrent file transfers. When
-       this limit is reached the fact will be logged and new requests will be
-       rejected with a status code of <em>EMFILE (too many open files)</em>.
+       this limit is reached new requests wait (up to the server's admission
+       wait limit, which is 30 seconds unless set with sfd_spawn_opts()) for
+       running transfers to complete; up to @a maxfiles requests can wait, and
+       further requests will be rejected with a status code of <em>EMFILE (too
+       many open files)</em>.
 
        @param open_fd_timeout_ms The number of milliseconds after which files
        opened by sfd_open() and then abandoned will be closed.
@@ -91,6 +224,42 @@ extern "C" {
                     int maxfiles,
                     int open_fd_timeout_ms) SFD_API;
 
+    /**
+       Optional server parameters, for sfd_spawn_opts().
+
+       Zero-initialise, then set the members of interest; zero-valued members
+       leave the server's defaults in place.
+    */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+    struct sfd_srv_opts {
+        /** The number of milliseconds a request may wait for room for another
+            transfer before being rejected with ETIMEDOUT (default: 30000) */
+        int admission_wait_ms;
+        /** The number of milliseconds after which transfers which have made no
+            progress are aborted with ETIMEDOUT (default: 0, i.e., never) */
+        int idle_timeout_ms;
+        /** The minimum transfer rate, in bytes per second, over an idle
+            timeout period, below which transfers are aborted with ETIMEDOUT.
+            Requires @a idle_timeout_ms. (default: 0, i.e., none) */
+        long min_rate;
+    };
+#pragma GCC diagnostic pop
+
+    /**
+       Spawns a server process with optional parameters.
+
+       Identical to sfd_spawn() apart from @a opts, which may be @a NULL.
+
+       @sa sfd_spawn()
+    */
+    pid_t sfd_spawn_opts(const char* server_name,
+                         const char* root_dir,
+                         const char* sockdir,
+                         int maxfiles,
+                         int open_fd_timeout_ms,
+                         const struct sfd_srv_opts* opts) SFD_API;
+
     /**
        Connects to a server process.
 
@@ -204,6 +373,73 @@ extern "C" {
                  off_t offset, size_t len,
                  bool stat_fd_nonblock) SFD_API;
 
+    /**
+       Same as sfd_send(), with the addition of request flags.
+
+       @param flags Bitwise OR of zero or more values of enum sfd_req_flags
+
+       @sa sfd_send()
+    */
+    int sfd_send_ex(int srv_sockfd,
+                    const char* path,
+                    int destination_fd,
+                    off_t offset, size_t len,
+                    bool stat_fd_nonblock,
+                    int flags) SFD_API;
+
+    /**
+       Same as sfd_send(), with optional request parameters.
+
+       @param opts The request parameters
+
+       @sa sfd_send()
+    */
+    int sfd_send_opts(int srv_sockfd,
+                      const char* path,
+                      int destination_fd,
+                      off_t offset, size_t len,
+                      bool stat_fd_nonblock,
+                      const struct sfd_req_opts* opts) SFD_API;
+
+    /**
+       Requests the server to send a file to an open file descriptor without a
+       status channel ('fire and forget').
+
+       Only @a destination_fd is passed to the server, which never writes any
+       metadata or status to it. If the request is rejected or the transfer
+       fails, the server closes its copy of @a destination_fd, so that the peer
+       (e.g., of a socket) sees the data stream end early if the caller has
+       closed its own copy too.
+
+       Unlike other transfers, which are cancelled when the process which
+       requested them exits, the transfer carries on after the caller has
+       exited.
+
+       @param srv_sockfd A socket connected to the server
+
+       @param path Path to the file
+
+       @param destination_fd The descriptor to which the file data is to be
+       written
+
+       @param offset The starting file offset. May be @a zero, in which case the
+       file will be read from the beginning.
+
+       @param len The number of bytes, starting from @a offset, to be read from
+       the file. May be @a zero, in which case the file will be read all the way
+       to its end.
+
+       @retval true The request was sent to the server
+
+       @retval false An error occurred--check @c errno(3)
+
+       @sa sfd_send()
+    */
+    bool sfd_send_nostat(int srv_sockfd,
+                         const char* path,
+                         int destination_fd,
+                         off_t offset, size_t len) SFD_API;
+
     /**
        Requests the server to open and return metadata about a file (leaving it
        open for a configurable period).
@@ -241,6 +477,21 @@ extern "C" {
                  off_t offset, size_t len,
                  bool stat_fd_nonblock) SFD_API;
 
+    /**
+       Same as sfd_open(), with the addition of request flags.
+
+       The flags apply to the subsequent sfd_send_open() request.
+
+       @param flags Bitwise OR of zero or more values of enum sfd_req_flags
+
+       @sa sfd_open()
+    */
+    int sfd_open_ex(int srv_sockfd,
+                    const char* path,
+                    off_t offset, size_t len,
+                    bool stat_fd_nonblock,
+                    int flags) SFD_API;
+
     /**
        Request the server to send a previously-opened file to an open file
        descriptor.
@@ -266,6 +517,148 @@ extern "C" {
                        size_t txnid,
                        int destination_fd) SFD_API;
 
+    /**
+       Requests the server to open a file handle from which ranges of a file can
+       be sent any number of times (cf. sfd_send_range()).
+
+       The server responds with a message of type sfd_open_file_info, whose
+       transaction ID identifies the handle. Unlike a file opened by sfd_open(),
+       a handle is not consumed by a send; it stays open until it is closed by
+       sfd_close_handle() or has not been used for the open file timeout (cf.
+       sfd_spawn()), in which case an ETIMEDOUT transfer status is written to
+       the returned descriptor.
+
+       @param srv_sockfd A socket connected to the server
+
+       @param path Path to the file
+
+       @param stat_fd_nonblock Whether or not the returned file descriptor (the
+       handle's status channel) should be in non-blocking mode
+
+       @retval >0 A new file descriptor from which the file metadata is to be
+       read; closed by the server when the handle is closed
+
+       @retval -1 An error occurred--check @c errno(3)
+
+       @sa sfd_send_range(), sfd_close_handle()
+    */
+    int sfd_open_handle(int srv_sockfd,
+                        const char* path,
+                        bool stat_fd_nonblock) SFD_API;
+
+    /**
+       Requests the server to send a range of a file handle's file to an open
+       file descriptor, leaving the handle open.
+
+       The server responds as it does to sfd_send(), with the file size
+       information being the range's size. Ranged sends of the same handle may
+       run concurrently and carry on after the handle has been closed.
+
+       @param srv_sockfd A socket connected to the server
+
+       @param handle The file handle (the transaction ID read from the
+       descriptor returned by sfd_open_handle())
+
+       @param destination_fd The descriptor to which the file data is to be
+       written
+
+       @param offset The starting file offset
+
+       @param len The number of bytes, starting from @a offset, to be sent. May
+       be @a zero, in which case the file will be sent all the way to its end.
+
+       @param stat_fd_nonblock Whether or not the returned file descriptor (the
+       status channel) should be in non-blocking mode
+
+       @param flags Bitwise OR of zero or more values of enum sfd_req_flags
+
+       @retval >0 A new file descriptor from which the range's metadata and
+       transfer status updates are to be read (the status channel)
+
+       @retval -1 An error occurred--check @c errno(3)
+
+       @sa sfd_open_handle(), sfd_send_range_opts()
+    */
+    int sfd_send_range(int srv_sockfd,
+                       size_t handle,
+                       int destination_fd,
+                       off_t offset, size_t len,
+                       bool stat_fd_nonblock,
+                       int flags) SFD_API;
+
+    /**
+       Same as sfd_send_range(), with optional request parameters.
+
+       @param opts The request parameters; may be NULL. Ranged sends share
+       their handle's open file description, to which an access hint would
+       apply, so @a opts->access_hint is ignored.
+
+       @sa sfd_send_range()
+    */
+    int sfd_send_range_opts(int srv_sockfd,
+                            size_t handle,
+                            int destination_fd,
+                            off_t offset, size_t len,
+                            bool stat_fd_nonblock,
+                            const struct sfd_req_opts* opts) SFD_API;
+
+    /**
+       Closes a file handle opened by sfd_open_handle().
+
+       Ranged sends which are still running are not affected.
+
+       @param srv_sockfd A socket connected to the server
+
+       @param handle The file handle
+
+       @retval true The request was sent
+       @retval false An error occurred--check @c errno(3)
+    */
+    bool sfd_close_handle(int srv_sockfd, size_t handle) SFD_API;
+
+    /**
+       Requests the server to move data from an open, non-seekable file
+       descriptor (e.g., a socket or pipe) to another one ('pump').
+
+       The server responds as it does to sfd_send(), with the file size
+       information being @a len. The transfer is scheduled, rate-limited and
+       reported on like any other; it times out if the source does not yield
+       data for as long as a stalled send would.
+
+       @note The server puts its copy of @a source_fd--and thereby the caller's,
+       which shares its file status flags--into non-blocking mode for as long as
+       the pump runs, so the caller should not read from it meanwhile. The
+       original mode is restored once the pump has ended, before its
+       destination and status channel are closed.
+
+       @param srv_sockfd A socket connected to the server
+
+       @param source_fd The descriptor from which data is to be read. Regular
+       files are rejected (EINVAL); they are sent with sfd_send().
+
+       @param destination_fd The descriptor to which the data is to be written
+
+       @param len The number of bytes to move. May be @a zero, in which case
+       data is moved until @a source_fd reaches end-of-file. Otherwise, reaching
+       end-of-file early fails the transfer with EPIPE.
+
+       @param stat_fd_nonblock Whether or not the returned file descriptor (the
+       status channel) should be in non-blocking mode
+
+       @param opts Optional request parameters; may be NULL
+
+       @retval >0 A new file descriptor from which the transfer's metadata and
+       status updates are to be read (the status channel)
+
+       @retval -1 An error occurred--check @c errno(3)
+    */
+    int sfd_pump(int srv_sockfd,
+                 int source_fd,
+                 int destination_fd,
+                 size_t len,
+                 bool stat_fd_nonblock,
+                 const struct sfd_req_opts* opts) SFD_API;
+
     /**
        Causes the server to cancel a transfer.
 
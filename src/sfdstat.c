@@ -0,0 +1,228 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   @file
+
+   Displays a running server instance's statistics.
+
+   Samples the statistics segment published by the server (cf.
+   sfd_stats_map()); the server itself is not involved.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "impl/errors.h"
+
+#include "stats.h"
+
+static void print_usage(void);
+static long opt_strtol(const char*);
+static void print_stats(const struct sfd_stats* cur,
+                        const struct sfd_stats* prev,
+                        double interval_secs);
+
+int main(const int argc, char** argv)
+{
+    const char* srvname = NULL;
+    long interval_secs = 0;
+    long count = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:i:c:h")) != -1) {
+        switch (opt) {
+        case 's':
+            srvname = optarg;
+            break;
+
+        case 'i':
+            interval_secs = opt_strtol(optarg);
+            break;
+
+        case 'c':
+            count = opt_strtol(optarg);
+            break;
+
+        default:
+            print_usage();
+            return (opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (!srvname || interval_secs < 0 || (count < 1 && count != -1)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    const struct sfd_stats* const stats = sfd_stats_map(srvname);
+    if (!stats) {
+        LOGERRNOV("Couldn't map statistics of server '%s'\n", srvname);
+        return EXIT_FAILURE;
+    }
+
+    struct sfd_stats prev;
+    memcpy(&prev, stats, sizeof(prev));
+
+    print_stats(&prev, NULL, 0);
+
+    if (interval_secs > 0) {
+        for (long i = 1; count == -1 || i < count; i++) {
+            sleep((unsigned)interval_secs);
+
+            struct sfd_stats cur;
+            memcpy(&cur, stats, sizeof(cur));
+
+            printf("\n");
+            print_stats(&cur, &prev, (double)interval_secs);
+
+            prev = cur;
+        }
+    }
+
+    sfd_stats_unmap(stats);
+
+    return EXIT_SUCCESS;
+}
+
+static void print_usage(void)
+{
+    printf("Usage: sfdstat OPTION\n"
+           "\nOptions:\n"
+           "-s <server_name> (the server instance)\n"
+           "[-i <secs>] (redisplay every <secs> seconds, with rates)\n"
+           "[-c <count>] (number of times to display; default: unlimited)\n");
+}
+
+static long opt_strtol(const char* s)
+{
+    errno = 0;
+    char* end;
+    const long l = strtol(s, &end, 10);
+
+    if (errno != 0 || *end != '\0' || l == LONG_MIN || l == LONG_MAX)
+        return -1;
+
+    return l;
+}
+
+/** Prints a counter and, if there is a previous sample, its rate */
+static void print_counter(const char* name,
+                          const uint64_t cur, const uint64_t* prev,
+                          const double interval_secs)
+{
+    if (prev) {
+        printf("  %-20s %20llu %14.1f/s\n",
+               name, (unsigned long long)cur,
+               (double)(cur - *prev) / interval_secs);
+    } else {
+        printf("  %-20s %20llu\n", name, (unsigned long long)cur);
+    }
+}
+
+static void print_hist(const char* name, const struct sfd_stats_hist* h)
+{
+    printf("  %-20s n=%llu mean=%.1f p50<=%llu p99<=%llu p999<=%llu (us)\n",
+           name,
+           (unsigned long long)h->count,
+           (h->count > 0 ? (double)h->sum_us / (double)h->count : 0.0),
+           (unsigned long long)sfd_stats_hist_percentile(h, 0.5),
+           (unsigned long long)sfd_stats_hist_percentile(h, 0.99),
+           (unsigned long long)sfd_stats_hist_percentile(h, 0.999));
+}
+
+#define COUNTER(field)                                              \
+    print_counter(#field, cur->field, (prev ? &prev->field : NULL), \
+                  interval_secs)
+
+#define GAUGE(field)                                                \
+    printf("  %-20s %20llu\n", #field, (unsigned long long)cur->field)
+
+static void print_stats(const struct sfd_stats* cur,
+                        const struct sfd_stats* prev,
+                        const double interval_secs)
+{
+    const time_t start_time = (time_t)cur->start_time;
+    char started[32];
+    strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S",
+             localtime(&start_time));
+
+    printf("pid %lld; started %s\n", (long long)cur->pid, started);
+
+    printf("Gauges:\n");
+    GAUGE(active_reads);
+    GAUGE(active_sends);
+    GAUGE(active_pumps);
+    GAUGE(open_files);
+    GAUGE(deferred_xfers);
+    GAUGE(queued_requests);
+    GAUGE(xfer_slots);
+    GAUGE(footprint);
+
+    printf("Requests:\n");
+    COUNTER(requests);
+    COUNTER(requests_queued);
+    COUNTER(rejected_emfile);
+    COUNTER(rejected_timeout);
+    COUNTER(rejected_erange);
+    COUNTER(rejected_other);
+
+    printf("Transfers:\n");
+    COUNTER(xfers_completed);
+    COUNTER(xfers_failed);
+    COUNTER(xfers_cancelled);
+    COUNTER(xfers_reclaimed);
+    COUNTER(bytes_sent);
+    COUNTER(writes);
+    COUNTER(writes_eagain);
+    COUNTER(progress_notifications);
+    COUNTER(xfers_pipelined);
+    COUNTER(fanout_joins);
+    COUNTER(fanout_stragglers);
+    COUNTER(copy_segments);
+    COUNTER(direct_xfers);
+    COUNTER(deferrals);
+
+    printf("Timers:\n");
+    COUNTER(timer_expiries);
+    COUNTER(open_file_timeouts);
+    COUNTER(xfer_timeouts);
+
+    printf("Open file lookups:\n");
+    COUNTER(open_file_hits);
+    COUNTER(open_file_misses);
+
+    printf("Latency:\n");
+    print_hist("ttfb", &cur->ttfb);
+    print_hist("duration", &cur->duration);
+}
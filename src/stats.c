@@ -0,0 +1,123 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <limits.h>
+#include <stdio.h>
+
+#include <sfd_config.h>
+
+#include "impl/metrics.h"
+#include "impl/util.h"
+
+#include "stats.h"
+
+const struct sfd_stats* sfd_stats_map(const char* srvname)
+{
+    char name[NAME_MAX + 1];
+
+    if (stats_shm_name(name, sizeof(name), srvname) == -1)
+        return NULL;
+
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        goto fail;
+
+    if ((size_t)st.st_size < sizeof(struct sfd_stats)) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    const struct sfd_stats* const stats = mmap(NULL, sizeof(*stats),
+                                               PROT_READ, MAP_SHARED,
+                                               fd, 0);
+    if (stats == MAP_FAILED)
+        goto fail;
+
+    close(fd);
+
+    if (stats->magic != SFD_STATS_MAGIC ||
+        stats->version != SFD_STATS_VERSION) {
+        munmap((void*)stats, sizeof(*stats));
+        errno = EPROTO;
+        return NULL;
+    }
+
+    return stats;
+
+ fail:
+    PRESERVE_ERRNO(close(fd));
+
+    return NULL;
+}
+
+void sfd_stats_unmap(const struct sfd_stats* stats)
+{
+    if (stats)
+        munmap((void*)stats, sizeof(*stats));
+}
+
+uint64_t sfd_stats_hist_percentile(const struct sfd_stats_hist* h,
+                                   const double p)
+{
+    const uint64_t count = h->count;
+    if (count == 0)
+        return 0;
+
+    const uint64_t rank = (uint64_t)(p * (double)count);
+    uint64_t nseen = 0;
+
+    for (unsigned i = 0; i < SFD_STATS_HIST_NBUCKETS; i++) {
+        nseen += h->buckets[i];
+        if (nseen > rank)
+            return ((uint64_t)2 << i) - 1;
+    }
+
+    return ((uint64_t)2 << (SFD_STATS_HIST_NBUCKETS - 1)) - 1;
+}
+
+int stats_shm_name(char* buf, const size_t size, const char* srvname)
+{
+    const int len = snprintf(buf, size, "/%s.%s", SFD_PROGNAME, srvname);
+
+    if (len < 0 || (size_t)len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return len;
+}
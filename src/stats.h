@@ -0,0 +1,244 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   @file
+
+   Server statistics.
+
+   A server publishes its statistics in a read-only shared-memory segment which
+   client applications (and the @c sfdstat tool) can map and sample at any time
+   without involving the server.
+
+   @ingroup mod_client
+*/
+
+#ifndef SFD_STATS_H
+#define SFD_STATS_H
+
+#include <stdint.h>
+
+#include "attr.h"
+
+/**
+   @addtogroup mod_client
+   @{
+*/
+
+/** Identifies a statistics segment */
+#define SFD_STATS_MAGIC 0x53464453U   /* 'SFDS' */
+
+/** Incremented whenever the layout of struct sfd_stats changes */
+#define SFD_STATS_VERSION 11
+
+/**
+   The number of buckets in a histogram.
+
+   Bucket @c i counts samples of between 2^i and 2^(i+1) - 1 microseconds; the
+   first bucket also counts samples of less than 1 microsecond and the last
+   one all samples too large for the other buckets.
+*/
+#define SFD_STATS_HIST_NBUCKETS 32
+
+/**
+   A histogram with logarithmically-sized (base 2) buckets.
+*/
+struct sfd_stats_hist {
+    /** Sample counts, by magnitude */
+    uint64_t buckets[SFD_STATS_HIST_NBUCKETS];
+    /** Total number of samples */
+    uint64_t count;
+    /** Sum of all samples, in microseconds */
+    uint64_t sum_us;
+};
+
+/**
+   Server statistics.
+
+   All fields are updated by the server only. Counters are monotonically
+   increasing; gauges reflect current values. Individual fields are always
+   consistent, but a snapshot of the whole structure is not atomic.
+*/
+struct sfd_stats {
+    /** SFD_STATS_MAGIC */
+    uint32_t magic;
+    /** SFD_STATS_VERSION */
+    uint32_t version;
+    /** Size of this structure, in bytes */
+    uint64_t size;
+    /** The server's process ID */
+    int64_t pid;
+    /** The server's start time (seconds since the Epoch) */
+    int64_t start_time;
+
+    /** @name Gauges
+        @{ */
+    /** Read File transfers in progress */
+    uint64_t active_reads;
+    /** Send File and Send Open File transfers in progress */
+    uint64_t active_sends;
+    /** Pumps (descriptor-to-descriptor transfers) in progress */
+    uint64_t active_pumps;
+    /** Files opened by Open File requests which are awaiting a Send Open File
+        request */
+    uint64_t open_files;
+    /** Transfers currently deferred to secondary processing */
+    uint64_t deferred_xfers;
+    /** Requests waiting in the admission queue for room in the transfer
+        table */
+    uint64_t queued_requests;
+    /** Slots in the transfer table, which grows and shrinks with demand (up
+        to the server's maximum number of files) */
+    uint64_t xfer_slots;
+    /** Bytes of memory used by the transfer tables, admission queue and
+        poller, excluding the transfers themselves */
+    uint64_t footprint;
+    /** @} */
+
+    /** @name Requests
+        @{ */
+    /** Requests received (all commands) */
+    uint64_t requests;
+    /** Requests which had to wait in the admission queue */
+    uint64_t requests_queued;
+    /** Requests rejected because both the transfer table and the admission
+        queue were full (EMFILE) */
+    uint64_t rejected_emfile;
+    /** Requests rejected because they waited in the admission queue for
+        longer than the open file timeout (ETIMEDOUT) */
+    uint64_t rejected_timeout;
+    /** Requests rejected because of an invalid file range (ERANGE) */
+    uint64_t rejected_erange;
+    /** Requests rejected for any other reason */
+    uint64_t rejected_other;
+    /** @} */
+
+    /** @name Transfers
+        @{ */
+    /** Transfers which completed successfully */
+    uint64_t xfers_completed;
+    /** Transfers aborted due to I/O errors */
+    uint64_t xfers_failed;
+    /** Transfers cancelled by clients or by the server */
+    uint64_t xfers_cancelled;
+    /** Transfers (including open files) cancelled because their client
+        processes exited */
+    uint64_t xfers_reclaimed;
+    /** Total number of file data bytes written */
+    uint64_t bytes_sent;
+    /** Calls made to transfer file data (splice(2), sendfile(2), etc.) */
+    uint64_t writes;
+    /** Calls which failed with EAGAIN (i.e., destination full) */
+    uint64_t writes_eagain;
+    /** Transfer status (progress) notifications written to status channels */
+    uint64_t progress_notifications;
+    /** Transfers which had to wait for a pipelined transfer to the same
+        destination to complete */
+    uint64_t xfers_pipelined;
+    /** Send File transfers which joined a fan-out group, i.e., which share the
+        reading of their file with an earlier one */
+    uint64_t fanout_joins;
+    /** Members of fan-out groups which fell behind and carried on by
+        themselves */
+    uint64_t fanout_stragglers;
+    /** Segments of parallel copies (cf. SFD_REQ_PARALLEL) which have been
+        copied */
+    uint64_t copy_segments;
+    /** Sends whose files have been read with direct I/O (cf.
+        SFD_REQ_DIRECT) */
+    uint64_t direct_xfers;
+    /** Number of times transfers were deferred to secondary processing in
+        order to avoid starving other transfers */
+    uint64_t deferrals;
+    /** @} */
+
+    /** @name Timers
+        @{ */
+    /** Open file timers which expired */
+    uint64_t timer_expiries;
+    /** Open files closed because their timers expired before the transfer
+        was started */
+    uint64_t open_file_timeouts;
+    /** Transfers cancelled because they made too little progress within an
+        idle timeout period */
+    uint64_t xfer_timeouts;
+    /** @} */
+
+    /** @name Open file lookups
+        Lookups of previously-opened files (Send Open File, Cancel).
+        @{ */
+    uint64_t open_file_hits;
+    uint64_t open_file_misses;
+    /** @} */
+
+    /** Time from receipt of a transfer's request (or of its Send Open File
+        request) to the writing of its first byte */
+    struct sfd_stats_hist ttfb;
+    /** Time from receipt of a transfer's request (or of its Send Open File
+        request) to its completion */
+    struct sfd_stats_hist duration;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+       Maps a server instance's statistics into memory (read-only).
+
+       @param server_name The server instance name (cf. sfd_spawn())
+
+       @retval NULL The segment does not exist or could not be mapped--check @c
+       errno(3)
+
+       @sa sfd_stats_unmap()
+    */
+    const struct sfd_stats* sfd_stats_map(const char* server_name) SFD_API;
+
+    /**
+       Unmaps statistics mapped by sfd_stats_map().
+    */
+    void sfd_stats_unmap(const struct sfd_stats*) SFD_API;
+
+    /**
+       Returns the value below which the specified fraction of a histogram's
+       samples lie, in microseconds.
+
+       The value is an upper bound, i.e., the upper limit of the bucket in which
+       the percentile falls.
+
+       @param p The percentile, in the range [0.0, 1.0]
+    */
+    uint64_t sfd_stats_hist_percentile(const struct sfd_stats_hist*,
+                                       double p) SFD_API;
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
+
+#endif
@@ -0,0 +1,172 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <errno.h>
+
+#include <numeric>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../impl/copy_pool.h"
+#include "../impl/test_utils.hpp"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wglobal-constructors"
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#pragma GCC diagnostic ignored "-Wpadded"
+
+namespace {
+
+constexpr size_t SEG_SIZE {64 * 1024};
+constexpr size_t NSEGS {8};
+
+struct CopyPoolFix : public ::testing::Test {
+    CopyPoolFix() :
+        data(SEG_SIZE * NSEGS),
+        segs(NSEGS) {
+        std::iota(data.begin(), data.end(), uint8_t{0});
+
+        if (write(src, data.data(), data.size()) != ssize_t(data.size()))
+            throw std::runtime_error("Couldn't write file");
+        src.close();
+        dest.close();
+
+        in.reset(open(src.name().c_str(), O_RDONLY));
+        out.reset(open(dest.name().c_str(), O_WRONLY));
+        if (!in || !out)
+            throw std::runtime_error("Couldn't open files");
+
+        for (size_t i = 0; i < NSEGS; i++) {
+            copy_seg& seg {segs[i]};
+            seg.fd_in = in;
+            seg.fd_out = out;
+            seg.offset = off_t(i * SEG_SIZE);
+            seg.dest_offset = seg.offset;
+            seg.zeroed_from = 0;
+            seg.len = SEG_SIZE;
+            seg.owner = this;
+            seg.err = -1;
+            seg.ncalls = 0;
+            seg.next = nullptr;
+        }
+    }
+
+    // Reaps segments until as many as were submitted have been returned
+    std::vector<copy_seg*> reap_all(copy_pool* pool, const size_t n) {
+        std::vector<copy_seg*> reaped;
+
+        while (reaped.size() < n) {
+            struct pollfd pfd {copy_pool_fd(pool), POLLIN, 0};
+            if (poll(&pfd, 1, 5000) != 1)
+                throw std::runtime_error("Segments not reaped in time");
+
+            copy_seg* seg;
+            while ((seg = copy_pool_reap(pool)))
+                reaped.push_back(seg);
+        }
+
+        return reaped;
+    }
+
+    std::vector<uint8_t> read_dest() {
+        std::vector<uint8_t> buf(data.size() + 1);
+        const test::unique_fd fd {open(dest.name().c_str(), O_RDONLY)};
+        const ssize_t n {read(fd, buf.data(), buf.size())};
+        buf.resize(n < 0 ? 0 : size_t(n));
+        return buf;
+    }
+
+    std::vector<uint8_t> data;
+    std::vector<copy_seg> segs;
+    test::TmpFile src;
+    test::TmpFile dest;
+    test::unique_fd in;
+    test::unique_fd out;
+};
+
+} // namespace
+
+TEST_F(CopyPoolFix, copy_segments)
+{
+    copy_pool* pool {copy_pool_new(3)};
+    ASSERT_NE(nullptr, pool);
+
+    for (copy_seg& seg : segs)
+        copy_pool_submit(pool, &seg);
+
+    const std::vector<copy_seg*> reaped {reap_all(pool, NSEGS)};
+    EXPECT_EQ(NSEGS, reaped.size());
+
+    for (const copy_seg* seg : reaped) {
+        EXPECT_EQ(0, seg->err);
+        EXPECT_GE(seg->ncalls, 1U);
+    }
+
+    EXPECT_EQ(nullptr, copy_pool_reap(pool));
+
+    copy_pool_delete(pool);
+
+    EXPECT_EQ(data, read_dest());
+}
+
+// Cancelled segments are returned, too; those which did get copied are intact
+TEST_F(CopyPoolFix, cancel)
+{
+    copy_pool* pool {copy_pool_new(1)};
+    ASSERT_NE(nullptr, pool);
+
+    for (copy_seg& seg : segs)
+        copy_pool_submit(pool, &seg);
+
+    copy_pool_cancel(pool, this);
+
+    const std::vector<copy_seg*> reaped {reap_all(pool, NSEGS)};
+    EXPECT_EQ(NSEGS, reaped.size());
+
+    copy_pool_wait(pool);
+    copy_pool_delete(pool);
+
+    const std::vector<uint8_t> copied {read_dest()};
+
+    for (const copy_seg* seg : reaped) {
+        if (seg->err == ECANCELED)
+            continue;
+
+        ASSERT_EQ(0, seg->err);
+        ASSERT_GE(copied.size(), size_t(seg->dest_offset) + seg->len);
+        EXPECT_TRUE(std::equal(data.begin() + seg->offset,
+                               data.begin() + seg->offset + off_t(seg->len),
+                               copied.begin() + seg->dest_offset));
+    }
+}
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,195 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "../impl/log.h"
+
+namespace {
+
+unsigned long nsuppressed()
+{
+    struct sfd_log_counters c;
+    sfd_log_get_counters(&c);
+    return c.nsuppressed;
+}
+
+} // namespace
+
+TEST(Log, rate_limit)
+{
+    constexpr unsigned long N {200};
+
+    const unsigned long before {nsuppressed()};
+
+    for (unsigned long i = 0; i < N; i++)
+        sfd_log(LOG_DEBUG, "rate_limit test message %lu\n", i);
+
+    // Allow for the burst window being restarted once during the loop
+    const unsigned long n {nsuppressed() - before};
+    EXPECT_LE(n, N - SFD_LOG_BURST);
+    EXPECT_GE(n, N - 2 * SFD_LOG_BURST);
+}
+
+TEST(Log, level)
+{
+    const int orig_level {sfd_log_level()};
+
+    sfd_log_set_level(LOG_ERR);
+    EXPECT_EQ(LOG_ERR, sfd_log_level());
+
+    // Discarded before reaching the rate limiter
+    const unsigned long before {nsuppressed()};
+    for (int i = 0; i < 2 * SFD_LOG_BURST; i++)
+        sfd_log(LOG_INFO, "level test message\n");
+    EXPECT_EQ(before, nsuppressed());
+
+    sfd_log_set_level(LOG_DEBUG + 1);
+    EXPECT_EQ(LOG_DEBUG, sfd_log_level());
+
+    sfd_log_set_level(orig_level);
+}
+
+TEST(Log, preserves_errno)
+{
+    errno = EIO;
+    sfd_log(LOG_DEBUG, "preserves_errno test message [%m]\n");
+    EXPECT_EQ(EIO, errno);
+}
+
+namespace {
+
+// Number of lines in @a text which contain @a what, not counting summaries of
+// suppressed messages
+size_t count_lines(const std::string& text, const std::string& what)
+{
+    std::istringstream in {text};
+    std::string line;
+    size_t n {0};
+
+    while (std::getline(in, line)) {
+        if (line.find(what) != std::string::npos &&
+            line.find("suppressed") == std::string::npos) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+} // namespace
+
+TEST(Log, async)
+{
+    constexpr unsigned long N {1000};
+    constexpr size_t NFMTS {256};
+    constexpr unsigned long NREPEATS {4};
+
+    sigset_t orig_sigmask;
+    ASSERT_EQ(0, pthread_sigmask(SIG_SETMASK, nullptr, &orig_sigmask));
+
+    // Messages are also written to stderr, which is captured in a file
+    FILE* const out {tmpfile()};
+    ASSERT_NE(nullptr, out);
+    const int orig_stderr {dup(STDERR_FILENO)};
+    ASSERT_NE(-1, orig_stderr);
+    ASSERT_NE(-1, dup2(fileno(out), STDERR_FILENO));
+
+    sfd_log_open("test_log", LOG_PERROR, LOG_USER);
+
+    struct sfd_log_counters before;
+    sfd_log_get_counters(&before);
+
+    ASSERT_TRUE(sfd_log_start_async());
+
+    errno = EIO;
+    for (unsigned long i = 0; i < N; i++)
+        sfd_log(LOG_DEBUG, "async test message %lu [%m]\n", i);
+    EXPECT_EQ(EIO, errno);
+
+    // Too many call sites to be rate-limited, each logging fewer messages than
+    // a burst, faster than the flusher drains the ring
+    std::vector<std::string> fmts;
+    for (size_t i = 0; i < NFMTS; i++)
+        fmts.push_back("overflow test message " + std::to_string(i) + "\n");
+
+    for (unsigned long i = 0; i < NREPEATS; i++) {
+        for (const std::string& fmt : fmts) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+            sfd_log(LOG_DEBUG, fmt.c_str());
+#pragma GCC diagnostic pop
+        }
+    }
+
+    // Joins the flusher thread once the ring has been drained
+    sfd_log_close();
+
+    struct sfd_log_counters after;
+    sfd_log_get_counters(&after);
+
+    // Synchronous again
+    sfd_log(LOG_DEBUG, "async test message after close\n");
+
+    dup2(orig_stderr, STDERR_FILENO);
+    close(orig_stderr);
+    sfd_log_open("test_log", 0, LOG_USER);
+    sfd_log_close();
+
+    ASSERT_EQ(0, pthread_sigmask(SIG_SETMASK, &orig_sigmask, nullptr));
+
+    std::string text;
+    rewind(out);
+    char buf [4096];
+    size_t nread;
+    while ((nread = fread(buf, 1, sizeof(buf), out)) > 0)
+        text.append(buf, nread);
+    fclose(out);
+
+    const unsigned long nsuppressed {after.nsuppressed - before.nsuppressed};
+    const unsigned long ndropped {after.ndropped - before.ndropped};
+
+    EXPECT_GE(nsuppressed, N - 2 * SFD_LOG_BURST);
+    EXPECT_GT(ndropped, 0u);
+
+    // Everything which was neither suppressed nor dropped was written
+    EXPECT_EQ(N + NFMTS * NREPEATS - nsuppressed - ndropped,
+              count_lines(text, "async test message ") - 1 +
+              count_lines(text, "overflow test message "));
+    EXPECT_EQ(1u, count_lines(text, "async test message after close"));
+}
@@ -0,0 +1,62 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <gtest/gtest.h>
+
+#include "../impl/metrics.h"
+
+TEST(Metrics, hist_buckets)
+{
+    sfd_stats_hist h {};
+
+    metrics_hist_add(&h, 0);
+    metrics_hist_add(&h, 1);
+    metrics_hist_add(&h, 2);
+    metrics_hist_add(&h, 3);
+    metrics_hist_add(&h, 1000);
+    metrics_hist_add(&h, UINT64_MAX);
+
+    EXPECT_EQ(2, h.buckets[0]);
+    EXPECT_EQ(2, h.buckets[1]);
+    EXPECT_EQ(1, h.buckets[9]);     // 512-1023
+    EXPECT_EQ(1, h.buckets[SFD_STATS_HIST_NBUCKETS - 1]);
+    EXPECT_EQ(6, h.count);
+}
+
+TEST(Metrics, hist_percentile)
+{
+    sfd_stats_hist h {};
+
+    EXPECT_EQ(0, sfd_stats_hist_percentile(&h, 0.5));
+
+    for (int i = 0; i < 99; i++)
+        metrics_hist_add(&h, 100);  // 64-127
+    metrics_hist_add(&h, 5000);     // 4096-8191
+
+    EXPECT_EQ(127, sfd_stats_hist_percentile(&h, 0.5));
+    EXPECT_EQ(127, sfd_stats_hist_percentile(&h, 0.98));
+    EXPECT_EQ(8191, sfd_stats_hist_percentile(&h, 0.999));
+}
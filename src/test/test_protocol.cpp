@@ -70,6 +70,141 @@ TEST(Protocol, unmarshal_file_info)
     EXPECT_EQ(777, pdu2.txnid);
 }
 
+TEST(Protocol, unmarshal_xfer_stats)
+{
+    struct sfd_xfer_stats pdu1;
+    prot_marshal_xfer_stats(&pdu1, 111, 222, 333, 777, 444, 555, 666, 888);
+
+    struct sfd_xfer_stats pdu2;
+    ASSERT_TRUE(sfd_unmarshal_xfer_stats(&pdu2, &pdu1));
+
+    EXPECT_EQ(SFD_XFER_STATS, pdu2.cmd);
+    EXPECT_EQ(SFD_STAT_OK, pdu2.stat);
+    EXPECT_EQ(111, pdu2.size);
+    EXPECT_EQ(222, pdu2.duration_us);
+    EXPECT_EQ(333, pdu2.ttfb_us);
+    EXPECT_EQ(777, pdu2.queue_us);
+    EXPECT_EQ(444, pdu2.nwrites);
+    EXPECT_EQ(555, pdu2.nstalls);
+    EXPECT_EQ(666, pdu2.ndeferrals);
+    EXPECT_EQ(888, pdu2.cookie);
+
+    // A regular transfer completion notification is not a statistics PDU
+    struct sfd_xfer_stat stat;
+    prot_marshal_xfer_stat(&stat, PROT_XFER_COMPLETE);
+    EXPECT_FALSE(sfd_unmarshal_xfer_stats(&pdu2, &stat));
+}
+
+TEST(Protocol, v2_response_has_fixed_width_little_endian_fields)
+{
+    struct sfd_file_info pdu;
+    prot_marshal_file_info(&pdu, 0x0102, 0x0304, 0x0506, -2, 0x0708);
+
+    std::vector<uint8_t> buf(SFD_MAX_RESP_SIZE);
+    buf.resize(prot_marshal_response(buf.data(), &pdu, PROT_VERSION));
+
+    const std::vector<uint8_t> expected {
+        SFD_FILE_INFO, SFD_STAT_OK, PROT_VERSION, 0, 0, 0, 0, 0,
+        0x02, 0x01, 0, 0, 0, 0, 0, 0,                   // Size
+        0x04, 0x03, 0, 0, 0, 0, 0, 0,                   // atime
+        0x06, 0x05, 0, 0, 0, 0, 0, 0,                   // mtime
+        0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // ctime
+        0x08, 0x07, 0, 0, 0, 0, 0, 0                    // Transaction ID
+    };
+
+    EXPECT_EQ(expected, buf);
+    EXPECT_EQ(size_t(SFD_FILE_INFO_SIZE), buf.size());
+}
+
+TEST(Protocol, unmarshal_v2_responses)
+{
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+
+    struct sfd_file_info info1;
+    prot_marshal_file_info(&info1, 111, 222, 333, -444, 777);
+    EXPECT_EQ(SFD_FILE_INFO_SIZE,
+              prot_marshal_response(buf, &info1, PROT_VERSION));
+
+    struct sfd_file_info info2;
+    ASSERT_TRUE(sfd_unmarshal_file_info(&info2, buf));
+    EXPECT_EQ(SFD_FILE_INFO, info2.cmd);
+    EXPECT_EQ(SFD_STAT_OK, info2.stat);
+    EXPECT_EQ(111, info2.size);
+    EXPECT_EQ(222, info2.atime);
+    EXPECT_EQ(333, info2.mtime);
+    EXPECT_EQ(-444, info2.ctime);
+    EXPECT_EQ(777, info2.txnid);
+
+    struct sfd_xfer_stat stat1;
+    prot_marshal_xfer_stat(&stat1, PROT_XFER_COMPLETE);
+    EXPECT_EQ(SFD_XFER_STAT_SIZE,
+              prot_marshal_response(buf, &stat1, PROT_VERSION));
+
+    struct sfd_xfer_stat stat2;
+    ASSERT_TRUE(sfd_unmarshal_xfer_stat(&stat2, buf));
+    EXPECT_TRUE(sfd_xfer_complete(&stat2));
+
+    struct sfd_xfer_stats stats1;
+    prot_marshal_xfer_stats(&stats1, 111, 222, 333, 777, 444, 555, 666, 888);
+    EXPECT_EQ(SFD_XFER_STATS_SIZE,
+              prot_marshal_response(buf, &stats1, PROT_VERSION));
+
+    struct sfd_xfer_stats stats2;
+    ASSERT_TRUE(sfd_unmarshal_xfer_stats(&stats2, buf));
+    EXPECT_EQ(111, stats2.size);
+    EXPECT_EQ(222, stats2.duration_us);
+    EXPECT_EQ(333, stats2.ttfb_us);
+    EXPECT_EQ(777, stats2.queue_us);
+    EXPECT_EQ(444, stats2.nwrites);
+    EXPECT_EQ(555, stats2.nstalls);
+    EXPECT_EQ(666, stats2.ndeferrals);
+    EXPECT_EQ(888, stats2.cookie);
+
+    struct sfd_req_queued queued1;
+    prot_marshal_req_queued(&queued1, 3, 1000);
+    EXPECT_EQ(SFD_REQ_QUEUED_SIZE,
+              prot_marshal_response(buf, &queued1, PROT_VERSION));
+
+    struct sfd_req_queued queued2;
+    ASSERT_TRUE(sfd_unmarshal_req_queued(&queued2, buf));
+    EXPECT_EQ(3, queued2.position);
+    EXPECT_EQ(1000, queued2.max_wait_ms);
+
+    // Unknown version
+    buf[PROT_RESP_VERSION_OFFSET] = PROT_VERSION + 1;
+    EXPECT_FALSE(sfd_unmarshal_req_queued(&queued2, buf));
+}
+
+// Responses to version 1 requests are the structures, as they are in memory
+TEST(Protocol, v1_response_is_structure_layout)
+{
+    struct sfd_xfer_stats pdu;
+    prot_marshal_xfer_stats(&pdu, 111, 222, 333, 777, 444, 555, 666, 888);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    ASSERT_EQ(sizeof(pdu), prot_marshal_response(buf, &pdu, 1));
+    EXPECT_EQ(0, std::memcmp(buf, &pdu, sizeof(pdu)));
+    EXPECT_EQ(0, buf[PROT_RESP_VERSION_OFFSET]);
+}
+
+TEST(Protocol, marshal_send_flags)
+{
+    struct prot_request pdu;
+    ASSERT_TRUE(prot_marshal_send(&pdu, "abc", 0, 0));
+
+    // Flags are zeroed by default and survive the trip
+    EXPECT_EQ(0, pdu.flags);
+    pdu.flags = PROT_REQ_XFER_STATS;
+
+    uint8_t buf[PROT_REQ_MAXSIZE];
+    memcpy(buf, &pdu, PROT_REQ_BASE_SIZE);
+    memcpy(buf + PROT_REQ_BASE_SIZE, "abc", 4);
+
+    struct prot_request pdu2;
+    ASSERT_TRUE(prot_unmarshal_request(&pdu2, buf, PROT_REQ_BASE_SIZE + 4));
+    EXPECT_EQ(PROT_REQ_XFER_STATS, pdu2.flags);
+}
+
 TEST(Protocol, marshal_send)
 {
     const std::string fname {"abc"};
@@ -228,6 +363,208 @@ TEST(Protocol, unmarshal_send)
     EXPECT_EQ(fname, recvd_fname);
 }
 
+TEST(Protocol, get_request_flags)
+{
+    struct prot_request tmp;
+    ASSERT_TRUE(prot_marshal_send(&tmp, "abc", 0, 0));
+    tmp.flags = PROT_REQ_NO_STAT;
+
+    std::vector<uint8_t> buf(PROT_REQ_BASE_SIZE + tmp.filename_len + 1);
+    memcpy(buf.data(), &tmp, PROT_REQ_BASE_SIZE);
+    memcpy(buf.data() + PROT_REQ_BASE_SIZE, tmp.filename, tmp.filename_len);
+
+    EXPECT_EQ(PROT_REQ_NO_STAT, prot_get_req_flags(buf.data(), buf.size()));
+
+    // Truncated request
+    EXPECT_EQ(0, prot_get_req_flags(buf.data(), 2));
+
+    // Not a file operation request
+    struct prot_cancel cancel;
+    prot_marshal_cancel(&cancel, 1);
+    EXPECT_EQ(0, prot_get_req_flags(&cancel, sizeof(cancel)));
+}
+
+namespace {
+
+// Encodes a request in the version 2 wire format, as the client library does
+std::vector<uint8_t> marshal_v2(const struct prot_request& req)
+{
+    std::vector<uint8_t> buf(PROT_REQ_V2_HDR_MAXSIZE);
+    buf.resize(prot_marshal_request_hdr(buf.data(), &req));
+    buf.insert(buf.end(), req.filename, req.filename + req.filename_len + 1);
+    return buf;
+}
+
+} // namespace
+
+TEST(Protocol, v2_request_has_fixed_width_little_endian_fields)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_send(&req, "abc", 0x0102, 0x030405));
+    req.flags = PROT_REQ_XFER_STATS;
+    req.cookie = 0x060708090A0B0C0DULL;
+
+    const std::vector<uint8_t> buf {marshal_v2(req)};
+
+    const std::vector<uint8_t> expected {
+        PROT_CMD_SEND, SFD_STAT_OK, PROT_REQ_XFER_STATS, PROT_VERSION,
+        0, 0, 0, 0,                                     // No extensions
+        0x02, 0x01, 0, 0, 0, 0, 0, 0,                   // Offset
+        0x05, 0x04, 0x03, 0, 0, 0, 0, 0,                // Length
+        0x0D, 0x0C, 0x0B, 0x0A, 0x09, 0x08, 0x07, 0x06, // Cookie
+        'a', 'b', 'c', '\0'
+    };
+
+    EXPECT_EQ(expected, buf);
+}
+
+TEST(Protocol, unmarshal_v2_request)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_send(&req, "abc", 0xDEAD, 0xBEEF));
+    req.flags = PROT_REQ_PROGRESS_MS;
+    req.progress = 250;
+    req.cookie = 0xFEEDFACECAFEBEEFULL;
+
+    const std::vector<uint8_t> buf {marshal_v2(req)};
+
+    // The progress interval travels as an extension
+    EXPECT_EQ(PROT_REQ_V2_HDR_SIZE + 2 + 4 + 4, buf.size());
+
+    struct prot_request pdu;
+    ASSERT_TRUE(prot_unmarshal_request(&pdu, buf.data(), buf.size()));
+    EXPECT_EQ(PROT_CMD_SEND, pdu.cmd);
+    EXPECT_EQ(PROT_REQ_PROGRESS_MS, pdu.flags);
+    EXPECT_EQ(250u, pdu.progress);
+    EXPECT_EQ(0xDEAD, pdu.offset);
+    EXPECT_EQ(0xBEEF, pdu.len);
+    EXPECT_EQ(0xFEEDFACECAFEBEEFULL, pdu.cookie);
+    EXPECT_EQ(3u, pdu.filename_len);
+    EXPECT_STREQ("abc", pdu.filename);
+
+    // Not copied
+    EXPECT_EQ(reinterpret_cast<const char*>(buf.data()) + buf.size() - 4,
+              pdu.filename);
+
+    EXPECT_EQ(PROT_REQ_PROGRESS_MS, prot_get_req_flags(buf.data(), buf.size()));
+}
+
+TEST(Protocol, unmarshal_v2_request_ext_flags)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_send(&req, "abc", 0, 0));
+    req.flags = PROT_REQ_XFER_STATS;
+    req.ext_flags = PROT_REQX_DIRECT;
+
+    const std::vector<uint8_t> buf {marshal_v2(req)};
+
+    // The flags which do not fit into the flags byte travel as an extension
+    EXPECT_EQ(PROT_REQ_V2_HDR_SIZE + 2 + 4 + 4, buf.size());
+
+    struct prot_request pdu;
+    ASSERT_TRUE(prot_unmarshal_request(&pdu, buf.data(), buf.size()));
+    EXPECT_EQ(PROT_REQ_XFER_STATS, pdu.flags);
+    EXPECT_EQ(uint32_t(PROT_REQX_DIRECT), pdu.ext_flags);
+    EXPECT_EQ(0u, pdu.progress);
+    EXPECT_STREQ("abc", pdu.filename);
+}
+
+TEST(Protocol, unmarshal_v2_request_access_hint)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_send(&req, "abc", 0, 0));
+    req.access = PROT_ACCESS_NOREUSE;
+
+    const std::vector<uint8_t> buf {marshal_v2(req)};
+    EXPECT_EQ(PROT_REQ_V2_HDR_SIZE + 2 + 1 + 4, buf.size());
+
+    struct prot_request pdu;
+    ASSERT_TRUE(prot_unmarshal_request(&pdu, buf.data(), buf.size()));
+    EXPECT_EQ(PROT_ACCESS_NOREUSE, pdu.access);
+    EXPECT_EQ(0u, pdu.ext_flags);
+    EXPECT_STREQ("abc", pdu.filename);
+
+    // The default is not sent at all
+    req.access = PROT_ACCESS_NORMAL;
+    EXPECT_EQ(PROT_REQ_V2_HDR_SIZE + 4, marshal_v2(req).size());
+}
+
+TEST(Protocol, unmarshal_v2_request_skips_unknown_extensions)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_send(&req, "abc", 0, 0));
+
+    std::vector<uint8_t> buf {marshal_v2(req)};
+
+    const std::vector<uint8_t> ext {0xEE, 3, 1, 2, 3};
+    buf.insert(buf.begin() + PROT_REQ_V2_HDR_SIZE, ext.begin(), ext.end());
+    buf[4] = uint8_t(ext.size());
+
+    struct prot_request pdu;
+    ASSERT_TRUE(prot_unmarshal_request(&pdu, buf.data(), buf.size()));
+    EXPECT_STREQ("abc", pdu.filename);
+
+    // Extension running past the extension area
+    buf[PROT_REQ_V2_HDR_SIZE + 1] = 4;
+    EXPECT_FALSE(prot_unmarshal_request(&pdu, buf.data(), buf.size()));
+
+    // Extension area running past the filename
+    buf[PROT_REQ_V2_HDR_SIZE + 1] = 3;
+    buf[4] = 0xFF;
+    EXPECT_FALSE(prot_unmarshal_request(&pdu, buf.data(), buf.size()));
+}
+
+// Requests which need nothing newer are sent in the version 1 wire format,
+// which servers predating version 2 understand too
+TEST(Protocol, compat_request_falls_back_to_v1)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_send(&req, "abc", 0xDEAD, 0xBEEF));
+    req.flags = PROT_REQ_PROGRESS_MS;
+    req.progress = 250;
+
+    std::vector<uint8_t> buf(PROT_REQ_V2_HDR_MAXSIZE);
+    buf.resize(prot_marshal_request_hdr_compat(buf.data(), &req));
+    EXPECT_EQ(PROT_REQ_BASE_SIZE, buf.size());
+    EXPECT_EQ(0, buf[PROT_REQ_VERSION_OFFSET]);
+    buf.insert(buf.end(), req.filename, req.filename + req.filename_len + 1);
+
+    struct prot_request pdu;
+    ASSERT_TRUE(prot_unmarshal_request(&pdu, buf.data(), buf.size()));
+    EXPECT_EQ(PROT_CMD_SEND, pdu.cmd);
+    EXPECT_EQ(PROT_REQ_PROGRESS_MS, pdu.flags);
+    EXPECT_EQ(250u, pdu.progress);
+    EXPECT_EQ(0xDEAD, pdu.offset);
+    EXPECT_EQ(0xBEEF, pdu.len);
+    EXPECT_STREQ("abc", pdu.filename);
+
+    // Version 2 parameters need version 2
+    req.cookie = 1;
+    buf.resize(PROT_REQ_V2_HDR_MAXSIZE);
+    buf.resize(prot_marshal_request_hdr_compat(buf.data(), &req));
+    EXPECT_EQ(PROT_VERSION, buf[PROT_REQ_VERSION_OFFSET]);
+
+    req.cookie = 0;
+    req.access = PROT_ACCESS_RANDOM;
+    buf.resize(PROT_REQ_V2_HDR_MAXSIZE);
+    buf.resize(prot_marshal_request_hdr_compat(buf.data(), &req));
+    EXPECT_EQ(PROT_VERSION, buf[PROT_REQ_VERSION_OFFSET]);
+}
+
+TEST(Protocol, unmarshal_request_of_unsupported_version)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_send(&req, "abc", 0, 0));
+
+    std::vector<uint8_t> buf {marshal_v2(req)};
+    buf[PROT_REQ_VERSION_OFFSET] = PROT_VERSION + 1;
+
+    struct prot_request pdu;
+    errno = 0;
+    EXPECT_FALSE(prot_unmarshal_request(&pdu, buf.data(), buf.size()));
+    EXPECT_EQ(EPROTONOSUPPORT, errno);
+}
+
 TEST(Protocol, unmarshal_send_open_file)
 {
     struct prot_send_open tmp;
@@ -240,6 +577,114 @@ TEST(Protocol, unmarshal_send_open_file)
     EXPECT_EQ(0xDEADBEEF, pdu.txnid);
 }
 
+TEST(Protocol, send_range_has_fixed_width_little_endian_fields)
+{
+    std::vector<uint8_t> buf(PROT_SEND_RANGE_MAXSIZE);
+    buf.resize(prot_marshal_send_range(buf.data(), 0x0102, 0x0304, 0x0506,
+                                       PROT_REQ_XFER_STATS, 0,
+                                       0x060708090A0B0C0DULL));
+
+    const std::vector<uint8_t> expected {
+        PROT_CMD_SEND_RANGE, SFD_STAT_OK, PROT_REQ_XFER_STATS, PROT_VERSION,
+        0, 0, 0, 0,                                     // No extensions
+        0x02, 0x01, 0, 0, 0, 0, 0, 0,                   // Handle
+        0x04, 0x03, 0, 0, 0, 0, 0, 0,                   // Offset
+        0x06, 0x05, 0, 0, 0, 0, 0, 0,                   // Length
+        0x0D, 0x0C, 0x0B, 0x0A, 0x09, 0x08, 0x07, 0x06  // Cookie
+    };
+
+    EXPECT_EQ(expected, buf);
+}
+
+TEST(Protocol, unmarshal_send_range)
+{
+    uint8_t buf [PROT_SEND_RANGE_MAXSIZE];
+    size_t size = prot_marshal_send_range(buf, 0xDEADBEEF, 1000, 500,
+                                          PROT_REQ_XFER_STATS |
+                                          PROT_REQ_PROGRESS_MS,
+                                          250, 0xC0FFEE);
+
+    struct prot_send_range pdu;
+    ASSERT_TRUE(prot_unmarshal_send_range(&pdu, buf, size));
+    EXPECT_EQ(PROT_CMD_SEND_RANGE, pdu.cmd);
+    EXPECT_EQ(SFD_STAT_OK, pdu.stat);
+    EXPECT_EQ(PROT_REQ_XFER_STATS | PROT_REQ_PROGRESS_MS, pdu.flags);
+    EXPECT_EQ(250u, pdu.progress);
+    EXPECT_EQ(0xDEADBEEF, pdu.txnid);
+    EXPECT_EQ(1000, pdu.offset);
+    EXPECT_EQ(500, pdu.len);
+    EXPECT_EQ(0xC0FFEE, pdu.cookie);
+
+    // Truncated
+    EXPECT_FALSE(prot_unmarshal_send_range(&pdu, buf, size - 1));
+    EXPECT_FALSE(prot_unmarshal_send_range(&pdu, buf, PROT_SEND_RANGE_SIZE - 1));
+
+    // Unsupported version
+    buf[PROT_REQ_VERSION_OFFSET] = PROT_VERSION + 1;
+    errno = 0;
+    EXPECT_FALSE(prot_unmarshal_send_range(&pdu, buf, size));
+    EXPECT_EQ(EPROTONOSUPPORT, errno);
+
+    // Negative offset
+    size = prot_marshal_send_range(buf, 0xDEADBEEF, -1, 500, 0, 0, 0);
+    errno = 0;
+    EXPECT_FALSE(prot_unmarshal_send_range(&pdu, buf, size));
+    EXPECT_EQ(EINVAL, errno);
+
+    // Wrong command ID
+    prot_marshal_send_open(reinterpret_cast<struct prot_send_open*>(buf),
+                           0xDEADBEEF);
+    EXPECT_FALSE(prot_unmarshal_send_range(&pdu, buf, size));
+}
+
+TEST(Protocol, pump_has_fixed_width_little_endian_fields)
+{
+    std::vector<uint8_t> buf(PROT_PUMP_MAXSIZE);
+    buf.resize(prot_marshal_pump(buf.data(), 0x030405, PROT_REQ_PIPELINE,
+                                 0x0102, 0x060708090A0B0C0DULL));
+
+    const std::vector<uint8_t> expected {
+        PROT_CMD_PUMP, SFD_STAT_OK, PROT_REQ_PIPELINE, PROT_VERSION,
+        6, 0, 0, 0,                                     // Extension area length
+        0x05, 0x04, 0x03, 0, 0, 0, 0, 0,                // Length
+        0x0D, 0x0C, 0x0B, 0x0A, 0x09, 0x08, 0x07, 0x06, // Cookie
+        PROT_EXT_PROGRESS, 4, 0x02, 0x01, 0, 0
+    };
+
+    EXPECT_EQ(expected, buf);
+}
+
+TEST(Protocol, unmarshal_pump)
+{
+    uint8_t buf [PROT_PUMP_MAXSIZE];
+    const size_t size = prot_marshal_pump(buf, 4096, PROT_REQ_PIPELINE, 100,
+                                          0xC0FFEE);
+
+    struct prot_pump pdu;
+    ASSERT_TRUE(prot_unmarshal_pump(&pdu, buf, size));
+    EXPECT_EQ(PROT_CMD_PUMP, pdu.cmd);
+    EXPECT_EQ(SFD_STAT_OK, pdu.stat);
+    EXPECT_EQ(PROT_REQ_PIPELINE, pdu.flags);
+    EXPECT_EQ(100, pdu.progress);
+    EXPECT_EQ(4096, pdu.len);
+    EXPECT_EQ(0xC0FFEE, pdu.cookie);
+
+    // Truncated
+    EXPECT_FALSE(prot_unmarshal_pump(&pdu, buf, size - 1));
+    EXPECT_FALSE(prot_unmarshal_pump(&pdu, buf, PROT_PUMP_SIZE - 1));
+
+    // Unsupported version
+    buf[PROT_REQ_VERSION_OFFSET] = PROT_VERSION + 1;
+    errno = 0;
+    EXPECT_FALSE(prot_unmarshal_pump(&pdu, buf, size));
+    EXPECT_EQ(EPROTONOSUPPORT, errno);
+
+    // Wrong command ID
+    prot_marshal_cancel(reinterpret_cast<struct prot_cancel*>(buf),
+                        0xDEADBEEF);
+    EXPECT_FALSE(prot_unmarshal_pump(&pdu, buf, size));
+}
+
 TEST(Protocol, unmarshal_cancel_file)
 {
     struct prot_cancel tmp;
@@ -320,13 +765,13 @@ TEST(Protocol, unmarshal_request_with_oversized_filename)
 {
     std::string fname(PROT_FILENAME_MAX + 1, 'a');
 
-    struct prot_request req = {
-        PROT_CMD_SEND,
-        SFD_STAT_OK,
-        0xDEAD,
-        0xBEEF,
-        nullptr, 0
-    };
+    // Zeroed, padding included, as by the client library
+    struct prot_request req;
+    std::memset(&req, 0, sizeof(req));
+    req.cmd = PROT_CMD_SEND;
+    req.stat = SFD_STAT_OK;
+    req.offset = 0xDEAD;
+    req.len = 0xBEEF;
 
     std::vector<std::uint8_t> buf(PROT_REQ_BASE_SIZE + fname.size() + 1, '\0');
     std::memcpy(buf.data(), &req, PROT_REQ_BASE_SIZE);
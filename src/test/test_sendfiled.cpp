@@ -24,12 +24,19 @@
   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <cerrno>
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <csignal>
 #include <future>
@@ -43,10 +50,13 @@
 #include "../impl/test_utils.hpp"
 
 #include "../sendfiled.h"
+#include "../impl/metrics.h"
 #include "../impl/protocol_client.h"
 #include "../impl/server.h"
+#include "../impl/server_handover.h"
 #include "../impl/syspoll.h"
 #include "../impl/test_interpose.h"
+#include "../impl/unix_socket_client.h"
 #include "../impl/unix_socket_server.h"
 #include "../impl/util.h"
 
@@ -107,10 +117,13 @@ using SfdProcFix = SfdProcFixTemplate<1000>;
  * Currently exists solely to make it easier to control the mocked versions of
  * system calls such as sendfile(2) and splice(2).
  */
-template<long OpenFileTimeoutMs>
+template<long OpenFileTimeoutMs, int MaxFiles = 1000,
+         long IdleTimeoutMs = 0, long MinRate = 0,
+         long AdmissionWaitMs = OpenFileTimeoutMs>
 struct SfdThreadFixTemplate : public ::testing::Test {
     static constexpr long open_file_timeout_ms {OpenFileTimeoutMs};
-    static constexpr int maxfiles {1000};
+    static constexpr int maxfiles {MaxFiles};
+    static constexpr long idle_timeout_ms {IdleTimeoutMs};
     static const std::string srvname;
 
     SfdThreadFixTemplate() : srv_barr(2),
@@ -132,6 +145,7 @@ struct SfdThreadFixTemplate : public ::testing::Test {
         mock_write_reset();
         mock_sendfile_reset();
         mock_splice_reset();
+        mock_count_stop();
     }
 
     void run_server() {
@@ -145,9 +159,15 @@ struct SfdThreadFixTemplate : public ::testing::Test {
 
         srv_barr.wait();
 
-        srv_run(listenfd, maxfiles, OpenFileTimeoutMs);
+        srv_exit = srv_run(listenfd, maxfiles,
+                           OpenFileTimeoutMs, AdmissionWaitMs,
+                           IdleTimeoutMs, MinRate);
 
-        us_stop_serving(SFD_SRV_SOCKDIR, srvname.c_str(), listenfd);
+        // The socket file belongs to the server which has taken over
+        if (srv_exit == SRV_EXIT_HANDOVER)
+            close(listenfd);
+        else
+            us_stop_serving(SFD_SRV_SOCKDIR, srvname.c_str(), listenfd);
     }
 
     void stop_thread() {
@@ -157,17 +177,36 @@ struct SfdThreadFixTemplate : public ::testing::Test {
 
     test::unique_fd srv_fd;
     test::thread_barrier srv_barr;
+    // How srv_run() returned; -1 while it is running
+    std::atomic<int> srv_exit {-1};
     std::thread thr;
 };
 
-template<long OpenFileTimeoutMs>
-constexpr long SfdThreadFixTemplate<OpenFileTimeoutMs>::open_file_timeout_ms;
-
-template<long OpenFileTimeoutMs>
-constexpr int SfdThreadFixTemplate<OpenFileTimeoutMs>::maxfiles;
-
-template<long OpenFileTimeoutMs>
-const std::string SfdThreadFixTemplate<OpenFileTimeoutMs>::srvname {"testing123_thread"};
+template<long OpenFileTimeoutMs, int MaxFiles, long IdleTimeoutMs, long MinRate,
+         long AdmissionWaitMs>
+constexpr long SfdThreadFixTemplate<OpenFileTimeoutMs, MaxFiles,
+                                    IdleTimeoutMs, MinRate,
+                                    AdmissionWaitMs>::open_file_timeout_ms;
+
+template<long OpenFileTimeoutMs, int MaxFiles, long IdleTimeoutMs, long MinRate,
+         long AdmissionWaitMs>
+constexpr int SfdThreadFixTemplate<OpenFileTimeoutMs, MaxFiles,
+                                   IdleTimeoutMs, MinRate,
+                                   AdmissionWaitMs>::maxfiles;
+
+template<long OpenFileTimeoutMs, int MaxFiles, long IdleTimeoutMs, long MinRate,
+         long AdmissionWaitMs>
+constexpr long SfdThreadFixTemplate<OpenFileTimeoutMs, MaxFiles,
+                                    IdleTimeoutMs, MinRate,
+                                    AdmissionWaitMs>::idle_timeout_ms;
+
+template<long OpenFileTimeoutMs, int MaxFiles, long IdleTimeoutMs, long MinRate,
+         long AdmissionWaitMs>
+const std::string SfdThreadFixTemplate<OpenFileTimeoutMs, MaxFiles,
+                                       IdleTimeoutMs, MinRate,
+                                       AdmissionWaitMs>::srvname {
+    "testing123_thread"
+};
 
 struct SmallFile {
     static const std::string file_contents;
@@ -228,6 +267,52 @@ struct SfdThreadLargeFileFix : public SfdThreadFixTemplate<1000>, public LargeFi
 
 using SfdThreadFix = SfdThreadFixTemplate<1000>;
 
+// Room for a single transfer (and a single queued request)
+struct SfdThread1XferLargeFileFix :
+        public SfdThreadFixTemplate<1000, 1, 0, 0, 200>, public LargeFile {
+    static void SetUpTestCase() {
+        LargeFile::SetUpTestCase();
+    }
+};
+
+// Transfers have to make progress every 100ms
+struct SfdThreadIdleTimeoutFix :
+        public SfdThreadFixTemplate<1000, 1000, 100>, public LargeFile {
+    static void SetUpTestCase() {
+        LargeFile::SetUpTestCase();
+    }
+};
+
+// A daemon whose transfers have to make progress every 100ms
+struct SfdProcIdleTimeoutFix : public SfdProcFix, public LargeFile {
+    static constexpr int idle_timeout_ms {100};
+
+    static void SetUpTestCase() {
+        LargeFile::SetUpTestCase();
+
+        struct sfd_srv_opts opts {};
+        opts.idle_timeout_ms = idle_timeout_ms;
+
+        srv_pid = sfd_spawn_opts(srvname.c_str(),
+                                 "/",
+                                 SFD_SRV_SOCKDIR,
+                                 maxfiles, 1000, &opts);
+        if (srv_pid == -1)
+            throw std::runtime_error("Couldn't start daemon");
+    }
+};
+
+constexpr int SfdProcIdleTimeoutFix::idle_timeout_ms;
+
+// Transfers have to make 1.6MB of progress every 100ms
+struct SfdThreadMinRateFix :
+        public SfdThreadFixTemplate<1000, 1000, 100, 16 * 1000 * 1000>,
+        public LargeFile {
+    static void SetUpTestCase() {
+        LargeFile::SetUpTestCase();
+    }
+};
+
 } // namespace
 
 // Non-existent file should respond to request with status message containing
@@ -291,11 +376,13 @@ TEST_F(SfdProcFix, open_directory_fails)
 using SfdProcFix2Xfers = SfdProcFixTemplate<2>;
 /**
  * Checks that the client receives EMFILE if there are too many concurrent
- * transfers on the server (-n command-line parameter sets the limit).
+ * transfers on the server (-n command-line parameter sets the limit) and the
+ * admission queue (of the same size) is full as well.
  */
 TEST_F(SfdProcFix2Xfers, transfer_table_full)
 {
     test::unique_fd stat_fds [maxfiles];
+    test::unique_fd queued_stat_fds [maxfiles];
     test::TmpFile file {"1234567890"};
 
     for (std::size_t i = 0; i < maxfiles; i++) {
@@ -315,7 +402,15 @@ TEST_F(SfdProcFix2Xfers, transfer_table_full)
         EXPECT_EQ(SFD_STAT_OK, sfd_get_stat(buf));
     }
 
-    // One over the 'open file limit'
+    // These have to wait for room in the transfer table
+    for (std::size_t i = 0; i < maxfiles; i++) {
+        queued_stat_fds[i] = sfd_open(srv_fd,
+                                      file.name().c_str(),
+                                      0, 0, false);
+        ASSERT_TRUE(queued_stat_fds[i]);
+    }
+
+    // One over the 'open file limit' plus the queue's capacity
 
     auto sockets = test::make_connection(test_port + maxfiles);
 
@@ -446,6 +541,272 @@ TEST_F(SfdThreadSmallFileFix, send)
     EXPECT_EQ(file_contents, recvd_file);
 }
 
+TEST_F(SfdThreadSmallFileFix, send_with_xfer_stats)
+{
+    auto sockets = test::make_connection(test_port);
+
+    const test::unique_fd stat_fd {sfd_send_ex(srv_fd,
+                                               file.name().c_str(),
+                                               sockets.first,
+                                               0, 0, false,
+                                               SFD_REQ_XFER_STATS)};
+
+    ASSERT_TRUE(stat_fd);
+
+    sockets.first.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    ssize_t nread;
+    struct sfd_file_info ack;
+    struct sfd_xfer_stats stats;
+
+    nread = read(stat_fd, buf, sizeof(ack));
+    ASSERT_EQ(sizeof(ack), nread);
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+
+    // Terminal response carries the statistics instead of PROT_XFER_COMPLETE
+    nread = read(stat_fd, buf, sizeof(buf));
+    ASSERT_EQ(sizeof(stats), nread);
+    ASSERT_TRUE(sfd_unmarshal_xfer_stats(&stats, buf));
+    EXPECT_EQ(SFD_XFER_STATS, stats.cmd);
+    EXPECT_EQ(SFD_STAT_OK, stats.stat);
+    EXPECT_EQ(file_contents.size(), stats.size);
+    EXPECT_GE(stats.nwrites, 1u);
+    EXPECT_EQ(0u, stats.nstalls);
+    EXPECT_LE(stats.ttfb_us, stats.duration_us);
+
+    nread = read(sockets.second, buf, sizeof(buf));
+    ASSERT_EQ(file_contents.size(), nread);
+}
+
+TEST_F(SfdThreadSmallFileFix, send_nostat)
+{
+    auto sockets = test::make_connection(test_port);
+
+    ASSERT_TRUE(sfd_send_nostat(srv_fd,
+                                file.name().c_str(),
+                                sockets.first,
+                                0, 0));
+
+    sockets.first.reset();
+
+    // Only the file content is written, followed by the server's close
+    uint8_t buf [PROT_REQ_MAXSIZE];
+    std::string recvd_file;
+    ssize_t nread;
+
+    while ((nread = read(sockets.second, buf, sizeof(buf))) > 0)
+        recvd_file.append(reinterpret_cast<const char*>(buf), size_t(nread));
+
+    ASSERT_EQ(0, nread);
+    EXPECT_EQ(file_contents, recvd_file);
+}
+
+TEST_F(SfdThreadSmallFileFix, send_nostat_failure_closes_destination)
+{
+    auto sockets = test::make_connection(test_port);
+
+    ASSERT_TRUE(sfd_send_nostat(srv_fd,
+                                "/non-existent/file",
+                                sockets.first,
+                                0, 0));
+
+    sockets.first.reset();
+
+    // No error response; the destination is simply closed
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    EXPECT_EQ(0, read(sockets.second, buf, sizeof(buf)));
+}
+
+TEST_F(SfdThreadSmallFileFix, send_with_cookie)
+{
+    auto sockets = test::make_connection(test_port);
+
+    struct sfd_req_opts opts {};
+    opts.flags = SFD_REQ_XFER_STATS;
+    opts.cookie = 0xFEEDFACECAFEBEEFULL;
+
+    const test::unique_fd stat_fd {sfd_send_opts(srv_fd,
+                                                 file.name().c_str(),
+                                                 sockets.first,
+                                                 0, 0, false, &opts)};
+    ASSERT_TRUE(stat_fd);
+
+    sockets.first.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    struct sfd_xfer_stats stats;
+
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+
+    ASSERT_EQ(sizeof(stats), read(stat_fd, buf, sizeof(buf)));
+    ASSERT_TRUE(sfd_unmarshal_xfer_stats(&stats, buf));
+    EXPECT_EQ(opts.cookie, stats.cookie);
+
+    EXPECT_EQ(file_contents.size(), read(sockets.second, buf, sizeof(buf)));
+}
+
+// Responses are sent in the wire format version of the request they respond
+// to, so only clients which send version 2 requests (e.g., with a cookie) get
+// fixed-width responses
+TEST_F(SfdThreadSmallFileFix, responses_follow_request_version)
+{
+    for (const uint64_t cookie : {0ULL, 42ULL}) {
+        auto sockets = test::make_connection(test_port);
+
+        struct sfd_req_opts opts {};
+        opts.flags = SFD_REQ_XFER_STATS;
+        opts.cookie = cookie;
+
+        const test::unique_fd stat_fd {sfd_send_opts(srv_fd,
+                                                     file.name().c_str(),
+                                                     sockets.first,
+                                                     0, 0, false, &opts)};
+        ASSERT_TRUE(stat_fd);
+
+        sockets.first.reset();
+
+        const int version {cookie != 0 ? PROT_VERSION : 0};
+
+        uint8_t buf [SFD_MAX_RESP_SIZE];
+        struct sfd_file_info ack;
+        struct sfd_xfer_stats stats;
+
+        ASSERT_EQ(SFD_FILE_INFO_SIZE,
+                  read(stat_fd, buf, SFD_FILE_INFO_SIZE));
+        EXPECT_EQ(version, buf[PROT_RESP_VERSION_OFFSET]);
+        ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+        EXPECT_EQ(file_contents.size(), ack.size);
+
+        ASSERT_EQ(SFD_XFER_STATS_SIZE, read(stat_fd, buf, sizeof(buf)));
+        EXPECT_EQ(version, buf[PROT_RESP_VERSION_OFFSET]);
+        ASSERT_TRUE(sfd_unmarshal_xfer_stats(&stats, buf));
+        EXPECT_EQ(file_contents.size(), stats.size);
+        EXPECT_EQ(cookie, stats.cookie);
+
+        EXPECT_EQ(file_contents.size(),
+                  read(sockets.second, buf, sizeof(buf)));
+    }
+}
+
+namespace {
+
+// Sends a Read File request as encoded by the caller, returning the data channel
+test::unique_fd send_raw_read(const int srv_fd, const struct iovec* iovs)
+{
+    int fds[2];
+    if (sfd_pipe(fds, O_CLOEXEC) == -1)
+        return test::unique_fd{-1};
+
+    test::unique_fd data_fd {fds[0]};
+    const test::unique_fd write_fd {fds[1]};
+
+    if (us_sendv(srv_fd, iovs, 2, &fds[1], 1) == -1)
+        return test::unique_fd{-1};
+
+    return data_fd;
+}
+
+} // namespace
+
+// Clients from before the version 2 wire format are still served
+TEST_F(SfdThreadSmallFileFix, read_with_version_1_request)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_read(&req, file.name().c_str(), 0, 0));
+
+    const struct iovec iovs[] {
+        {&req, PROT_REQ_BASE_SIZE},
+        {const_cast<char*>(req.filename), req.filename_len + 1}
+    };
+
+    const test::unique_fd data_fd {send_raw_read(srv_fd, iovs)};
+    ASSERT_TRUE(data_fd);
+
+    uint8_t buf [PROT_REQ_MAXSIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(data_fd, buf, sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+    EXPECT_EQ(file_contents.size(), ack.size);
+
+    ASSERT_EQ(file_contents.size(), read(data_fd, buf, sizeof(buf)));
+}
+
+// Clients using a newer wire format are told so, to let them fall back
+TEST_F(SfdThreadSmallFileFix, newer_request_version_is_refused)
+{
+    struct prot_request req;
+    ASSERT_TRUE(prot_marshal_read(&req, file.name().c_str(), 0, 0));
+
+    uint8_t hdr [PROT_REQ_V2_HDR_MAXSIZE];
+    const struct iovec iovs[] {
+        {hdr, prot_marshal_request_hdr(hdr, &req)},
+        {const_cast<char*>(req.filename), req.filename_len + 1}
+    };
+    hdr[PROT_REQ_VERSION_OFFSET] = PROT_VERSION + 1;
+
+    const test::unique_fd data_fd {send_raw_read(srv_fd, iovs)};
+    ASSERT_TRUE(data_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    ASSERT_EQ(sizeof(struct prot_hdr), read(data_fd, buf, sizeof(buf)));
+    EXPECT_EQ(SFD_FILE_INFO, sfd_get_cmd(buf));
+    EXPECT_EQ(EPROTONOSUPPORT, sfd_get_stat(buf));
+}
+
+TEST_F(SfdThreadSmallFileFix, send_updates_metrics)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto sockets = test::make_connection(test_port);
+
+    const test::unique_fd stat_fd {sfd_send(srv_fd,
+                                            file.name().c_str(),
+                                            sockets.first,
+                                            0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+
+    sockets.first.reset();
+
+    uint8_t buf [PROT_REQ_MAXSIZE];
+    struct sfd_file_info ack;
+    struct sfd_xfer_stat xfer_stat;
+
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+    ASSERT_EQ(sizeof(xfer_stat), read(stat_fd, buf, sizeof(xfer_stat)));
+    ASSERT_TRUE(sfd_unmarshal_xfer_stat(&xfer_stat, buf));
+    ASSERT_TRUE(sfd_xfer_complete(&xfer_stat));
+
+    EXPECT_EQ(before.requests + 1, sfd_metrics->requests);
+    EXPECT_EQ(before.xfers_completed + 1, sfd_metrics->xfers_completed);
+    EXPECT_EQ(before.bytes_sent + file_contents.size(),
+              sfd_metrics->bytes_sent);
+    EXPECT_EQ(before.ttfb.count + 1, sfd_metrics->ttfb.count);
+    EXPECT_EQ(before.duration.count + 1, sfd_metrics->duration.count);
+    EXPECT_EQ(before.rejected_emfile, sfd_metrics->rejected_emfile);
+}
+
+TEST_F(SfdThreadSmallFileFix, rejected_request_updates_metrics)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    // Range beyond the end of the file
+    const test::unique_fd data_fd {sfd_read(srv_fd,
+                                            file.name().c_str(),
+                                            0, file_contents.size() + 1,
+                                            false)};
+    ASSERT_TRUE(data_fd);
+
+    uint8_t buf [PROT_REQ_MAXSIZE];
+    ASSERT_EQ(SFD_HDR_SIZE, read(data_fd, buf, sizeof(buf)));
+    EXPECT_EQ(ERANGE, sfd_get_stat(buf));
+
+    EXPECT_EQ(before.rejected_erange + 1, sfd_metrics->rejected_erange);
+    EXPECT_EQ(before.active_reads, sfd_metrics->active_reads);
+}
+
 /// Causes the final (and only, in this case) transfer status send to fail
 /// temporarily. The server should keep trying until it is able to send the
 /// final status.
@@ -1163,4 +1524,2256 @@ TEST_F(SfdThreadLargeFileFix, send_io_error)
     EXPECT_LT(nchunks, NCHUNKS);
 }
 
+// -------------------- System call budgets --------------------
+//
+// Upper bounds on the number of system calls made by the server while
+// processing a single request. Only the interposed functions are counted (see
+// test_interpose.h), and only when called by the server thread. The bounds
+// include a little slack for platform differences; a failure here means that
+// the hot path has gained system calls.
+
+namespace {
+
+// Send File of a small, cached file
+constexpr unsigned long SEND_SMALL_FILE_BUDGET {20};
+// Open File (until the file information message has been sent)
+constexpr unsigned long OPEN_FILE_BUDGET {12};
+// Read File: data-transfer calls in excess of one per st_blksize-sized chunk,
+// as a fraction of the number of chunks (the server may find the pipe full
+// once per pipe-capacity's worth of data)
+constexpr unsigned long READ_EXCESS_SPLICE_DIVISOR {8};
+
+// Waits for the server thread to settle (i.e., to block in the poller) by
+// waiting for its call counts to stop changing
+void wait_for_server_idle()
+{
+    unsigned long prev {mock_count_total()};
+
+    for (int i = 0; i < 100; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+        const unsigned long cur {mock_count_total()};
+        if (cur == prev)
+            return;
+
+        prev = cur;
+    }
+}
+
+// Starts counting the server thread's calls, after performing one-time
+// initialisations which would otherwise be counted
+void start_counting(std::thread& thr)
+{
+    pipe_capacity();
+    mock_count_start(thr.native_handle());
+}
+
+} // namespace
+
+TEST_F(SfdThreadFix, send_small_file_syscall_budget)
+{
+    const test::TmpFile file {std::string(4096, 'x')};
+
+    auto sockets = test::make_connection(test_port);
+
+    start_counting(thr);
+
+    const test::unique_fd stat_fd {sfd_send(srv_fd,
+                                            file.name().c_str(),
+                                            sockets.first,
+                                            0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+
+    sockets.first.reset();
+
+    // File information, transfer completion, EOF
+    std::vector<uint8_t> buf(SFD_MAX_RESP_SIZE);
+    ASSERT_EQ(sizeof(struct sfd_file_info),
+              read(stat_fd, buf.data(), sizeof(struct sfd_file_info)));
+    ASSERT_EQ(sizeof(struct sfd_xfer_stat),
+              read(stat_fd, buf.data(), sizeof(struct sfd_xfer_stat)));
+    ASSERT_EQ(0, read(stat_fd, buf.data(), buf.size()));
+
+    wait_for_server_idle();
+    mock_count_stop();
+
+    EXPECT_EQ(1, mock_count(MOCK_CALL_sendfile));
+    EXPECT_EQ(1, mock_count(MOCK_CALL_open));
+    EXPECT_LE(mock_count_total(), SEND_SMALL_FILE_BUDGET);
+}
+
+TEST_F(SfdThreadSmallFileFix, open_file_syscall_budget)
+{
+    start_counting(thr);
+
+    const test::unique_fd stat_fd {sfd_open(srv_fd,
+                                            file.name().c_str(),
+                                            0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+
+    struct sfd_file_info ack;
+    std::vector<uint8_t> buf(SFD_MAX_RESP_SIZE);
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf.data(), sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf.data()));
+
+    wait_for_server_idle();
+    mock_count_stop();
+
+    EXPECT_EQ(1, mock_count(MOCK_CALL_open));
+    EXPECT_EQ(0, mock_count(MOCK_CALL_sendfile) + mock_count(MOCK_CALL_splice));
+    EXPECT_LE(mock_count_total(), OPEN_FILE_BUDGET);
+
+    EXPECT_TRUE(sfd_cancel(srv_fd, ack.txnid));
+    EXPECT_EQ(0, read(stat_fd, buf.data(), buf.size()));
+}
+
+TEST_F(SfdThreadFix, read_large_file_syscall_budget)
+{
+    // Sparse, so as to be quick to create and to read
+    constexpr off_t FILE_SIZE {64 * 1024 * 1024};
+
+    test::TmpFile file;
+    ASSERT_EQ(0, ftruncate(file, FILE_SIZE));
+
+    struct stat sb;
+    ASSERT_EQ(0, fstat(file, &sb));
+    file.close();
+
+    start_counting(thr);
+
+    const test::unique_fd data_fd {
+        sfd_read(srv_fd, file.name().c_str(), 0, 0, false)};
+    ASSERT_TRUE(data_fd);
+
+    std::vector<uint8_t> buf(1024 * 1024);
+    struct sfd_file_info ack;
+
+    ASSERT_EQ(sizeof(ack), read(data_fd, buf.data(), sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf.data()));
+
+    off_t total {};
+    ssize_t n;
+    while ((n = read(data_fd, buf.data(), buf.size())) > 0)
+        total += n;
+
+    ASSERT_EQ(FILE_SIZE, total);
+
+    wait_for_server_idle();
+    mock_count_stop();
+
+    const unsigned long nchunks {
+        static_cast<unsigned long>(FILE_SIZE / sb.st_blksize)};
+
+#ifdef __linux__
+    const unsigned long nxfers {mock_count(MOCK_CALL_splice)};
+#else
+    const unsigned long nxfers {mock_count(MOCK_CALL_read)};
+#endif
+
+    EXPECT_GE(nxfers, nchunks);
+    EXPECT_LE(nxfers, nchunks + nchunks / READ_EXCESS_SPLICE_DIVISOR);
+}
+
+// -------------------- Admission queue --------------------
+
+namespace {
+
+// A pipe whose write end is non-blocking (as required of destination
+// descriptors) and fills up after pipe_capacity() bytes
+std::pair<test::unique_fd, test::unique_fd> make_dest_pipe()
+{
+    int fds[2];
+    if (pipe(fds) == -1 || !set_nonblock(fds[1], true))
+        throw std::runtime_error("Couldn't create destination pipe");
+
+    return {test::unique_fd{fds[0]}, test::unique_fd{fds[1]}};
+}
+
+} // namespace
+
+// A request which arrives while the transfer table is full waits until a
+// transfer completes, instead of failing with EMFILE
+TEST_F(SfdThread1XferLargeFileFix, queued_request_is_admitted)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    // Occupy the only slot with a transfer which stalls on a full pipe
+    auto dest1 = make_dest_pipe();
+    const test::unique_fd stat_fd1 {sfd_send(srv_fd, file.name().c_str(),
+                                             dest1.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd1);
+    dest1.second.reset();
+
+    std::vector<uint8_t> buf(FILE_SIZE);
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd1, buf.data(), sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf.data()));
+
+    // Queued
+    const test::TmpFile small_file {"1234567890"};
+    auto dest2 = make_dest_pipe();
+    const test::unique_fd stat_fd2 {sfd_send_ex(srv_fd,
+                                                small_file.name().c_str(),
+                                                dest2.second, 0, 0, false,
+                                                SFD_REQ_XFER_STATS)};
+    ASSERT_TRUE(stat_fd2);
+    dest2.second.reset();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    EXPECT_EQ(before.requests_queued + 1, sfd_metrics->requests_queued);
+    EXPECT_EQ(1, sfd_metrics->queued_requests);
+
+    // Let the first transfer complete
+    size_t total {};
+    ssize_t n;
+    while ((n = read(dest1.first, buf.data(), buf.size())) > 0)
+        total += (size_t)n;
+    EXPECT_EQ(FILE_SIZE, total);
+
+    // The queued request is then admitted
+    ASSERT_EQ(sizeof(ack), read(stat_fd2, buf.data(), sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf.data()));
+    EXPECT_EQ(SFD_STAT_OK, ack.stat);
+
+    struct sfd_xfer_stats stats;
+    ASSERT_EQ(sizeof(stats), read(stat_fd2, buf.data(), sizeof(stats)));
+    ASSERT_TRUE(sfd_unmarshal_xfer_stats(&stats, buf.data()));
+    EXPECT_GT(stats.queue_us, 0);
+    EXPECT_LE(stats.queue_us, stats.duration_us);
+
+    EXPECT_EQ(0, sfd_metrics->queued_requests);
+}
+
+// A request made with SFD_REQ_QUEUED_STATUS is told that it has been queued,
+// before its other responses
+TEST_F(SfdThread1XferLargeFileFix, queued_request_is_told_so)
+{
+    auto dest1 = make_dest_pipe();
+    const test::unique_fd stat_fd1 {sfd_send(srv_fd, file.name().c_str(),
+                                             dest1.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd1);
+    dest1.second.reset();
+
+    std::vector<uint8_t> buf(FILE_SIZE);
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd1, buf.data(), sizeof(ack)));
+
+    const test::TmpFile small_file {"1234567890"};
+    auto dest2 = make_dest_pipe();
+    const test::unique_fd stat_fd2 {sfd_send_ex(srv_fd,
+                                                small_file.name().c_str(),
+                                                dest2.second, 0, 0, false,
+                                                SFD_REQ_QUEUED_STATUS)};
+    ASSERT_TRUE(stat_fd2);
+    dest2.second.reset();
+
+    struct sfd_req_queued queued;
+    ASSERT_EQ(sizeof(queued), read(stat_fd2, buf.data(), sizeof(queued)));
+    ASSERT_TRUE(sfd_unmarshal_req_queued(&queued, buf.data()));
+    EXPECT_EQ(0u, queued.position);
+    EXPECT_EQ(200u, queued.max_wait_ms);
+
+    // Let the first transfer complete
+    while (read(dest1.first, buf.data(), buf.size()) > 0)
+        ;
+
+    // The queued request is then admitted as usual
+    ASSERT_EQ(sizeof(ack), read(stat_fd2, buf.data(), sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf.data()));
+
+    // The status channel is closed once the transfer has been deleted
+    while (read(stat_fd2, buf.data(), buf.size()) > 0)
+        ;
+
+    // Requests which are not queued are not told so
+
+    auto dest3 = make_dest_pipe();
+    const test::unique_fd stat_fd3 {sfd_send_ex(srv_fd,
+                                                small_file.name().c_str(),
+                                                dest3.second, 0, 0, false,
+                                                SFD_REQ_QUEUED_STATUS)};
+    ASSERT_TRUE(stat_fd3);
+    dest3.second.reset();
+
+    ASSERT_EQ(sizeof(ack), read(stat_fd3, buf.data(), sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf.data()));
+}
+
+// Requests which wait in the queue for longer than the admission wait limit
+// (rather than the open file timeout) are rejected with ETIMEDOUT; requests
+// which don't fit in the queue are rejected with EMFILE at once
+TEST_F(SfdThread1XferLargeFileFix, queued_request_times_out)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto dest1 = make_dest_pipe();
+    const test::unique_fd stat_fd1 {sfd_send(srv_fd, file.name().c_str(),
+                                             dest1.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd1);
+    dest1.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd1, buf, sizeof(ack)));
+
+    auto dest2 = make_dest_pipe();
+    const test::unique_fd stat_fd2 {sfd_send(srv_fd, file.name().c_str(),
+                                             dest2.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd2);
+    dest2.second.reset();
+
+    // The queue (of the same capacity as the transfer table) is full
+    auto dest3 = make_dest_pipe();
+    const test::unique_fd stat_fd3 {sfd_send(srv_fd, file.name().c_str(),
+                                             dest3.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd3);
+    dest3.second.reset();
+
+    ASSERT_EQ(sizeof(struct prot_hdr), read(stat_fd3, buf, sizeof(buf)));
+    EXPECT_EQ(SFD_FILE_INFO, sfd_get_cmd(buf));
+    EXPECT_EQ(EMFILE, sfd_get_stat(buf));
+
+    // Blocks until the queued request's deadline
+    const auto t0 = std::chrono::steady_clock::now();
+    ASSERT_EQ(sizeof(struct prot_hdr), read(stat_fd2, buf, sizeof(buf)));
+    EXPECT_EQ(SFD_FILE_INFO, sfd_get_cmd(buf));
+    EXPECT_EQ(ETIMEDOUT, sfd_get_stat(buf));
+    EXPECT_LT(std::chrono::steady_clock::now() - t0,
+              std::chrono::milliseconds{open_file_timeout_ms});
+    EXPECT_EQ(0, read(stat_fd2, buf, sizeof(buf)));
+
+    EXPECT_EQ(before.rejected_emfile + 1, sfd_metrics->rejected_emfile);
+    EXPECT_EQ(before.rejected_timeout + 1, sfd_metrics->rejected_timeout);
+    EXPECT_EQ(0, sfd_metrics->queued_requests);
+}
+
+// -------------------- Idle and minimum-rate timeouts --------------------
+
+namespace {
+
+// Reads transfer status notifications until the terminal one, returning its
+// status code
+int read_terminal_stat(const int stat_fd)
+{
+    for (;;) {
+        uint8_t buf [SFD_MAX_RESP_SIZE];
+
+        if (read(stat_fd, buf, sizeof(struct prot_hdr)) !=
+            sizeof(struct prot_hdr)) {
+            return -1;
+        }
+
+        if (sfd_get_stat(buf) != SFD_STAT_OK)
+            return sfd_get_stat(buf);
+
+        const size_t body_size =
+            sizeof(struct sfd_xfer_stat) - sizeof(struct prot_hdr);
+
+        if (read(stat_fd, buf + sizeof(struct prot_hdr), body_size) !=
+            (ssize_t)body_size) {
+            return -1;
+        }
+
+        struct sfd_xfer_stat xfer_stat;
+        if (!sfd_unmarshal_xfer_stat(&xfer_stat, buf))
+            return -1;
+
+        if (sfd_xfer_complete(&xfer_stat))
+            return SFD_STAT_OK;
+    }
+}
+
+} // namespace
+
+// A transfer whose destination is never read from is cancelled after the idle
+// timeout
+TEST_F(SfdThreadIdleTimeoutFix, stalled_send_times_out)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+
+    const auto t0 = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(ETIMEDOUT, read_terminal_stat(stat_fd));
+    EXPECT_EQ(0, read(stat_fd, buf, sizeof(buf)));
+
+    const auto elapsed = std::chrono::steady_clock::now() - t0;
+    EXPECT_GE(elapsed, std::chrono::milliseconds{idle_timeout_ms});
+    EXPECT_LT(elapsed, std::chrono::milliseconds{idle_timeout_ms * 3});
+
+    EXPECT_EQ(before.xfer_timeouts + 1, sfd_metrics->xfer_timeouts);
+    EXPECT_EQ(before.active_sends, sfd_metrics->active_sends);
+}
+
+// The idle timeout is passed on to a spawned daemon
+TEST_F(SfdProcIdleTimeoutFix, stalled_send_times_out)
+{
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+
+    const auto t0 = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(ETIMEDOUT, read_terminal_stat(stat_fd));
+
+    const auto elapsed = std::chrono::steady_clock::now() - t0;
+    EXPECT_GE(elapsed, std::chrono::milliseconds{idle_timeout_ms});
+}
+
+// A transfer which keeps making progress is not affected by the idle timeout
+TEST_F(SfdThreadIdleTimeoutFix, slow_send_completes)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest.second, 0, FILE_SIZE / 4,
+                                            false)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    // Drain the destination in small chunks, taking longer than the idle
+    // timeout in total
+    std::thread reader {[&dest] {
+            std::vector<uint8_t> chunk(16 * 1024);
+            while (read(dest.first, chunk.data(), chunk.size()) > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        }};
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+    reader.join();
+
+    EXPECT_EQ(before.xfer_timeouts, sfd_metrics->xfer_timeouts);
+}
+
+// A transfer which makes progress, but too slowly, is cancelled
+TEST_F(SfdThreadMinRateFix, slow_send_times_out)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    // ~400KB/s; reads until the server closes the destination
+    std::thread reader {[&dest] {
+            std::vector<uint8_t> chunk(4 * 1024);
+            while (read(dest.first, chunk.data(), chunk.size()) > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        }};
+
+    EXPECT_EQ(ETIMEDOUT, read_terminal_stat(stat_fd));
+    reader.join();
+
+    EXPECT_EQ(before.xfer_timeouts + 1, sfd_metrics->xfer_timeouts);
+}
+
+// A transfer which sustains the minimum rate completes
+TEST_F(SfdThreadMinRateFix, fast_send_completes)
+{
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    std::vector<uint8_t> data(FILE_SIZE);
+    size_t total {};
+    ssize_t n;
+    while ((n = read(dest.first, data.data(), data.size())) > 0)
+        total += (size_t)n;
+    EXPECT_EQ(FILE_SIZE, total);
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+}
+
+// -------------------- Progress notifications --------------------
+
+namespace {
+
+// Reads a send's data channel to the end, a little at a time
+size_t drain_slowly(const int fd)
+{
+    size_t total {0};
+    char buf [4096];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        total += size_t(n);
+
+    return total;
+}
+
+// Reads a send's status channel up to its terminal notification, collecting the
+// sizes reported by the progress notifications before it
+int read_progress(const int stat_fd, std::vector<size_t>& sizes)
+{
+    for (;;) {
+        struct sfd_xfer_stat xfer_stat;
+        uint8_t buf [sizeof(xfer_stat)];
+
+        if (read(stat_fd, buf, sizeof(buf)) != sizeof(buf))
+            return -1;
+
+        if (sfd_get_stat(buf) != SFD_STAT_OK)
+            return sfd_get_stat(buf);
+
+        if (!sfd_unmarshal_xfer_stat(&xfer_stat, buf))
+            return -1;
+
+        if (sfd_xfer_complete(&xfer_stat))
+            return SFD_STAT_OK;
+
+        sizes.push_back(xfer_stat.size);
+    }
+}
+
+} // namespace
+
+// Progress notifications are coalesced into the requested byte interval, each
+// reporting everything written since the previous one
+TEST_F(SfdThreadLargeFileFix, progress_byte_interval)
+{
+    const size_t interval {FILE_SIZE / 4};
+
+    struct sfd_req_opts opts {};
+    opts.progress_interval = interval;
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send_opts(srv_fd, file.name().c_str(),
+                                                 dest.second, 0, 0, false,
+                                                 &opts)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [sizeof(struct sfd_file_info)];
+    ASSERT_EQ(sizeof(buf), read(stat_fd, buf, sizeof(buf)));
+
+    EXPECT_EQ(FILE_SIZE, drain_slowly(dest.first));
+
+    std::vector<size_t> sizes;
+    ASSERT_EQ(SFD_STAT_OK, read_progress(stat_fd, sizes));
+
+    EXPECT_LE(sizes.size(), FILE_SIZE / interval);
+    for (const size_t size : sizes)
+        EXPECT_GE(size, interval);
+}
+
+// No progress notifications at all; only the terminal one
+TEST_F(SfdThreadLargeFileFix, no_progress)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send_ex(srv_fd, file.name().c_str(),
+                                               dest.second, 0, 0, false,
+                                               SFD_REQ_NO_PROGRESS)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [sizeof(struct sfd_file_info)];
+    ASSERT_EQ(sizeof(buf), read(stat_fd, buf, sizeof(buf)));
+
+    EXPECT_EQ(FILE_SIZE, drain_slowly(dest.first));
+
+    std::vector<size_t> sizes;
+    ASSERT_EQ(SFD_STAT_OK, read_progress(stat_fd, sizes));
+    EXPECT_TRUE(sizes.empty());
+
+    EXPECT_EQ(before.progress_notifications,
+              sfd_metrics->progress_notifications);
+}
+
+// -------------------- File handles --------------------
+
+namespace {
+
+// Opens a file handle, returning its status channel and setting @a handle
+test::unique_fd open_handle(const int srv_fd, const std::string& path,
+                            size_t& handle, size_t& size)
+{
+    test::unique_fd stat_fd {sfd_open_handle(srv_fd, path.c_str(), false)};
+    if (!stat_fd)
+        return stat_fd;
+
+    struct sfd_file_info ack;
+    uint8_t buf [sizeof(ack)];
+
+    if (read(stat_fd, buf, sizeof(buf)) != sizeof(buf) ||
+        !sfd_unmarshal_file_info(&ack, buf)) {
+        return test::unique_fd{-1};
+    }
+
+    handle = ack.txnid;
+    size = ack.size;
+
+    return stat_fd;
+}
+
+// Sends a range of a file handle and reads it from the destination, returning
+// the terminal transfer status
+int send_range(const int srv_fd, const size_t handle,
+               const off_t offset, const size_t len,
+               std::vector<std::uint8_t>& data)
+{
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send_range(srv_fd, handle, dest.second,
+                                                  offset, len, false, 0)};
+    if (!stat_fd)
+        return -1;
+    dest.second.reset();
+
+    struct sfd_file_info ack;
+    uint8_t buf [4096];
+
+    // Rejected requests are answered by a bare header
+    const ssize_t nread {read(stat_fd, buf, sizeof(ack))};
+    if (nread == sizeof(struct prot_hdr))
+        return sfd_get_stat(buf);
+    if (nread != sizeof(ack) || !sfd_unmarshal_file_info(&ack, buf))
+        return -1;
+
+    ssize_t n;
+    while ((n = read(dest.first, buf, sizeof(buf))) > 0)
+        data.insert(data.end(), buf, buf + n);
+
+    if (data.size() != ack.size)
+        return -1;
+
+    std::vector<size_t> sizes;
+    return read_progress(stat_fd, sizes);
+}
+
+} // namespace
+
+// Ranged sends' progress notifications are coalesced as other sends' are
+TEST_F(SfdThreadLargeFileFix, file_handle_ranged_send_progress_interval)
+{
+    size_t handle;
+    size_t size;
+    const test::unique_fd stat_fd {open_handle(srv_fd, file.name(),
+                                               handle, size)};
+    ASSERT_TRUE(stat_fd);
+
+    const size_t interval {FILE_SIZE / 4};
+
+    struct sfd_req_opts opts {};
+    opts.progress_interval = interval;
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd xfer_stat_fd {sfd_send_range_opts(srv_fd, handle,
+                                                            dest.second, 0, 0,
+                                                            false, &opts)};
+    ASSERT_TRUE(xfer_stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [sizeof(struct sfd_file_info)];
+    ASSERT_EQ(sizeof(buf), read(xfer_stat_fd, buf, sizeof(buf)));
+
+    EXPECT_EQ(FILE_SIZE, drain_slowly(dest.first));
+
+    std::vector<size_t> sizes;
+    ASSERT_EQ(SFD_STAT_OK, read_progress(xfer_stat_fd, sizes));
+
+    EXPECT_LE(sizes.size(), FILE_SIZE / interval);
+    for (const size_t nwritten : sizes)
+        EXPECT_GE(nwritten, interval);
+
+    ASSERT_TRUE(sfd_close_handle(srv_fd, handle));
+}
+
+// Each ranged send's Transfer Statistics carry its own cookie
+TEST_F(SfdThreadLargeFileFix, file_handle_ranged_send_cookies)
+{
+    size_t handle;
+    size_t size;
+    const test::unique_fd stat_fd {open_handle(srv_fd, file.name(),
+                                               handle, size)};
+    ASSERT_TRUE(stat_fd);
+
+    for (const uint64_t cookie : {0xFEEDFACECAFEBEEFULL, 42ULL}) {
+        struct sfd_req_opts opts {};
+        opts.flags = SFD_REQ_XFER_STATS;
+        opts.cookie = cookie;
+
+        auto dest = make_dest_pipe();
+        const test::unique_fd xfer_stat_fd {sfd_send_range_opts(srv_fd, handle,
+                                                                dest.second,
+                                                                0, 4096,
+                                                                false, &opts)};
+        ASSERT_TRUE(xfer_stat_fd);
+        dest.second.reset();
+
+        uint8_t buf [SFD_MAX_RESP_SIZE];
+        struct sfd_file_info ack;
+        struct sfd_xfer_stats stats;
+
+        ASSERT_EQ(sizeof(ack), read(xfer_stat_fd, buf, sizeof(ack)));
+        ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+
+        EXPECT_EQ(4096, drain_slowly(dest.first));
+
+        ASSERT_EQ(sizeof(stats), read(xfer_stat_fd, buf, sizeof(buf)));
+        ASSERT_TRUE(sfd_unmarshal_xfer_stats(&stats, buf));
+        EXPECT_EQ(cookie, stats.cookie);
+    }
+
+    ASSERT_TRUE(sfd_close_handle(srv_fd, handle));
+}
+
+// A handle can be sent from any number of times, in arbitrary ranges
+TEST_F(SfdThreadLargeFileFix, file_handle_ranged_sends)
+{
+    size_t handle;
+    size_t size;
+    const test::unique_fd stat_fd {open_handle(srv_fd, file.name(),
+                                               handle, size)};
+    ASSERT_TRUE(stat_fd);
+    EXPECT_EQ(FILE_SIZE, size);
+
+    const struct {
+        off_t offset;
+        size_t len;
+        size_t expected_len;
+    } ranges[] {
+        {1000, 100, 100},
+        {0, 3 * CHUNK_SIZE + 7, 3 * CHUNK_SIZE + 7},
+        {FILE_SIZE - 10, 0, 10},
+        {1000, 100, 100}
+    };
+
+    for (const auto& r : ranges) {
+        std::vector<std::uint8_t> data;
+        ASSERT_EQ(SFD_STAT_OK, send_range(srv_fd, handle,
+                                          r.offset, r.len, data));
+        ASSERT_EQ(r.expected_len, data.size());
+
+        for (size_t i = 0; i < data.size(); i++) {
+            ASSERT_EQ(uint8_t((size_t(r.offset) + i) % CHUNK_SIZE), data[i])
+                << "at offset " << (size_t(r.offset) + i);
+        }
+    }
+
+    // Out-of-range sends fail, leaving the handle open
+    std::vector<std::uint8_t> data;
+    EXPECT_EQ(ERANGE, send_range(srv_fd, handle, FILE_SIZE, 0, data));
+    EXPECT_EQ(ERANGE, send_range(srv_fd, handle, 0, FILE_SIZE + 1, data));
+    EXPECT_EQ(SFD_STAT_OK, send_range(srv_fd, handle, 0, 0, data));
+    EXPECT_EQ(FILE_SIZE, data.size());
+    data.clear();
+
+    // Close the handle
+    ASSERT_TRUE(sfd_close_handle(srv_fd, handle));
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    EXPECT_EQ(0, read(stat_fd, buf, sizeof(buf)));
+
+    EXPECT_EQ(EBADF, send_range(srv_fd, handle, 0, 0, data));
+}
+
+// Ranged sends which are still running when the handle is closed complete
+TEST_F(SfdThreadLargeFileFix, file_handle_closed_during_send)
+{
+    size_t handle;
+    size_t size;
+    const test::unique_fd stat_fd {open_handle(srv_fd, file.name(),
+                                               handle, size)};
+    ASSERT_TRUE(stat_fd);
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd xfer_stat_fd {sfd_send_range(srv_fd, handle,
+                                                       dest.second, 0, 0,
+                                                       false,
+                                                       SFD_REQ_NO_PROGRESS)};
+    ASSERT_TRUE(xfer_stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [sizeof(struct sfd_file_info)];
+    ASSERT_EQ(sizeof(buf), read(xfer_stat_fd, buf, sizeof(buf)));
+
+    ASSERT_TRUE(sfd_close_handle(srv_fd, handle));
+    EXPECT_EQ(0, read(stat_fd, buf, sizeof(buf)));
+
+    EXPECT_EQ(FILE_SIZE, drain_slowly(dest.first));
+
+    std::vector<size_t> sizes;
+    EXPECT_EQ(SFD_STAT_OK, read_progress(xfer_stat_fd, sizes));
+}
+
+// A handle which is in use outlives the open file timeout; an idle one does not
+TEST_F(SfdThreadSmallFileShortOpenFileTimeoutFix, file_handle_idle_timeout)
+{
+    size_t handle;
+    size_t size;
+    const test::unique_fd stat_fd {open_handle(srv_fd, file.name(),
+                                               handle, size)};
+    ASSERT_TRUE(stat_fd);
+
+    for (int i = 0; i < 3; i++) {
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds{open_file_timeout_ms / 2});
+
+        std::vector<std::uint8_t> data;
+        ASSERT_EQ(SFD_STAT_OK, send_range(srv_fd, handle, 0, 0, data));
+        EXPECT_EQ(file_contents,
+                  std::string(data.begin(), data.end()));
+    }
+
+    // Idle for longer than the timeout
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    ASSERT_EQ(sizeof(struct prot_hdr), read(stat_fd, buf, sizeof(buf)));
+    EXPECT_EQ(SFD_XFER_STAT, sfd_get_cmd(buf));
+    EXPECT_EQ(ETIMEDOUT, sfd_get_stat(buf));
+    EXPECT_EQ(0, read(stat_fd, buf, sizeof(buf)));
+}
+
+// -------------------- Pipelined sends --------------------
+
+namespace {
+
+// Reads the File Information message from a status channel, returning the
+// transaction ID (zero on failure)
+size_t read_txnid(const int stat_fd)
+{
+    struct sfd_file_info ack;
+    uint8_t buf [sizeof(ack)];
+
+    if (read(stat_fd, buf, sizeof(buf)) != sizeof(buf) ||
+        !sfd_unmarshal_file_info(&ack, buf)) {
+        return 0;
+    }
+
+    return ack.txnid;
+}
+
+} // namespace
+
+// Pipelined sends to the same destination are written one after the other, in
+// order of arrival, without the client waiting for each to complete
+TEST_F(SfdThreadLargeFileFix, pipelined_sends_are_not_interleaved)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    const struct {
+        off_t offset;
+        size_t len;
+    } ranges[] {
+        {0, FILE_SIZE / 2 + 13},
+        {FILE_SIZE / 2 + 13, 0},
+        {0, 100}
+    };
+
+    auto dest = make_dest_pipe();
+    std::vector<test::unique_fd> stat_fds;
+
+    for (const auto& r : ranges) {
+        stat_fds.emplace_back(sfd_send_ex(srv_fd, file.name().c_str(),
+                                          dest.second, r.offset, r.len, false,
+                                          SFD_REQ_PIPELINE |
+                                          SFD_REQ_NO_PROGRESS));
+        ASSERT_TRUE(stat_fds.back());
+        ASSERT_GT(read_txnid(stat_fds.back()), 0);
+    }
+    dest.second.reset();
+
+    EXPECT_EQ(before.xfers_pipelined + 2, sfd_metrics->xfers_pipelined);
+
+    std::vector<std::uint8_t> data;
+    std::uint8_t buf [4096];
+    ssize_t n;
+    while ((n = read(dest.first, buf, sizeof(buf))) > 0)
+        data.insert(data.end(), buf, buf + n);
+
+    ASSERT_EQ(size_t(FILE_SIZE) + 100, data.size());
+    for (size_t i = 0; i < data.size(); i++)
+        ASSERT_EQ(uint8_t((i % FILE_SIZE) % CHUNK_SIZE), data[i]) << i;
+
+    for (const auto& stat_fd : stat_fds) {
+        std::vector<size_t> sizes;
+        EXPECT_EQ(SFD_STAT_OK, read_progress(stat_fd, sizes));
+    }
+}
+
+// Sends pipelined behind one which is cancelled are cancelled, too
+TEST_F(SfdThreadLargeFileFix, pipelined_send_behind_cancelled_send)
+{
+    auto dest = make_dest_pipe();
+
+    const test::unique_fd first {sfd_send_ex(srv_fd, file.name().c_str(),
+                                             dest.second, 0, 0, false,
+                                             SFD_REQ_PIPELINE)};
+    ASSERT_TRUE(first);
+    const size_t txnid {read_txnid(first)};
+    ASSERT_GT(txnid, 0);
+
+    const test::unique_fd second {sfd_send_ex(srv_fd, file.name().c_str(),
+                                              dest.second, 0, 0, false,
+                                              SFD_REQ_PIPELINE)};
+    ASSERT_TRUE(second);
+    ASSERT_GT(read_txnid(second), 0);
+    dest.second.reset();
+
+    // The destination is full; the first send can't complete
+    ASSERT_TRUE(sfd_cancel(srv_fd, txnid));
+
+    EXPECT_EQ(ECANCELED, read_terminal_stat(second));
+
+    EXPECT_LT(drain_slowly(dest.first), size_t(FILE_SIZE));
+}
+
+// Cancelling a pipelined send which is still waiting leaves those behind it be
+TEST_F(SfdThreadLargeFileFix, pipelined_send_behind_cancelled_waiting_send)
+{
+    auto dest = make_dest_pipe();
+
+    std::vector<test::unique_fd> stat_fds;
+    std::vector<size_t> txnids;
+
+    for (const size_t len : {size_t(0), size_t(100), size_t(200)}) {
+        stat_fds.emplace_back(sfd_send_ex(srv_fd, file.name().c_str(),
+                                          dest.second, 0, len, false,
+                                          SFD_REQ_PIPELINE |
+                                          SFD_REQ_NO_PROGRESS));
+        ASSERT_TRUE(stat_fds.back());
+        txnids.push_back(read_txnid(stat_fds.back()));
+        ASSERT_GT(txnids.back(), 0);
+    }
+    dest.second.reset();
+
+    // The destination is full, so the second send is still waiting
+    ASSERT_TRUE(sfd_cancel(srv_fd, txnids[1]));
+
+    std::vector<std::uint8_t> data;
+    std::uint8_t buf [4096];
+    ssize_t n;
+    while ((n = read(dest.first, buf, sizeof(buf))) > 0)
+        data.insert(data.end(), buf, buf + n);
+
+    ASSERT_EQ(size_t(FILE_SIZE) + 200, data.size());
+    for (size_t i = 0; i < data.size(); i++)
+        ASSERT_EQ(uint8_t((i % FILE_SIZE) % CHUNK_SIZE), data[i]) << i;
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fds[0]));
+    EXPECT_NE(SFD_STAT_OK, read_terminal_stat(stat_fds[1]));
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fds[2]));
+}
+
+// -------------------- Pumps --------------------
+
+namespace {
+
+// Writes @a n bytes of a known pattern to a pipe or socket in a separate
+// thread, closing it afterwards
+std::thread write_pattern(test::unique_fd&& fd, const size_t n)
+{
+    if (!set_nonblock(fd, false))
+        throw std::runtime_error("Couldn't make source blocking");
+
+    return std::thread {[fd = std::move(fd), n] {
+            std::vector<uint8_t> data(n);
+            for (size_t i = 0; i < n; i++)
+                data[i] = uint8_t(i % 251);
+
+            size_t total {0};
+            while (total < n) {
+                const ssize_t nwritten = write(fd, data.data() + total,
+                                               n - total);
+                if (nwritten <= 0)
+                    return;
+                total += size_t(nwritten);
+            }
+        }};
+}
+
+// Reads a pump's destination to the end, checking the pattern written by
+// write_pattern(). Returns the number of bytes read.
+size_t read_pattern(const int fd)
+{
+    size_t total {0};
+    uint8_t buf [4096];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != uint8_t((total + size_t(i)) % 251))
+                return 0;
+        }
+        total += size_t(n);
+    }
+
+    return total;
+}
+
+} // namespace
+
+// An unbounded pump moves everything up to the source's end-of-file
+TEST_F(SfdThreadFix, pump_until_eof)
+{
+    const size_t n {1024 * 1024 + 13};
+
+    auto src = make_dest_pipe();
+    auto dest = make_dest_pipe();
+
+    struct sfd_req_opts opts {};
+    opts.flags = SFD_REQ_XFER_STATS | SFD_REQ_NO_PROGRESS;
+    opts.cookie = 42;
+
+    const test::unique_fd stat_fd {sfd_pump(srv_fd, src.first, dest.second,
+                                            0, false, &opts)};
+    ASSERT_TRUE(stat_fd);
+    src.first.reset();
+    dest.second.reset();
+
+    ASSERT_GT(read_txnid(stat_fd), 0);
+    EXPECT_EQ(1U, sfd_metrics->active_pumps);
+
+    std::thread writer {write_pattern(std::move(src.second), n)};
+    EXPECT_EQ(n, read_pattern(dest.first));
+    writer.join();
+
+    // The size reported is the amount actually moved
+    struct sfd_xfer_stats stats;
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    ASSERT_EQ(sizeof(stats), read(stat_fd, buf, sizeof(buf)));
+    ASSERT_TRUE(sfd_unmarshal_xfer_stats(&stats, buf));
+    EXPECT_EQ(SFD_STAT_OK, stats.stat);
+    EXPECT_EQ(n, stats.size);
+    EXPECT_EQ(42U, stats.cookie);
+}
+
+// A bounded pump leaves whatever follows its length in the source
+TEST_F(SfdThreadFix, pump_stops_after_len)
+{
+    const size_t len {200 * 1000};
+
+    int sv[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    test::unique_fd src_read {sv[0]};
+    test::unique_fd src_write {sv[1]};
+    auto dest = make_dest_pipe();
+
+    const test::unique_fd stat_fd {sfd_pump(srv_fd, src_read, dest.second,
+                                            len, false, nullptr)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    ASSERT_GT(read_txnid(stat_fd), 0);
+
+    std::thread writer {write_pattern(std::move(src_write), len + 100)};
+    EXPECT_EQ(len, read_pattern(dest.first));
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+
+    // The server has put the source back into blocking mode
+    EXPECT_FALSE(fcntl(src_read, F_GETFL) & O_NONBLOCK);
+
+    uint8_t buf [200];
+    size_t nrest {0};
+    ssize_t n;
+    while ((n = read(src_read, buf, sizeof(buf))) > 0)
+        nrest += size_t(n);
+    EXPECT_EQ(100U, nrest);
+
+    writer.join();
+}
+
+namespace {
+
+// Counts the calling process's open file descriptors
+size_t count_open_fds()
+{
+    const long max = sysconf(_SC_OPEN_MAX);
+    size_t n {0};
+
+    for (int fd = 0; fd < (max > 0 && max < 65536 ? int(max) : 65536); fd++) {
+        if (fcntl(fd, F_GETFD) != -1)
+            n++;
+    }
+
+    return n;
+}
+
+// Reads a file with Read File to the end, returning the number of bytes of
+// file data read (or zero on error)
+size_t read_file(const int srv_fd, const std::string& path)
+{
+    const test::unique_fd data_fd {sfd_read(srv_fd, path.c_str(), 0, 0, false)};
+    if (!data_fd)
+        return 0;
+
+    uint8_t buf [PROT_REQ_MAXSIZE];
+    struct sfd_file_info ack;
+    if (read(data_fd, buf, sizeof(ack)) != sizeof(ack) ||
+        !sfd_unmarshal_file_info(&ack, buf)) {
+        return 0;
+    }
+
+    size_t total {0};
+    ssize_t n;
+    while ((n = read(data_fd, buf, sizeof(buf))) > 0)
+        total += size_t(n);
+
+    return total;
+}
+
+} // namespace
+
+// A request with the wrong number of descriptors for its command is ignored,
+// and the descriptors are closed
+TEST_F(SfdThreadSmallFileFix, unexpected_number_of_fds_are_closed)
+{
+    auto pipe = make_dest_pipe();
+
+    // Let the server settle (e.g., allocate whatever it allocates on its first
+    // request) before counting
+    ASSERT_EQ(file_contents.size(), read_file(srv_fd, file.name()));
+
+    const size_t nfds_before {count_open_fds()};
+
+    uint8_t pdu [PROT_PUMP_MAXSIZE];
+    struct iovec iov {pdu, prot_marshal_pump(pdu, 0, 0, 0, 0)};
+
+    const int fd {pipe.second};
+    for (int i = 0; i < 10; i++)
+        ASSERT_NE(-1, us_sendv(srv_fd, &iov, 1, &fd, 1));
+
+    // Requests are processed in order
+    ASSERT_EQ(file_contents.size(), read_file(srv_fd, file.name()));
+
+    // Allows for the descriptor by which the server may (still) be watching
+    // this process (cf. struct resrc_client)
+    EXPECT_LE(count_open_fds(), nfds_before + 1);
+}
+
+// A bounded pump whose source ends early fails
+TEST_F(SfdThreadFix, pump_source_ends_early)
+{
+    auto src = make_dest_pipe();
+    auto dest = make_dest_pipe();
+
+    const test::unique_fd stat_fd {sfd_pump(srv_fd, src.first, dest.second,
+                                            2000, false, nullptr)};
+    ASSERT_TRUE(stat_fd);
+    src.first.reset();
+    dest.second.reset();
+
+    ASSERT_GT(read_txnid(stat_fd), 0);
+
+    std::thread writer {write_pattern(std::move(src.second), 1000)};
+    writer.join();
+
+    EXPECT_EQ(EPIPE, read_terminal_stat(stat_fd));
+    EXPECT_EQ(1000U, read_pattern(dest.first));
+}
+
+// Regular files are sent, not pumped
+TEST_F(SfdThreadSmallFileFix, pump_rejects_regular_file)
+{
+    const test::unique_fd file_fd {open(file.name().c_str(), O_RDONLY)};
+    ASSERT_TRUE(file_fd);
+    auto dest = make_dest_pipe();
+
+    const test::unique_fd stat_fd {sfd_pump(srv_fd, file_fd, dest.second,
+                                            0, false, nullptr)};
+    ASSERT_TRUE(stat_fd);
+
+    EXPECT_EQ(EINVAL, read_terminal_stat(stat_fd));
+}
+
+// -------------------- Fan-out --------------------
+
+namespace {
+
+// Fills a destination pipe up, so that no transfer to it can start writing
+// before it is read from. Returns the number of bytes written.
+size_t fill_up(const int fd)
+{
+    const char junk [4096] {};
+    size_t total {0};
+    ssize_t n;
+
+    while ((n = write(fd, junk, sizeof(junk))) > 0)
+        total += size_t(n);
+
+    return total;
+}
+
+// Reads a pipe filled up by fill_up() to the end, returning the data following
+// the @a njunk bytes written by fill_up()
+std::vector<std::uint8_t> read_after_junk(const int fd, size_t njunk)
+{
+    std::vector<std::uint8_t> data;
+    std::uint8_t buf [4096];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        const size_t skip {std::min(njunk, size_t(n))};
+        njunk -= skip;
+        data.insert(data.end(), buf + skip, buf + n);
+    }
+
+    return data;
+}
+
+} // namespace
+
+// Concurrent fan-out sends of the same file all receive all of it
+TEST_F(SfdThreadLargeFileFix, fanout_sends_share_reads)
+{
+    const sfd_stats before {*sfd_metrics};
+    constexpr size_t NSENDS {4};
+
+    std::vector<std::pair<test::unique_fd, test::unique_fd>> dests;
+    std::vector<size_t> njunk;
+    std::vector<test::unique_fd> stat_fds;
+
+    for (size_t i = 0; i < NSENDS; i++) {
+        dests.push_back(make_dest_pipe());
+        njunk.push_back(fill_up(dests.back().second));
+
+        stat_fds.emplace_back(sfd_send_ex(srv_fd, file.name().c_str(),
+                                          dests.back().second, 0, 0, false,
+                                          SFD_REQ_FANOUT |
+                                          SFD_REQ_NO_PROGRESS));
+        ASSERT_TRUE(stat_fds.back());
+        ASSERT_GT(read_txnid(stat_fds.back()), 0);
+        dests.back().second.reset();
+    }
+
+    EXPECT_EQ(before.fanout_joins + NSENDS - 1, sfd_metrics->fanout_joins);
+
+    std::vector<std::future<std::vector<std::uint8_t>>> data;
+    for (size_t i = 0; i < NSENDS; i++) {
+        data.push_back(std::async(std::launch::async,
+                                  read_after_junk,
+                                  int(dests[i].first), njunk[i]));
+    }
+
+    for (size_t i = 0; i < NSENDS; i++) {
+        const auto d = data[i].get();
+        ASSERT_EQ(size_t(FILE_SIZE), d.size()) << i;
+        for (size_t j = 0; j < d.size(); j++)
+            ASSERT_EQ(uint8_t(j % CHUNK_SIZE), d[j]) << i << ":" << j;
+
+        std::vector<size_t> sizes;
+        EXPECT_EQ(SFD_STAT_OK, read_progress(stat_fds[i], sizes));
+    }
+}
+
+// A fan-out send which falls behind leaves the group, without holding up the
+// others, and carries on by itself
+TEST_F(SfdThreadLargeFileFix, fanout_straggler_carries_on)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto fast = make_dest_pipe();
+    auto slow = make_dest_pipe();
+    const size_t fast_junk {fill_up(fast.second)};
+    const size_t slow_junk {fill_up(slow.second)};
+
+    const test::unique_fd fast_stat {sfd_send_ex(srv_fd, file.name().c_str(),
+                                                 fast.second, 0, 0, false,
+                                                 SFD_REQ_FANOUT |
+                                                 SFD_REQ_NO_PROGRESS)};
+    ASSERT_TRUE(fast_stat);
+    ASSERT_GT(read_txnid(fast_stat), 0);
+    fast.second.reset();
+
+    const test::unique_fd slow_stat {sfd_send_ex(srv_fd, file.name().c_str(),
+                                                 slow.second, 0, 0, false,
+                                                 SFD_REQ_FANOUT |
+                                                 SFD_REQ_NO_PROGRESS)};
+    ASSERT_TRUE(slow_stat);
+    ASSERT_GT(read_txnid(slow_stat), 0);
+    slow.second.reset();
+
+    EXPECT_EQ(before.fanout_joins + 1, sfd_metrics->fanout_joins);
+
+    // The slow destination is not read from until the fast send has completed
+    EXPECT_EQ(size_t(FILE_SIZE), read_after_junk(fast.first, fast_junk).size());
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(fast_stat));
+
+    EXPECT_EQ(before.fanout_stragglers + 1, sfd_metrics->fanout_stragglers);
+
+    const auto d = read_after_junk(slow.first, slow_junk);
+    ASSERT_EQ(size_t(FILE_SIZE), d.size());
+    for (size_t j = 0; j < d.size(); j++)
+        ASSERT_EQ(uint8_t(j % CHUNK_SIZE), d[j]) << j;
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(slow_stat));
+}
+
+// -------------------- Regular-file destinations --------------------
+
+namespace {
+
+constexpr size_t SPARSE_CHUNK_SIZE {1024 * 1024};
+
+// Writes a file of three chunks, the middle one of which is a hole, returning
+// its contents
+std::vector<uint8_t> write_sparse_file(test::TmpFile& file)
+{
+    std::vector<uint8_t> data(SPARSE_CHUNK_SIZE * 3);
+    std::iota(data.begin(), data.begin() + SPARSE_CHUNK_SIZE, uint8_t{1});
+    std::iota(data.end() - SPARSE_CHUNK_SIZE, data.end(), uint8_t{7});
+
+    const off_t tail {off_t(SPARSE_CHUNK_SIZE * 2)};
+
+    if (pwrite(file, data.data(), SPARSE_CHUNK_SIZE, 0) !=
+        ssize_t(SPARSE_CHUNK_SIZE) ||
+        pwrite(file, data.data() + tail, SPARSE_CHUNK_SIZE, tail) !=
+        ssize_t(SPARSE_CHUNK_SIZE)) {
+        throw std::runtime_error("Couldn't write sparse file");
+    }
+
+    file.close();
+
+    return data;
+}
+
+std::vector<uint8_t> read_whole_file(const std::string& name)
+{
+    const test::unique_fd fd {open(name.c_str(), O_RDONLY)};
+    if (!fd)
+        throw std::runtime_error("Couldn't open file");
+
+    std::vector<uint8_t> data;
+    uint8_t buf [4096];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        data.insert(data.end(), buf, buf + n);
+
+    return data;
+}
+
+} // namespace
+
+// A file sent to a regular file (which the poller does not support) arrives
+// complete, with its hole left unallocated
+TEST_F(SfdThreadFix, send_to_file_keeps_holes)
+{
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_sparse_file(file)};
+
+    test::TmpFile dest;
+    dest.close();
+    const test::unique_fd dest_fd {open(dest.name().c_str(), O_WRONLY)};
+    ASSERT_TRUE(dest_fd);
+
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest_fd, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+    EXPECT_EQ(contents, read_whole_file(dest.name()));
+
+    struct stat st;
+    ASSERT_EQ(0, fstat(dest_fd, &st));
+    EXPECT_EQ(off_t(contents.size()), st.st_size);
+    EXPECT_LT(st.st_blocks * 512, off_t(contents.size()));
+}
+
+// A character device is always writable, like a regular file, and its holes
+// are written out
+TEST_F(SfdThreadFix, send_to_device)
+{
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_sparse_file(file)};
+
+    const test::unique_fd dest_fd {open("/dev/null", O_WRONLY)};
+    ASSERT_TRUE(dest_fd);
+
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest_fd, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+    EXPECT_EQ(SFD_STAT_OK, ack.stat);
+    EXPECT_EQ(contents.size(), ack.size);
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+}
+
+#ifdef __linux__
+// A device or file which is out of space fails the transfer rather than being
+// retried for as long as it stays full
+TEST_F(SfdThreadLargeFileFix, send_to_full_device_fails)
+{
+    const test::unique_fd dest_fd {open("/dev/full", O_WRONLY)};
+    ASSERT_TRUE(dest_fd);
+
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest_fd, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    EXPECT_EQ(ENOSPC, read_terminal_stat(stat_fd));
+}
+#endif
+
+// A hole sent over existing data overwrites it with zeroes
+TEST_F(SfdThreadFix, send_over_file_fills_holes)
+{
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_sparse_file(file)};
+
+    const test::TmpFile dest {std::string(contents.size(), 'x')};
+    const test::unique_fd dest_fd {open(dest.name().c_str(), O_WRONLY)};
+    ASSERT_TRUE(dest_fd);
+
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest_fd, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+    EXPECT_EQ(contents, read_whole_file(dest.name()));
+}
+
+namespace {
+
+constexpr size_t COPY_SEG_SIZE {16 * 1024 * 1024};
+
+// Writes a file of four and a half copy segments, with a chunk of data at the
+// start of each segment and at its end and holes in between, returning its
+// contents
+std::vector<uint8_t> write_segmented_file(test::TmpFile& file)
+{
+    std::vector<uint8_t> data(COPY_SEG_SIZE * 4 + COPY_SEG_SIZE / 2);
+
+    std::vector<off_t> chunks;
+    for (size_t i = 0; i < 5; i++)
+        chunks.push_back(off_t(COPY_SEG_SIZE * i));
+    chunks.push_back(off_t(data.size() - SPARSE_CHUNK_SIZE));
+
+    uint8_t first {1};
+    for (const off_t chunk : chunks) {
+        std::iota(data.begin() + chunk,
+                  data.begin() + chunk + off_t(SPARSE_CHUNK_SIZE),
+                  first++);
+
+        if (pwrite(file, data.data() + chunk, SPARSE_CHUNK_SIZE, chunk) !=
+            ssize_t(SPARSE_CHUNK_SIZE)) {
+            throw std::runtime_error("Couldn't write segmented file");
+        }
+    }
+
+    file.close();
+
+    return data;
+}
+
+} // namespace
+
+// A large file sent in parallel to a regular file arrives complete, with its
+// holes left unallocated
+TEST_F(SfdThreadFix, send_to_file_in_parallel)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_segmented_file(file)};
+
+    test::TmpFile dest;
+    dest.close();
+    const test::unique_fd dest_fd {open(dest.name().c_str(), O_WRONLY)};
+    ASSERT_TRUE(dest_fd);
+
+    const test::unique_fd stat_fd {sfd_send_ex(srv_fd, file.name().c_str(),
+                                               dest_fd, 0, 0, false,
+                                               SFD_REQ_PARALLEL)};
+    ASSERT_TRUE(stat_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+    EXPECT_EQ(contents, read_whole_file(dest.name()));
+
+    struct stat st;
+    ASSERT_EQ(0, fstat(dest_fd, &st));
+    EXPECT_EQ(off_t(contents.size()), st.st_size);
+    EXPECT_LT(st.st_blocks * 512, off_t(contents.size()));
+
+    // The destination's file offset is left at the end of the copied range,
+    // as it would be after a sequential copy
+    EXPECT_EQ(off_t(contents.size()), lseek(dest_fd, 0, SEEK_CUR));
+
+    EXPECT_EQ(before.copy_segments + 5, sfd_metrics->copy_segments);
+    EXPECT_EQ(before.xfers_completed + 1, sfd_metrics->xfers_completed);
+}
+
+// Holes copied in parallel over existing data overwrite it with zeroes, also
+// within the segment in which the existing data ends
+TEST_F(SfdThreadFix, send_over_file_in_parallel)
+{
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_segmented_file(file)};
+
+    const test::TmpFile dest {std::string(COPY_SEG_SIZE * 2 + 12345, 'x')};
+    const test::unique_fd dest_fd {open(dest.name().c_str(), O_WRONLY)};
+    ASSERT_TRUE(dest_fd);
+
+    const test::unique_fd stat_fd {sfd_send_ex(srv_fd, file.name().c_str(),
+                                               dest_fd, 0, 0, false,
+                                               SFD_REQ_PARALLEL)};
+    ASSERT_TRUE(stat_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+    EXPECT_EQ(contents, read_whole_file(dest.name()));
+}
+
+namespace {
+
+// The number of pages of a file which are in the page cache, and the file's
+// number of pages
+std::pair<size_t, size_t> count_resident(const std::string& name,
+                                         const size_t size)
+{
+    const test::unique_fd fd {open(name.c_str(), O_RDONLY)};
+    if (!fd)
+        throw std::runtime_error("Couldn't open file");
+
+    void* const p {mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)};
+    if (p == MAP_FAILED)
+        throw std::runtime_error("Couldn't map file");
+
+    const size_t page_size {size_t(sysconf(_SC_PAGESIZE))};
+    std::vector<unsigned char> resident((size + page_size - 1) / page_size);
+    const int ret {mincore(p, size, resident.data())};
+    munmap(p, size);
+
+    if (ret == -1)
+        throw std::runtime_error("mincore() failed");
+
+    return {size_t(std::count_if(resident.begin(), resident.end(),
+                                 [](unsigned char c) { return c & 1; })),
+            resident.size()};
+}
+
+// Writes a file of @a size bytes, returning its contents
+std::vector<uint8_t> write_patterned_file(test::TmpFile& file,
+                                          const size_t size)
+{
+    std::vector<uint8_t> contents(size);
+    for (size_t i = 0; i < size; i++)
+        contents[i] = uint8_t(i * 7 + i / 4096);
+
+    if (write(file, contents.data(), size) != ssize_t(size) || fsync(file))
+        throw std::runtime_error("Couldn't write file");
+
+    return contents;
+}
+
+std::vector<uint8_t> read_to_eof(const int fd)
+{
+    std::vector<uint8_t> received;
+    uint8_t buf [65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        received.insert(received.end(), buf, buf + n);
+    return received;
+}
+
+} // namespace
+
+// A large range sent with direct I/O arrives complete, starting at an
+// unaligned offset, without having been read into the page cache
+TEST_F(SfdThreadFix, send_direct)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    const size_t size {5 * 1024 * 1024 + 4321};
+
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_patterned_file(file, size)};
+    ASSERT_EQ(0, posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED));
+    file.close();
+
+    const off_t offset {1001};
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send_ex(srv_fd, file.name().c_str(),
+                                               dest.second, offset, 0, false,
+                                               SFD_REQ_DIRECT)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    const std::vector<uint8_t> received {read_to_eof(dest.first)};
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+    EXPECT_TRUE(std::equal(contents.begin() + offset, contents.end(),
+                           received.begin(), received.end()));
+
+    EXPECT_EQ(before.direct_xfers + 1, sfd_metrics->direct_xfers);
+
+    // Little, if any, of the file has found its way into the page cache
+    const auto resident = count_resident(file.name(), size);
+    EXPECT_LT(resident.first, resident.second / 4);
+}
+
+// Ranges too small for direct I/O are sent through the page cache
+TEST_F(SfdThreadSmallFileFix, send_direct_small_range)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send_ex(srv_fd, file.name().c_str(),
+                                               dest.second, 0, 0, false,
+                                               SFD_REQ_DIRECT)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+    EXPECT_EQ(before.direct_xfers, sfd_metrics->direct_xfers);
+}
+
+// A file sent once with the NOREUSE hint is dropped from the page cache
+// behind the transfer
+TEST_F(SfdThreadFix, send_noreuse_drops_behind)
+{
+    const size_t size {32 * 1024 * 1024};
+
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_patterned_file(file, size)};
+    file.close();
+
+    sfd_req_opts opts {};
+    opts.access_hint = SFD_ACCESS_NOREUSE;
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send_opts(srv_fd, file.name().c_str(),
+                                                 dest.second, 0, 0, false,
+                                                 &opts)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    EXPECT_EQ(contents, read_to_eof(dest.first));
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+
+    const auto resident = count_resident(file.name(), size);
+    EXPECT_LT(resident.first, resident.second / 4);
+}
+
+// The WILLNEED hint reads the whole range into the page cache up front, before
+// the destination has taken much of it
+TEST_F(SfdThreadFix, send_willneed_reads_range)
+{
+    const size_t size {8 * 1024 * 1024};
+
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_patterned_file(file, size)};
+    ASSERT_EQ(0, posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED));
+    file.close();
+
+    sfd_req_opts opts {};
+    opts.access_hint = SFD_ACCESS_WILLNEED;
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send_opts(srv_fd, file.name().c_str(),
+                                                 dest.second, 0, 0, false,
+                                                 &opts)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    // The destination is not being read from, so only the readahead can have
+    // brought in most of the file
+    std::pair<size_t, size_t> resident;
+    for (int i = 0; i < 200; i++) {
+        resident = count_resident(file.name(), size);
+        if (resident.first >= resident.second * 3 / 4)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    EXPECT_GE(resident.first, resident.second * 3 / 4);
+
+    EXPECT_EQ(contents, read_to_eof(dest.first));
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+}
+
+// -------------------- Reclamation of exited clients' transfers ---------------
+
+namespace {
+
+// Runs @a request in a child process, which waits for the file information
+// response and then exits without consuming the rest of the responses.
+// Returns false if the request failed.
+template<typename F>
+bool request_and_exit(F request)
+{
+    const pid_t pid {fork()};
+
+    if (pid == -1)
+        return false;
+
+    if (pid == 0) {
+        const int stat_fd {request()};
+        if (stat_fd == -1)
+            _exit(EXIT_FAILURE);
+
+        uint8_t buf [SFD_MAX_RESP_SIZE];
+        struct sfd_file_info ack;
+        if (read(stat_fd, buf, sizeof(ack)) != sizeof(ack) ||
+            !sfd_unmarshal_file_info(&ack, buf)) {
+            _exit(EXIT_FAILURE);
+        }
+
+        _exit(EXIT_SUCCESS);
+    }
+
+    int stat;
+    return (waitpid(pid, &stat, 0) == pid &&
+            WIFEXITED(stat) && WEXITSTATUS(stat) == EXIT_SUCCESS);
+}
+
+// Waits (for up to half a second) for a statistic to reach a value
+bool wait_for_stat(const volatile uint64_t& stat, const uint64_t val)
+{
+    for (int i = 0; i < 50 && stat != val; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+    return (stat == val);
+}
+
+} // namespace
+
+// A file opened by a client which then exits is closed without waiting for the
+// open file timeout
+TEST_F(SfdThreadSmallFileFix, exited_client_open_file_is_reclaimed)
+{
+    const sfd_stats before {*sfd_metrics};
+    const int srv {srv_fd};
+    const std::string filename {file.name()};
+
+    ASSERT_TRUE(request_and_exit([srv, &filename] {
+                return sfd_open(srv, filename.c_str(), 0, 0, false);
+            }));
+
+    EXPECT_TRUE(wait_for_stat(sfd_metrics->open_files, before.open_files));
+    EXPECT_EQ(before.xfers_reclaimed + 1, sfd_metrics->xfers_reclaimed);
+    EXPECT_EQ(before.open_file_timeouts, sfd_metrics->open_file_timeouts);
+}
+
+// Only the exited clients' open files are reclaimed
+TEST_F(SfdThreadSmallFileFix, exited_clients_are_reclaimed_separately)
+{
+    const sfd_stats before {*sfd_metrics};
+    const int srv {srv_fd};
+    const std::string filename {file.name()};
+
+    const test::unique_fd stat_fd {sfd_open(srv_fd, filename.c_str(),
+                                            0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+
+    for (int i = 0; i < 2; i++) {
+        ASSERT_TRUE(request_and_exit([srv, &filename] {
+                    return sfd_open(srv, filename.c_str(), 0, 0, false);
+                }));
+    }
+
+    EXPECT_TRUE(wait_for_stat(sfd_metrics->xfers_reclaimed,
+                              before.xfers_reclaimed + 2));
+    EXPECT_TRUE(wait_for_stat(sfd_metrics->open_files, before.open_files + 1));
+}
+
+// A transfer initiated by a client which then exits is cancelled, even though
+// its destination is still open
+TEST_F(SfdThreadLargeFileFix, exited_client_send_is_reclaimed)
+{
+    const sfd_stats before {*sfd_metrics};
+    const int srv {srv_fd};
+    const std::string filename {file.name()};
+
+    auto dest = make_dest_pipe();
+    const int dest_fd {dest.second};
+
+    ASSERT_TRUE(request_and_exit([srv, &filename, dest_fd] {
+                return sfd_send(srv, filename.c_str(), dest_fd, 0, 0, false);
+            }));
+
+    dest.second.reset();
+
+    EXPECT_TRUE(wait_for_stat(sfd_metrics->active_sends, before.active_sends));
+    EXPECT_EQ(before.xfers_reclaimed + 1, sfd_metrics->xfers_reclaimed);
+
+    // The server has closed its copy of the destination
+    std::vector<uint8_t> buf(FILE_SIZE);
+    size_t total {};
+    ssize_t n;
+    while ((n = read(dest.first, buf.data(), buf.size())) > 0)
+        total += (size_t)n;
+    EXPECT_EQ(0, n);
+    EXPECT_LT(total, FILE_SIZE);
+}
+
+// A transfer without a status channel outlives the client which requested it
+TEST_F(SfdThreadLargeFileFix, exited_client_nostat_send_carries_on)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    auto dest = make_dest_pipe();
+
+    const pid_t pid {fork()};
+    ASSERT_NE(-1, pid);
+
+    if (pid == 0) {
+        _exit(sfd_send_nostat(srv_fd, file.name().c_str(), dest.second, 0, 0) ?
+              EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int stat;
+    ASSERT_EQ(pid, waitpid(pid, &stat, 0));
+    ASSERT_TRUE(WIFEXITED(stat) && WEXITSTATUS(stat) == EXIT_SUCCESS);
+
+    dest.second.reset();
+
+    std::vector<uint8_t> buf(FILE_SIZE);
+    size_t total {};
+    ssize_t n;
+    while ((n = read(dest.first, buf.data(), buf.size())) > 0)
+        total += (size_t)n;
+    EXPECT_EQ(0, n);
+    EXPECT_EQ(FILE_SIZE, total);
+
+    EXPECT_EQ(before.xfers_reclaimed, sfd_metrics->xfers_reclaimed);
+}
+
+// -------------------- Transfer table sizing --------------------
+
+// The transfer table (and the structures sized according to it) grows to
+// accommodate concurrent transfers, and shrinks again once they have
+// completed
+TEST_F(SfdThreadSmallFileFix, xfer_table_grows_and_shrinks)
+{
+    constexpr size_t NFILES {40};
+
+    // The server thread may not have initialised yet
+    for (int i = 0; i < 50 && sfd_metrics->xfer_slots == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+    const uint64_t initial_slots {sfd_metrics->xfer_slots};
+    const uint64_t initial_footprint {sfd_metrics->footprint};
+
+    EXPECT_GT(initial_slots, 0);
+    EXPECT_LT(initial_slots, NFILES);
+    EXPECT_GT(initial_footprint, 0);
+
+    std::vector<test::unique_fd> stat_fds;
+    std::vector<size_t> txnids;
+
+    for (size_t i = 0; i < NFILES; i++) {
+        stat_fds.emplace_back(sfd_open(srv_fd, file.name().c_str(),
+                                       0, 0, false));
+        ASSERT_TRUE(stat_fds.back());
+
+        uint8_t buf [SFD_MAX_RESP_SIZE];
+        struct sfd_file_info ack;
+        ASSERT_EQ(sizeof(ack), read(stat_fds.back(), buf, sizeof(ack)));
+        ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+        txnids.push_back(ack.txnid);
+    }
+
+    EXPECT_GE(sfd_metrics->xfer_slots, NFILES);
+    const uint64_t peak_footprint {sfd_metrics->footprint};
+    EXPECT_GT(peak_footprint, initial_footprint);
+
+    for (size_t i = 0; i < NFILES; i++) {
+        ASSERT_TRUE(sfd_cancel(srv_fd, txnids[i]));
+
+        uint8_t buf [SFD_MAX_RESP_SIZE];
+        EXPECT_EQ(0, read(stat_fds[i], buf, sizeof(buf)));
+    }
+
+    EXPECT_EQ(initial_slots, sfd_metrics->xfer_slots);
+    // (The open files' timers remain until they expire)
+    EXPECT_LT(sfd_metrics->footprint, peak_footprint);
+}
+
+// -------------------- Handover to a new server --------------------
+
+// A server which takes over carries on with the running transfers, open files,
+// and the request socket without the client noticing
+TEST_F(SfdThreadLargeFileFix, handover_resumes_transfers)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    // A send which stalls on a full pipe
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send(srv_fd, file.name().c_str(),
+                                            dest.second, 0, 0, false)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    std::vector<uint8_t> buf(FILE_SIZE);
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf.data(), sizeof(ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&ack, buf.data()));
+
+    // An open file, sent only after the handover
+    const test::TmpFile small_file {"1234567890"};
+    const test::unique_fd open_fd {sfd_open(srv_fd, small_file.name().c_str(),
+                                            0, 0, false)};
+    ASSERT_TRUE(open_fd);
+
+    struct sfd_file_info open_ack;
+    ASSERT_EQ(sizeof(open_ack), read(open_fd, buf.data(), sizeof(open_ack)));
+    ASSERT_TRUE(sfd_unmarshal_file_info(&open_ack, buf.data()));
+
+    // Some of the data is read before the handover, the rest after
+    ssize_t total {read(dest.first, buf.data(), 4096)};
+    ASSERT_EQ(4096, total);
+
+    std::atomic<int> successor_exit {-1};
+    std::thread successor {[&successor_exit] {
+        const int fd {ho_request(SFD_SRV_SOCKDIR, srvname.c_str())};
+        if (fd == -1) {
+            perror("ho_request");
+            return;
+        }
+
+        successor_exit = srv_resume(fd, maxfiles, open_file_timeout_ms,
+                                    open_file_timeout_ms, 0, 0);
+
+        if (successor_exit == SRV_EXIT_SHUTDOWN)
+            us_stop_serving(SFD_SRV_SOCKDIR, srvname.c_str(), -1);
+    }};
+
+    for (int i = 0; i < 200 && srv_exit == -1; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+    ASSERT_EQ(SRV_EXIT_HANDOVER, srv_exit);
+
+    ssize_t n;
+    while ((n = read(dest.first, buf.data() + total,
+                     buf.size() - (size_t)total)) > 0) {
+        total += n;
+    }
+    EXPECT_EQ(FILE_SIZE, total);
+
+    // Each chunk of the file contains 0, 1, ..., 255, 0, 1, ...
+    std::vector<uint8_t> expected(FILE_SIZE);
+    for (size_t i = 0; i < expected.size(); i++)
+        expected[i] = (uint8_t)i;
+    EXPECT_EQ(expected, buf);
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(stat_fd));
+
+    // The open file's transaction ID is still valid
+    auto dest2 = make_dest_pipe();
+    ASSERT_TRUE(sfd_send_open(srv_fd, open_ack.txnid, dest2.second));
+    dest2.second.reset();
+
+    EXPECT_EQ(SFD_STAT_OK, read_terminal_stat(open_fd));
+
+    char contents [16] {};
+    ASSERT_EQ(10, read(dest2.first, contents, sizeof(contents)));
+    EXPECT_STREQ("1234567890", contents);
+
+    // The terminal status is written just before the transfer is deleted
+    for (int i = 0; i < 50 && sfd_metrics->active_sends != 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+    EXPECT_EQ(before.xfers_completed + 2, sfd_metrics->xfers_completed);
+    EXPECT_EQ(0, sfd_metrics->active_sends);
+    EXPECT_EQ(0, sfd_metrics->open_files);
+
+    test::kill_thread(successor, SIGTERM);
+    successor.join();
+
+    EXPECT_EQ(SRV_EXIT_SHUTDOWN, successor_exit);
+}
+
+// A transfer keeps reading with direct I/O (or after its access hint) once it
+// has been handed over
+TEST_F(SfdThreadFix, handover_keeps_direct_io)
+{
+    const sfd_stats before {*sfd_metrics};
+
+    const size_t size {5 * 1024 * 1024 + 4321};
+
+    test::TmpFile file;
+    const std::vector<uint8_t> contents {write_patterned_file(file, size)};
+    file.close();
+
+    auto dest = make_dest_pipe();
+    const test::unique_fd stat_fd {sfd_send_ex(srv_fd, file.name().c_str(),
+                                               dest.second, 0, 0, false,
+                                               SFD_REQ_DIRECT)};
+    ASSERT_TRUE(stat_fd);
+    dest.second.reset();
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    ASSERT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+
+    // Some of the data is read before the handover, the rest after
+    std::vector<uint8_t> received(4096);
+    ASSERT_EQ(4096, read(dest.first, received.data(), received.size()));
+    EXPECT_EQ(before.direct_xfers + 1, sfd_metrics->direct_xfers);
+
+    std::atomic<int> successor_exit {-1};
+    std::thread successor {[&successor_exit] {
+        const int fd {ho_request(SFD_SRV_SOCKDIR, srvname.c_str())};
+        if (fd == -1) {
+            perror("ho_request");
+            return;
+        }
+
+        successor_exit = srv_resume(fd, maxfiles, open_file_timeout_ms,
+                                    open_file_timeout_ms, 0, 0);
+
+        if (successor_exit == SRV_EXIT_SHUTDOWN)
+            us_stop_serving(SFD_SRV_SOCKDIR, srvname.c_str(), -1);
+    }};
+
+    for (int i = 0; i < 200 && srv_exit == -1; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+    ASSERT_EQ(SRV_EXIT_HANDOVER, srv_exit);
+
+    const std::vector<uint8_t> rest {read_to_eof(dest.first)};
+    received.insert(received.end(), rest.begin(), rest.end());
+
+    // Both servers respond in the request's (version 2) wire format
+    struct sfd_xfer_stat xfer_stat {};
+    do {
+        ASSERT_EQ(SFD_XFER_STAT_SIZE, read(stat_fd, buf, SFD_XFER_STAT_SIZE));
+        ASSERT_TRUE(sfd_unmarshal_xfer_stat(&xfer_stat, buf));
+        EXPECT_EQ(PROT_VERSION, buf[PROT_RESP_VERSION_OFFSET]);
+    } while (!sfd_xfer_complete(&xfer_stat));
+
+    EXPECT_EQ(contents, received);
+
+    // The new server has started a direct I/O stream of its own
+    EXPECT_EQ(before.direct_xfers + 2, sfd_metrics->direct_xfers);
+
+    test::kill_thread(successor, SIGTERM);
+    successor.join();
+
+    EXPECT_EQ(SRV_EXIT_SHUTDOWN, successor_exit);
+}
+
+// A daemon started with a request socket passed in by a supervisor closes the
+// other descriptors it has inherited
+TEST(SfdProcInheritedSocket, stray_fds_are_closed)
+{
+    int fds[2];
+
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+    test::unique_fd srv_end {fds[0]}, client_end {fds[1]};
+
+    // A descriptor the supervisor has (wrongly) left open, well clear of the
+    // request socket's
+    ASSERT_EQ(0, pipe(fds));
+    test::unique_fd stray_read {fds[0]};
+    test::unique_fd stray_write {fcntl(fds[1], F_DUPFD, 10)};
+    close(fds[1]);
+    ASSERT_TRUE(stray_write);
+
+    const pid_t pid {fork()};
+    ASSERT_NE(-1, pid);
+
+    if (pid == 0) {
+        char pid_str [16];
+        std::snprintf(pid_str, sizeof(pid_str), "%d", (int)getpid());
+
+        if (dup2(srv_end, 3) != 3 ||
+            setenv("LISTEN_PID", pid_str, 1) == -1 ||
+            setenv("LISTEN_FDS", "1", 1) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+
+        execlp(SFD_PROGNAME, SFD_PROGNAME,
+               "-s", "testing123li", "-r", "/", "-n", "10",
+               static_cast<char*>(nullptr));
+        _exit(EXIT_FAILURE);
+    }
+
+    srv_end.reset();
+    stray_write.reset();
+
+    // Served over the inherited socket
+    test::TmpFile file {"1234567890"};
+    int data_pipe[2];
+    ASSERT_EQ(0, pipe(data_pipe));
+    test::unique_fd data_read {data_pipe[0]}, data_write {data_pipe[1]};
+
+    const test::unique_fd stat_fd {sfd_send(client_end, file.name().c_str(),
+                                            data_write, 0, 0, false)};
+    EXPECT_TRUE(stat_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    EXPECT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+    EXPECT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+
+    // The stray pipe's write end has been closed by the daemon
+    struct pollfd pfd {stray_read, POLLIN, 0};
+    const int nready {poll(&pfd, 1, 1000)};
+    EXPECT_EQ(1, nready);
+    if (nready == 1) {
+        EXPECT_EQ(0, read(stray_read, buf, sizeof(buf)));
+    }
+
+    kill(pid, SIGTERM);
+
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+}
+
+// Every syslog priority is accepted as the log level, including LOG_EMERG (0)
+TEST(SfdProcLogLevel, all_priorities_are_accepted)
+{
+    const auto spawn = [](const char* level, const int srv_end) {
+        const pid_t pid {fork()};
+
+        if (pid == 0) {
+            char pid_str [16];
+            std::snprintf(pid_str, sizeof(pid_str), "%d", (int)getpid());
+
+            if (dup2(srv_end, 3) != 3 ||
+                setenv("LISTEN_PID", pid_str, 1) == -1 ||
+                setenv("LISTEN_FDS", "1", 1) == -1) {
+                _exit(EXIT_FAILURE);
+            }
+
+            execlp(SFD_PROGNAME, SFD_PROGNAME,
+                   "-s", "testing123ll", "-r", "/", "-n", "10", "-l", level,
+                   static_cast<char*>(nullptr));
+            _exit(EXIT_FAILURE);
+        }
+
+        return pid;
+    };
+
+    int fds[2];
+
+    // Out of range
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+    test::unique_fd srv_end {fds[0]}, client_end {fds[1]};
+
+    pid_t pid {spawn("8", srv_end)};
+    ASSERT_NE(-1, pid);
+
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_NE(EXIT_SUCCESS, WEXITSTATUS(status));
+
+    // LOG_EMERG
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+    srv_end.reset(fds[0]);
+    client_end.reset(fds[1]);
+
+    pid = spawn("0", srv_end);
+    ASSERT_NE(-1, pid);
+    srv_end.reset();
+
+    test::TmpFile file {"1234567890"};
+    auto dest = make_dest_pipe();
+
+    const test::unique_fd stat_fd {sfd_send(client_end, file.name().c_str(),
+                                            dest.second, 0, 0, false)};
+    EXPECT_TRUE(stat_fd);
+
+    uint8_t buf [SFD_MAX_RESP_SIZE];
+    struct sfd_file_info ack;
+    EXPECT_EQ(sizeof(ack), read(stat_fd, buf, sizeof(ack)));
+    EXPECT_TRUE(sfd_unmarshal_file_info(&ack, buf));
+
+    kill(pid, SIGTERM);
+
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+}
+
+TEST(SfdInheritedSocket, only_unix_datagram_sockets_are_accepted)
+{
+    int fds[2];
+
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+    test::unique_fd dgram0 {fds[0]}, dgram1 {fds[1]};
+
+    ASSERT_TRUE(us_serve_inherited(dgram0));
+    EXPECT_TRUE(fcntl(dgram0, F_GETFL) & O_NONBLOCK);
+    EXPECT_TRUE(fcntl(dgram0, F_GETFD) & FD_CLOEXEC);
+
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    test::unique_fd stream0 {fds[0]}, stream1 {fds[1]};
+
+    EXPECT_FALSE(us_serve_inherited(stream0));
+    EXPECT_EQ(EINVAL, errno);
+
+    ASSERT_EQ(0, pipe(fds));
+    test::unique_fd pipe0 {fds[0]}, pipe1 {fds[1]};
+
+    EXPECT_FALSE(us_serve_inherited(pipe0));
+    EXPECT_EQ(ENOTSOCK, errno);
+}
+
 #pragma GCC diagnostic pop
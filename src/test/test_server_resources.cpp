@@ -0,0 +1,132 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <cstdint>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../impl/server_resources.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wglobal-constructors"
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#pragma GCC diagnostic ignored "-Wpadded"
+
+namespace {
+
+const resrc_xfer_file file {100, -1, 4096};
+
+} // namespace
+
+TEST(XferPool, transfers_fill_aligned_cache_lines)
+{
+    // Whole blocks, so that the pool is full once all are in use
+    constexpr std::size_t nxfers {512};
+
+    xfer_pool* const pool {xfer_pool_new(nxfers)};
+    ASSERT_NE(nullptr, pool);
+
+    EXPECT_EQ(XFER_HOT_SIZE, sizeof(resrc_xfer));
+
+    std::vector<resrc_xfer*> xfers(nxfers);
+
+    for (std::size_t i = 0; i < nxfers; i++) {
+        xfers[i] = xfer_new(pool, PROT_CMD_SEND, &file, file.size,
+                            static_cast<pid_t>(i), -1, -1, i + 1);
+        ASSERT_NE(nullptr, xfers[i]);
+
+        EXPECT_EQ(0, reinterpret_cast<std::uintptr_t>(xfers[i]) %
+                  XFER_HOT_SIZE);
+        EXPECT_TRUE(is_xfer(xfers[i]));
+    }
+
+    EXPECT_EQ(nxfers, pool->size);
+
+    // Full
+    EXPECT_EQ(nullptr, xfer_new(pool, PROT_CMD_SEND, &file, file.size,
+                                0, -1, -1, nxfers + 1));
+    EXPECT_EQ(EMFILE, errno);
+
+    // Each transfer's cold state is its own
+    for (std::size_t i = 0; i < nxfers; i++) {
+        EXPECT_EQ(i + 1, resrc_xfer_txnid(xfers[i]));
+        EXPECT_EQ(static_cast<pid_t>(i), xfer_cold(xfers[i])->client_pid);
+        EXPECT_EQ(file.size, xfer_cold(xfers[i])->window_nbytes_left);
+    }
+
+    for (resrc_xfer* const x : xfers)
+        xfer_delete(x);
+
+    EXPECT_EQ(0, pool->size);
+
+    xfer_pool_delete(pool);
+}
+
+TEST(XferPool, empty_blocks_are_released_but_one)
+{
+    xfer_pool* const pool {xfer_pool_new(10000)};
+    ASSERT_NE(nullptr, pool);
+
+    const std::size_t empty_footprint {xfer_pool_footprint(pool)};
+
+    std::vector<resrc_xfer*> xfers(1000);
+
+    for (std::size_t i = 0; i < xfers.size(); i++) {
+        xfers[i] = xfer_new(pool, PROT_CMD_READ, &file, file.size,
+                            0, -1, -1, i + 1);
+        ASSERT_NE(nullptr, xfers[i]);
+    }
+
+    const std::size_t nblocks {pool->nallocated};
+    EXPECT_GT(nblocks, 1);
+    EXPECT_GT(xfer_pool_footprint(pool), empty_footprint);
+
+    // Deleting the newest transfers empties the blocks at the top
+    while (xfers.size() > 1) {
+        xfer_delete(xfers.back());
+        xfers.pop_back();
+    }
+
+    EXPECT_EQ(nblocks - 1, pool->nempty);
+
+    xfer_pool_trim(pool);
+
+    EXPECT_EQ(2, pool->nallocated);
+    EXPECT_EQ(1, pool->nempty);
+
+    // The lowest free slot is reused
+    resrc_xfer* const x {xfer_new(pool, PROT_CMD_READ, &file, file.size,
+                                  0, -1, -1, 1)};
+    ASSERT_NE(nullptr, x);
+    EXPECT_EQ(1, pool->nempty);
+
+    xfer_delete(x);
+    xfer_delete(xfers.back());
+
+    xfer_pool_delete(pool);
+}
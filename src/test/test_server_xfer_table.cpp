@@ -25,6 +25,7 @@
 */
 
 #include <algorithm>
+#include <numeric>
 
 #include <gtest/gtest.h>
 
@@ -151,4 +152,76 @@ TEST_F(XferTableFix100, erase)
     }
 }
 
+TEST(XferTable, grow_on_collision_and_shrink)
+{
+    struct xfer_table tbl;
+
+    ASSERT_TRUE(xfer_table_construct_range(&tbl, hash, 4, 100));
+    EXPECT_EQ(4, tbl.capacity);
+    EXPECT_EQ(128, tbl.max_capacity);
+
+    std::vector<size_t> elems(tbl.max_capacity);
+    std::iota(elems.begin(), elems.end(), 0);
+
+    // Sequential hashes collide once the table is full
+    for (auto& e : elems) {
+        ASSERT_TRUE(xfer_table_insert(&tbl, &e));
+        ASSERT_GT(tbl.capacity, e);
+    }
+
+    EXPECT_EQ(128, tbl.capacity);
+
+    // No room to grow
+    size_t overflow {tbl.max_capacity};
+    EXPECT_FALSE(xfer_table_insert(&tbl, &overflow));
+
+    for (auto& e : elems) {
+        auto p = static_cast<size_t*>(xfer_table_find(&tbl, e));
+        ASSERT_NE(nullptr, p);
+        ASSERT_EQ(e, *p);
+    }
+
+    // Erasing the oldest elements leaves ones which can be rehashed into a
+    // smaller table without colliding
+    for (size_t i = 0; i < elems.size() - 1; i++) {
+        xfer_table_erase(&tbl, elems[i]);
+
+        const size_t e {elems.back()};
+        auto p = static_cast<size_t*>(xfer_table_find(&tbl, e));
+        ASSERT_NE(nullptr, p);
+        ASSERT_EQ(e, *p);
+    }
+
+    EXPECT_EQ(4, tbl.capacity);
+
+    xfer_table_destruct(&tbl, nullptr);
+}
+
+TEST(XferTable, shrink_avoids_collisions)
+{
+    struct xfer_table tbl;
+
+    ASSERT_TRUE(xfer_table_construct_range(&tbl, hash, 4, 16));
+
+    std::vector<size_t> elems(16);
+    std::iota(elems.begin(), elems.end(), 0);
+
+    for (auto& e : elems)
+        ASSERT_TRUE(xfer_table_insert(&tbl, &e));
+
+    ASSERT_EQ(16, tbl.capacity);
+
+    // Keep 0 and 8, which would occupy the same slot of an 8-slot table
+    for (auto& e : elems) {
+        if (e != 0 && e != 8)
+            xfer_table_erase(&tbl, e);
+    }
+
+    EXPECT_EQ(16, tbl.capacity);
+    EXPECT_EQ(&elems[0], xfer_table_find(&tbl, 0));
+    EXPECT_EQ(&elems[8], xfer_table_find(&tbl, 8));
+
+    xfer_table_destruct(&tbl, nullptr);
+}
+
 #pragma GCC diagnostic pop
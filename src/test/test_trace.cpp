@@ -0,0 +1,101 @@
+/*
+  Copyright (c) 2016, Francois Kritzinger
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../impl/test_utils.hpp"
+#include "../impl/trace.h"
+
+namespace {
+
+std::string read_file(const std::string& name)
+{
+    std::ifstream f {name};
+    return std::string {std::istreambuf_iterator<char>(f),
+                        std::istreambuf_iterator<char>()};
+}
+
+} // namespace
+
+TEST(Trace, disabled_by_default)
+{
+    EXPECT_FALSE(trace_enabled);
+    EXPECT_EQ(0, trace_now());
+    EXPECT_TRUE(trace_close());
+}
+
+TEST(Trace, dump_chrome_trace)
+{
+    test::TmpFile file;
+
+    ASSERT_TRUE(trace_open(open(file.name().c_str(), O_WRONLY), 4));
+    ASSERT_TRUE(trace_enabled);
+
+    uint64_t t0;
+    TRACE_BEGIN(t0, add_xfer, 7);
+    EXPECT_NE(0, t0);
+    TRACE_END(t0, add_xfer, 7, 0);
+
+    TRACE_BEGIN(t0, xfer_pass, 7);
+    TRACE_END(t0, xfer_pass, 7, 4096);
+
+    ASSERT_TRUE(trace_close());
+    EXPECT_FALSE(trace_enabled);
+
+    const std::string json {read_file(file.name())};
+
+    EXPECT_EQ(0, json.find("{\"displayTimeUnit\""));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"add_xfer\""));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"xfer_pass\""));
+    EXPECT_NE(std::string::npos, json.find("\"tid\":7"));
+    EXPECT_NE(std::string::npos, json.find("\"val\":4096"));
+    EXPECT_EQ(json.size() - 4, json.rfind("\n]}\n"));
+}
+
+TEST(Trace, ring_keeps_newest_spans)
+{
+    test::TmpFile file;
+
+    ASSERT_TRUE(trace_open(open(file.name().c_str(), O_WRONLY), 2));
+
+    for (long i = 1; i <= 5; i++)
+        trace_record(TRACE_STAGE_xfer_pass, 1, trace_now(), i);
+
+    ASSERT_TRUE(trace_close());
+
+    const std::string json {read_file(file.name())};
+
+    EXPECT_EQ(std::string::npos, json.find("\"val\":3}"));
+    EXPECT_NE(std::string::npos, json.find("\"val\":4}"));
+    EXPECT_NE(std::string::npos, json.find("\"val\":5}"));
+}